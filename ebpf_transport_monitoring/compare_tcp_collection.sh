@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Compares the BPF run time of the --tcp_collection modes. Lightfoot traces
+# the given cgroup for a while in each mode, and the run count and run time
+# of its programs are read from the kernel BPF stats. Generate the same
+# traffic in the cgroup during every mode.
+#
+# Needs root, bpftool and jq, run it from the directory with lightfoot and
+# the BPF objects.
+
+if [[ $# -lt 1 ]]; then
+  echo "Usage: $0 <cgroup> [seconds per mode]"
+  exit 1
+fi
+CGROUP=$1
+DURATION=${2:-60}
+LIGHTFOOT=${LIGHTFOOT:-./lightfoot}
+
+for tool in bpftool jq; do
+  if ! command -v $tool > /dev/null; then
+    echo "$tool not found"
+    exit 1
+  fi
+done
+
+# Run time is only accounted while the BPF stats are enabled.
+STATS=$(sysctl -n kernel.bpf_stats_enabled)
+sysctl -q -w kernel.bpf_stats_enabled=1
+trap 'sysctl -q -w kernel.bpf_stats_enabled=$STATS' EXIT
+
+printf "%-10s %12s %12s %10s\n" mode runs "run time ms" "ns/run"
+for mode in tcp_probe iter sock_ops; do
+  $LIGHTFOOT --cgroup "$CGROUP" --tcp_collection $mode > /dev/null 2>&1 &
+  PID=$!
+  sleep "$DURATION"
+  if ! kill -0 $PID 2> /dev/null; then
+    echo "lightfoot failed to start with --tcp_collection $mode"
+    continue
+  fi
+  # The programs of this lightfoot, with the stats of the whole run.
+  bpftool prog show -j | jq -r --arg mode $mode --argjson pid $PID '
+    [.[] | select(any(.pids[]?; .pid == $pid))]
+    | (map(.run_cnt // 0) | add // 0) as $runs
+    | (map(.run_time_ns // 0) | add // 0) as $ns
+    | [$mode, $runs, ($ns / 1e6 | floor),
+       (if $runs > 0 then $ns / $runs | floor else 0 end)]
+    | @tsv' | while IFS=$'\t' read -r name runs ms ns; do
+    printf "%-10s %12s %12s %10s\n" "$name" "$runs" "$ms" "$ns"
+  done
+  kill -INT $PID
+  wait $PID 2> /dev/null
+done
@@ -26,6 +26,9 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "bpf/libbpf.h"
 #include "events.h"
 #include "loader/correlator/correlator.h"
@@ -34,6 +37,7 @@
 namespace prober {
 
 #define PERF_PAGES 2
+#define CLOSED_CONNECTION_GRACE absl::Seconds(30)
 
 absl::Status H2GoCorrelator::Init() {
   auto it = sources_.find(Layer::kHTTP2);
@@ -78,10 +82,15 @@ std::vector<DataCtx *> &H2GoCorrelator::GetMetricSources() {
 
 absl::flat_hash_map<std::string, std::string> H2GoCorrelator::GetLabels(
     std::string uuid) {
-  if (correlator_.find(uuid) == correlator_.end()) {
-    return {};
+  absl::ReaderMutexLock lock(&mu_);
+  auto it = correlator_.find(uuid);
+  if (it == correlator_.end()) {
+    it = closed_.find(uuid);
+    if (it == closed_.end()) {
+      return {};
+    }
   }
-  return {{"pid", std::to_string(correlator_[uuid].pid)}};
+  return {{"pid", std::to_string(it->second.pid)}};
 }
 
 std::vector<std::string> H2GoCorrelator::GetLabelKeys() { return {{"pid"}}; }
@@ -122,6 +131,7 @@ absl::Status H2GoCorrelator::HandleHTTP2(const void *const data) {
   if (this->correlator_.find(key) == this->correlator_.end()) {
     conn_info.UUID = key;
     conn_info.h2_conn_id = c_data->conn_id;
+    conn_info.handle = NewConnHandle(key);
     this->correlator_.insert({key, conn_info});
   } else {
     this->correlator_[key].h2_conn_id = c_data->conn_id;
@@ -129,17 +139,63 @@ absl::Status H2GoCorrelator::HandleHTTP2(const void *const data) {
 
   conn_info = this->correlator_[key];
   if (conn_info.tcp_conn_id != 0 && conn_info.h2_conn_id != 0) {
-    connection_map_[conn_info.tcp_conn_id] = conn_info.UUID;
-    connection_map_[conn_info.h2_conn_id] = conn_info.UUID;
+    connection_map_[conn_info.tcp_conn_id] = conn_info.handle;
+    connection_map_[conn_info.h2_conn_id] = conn_info.handle;
   }
   return absl::OkStatus();
 }
 
 // Since we are using key as uuid this search is easy
 bool H2GoCorrelator::CheckUUID(std::string uuid) {
+  absl::ReaderMutexLock lock(&mu_);
   return correlator_.find(uuid) != correlator_.end();
 }
 
+void H2GoCorrelator::ReleaseConnection(const struct ConnInfo &info) {
+  // Connection ids are kernel and Go pointers that can be reused by a new
+  // connection within the grace period, its entries are kept.
+  for (uint64_t conn_id : {info.h2_conn_id, info.tcp_conn_id}) {
+    auto it = connection_map_.find(conn_id);
+    if (it != connection_map_.end() &&
+        it->second.index == info.handle.index &&
+        it->second.generation == info.handle.generation) {
+      connection_map_.erase(it);
+    }
+  }
+  FreeConnHandle(info.handle);
+}
+
+void H2GoCorrelator::CloseConnection(
+    absl::flat_hash_map<std::string, struct ConnInfo>::iterator it) {
+  // The same 4-tuple closed again within the grace period.
+  auto closed = closed_.find(it->first);
+  if (closed != closed_.end()) {
+    ReleaseConnection(closed->second);
+    closed_.erase(closed);
+  }
+  closed_order_.push_back({absl::Now(), it->first, it->second.handle});
+  closed_.insert({it->first, it->second});
+  correlator_.erase(it);
+}
+
+void H2GoCorrelator::ReleaseClosed() {
+  if (closed_order_.empty()) {
+    return;
+  }
+  auto cutoff = absl::Now() - CLOSED_CONNECTION_GRACE;
+  while (!closed_order_.empty() && closed_order_.front().closed < cutoff) {
+    const ClosedConn &entry = closed_order_.front();
+    auto it = closed_.find(entry.uuid);
+    if (it != closed_.end() &&
+        it->second.handle.index == entry.handle.index &&
+        it->second.handle.generation == entry.handle.generation) {
+      ReleaseConnection(it->second);
+      closed_.erase(it);
+    }
+    closed_order_.pop_front();
+  }
+}
+
 absl::Status H2GoCorrelator::HandleHTTP2Events(const void *const data) {
   const ec_ebpf_events_t *const event =
       static_cast<const ec_ebpf_events_t *const>(data);
@@ -147,11 +203,8 @@ absl::Status H2GoCorrelator::HandleHTTP2Events(const void *const data) {
   switch (event->mdata.event_type) {
     case EC_H2_EVENT_CLOSE: {
       for (auto it = correlator_.begin(); it != correlator_.end(); ++it) {
-        // TODO: Change the code to add delay to deletion
         if (it->second.h2_conn_id == event->mdata.connection_id) {
-          connection_map_.erase(it->second.h2_conn_id);
-          connection_map_.erase(it->second.tcp_conn_id);
-          correlator_.erase(it);
+          CloseConnection(it);
           break;
         }
       }
@@ -189,6 +242,7 @@ absl::Status H2GoCorrelator::HandleTCP(const void *const data) {
         conn_info.UUID = key;
         conn_info.tcp_conn_id = event->mdata.connection_id;
         conn_info.pid = event->mdata.pid;
+        conn_info.handle = NewConnHandle(key);
         this->correlator_.insert({key, conn_info});
       } else {
         this->correlator_[key].tcp_conn_id = event->mdata.connection_id;
@@ -197,8 +251,8 @@ absl::Status H2GoCorrelator::HandleTCP(const void *const data) {
 
       conn_info = this->correlator_[key];
       if (conn_info.tcp_conn_id != 0 && conn_info.h2_conn_id != 0) {
-        connection_map_[conn_info.tcp_conn_id] = conn_info.UUID;
-        connection_map_[conn_info.h2_conn_id] = conn_info.UUID;
+        connection_map_[conn_info.tcp_conn_id] = conn_info.handle;
+        connection_map_[conn_info.h2_conn_id] = conn_info.handle;
       }
       break;
     }
@@ -208,9 +262,7 @@ absl::Status H2GoCorrelator::HandleTCP(const void *const data) {
       if (state_change->new_state == 7) {  // 7 == TCP_CLOSE
         for (auto it = correlator_.begin(); it != correlator_.end(); ++it) {
           if (it->second.tcp_conn_id == event->mdata.connection_id) {
-            connection_map_.erase(it->second.h2_conn_id);
-            connection_map_.erase(it->second.tcp_conn_id);
-            correlator_.erase(it);
+            CloseConnection(it);
             break;
           }
         }
@@ -223,6 +275,8 @@ absl::Status H2GoCorrelator::HandleTCP(const void *const data) {
 absl::Status H2GoCorrelator::HandleData(std::string log_name,
                                         const void *const data,
                                         const uint32_t size) {
+  absl::MutexLock lock(&mu_);
+  ReleaseClosed();
   if (!log_name.compare("h2_grpc_correlation")) {
     return HandleHTTP2(data);
   }
@@ -15,10 +15,12 @@
 #ifndef _CORRELATORS_H2_GO_CORRELATOR_
 #define _CORRELATORS_H2_GO_CORRELATOR_
 
+#include <deque>
 #include <string>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
+#include "absl/time/time.h"
 #include "event2/event.h"
 #include "loader/correlator/correlator.h"
 
@@ -42,6 +44,12 @@ class H2GoCorrelator : public CorrelatorInterface {
     uint64_t h2_conn_id;
     uint64_t tcp_conn_id;
     std::string UUID;
+    ConnHandle handle;
+  };
+  struct ClosedConn {
+    absl::Time closed;
+    std::string uuid;
+    ConnHandle handle;
   };
   absl::Status HandleData(std::string log_name, const void* const data,
                           const uint32_t size) override;
@@ -53,11 +61,23 @@ class H2GoCorrelator : public CorrelatorInterface {
   absl::Status HandleTCP(const void* const data);
   absl::Status HandleHTTP2(const void* const data);
   absl::Status HandleHTTP2Events(const void* const data);
+  void CloseConnection(
+      absl::flat_hash_map<std::string, struct ConnInfo>::iterator it)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void ReleaseClosed() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void ReleaseConnection(const struct ConnInfo& info)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   std::vector<DataCtx*> log_sources_;
   std::vector<DataCtx*> metric_sources_;
 
-  absl::flat_hash_map<std::string, struct ConnInfo> correlator_;
+  absl::flat_hash_map<std::string, struct ConnInfo> correlator_
+      ABSL_GUARDED_BY(mu_);
+  // Closed connections stay resolvable for a grace period so exporters
+  // working through their queues still see the close events' connection.
+  absl::flat_hash_map<std::string, struct ConnInfo> closed_
+      ABSL_GUARDED_BY(mu_);
+  std::deque<ClosedConn> closed_order_ ABSL_GUARDED_BY(mu_);
 };
 
 }  // namespace prober
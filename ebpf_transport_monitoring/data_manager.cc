@@ -14,6 +14,7 @@
 
 #include "data_manager.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <iostream>
@@ -21,21 +22,33 @@
 #include <string>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "bpf/bpf.h"
 #include "bpf/libbpf.h"
 #include "event2/event.h"
+#include "event_decoder.h"
 #include "loader/exporter/data_types.h"
 #include "loader/exporter/log_exporter.h"
 #include "loader/exporter/metric_exporter.h"
+#include "loader/exporter/self_metrics.h"
 #include "loader/source/data_source.h"
 
 namespace prober {
 
 #define PERF_PAGES 2
+#define MAP_STATS_INTERVAL absl::Seconds(60)
+// Occupancy above which LRU maps are considered to be evicting.
+#define MAP_NEAR_FULL_PERCENT 90
 
 DataManager::DataManager(struct event_base *base) : base_(base) {
+  num_cpus_ = libbpf_num_possible_cpus();
+  if (num_cpus_ <= 0) {
+    num_cpus_ = 1;
+  }
   struct event *event = nullptr;
   struct DataManagerCtx *data_ctx = new (struct DataManagerCtx);
   data_ctx->this_ = this;
@@ -44,6 +57,11 @@ DataManager::DataManager(struct event_base *base) : base_(base) {
   auto timeval = absl::ToTimeval(absl::Seconds(60));
   event_add(event, &timeval);
   events_.push_back(event);
+
+  event = event_new(base_, -1, EV_PERSIST, HandleMapStats, (void *)data_ctx);
+  timeval = absl::ToTimeval(MAP_STATS_INTERVAL);
+  event_add(event, &timeval);
+  events_.push_back(event);
 }
 
 absl::Status DataManager::RegisterLog(DataCtx *ctx) {
@@ -153,6 +171,15 @@ void DataManager::HandlePerf(void *arg, int cpu, void *data, uint32_t data_sz) {
   struct DataCtx *ctx = static_cast<DataCtx *>(d_ctx->ctx);
   DataManager *this_ = (DataManager *)d_ctx->this_;
 
+  if (!ctx->log_desc_.opaque) {
+    auto status = EventDecoder::Validate(data, data_sz);
+    if (!status.ok()) {
+      SelfMetrics::GetInstance().Increment(
+          absl::StrCat("log_", ctx->name_, "_invalid"));
+      return;
+    }
+  }
+
   if (ctx->internal_ == false) {
     for (auto handler : this_->ext_log_handlers_) {
       auto status = handler->HandleData(ctx->name_, data, data_sz);
@@ -173,21 +200,60 @@ void DataManager::HandlePerf(void *arg, int cpu, void *data, uint32_t data_sz) {
   }
 }
 
+bool DataManager::IsPerCpu(const struct bpf_map *map) {
+  switch (bpf_map__type(map)) {
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void DataManager::ReducePerCpu(size_t words) {
+  uint64_t *out = value_buffer_.data();
+  const uint64_t *in = percpu_buffer_.data();
+  std::fill(out, out + words, 0);
+  for (int cpu = 0; cpu < num_cpus_; cpu++, in += words) {
+    out[0] = std::max(out[0], in[0]);
+    for (size_t i = 1; i < words; i++) {
+      out[i] += in[i];
+    }
+  }
+}
+
 void DataManager::ReadMap(const struct DataManagerCtx *d_ctx) {
   uint64_t key = 0;
-  uint64_t data = 0;
   DataManager *this_ = (DataManager *)d_ctx->this_;
   struct DataCtx *ctx = static_cast<DataCtx *>(d_ctx->ctx);
+  // Values are metric_format_t or larger, e.g. metric_hist_format_t.
+  size_t words = (bpf_map__value_size(ctx->map_) + 7) / 8;
+  this_->value_buffer_.resize(words);
+  void *data = this_->value_buffer_.data();
+  bool percpu = IsPerCpu(ctx->map_);
+  if (percpu) {
+    this_->percpu_buffer_.resize(words * this_->num_cpus_);
+  }
 
   int err = bpf_map_get_next_key(ctx->bpf_map_fd_, nullptr, &key);
   if (err) return;
   do {
-    bpf_map_lookup_elem(ctx->bpf_map_fd_, (void *)&key, (void *)&data);
+    // The entry may have been evicted since it was listed.
+    if (percpu) {
+      if (bpf_map_lookup_elem(ctx->bpf_map_fd_, (void *)&key,
+                              this_->percpu_buffer_.data()) != 0) {
+        continue;
+      }
+      this_->ReducePerCpu(words);
+    } else if (bpf_map_lookup_elem(ctx->bpf_map_fd_, (void *)&key, data) !=
+               0) {
+      continue;
+    }
 
     if (ctx->internal_ == false) {
       for (auto handler : this_->ext_metric_handlers_) {
-        auto status =
-            handler->HandleData(ctx->name_, (void *)&key, (void *)&data);
+        auto status = handler->HandleData(ctx->name_, (void *)&key, data);
         if (!status.ok()) {
           std::cout << status << std::endl;
         }
@@ -196,14 +262,25 @@ void DataManager::ReadMap(const struct DataManagerCtx *d_ctx) {
     auto handler_it = this_->metric_handlers_.find(ctx->name_);
     if (handler_it != this_->metric_handlers_.end()) {
       for (auto handler : handler_it->second) {
-        auto status =
-            handler->HandleData(ctx->name_, (void *)&key, (void *)&data);
+        auto status = handler->HandleData(ctx->name_, (void *)&key, data);
         if (!status.ok()) {
           std::cout << status << std::endl;
         }
       }
     }
   } while (bpf_map_get_next_key(ctx->bpf_map_fd_, &key, &key) == 0);
+
+  if (ctx->internal_ == false) {
+    for (auto handler : this_->ext_metric_handlers_) {
+      handler->Flush(ctx->name_);
+    }
+  }
+  auto handler_it = this_->metric_handlers_.find(ctx->name_);
+  if (handler_it != this_->metric_handlers_.end()) {
+    for (auto handler : handler_it->second) {
+      handler->Flush(ctx->name_);
+    }
+  }
 }
 
 void DataManager::HandleEvent(evutil_socket_t, short, void *arg) {  // NOLINT
@@ -244,4 +321,70 @@ void DataManager::HandleCleanup(evutil_socket_t, short, void *arg) {  // NOLINT
   }
 }
 
+void DataManager::HandleMapStats(evutil_socket_t, short, void *arg) {  // NOLINT
+  struct DataManagerCtx *d_ctx = static_cast<struct DataManagerCtx *>(arg);
+  DataManager *this_ = (DataManager *)d_ctx->this_;
+  for (auto &source : this_->data_sources_) {
+    if (source.second->type_ == DataCtx::kMetric) {
+      this_->ReportMapStats(source.second);
+    }
+  }
+}
+
+/* Reports map_<name>_entries and map_<name>_capacity for hash maps. The
+  kernel does not count LRU evictions, so for LRU maps keys that disappeared
+  while the map was almost full are counted as map_<name>_evictions. Keys
+  the BPF side deleted at the same time are counted too, so this is an upper
+  bound meant to tell when capacities are too small. */
+void DataManager::ReportMapStats(DataCtx *ctx) {
+  bool lru;
+  switch (bpf_map__type(ctx->map_)) {
+    case BPF_MAP_TYPE_LRU_HASH:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+      lru = true;
+      break;
+    case BPF_MAP_TYPE_HASH:
+    case BPF_MAP_TYPE_PERCPU_HASH:
+      lru = false;
+      break;
+    default:
+      return;
+  }
+
+  std::string key(bpf_map__key_size(ctx->map_), '\0');
+  std::string next(key.size(), '\0');
+  MapStats &stats = map_stats_[ctx->name_];
+  absl::flat_hash_set<size_t> keys;
+  uint64_t entries = 0;
+  uint64_t evictions = 0;
+  void *prev = nullptr;
+  while (bpf_map_get_next_key(ctx->bpf_map_fd_, prev, &next[0]) == 0) {
+    entries++;
+    if (lru) {
+      keys.insert(absl::Hash<absl::string_view>()(next));
+    }
+    key.swap(next);
+    prev = &key[0];
+  }
+  if (lru && stats.near_full) {
+    for (size_t hash : stats.keys) {
+      if (!keys.contains(hash)) {
+        evictions++;
+      }
+    }
+  }
+
+  uint32_t capacity = bpf_map__max_entries(ctx->map_);
+  stats.near_full = entries * 100 >= capacity * MAP_NEAR_FULL_PERCENT;
+  stats.keys.swap(keys);
+
+  auto &self_metrics = SelfMetrics::GetInstance();
+  std::string prefix = absl::StrCat("map_", ctx->name_);
+  self_metrics.SetGauge(absl::StrCat(prefix, "_entries"), entries);
+  self_metrics.SetGauge(absl::StrCat(prefix, "_capacity"), capacity);
+  if (lru) {
+    self_metrics.Increment(absl::StrCat(prefix, "_evictions"), evictions);
+  }
+}
+
 }  // namespace prober
@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "event2/event.h"
 #include "loader/correlator/correlator.h"
@@ -46,12 +47,20 @@ class DataManager {
     DataCtx *ctx;
   };
   void ReadMap(const struct DataManagerCtx *d_ctx);
+  static bool IsPerCpu(const struct bpf_map *map);
+  /* Folds the per CPU copies of a value in percpu_buffer_ into
+    value_buffer_. Per CPU maps hold metric_format_t style counters: the
+    timestamp in the first word is the latest of all CPUs, the other words
+    are summed. */
+  void ReducePerCpu(size_t words);
   absl::Status RegisterLog(DataCtx *ctx);
   absl::Status RegisterMetric(DataCtx *ctx);
   static void HandleLostEvents(void *ctx, int cpu, __u64 lost_cnt);
   static void HandlePerf(void *d_ctx, int cpu, void *data, uint32_t data_sz);
   static void HandleEvent(evutil_socket_t, short, void *arg); // NOLINT
   static void HandleCleanup(evutil_socket_t, short, void *arg); // NOLINT
+  static void HandleMapStats(evutil_socket_t, short, void *arg); // NOLINT
+  void ReportMapStats(DataCtx *ctx);
 
   absl::flat_hash_map<std::string, DataCtx *> data_sources_;
   absl::flat_hash_map<std::string, bool> registered_sources_;
@@ -62,6 +71,18 @@ class DataManager {
   std::vector<MetricHandlerInterface *> ext_metric_handlers_;
   std::vector<LogHandlerInterface *> ext_log_handlers_;
   std::vector<struct event *> events_;
+  // Holds the value of the map entry being handed to the handlers.
+  std::vector<uint64_t> value_buffer_;
+  // Values of per CPU maps, one copy per possible CPU.
+  std::vector<uint64_t> percpu_buffer_;
+  int num_cpus_;
+  struct MapStats {
+    // The map was almost full at the last sweep.
+    bool near_full;
+    // Hashes of the keys seen at the last sweep, LRU maps only.
+    absl::flat_hash_set<size_t> keys;
+  };
+  absl::flat_hash_map<std::string, MapStats> map_stats_;
   struct event_base *base_;
 };
 
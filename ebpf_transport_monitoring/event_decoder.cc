@@ -0,0 +1,101 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "event_decoder.h"
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "events.h"
+
+namespace prober {
+
+absl::StatusOr<int32_t> EventDecoder::InfoSize(uint32_t category,
+                                               uint32_t type) {
+  switch (category) {
+    case EC_CAT_TCP:
+      switch (type) {
+        case EC_TCP_EVENT_START:
+          return sizeof(ec_tcp_start_t);
+        case EC_TCP_EVENT_STATE_CHANGE:
+          return sizeof(ec_tcp_state_change_t);
+        case EC_TCP_EVENT_RETRANS:
+          return sizeof(__u32);
+        case EC_TCP_EVENT_CONGESTION:
+          return sizeof(ec_tcp_congestion_t);
+        case EC_TCP_EVENT_PACKET_DROP:
+          return sizeof(ec_tcp_drop_t);
+        case EC_TCP_EVENT_RESET:
+          return 0;
+      }
+      break;
+    case EC_CAT_HTTP2:
+      switch (type) {
+        case EC_H2_EVENT_START:
+        case EC_H2_EVENT_CLOSE:
+          return 0;
+        case EC_H2_EVENT_STREAM_STATE:
+          return sizeof(ec_h2_state_t);
+        case EC_H2_EVENT_SETTINGS:
+          return -1;
+        case EC_H2_EVENT_WINDOW_UPDATE:
+          return sizeof(__u32);
+        case EC_H2_EVENT_GO_AWAY:
+          return sizeof(ec_h2_go_away_t);
+      }
+      break;
+    case EC_CAT_TLS:
+      switch (type) {
+        case EC_TLS_EVENT_STATE:
+          return sizeof(__u32);
+      }
+      break;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrFormat("Unknown event category %d type %d", category, type));
+}
+
+absl::Status EventDecoder::Validate(const void* data, uint32_t size) {
+  if (size < sizeof(ec_ebpf_event_metadata_t)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Event of %d bytes is shorter than its metadata", size));
+  }
+  const ec_ebpf_event_metadata_t* const mdata =
+      static_cast<const ec_ebpf_event_metadata_t*>(data);
+  if (mdata->version != EC_EVENT_VERSION) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Event version %d, expected %d", mdata->version,
+                        EC_EVENT_VERSION));
+  }
+  if (mdata->length > size - sizeof(ec_ebpf_event_metadata_t)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Event with %d bytes of data in a %d byte record",
+                        mdata->length, size));
+  }
+  auto expected = InfoSize(mdata->event_category, mdata->event_type);
+  if (!expected.ok()) {
+    return expected.status();
+  }
+  if (*expected < 0 ? mdata->length > EC_MAX_EVENT_DATA_SIZE
+                    : mdata->length != (uint32_t)*expected) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Event category %d type %d has %d bytes of data",
+        mdata->event_category, mdata->event_type, mdata->length));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace prober
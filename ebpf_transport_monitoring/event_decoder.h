@@ -0,0 +1,41 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EVENT_DECODER_H_
+#define _EVENT_DECODER_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "events.h"
+
+namespace prober {
+
+/* Checks records read from the tcp_events and h2_grpc_events perf buffers
+  before they are handed to exporters, which read the event specific data
+  as the struct of the event type. A record is only the metadata followed
+  by mdata.length bytes, see ec_ebpf_event_metadata_t. */
+class EventDecoder {
+ public:
+  // Size of the event specific data of a type, or -1 if it is variable
+  // (up to EC_MAX_EVENT_DATA_SIZE bytes).
+  static absl::StatusOr<int32_t> InfoSize(uint32_t category, uint32_t type);
+  // size is the size of the record read, perf pads it to 8 bytes.
+  static absl::Status Validate(const void* data, uint32_t size);
+};
+
+}  // namespace prober
+
+#endif  // _EVENT_DECODER_H_
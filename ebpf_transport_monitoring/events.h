@@ -34,8 +34,15 @@
 */
 #define EC_MAX_EVENT_DATA_SIZE 512
 
+/* Version of the record layout below, bumped whenever it or any event
+  specific struct changes so readers can reject records they do not
+  understand. */
+#define EC_EVENT_VERSION 1
+
 /* The information collected by eBPF will be stored or sent in the form of the
-  following packed C struct.*/
+  following packed C struct. Only the metadata and the length bytes of event
+  specific data that follow it are sent, ec_ebpf_events_t is the buffer the
+  probes build an event in.*/
 typedef struct {
   /* If event is regarding a frame, packet sent from the machine this bit is
   reset. If the packet or frame is received this bit is set. */
@@ -45,9 +52,9 @@ typedef struct {
   /* Type of event of the above defined category
   eg. ec_tcp_event_t for EC_CAT_TCP */
   __u32 event_type : 7;
-  /*Reserved*/
-  __u32 reserved : 4;
-  /* Length of the event specific data*/
+  /* EC_EVENT_VERSION of the probe that sent the event. */
+  __u32 version : 4;
+  /* Length of the event specific data, fixed for most event types. */
   __u32 length : 16;
   /* PID of the process from which this event originated. */
   __u32 pid;
@@ -95,7 +102,8 @@ typedef enum {
   /* TCP congestion control related information. ec_tcp_congestion_t
   will be used as the event specific information. */
   EC_TCP_EVENT_CONGESTION,
-  /* Packet dropped in kernel. No event specific information. */
+  /* Packet of the connection dropped in kernel. ec_tcp_drop_t will be used
+  as the event specific information. */
   EC_TCP_EVENT_PACKET_DROP,
   /* Connection reset. No event specific information. */
   EC_TCP_EVENT_RESET,
@@ -107,6 +115,11 @@ typedef struct {
   __u32 new_state;
 } ec_tcp_state_change_t;
 
+typedef struct {
+  __u32 reason;  // enum skb_drop_reason, 0 if the kernel does not give one.
+  __u32 count;   // Drops of the connection with this reason so far.
+} ec_tcp_drop_t;
+
 /* The values are in network byte order */
 typedef struct {
   __u8 family;  // IPv4 or IPv6.
@@ -182,9 +195,43 @@ typedef enum {
   EC_TLS_MAX
 } ec_tls_state_t;
 
+/* Runtime controls the probes read from the single entry ec_control array
+  map. All zeros, the state before lightfoot writes it, sends every event and
+  keeps the compiled sampling interval. */
+#define EC_CONTROL_TYPES 32
+
+typedef struct {
+  /* Bit t of disabled[c] drops events of category c and type t. */
+  __u32 disabled[EC_CAT_MAX];
+  /* Only about 1 in sample_every[c][t] events of the type are sent, 0 and 1
+  send all of them. */
+  __u32 sample_every[EC_CAT_MAX][EC_CONTROL_TYPES];
+  /* Minimum time between two reads of the TCP metrics of a connection in ns,
+  0 keeps the compiled SAMPLE_TIME. */
+  __u64 tcp_sample_ns;
+} ec_control_t;
+
 typedef struct _metric_format_t {
   __u64 timestamp;
   __u64 data;
 } metric_format_t;
 
+/* Log2 histogram of the samples of a connection since it was first seen.
+  Bucket 0 counts zeros and bucket i samples in [2^(i-1), 2^i), the last
+  bucket also counts everything above. Counts only grow. */
+#define METRIC_HIST_BUCKETS 32
+
+typedef struct _metric_hist_t {
+  __u64 count;
+  __u64 sum;
+  /* Latest sample, what metric_format_t would have carried. */
+  __u64 last;
+  __u64 buckets[METRIC_HIST_BUCKETS];
+} metric_hist_t;
+
+typedef struct _metric_hist_format_t {
+  __u64 timestamp;
+  metric_hist_t data;
+} metric_hist_format_t;
+
 #endif  // _EVENTS_H_
@@ -0,0 +1,207 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/async_exporter.h"
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "loader/exporter/self_metrics.h"
+
+namespace prober {
+
+ExporterWorker::ExporterWorker(std::string name, uint32_t max_queue)
+    : name_(name), max_queue_(max_queue ? max_queue : 1), stop_(false),
+      dropped_(0) {}
+
+ExporterWorker::~ExporterWorker() {
+  {
+    absl::MutexLock lock(&mu_);
+    stop_ = true;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void ExporterWorker::Start() {
+  if (!thread_.joinable()) {
+    thread_ = std::thread(&ExporterWorker::Run, this);
+  }
+}
+
+void ExporterWorker::Push(Task task) {
+  bool droppable = task.kind == Task::Kind::kLog ||
+                   task.kind == Task::Kind::kMetric;
+  task.queued = absl::Now();
+  absl::MutexLock lock(&mu_);
+  if (droppable && queue_.size() >= max_queue_) {
+    dropped_++;
+    return;
+  }
+  queue_.push_back(std::move(task));
+}
+
+void ExporterWorker::Run() {
+  auto has_work = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stop_ || !queue_.empty();
+  };
+  auto& self_metrics = SelfMetrics::GetInstance();
+  std::string depth_metric = absl::StrCat("exporter_", name_, "_queue_depth");
+  std::string latency_metric = absl::StrCat("exporter_", name_, "_latency");
+  std::string dropped_metric = absl::StrCat("exporter_", name_, "_dropped");
+  std::vector<Task> batch;
+  bool stop = false;
+
+  while (!stop) {
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(&has_work));
+      // Stop once what was queued before the stop has been handled.
+      stop = stop_;
+      batch.swap(queue_);
+    }
+    self_metrics.SetGauge(depth_metric, batch.size());
+    uint64_t dropped = dropped_.exchange(0);
+    if (dropped) {
+      self_metrics.Increment(dropped_metric, dropped);
+    }
+    if (batch.empty()) {
+      continue;
+    }
+
+    absl::Status status;
+    for (auto& task : batch) {
+      switch (task.kind) {
+        case Task::Kind::kLog:
+          status = task.log_handler->HandleData(task.name, task.data.data(),
+                                                task.data.size());
+          break;
+        case Task::Kind::kMetric:
+          status = task.metric_handler->HandleData(task.name, &task.key,
+                                                   &task.data[0]);
+          break;
+        case Task::Kind::kFlush:
+          task.metric_handler->Flush(task.name);
+          break;
+        case Task::Kind::kCleanup:
+          task.metric_handler->Cleanup();
+          break;
+      }
+      if (!status.ok()) {
+        std::cout << status << std::endl;
+        status = absl::OkStatus();
+      }
+    }
+    self_metrics.RecordLatency(latency_metric,
+                               absl::Now() - batch.front().queued);
+    batch.clear();
+  }
+}
+
+absl::Status AsyncLogExporter::Init() {
+  auto status = exporter_->Init();
+  if (!status.ok()) {
+    return status;
+  }
+  worker_->Start();
+  return absl::OkStatus();
+}
+
+absl::Status AsyncLogExporter::RegisterLog(std::string name,
+                                           LogDesc& log_desc) {
+  return exporter_->RegisterLog(name, log_desc);
+}
+
+void AsyncLogExporter::RegisterCorrelator(CorrelatorInterface* correlator) {
+  correlator_ = correlator;
+  exporter_->RegisterCorrelator(correlator);
+}
+
+absl::Status AsyncLogExporter::HandleData(std::string log_name,
+                                          const void* const data,
+                                          const uint32_t size) {
+  ExporterWorker::Task task;
+  task.kind = ExporterWorker::Task::Kind::kLog;
+  task.log_handler = exporter_;
+  task.name = log_name;
+  task.data.assign((const char*)data, size);
+  worker_->Push(std::move(task));
+  return absl::OkStatus();
+}
+
+absl::Status AsyncMetricExporter::Init() {
+  auto status = exporter_->Init();
+  if (!status.ok()) {
+    return status;
+  }
+  worker_->Start();
+  return absl::OkStatus();
+}
+
+absl::Status AsyncMetricExporter::RegisterMetric(std::string name,
+                                                 const MetricDesc& desc) {
+  auto status = exporter_->RegisterMetric(name, desc);
+  if (status.ok()) {
+    value_sizes_[name] = desc.value_type == MetricType::kLog2Histogram
+                             ? sizeof(metric_hist_format_t)
+                             : sizeof(metric_format_t);
+  }
+  return status;
+}
+
+void AsyncMetricExporter::RegisterCorrelator(CorrelatorInterface* correlator) {
+  correlator_ = correlator;
+  exporter_->RegisterCorrelator(correlator);
+}
+
+absl::Status AsyncMetricExporter::HandleData(std::string metric_name,
+                                             void* key, void* value) {
+  auto it = value_sizes_.find(metric_name);
+  if (it == value_sizes_.end()) {
+    return absl::NotFoundError("metric_name not found");
+  }
+  ExporterWorker::Task task;
+  task.kind = ExporterWorker::Task::Kind::kMetric;
+  task.metric_handler = exporter_;
+  task.name = metric_name;
+  task.key = *(uint64_t*)key;
+  task.data.assign((const char*)value, it->second);
+  worker_->Push(std::move(task));
+  return absl::OkStatus();
+}
+
+void AsyncMetricExporter::Flush(std::string metric_name) {
+  ExporterWorker::Task task;
+  task.kind = ExporterWorker::Task::Kind::kFlush;
+  task.metric_handler = exporter_;
+  task.name = metric_name;
+  worker_->Push(std::move(task));
+}
+
+void AsyncMetricExporter::Cleanup() {
+  ExporterWorker::Task task;
+  task.kind = ExporterWorker::Task::Kind::kCleanup;
+  task.metric_handler = exporter_;
+  worker_->Push(std::move(task));
+}
+
+}  // namespace prober
@@ -0,0 +1,126 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_ASYNC_EXPORTER_H_
+#define _EXPORTERS_ASYNC_EXPORTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/log_exporter.h"
+#include "loader/exporter/metric_exporter.h"
+
+#define EXPORTER_DEFAULT_QUEUE 65536
+
+namespace prober {
+
+/* A thread and a bounded queue shared by the exporters of one backend, so
+  their calls stay on a single thread like they did on the event loop. Logs
+  and data points are dropped while the queue is full, flushes and cleanups
+  are always queued.
+
+  Metrics are reported as exporter_<name>_queue_depth, exporter_<name>_latency
+  (time from dispatch to the exporter returning for the oldest task of each
+  batch) and exporter_<name>_dropped. */
+class ExporterWorker {
+ public:
+  struct Task {
+    enum class Kind { kLog, kMetric, kFlush, kCleanup };
+    Kind kind;
+    LogHandlerInterface* log_handler;
+    MetricHandlerInterface* metric_handler;
+    std::string name;
+    uint64_t key;
+    // Log event or metric value.
+    std::string data;
+    absl::Time queued;
+  };
+
+  ExporterWorker() = delete;
+  ExporterWorker(std::string name, uint32_t max_queue = EXPORTER_DEFAULT_QUEUE);
+  // Runs what is left in the queue before returning.
+  ~ExporterWorker();
+  ExporterWorker(const ExporterWorker&) = delete;
+  ExporterWorker& operator=(const ExporterWorker&) = delete;
+
+  void Start();
+  // Thread safe.
+  void Push(Task task);
+
+ private:
+  void Run();
+
+  std::string name_;
+  uint32_t max_queue_;
+  absl::Mutex mu_;
+  std::vector<Task> queue_ ABSL_GUARDED_BY(mu_);
+  bool stop_ ABSL_GUARDED_BY(mu_);
+  std::atomic<uint64_t> dropped_;
+  std::thread thread_;
+};
+
+/* Hands logs to exporter on worker's thread. Init, RegisterLog and
+  RegisterCorrelator are forwarded as is and must happen before data flows. */
+class AsyncLogExporter : public LogExporterInterface {
+ public:
+  AsyncLogExporter() = delete;
+  AsyncLogExporter(LogExporterInterface* exporter, ExporterWorker* worker)
+      : exporter_(exporter), worker_(worker) {}
+  absl::Status Init() override;
+  absl::Status RegisterLog(std::string name, LogDesc& log_desc) override;
+  void RegisterCorrelator(CorrelatorInterface* correlator) override;
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override;
+
+ private:
+  LogExporterInterface* exporter_;
+  ExporterWorker* worker_;
+};
+
+/* Hands data points, flushes and cleanups to exporter on worker's thread. */
+class AsyncMetricExporter : public MetricExporterInterface {
+ public:
+  AsyncMetricExporter() = delete;
+  AsyncMetricExporter(MetricExporterInterface* exporter,
+                      ExporterWorker* worker)
+      : exporter_(exporter), worker_(worker) {}
+  absl::Status Init() override;
+  absl::Status RegisterMetric(std::string name,
+                              const MetricDesc& desc) override;
+  void RegisterCorrelator(CorrelatorInterface* correlator) override;
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override;
+  void Flush(std::string metric_name) override;
+  void Cleanup();
+
+ private:
+  MetricExporterInterface* exporter_;
+  ExporterWorker* worker_;
+  // Size of the values of every registered metric.
+  absl::flat_hash_map<std::string, uint32_t> value_sizes_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_ASYNC_EXPORTER_H_
@@ -0,0 +1,75 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_BOUNDED_ASYNC_H_
+#define _EXPORTERS_BOUNDED_ASYNC_H_
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <utility>
+
+namespace prober {
+
+/* Runs blocking calls (e.g. RPCs) off the event loop while keeping at most
+  max_in_flight of them outstanding. Run blocks on the oldest call once the
+  limit is reached, which is the back pressure on the caller. Not thread safe,
+  it is meant to be driven from the event loop thread. */
+class BoundedAsync {
+ public:
+  explicit BoundedAsync(size_t max_in_flight)
+      : max_in_flight_(max_in_flight ? max_in_flight : 1) {}
+  ~BoundedAsync() { Drain(); }
+  BoundedAsync(const BoundedAsync&) = delete;
+  BoundedAsync& operator=(const BoundedAsync&) = delete;
+
+  void Run(std::function<void()> fn) {
+    Reap();
+    while (in_flight_.size() >= max_in_flight_) {
+      in_flight_.front().get();
+      in_flight_.pop_front();
+    }
+    in_flight_.push_back(std::async(std::launch::async, std::move(fn)));
+  }
+
+  void Drain() {
+    while (!in_flight_.empty()) {
+      in_flight_.front().get();
+      in_flight_.pop_front();
+    }
+  }
+
+  size_t InFlight() {
+    Reap();
+    return in_flight_.size();
+  }
+
+ private:
+  void Reap() {
+    while (!in_flight_.empty() &&
+           in_flight_.front().wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready) {
+      in_flight_.front().get();
+      in_flight_.pop_front();
+    }
+  }
+
+  size_t max_in_flight_;
+  std::deque<std::future<void>> in_flight_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_BOUNDED_ASYNC_H_
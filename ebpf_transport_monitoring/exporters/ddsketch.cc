@@ -0,0 +1,157 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/ddsketch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+
+// Smallest value counted in a bucket, anything below is counted as 0.
+#define DDSKETCH_MIN_VALUE 1e-9
+
+namespace prober {
+
+DDSketch::DDSketch(double relative_accuracy, uint32_t max_buckets)
+    : relative_accuracy_(relative_accuracy),
+      gamma_((1 + relative_accuracy) / (1 - relative_accuracy)),
+      log_gamma_(std::log(gamma_)),
+      max_buckets_(max_buckets ? max_buckets : 1),
+      min_key_(0),
+      zero_count_(0),
+      count_(0),
+      sum_(0),
+      min_(0),
+      max_(0) {}
+
+int32_t DDSketch::Key(double value) const {
+  return (int32_t)std::ceil(std::log(value) / log_gamma_);
+}
+
+double DDSketch::Value(int32_t key) const {
+  // Midpoint of (gamma^(key-1), gamma^key] in relative terms.
+  return 2 * std::pow(gamma_, key) / (gamma_ + 1);
+}
+
+void DDSketch::AddKey(int32_t key, uint64_t count) {
+  if (bins_.empty()) {
+    min_key_ = key;
+    bins_.push_back(0);
+  } else if (key < min_key_) {
+    bins_.insert(bins_.begin(), min_key_ - key, 0);
+    min_key_ = key;
+  } else if (key >= min_key_ + (int32_t)bins_.size()) {
+    bins_.resize(key - min_key_ + 1, 0);
+  }
+  bins_[key - min_key_] += count;
+
+  if (bins_.size() > max_buckets_) {
+    // Fold the lowest buckets into the lowest one kept.
+    size_t excess = bins_.size() - max_buckets_;
+    uint64_t folded = 0;
+    for (size_t i = 0; i < excess; i++) {
+      folded += bins_[i];
+    }
+    bins_.erase(bins_.begin(), bins_.begin() + excess);
+    bins_[0] += folded;
+    min_key_ += excess;
+  }
+}
+
+void DDSketch::Add(double value, uint64_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (value < 0) {
+    value = 0;
+  }
+  if (count_ == 0) {
+    min_ = value;
+    max_ = value;
+  } else {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+  count_ += count;
+  sum_ += value * count;
+  if (value < DDSKETCH_MIN_VALUE) {
+    zero_count_ += count;
+    return;
+  }
+  AddKey(Key(value), count);
+}
+
+absl::Status DDSketch::Merge(const DDSketch& other) {
+  if (other.relative_accuracy_ != relative_accuracy_) {
+    return absl::InvalidArgumentError("sketch accuracy differs");
+  }
+  if (other.count_ == 0) {
+    return absl::OkStatus();
+  }
+  if (count_ == 0) {
+    min_ = other.min_;
+    max_ = other.max_;
+  } else {
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  zero_count_ += other.zero_count_;
+  for (size_t i = 0; i < other.bins_.size(); i++) {
+    if (other.bins_[i]) {
+      AddKey(other.min_key_ + i, other.bins_[i]);
+    }
+  }
+  return absl::OkStatus();
+}
+
+double DDSketch::Quantile(double q) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  if (q <= 0) {
+    return min_;
+  }
+  if (q >= 1) {
+    return max_;
+  }
+  uint64_t rank = (uint64_t)(q * (count_ - 1));
+  uint64_t seen = zero_count_;
+  if (seen > rank) {
+    return 0;
+  }
+  for (size_t i = 0; i < bins_.size(); i++) {
+    seen += bins_[i];
+    if (seen > rank) {
+      return std::max(min_, std::min(max_, Value(min_key_ + i)));
+    }
+  }
+  return max_;
+}
+
+void DDSketch::Clear() {
+  bins_.clear();
+  min_key_ = 0;
+  zero_count_ = 0;
+  count_ = 0;
+  sum_ = 0;
+  min_ = 0;
+  max_ = 0;
+}
+
+}  // namespace prober
@@ -0,0 +1,75 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_DDSKETCH_H_
+#define _EXPORTERS_DDSKETCH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+
+#define DDSKETCH_DEFAULT_ACCURACY 0.01
+#define DDSKETCH_DEFAULT_MAX_BUCKETS 2048
+
+namespace prober {
+
+/* Quantile sketch with a relative error guarantee (DDSketch). Positive
+  values are counted in logarithmic buckets, so every quantile is within
+  relative_accuracy of the exact one. Sketches with the same accuracy merge
+  by adding bucket counts. Beyond max_buckets the lowest buckets are folded
+  together, which only costs accuracy on the lowest quantiles. Values <= 0
+  are counted as 0. */
+class DDSketch {
+ public:
+  explicit DDSketch(double relative_accuracy = DDSKETCH_DEFAULT_ACCURACY,
+                    uint32_t max_buckets = DDSKETCH_DEFAULT_MAX_BUCKETS);
+
+  void Add(double value, uint64_t count = 1);
+  // Fails if other was built with a different accuracy.
+  absl::Status Merge(const DDSketch& other);
+  // q in [0, 1], returns 0 for an empty sketch.
+  double Quantile(double q) const;
+  void Clear();
+
+  uint64_t Count() const { return count_; }
+  double Sum() const { return sum_; }
+  double Min() const { return min_; }
+  double Max() const { return max_; }
+  bool Empty() const { return count_ == 0; }
+  // Memory used by the buckets.
+  size_t Buckets() const { return bins_.size(); }
+
+ private:
+  int32_t Key(double value) const;
+  double Value(int32_t key) const;
+  void AddKey(int32_t key, uint64_t count);
+
+  double relative_accuracy_;
+  double gamma_;
+  double log_gamma_;
+  uint32_t max_buckets_;
+  // bins_[i] counts the values of key min_key_ + i.
+  std::vector<uint64_t> bins_;
+  int32_t min_key_;
+  uint64_t zero_count_;
+  uint64_t count_;
+  double sum_;
+  double min_;
+  double max_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_DDSKETCH_H_
@@ -0,0 +1,176 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/ddsketch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace prober {
+namespace {
+
+constexpr double kQuantiles[] = {0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999};
+
+// Same rank as DDSketch::Quantile.
+double Exact(std::vector<double> values, double q) {
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(q * (values.size() - 1))];
+}
+
+std::vector<double> LogNormal(size_t n) {
+  std::mt19937 rng(42);
+  // Latencies around 1ms with a long tail.
+  std::lognormal_distribution<double> dist(0, 1.5);
+  std::vector<double> values;
+  for (size_t i = 0; i < n; i++) {
+    values.push_back(dist(rng));
+  }
+  return values;
+}
+
+void ExpectWithinAccuracy(const DDSketch& sketch,
+                          const std::vector<double>& values, double accuracy) {
+  for (double q : kQuantiles) {
+    double exact = Exact(values, q);
+    EXPECT_NEAR(sketch.Quantile(q), exact, exact * accuracy + 1e-12)
+        << "q=" << q;
+  }
+}
+
+TEST(DDSketchTest, EmptySketch) {
+  DDSketch sketch;
+  EXPECT_TRUE(sketch.Empty());
+  EXPECT_EQ(sketch.Quantile(0.5), 0);
+}
+
+TEST(DDSketchTest, QuantilesWithinRelativeAccuracy) {
+  for (double accuracy : {0.01, 0.02, 0.05}) {
+    DDSketch sketch(accuracy);
+    std::vector<double> values = LogNormal(100000);
+    for (double value : values) {
+      sketch.Add(value);
+    }
+    EXPECT_EQ(sketch.Count(), values.size());
+    EXPECT_EQ(sketch.Min(), *std::min_element(values.begin(), values.end()));
+    EXPECT_EQ(sketch.Max(), *std::max_element(values.begin(), values.end()));
+    EXPECT_EQ(sketch.Quantile(0), sketch.Min());
+    EXPECT_EQ(sketch.Quantile(1), sketch.Max());
+    ExpectWithinAccuracy(sketch, values, accuracy);
+  }
+}
+
+TEST(DDSketchTest, UniformValues) {
+  DDSketch sketch;
+  std::vector<double> values;
+  for (int i = 1; i <= 10000; i++) {
+    values.push_back(i);
+    sketch.Add(i);
+  }
+  ExpectWithinAccuracy(sketch, values, DDSKETCH_DEFAULT_ACCURACY);
+  EXPECT_DOUBLE_EQ(sketch.Sum(), 10000.0 * 10001 / 2);
+}
+
+TEST(DDSketchTest, CountsZeroAndNegativeAsZero) {
+  DDSketch sketch;
+  sketch.Add(-5);
+  sketch.Add(0, 2);
+  sketch.Add(10);
+  EXPECT_EQ(sketch.Count(), 4);
+  EXPECT_EQ(sketch.Min(), 0);
+  EXPECT_EQ(sketch.Quantile(0.5), 0);
+  EXPECT_EQ(sketch.Quantile(1), 10);
+}
+
+TEST(DDSketchTest, WeightedAdd) {
+  DDSketch sketch;
+  sketch.Add(1, 99);
+  sketch.Add(1000, 1);
+  EXPECT_EQ(sketch.Count(), 100);
+  EXPECT_NEAR(sketch.Quantile(0.5), 1, DDSKETCH_DEFAULT_ACCURACY);
+  EXPECT_EQ(sketch.Quantile(1), 1000);
+}
+
+TEST(DDSketchTest, MergeMatchesSingleSketch) {
+  std::vector<double> values = LogNormal(20000);
+  DDSketch all, first, second;
+  for (size_t i = 0; i < values.size(); i++) {
+    all.Add(values[i]);
+    (i % 3 ? first : second).Add(values[i]);
+  }
+  ASSERT_TRUE(first.Merge(second).ok());
+  EXPECT_EQ(first.Count(), all.Count());
+  EXPECT_NEAR(first.Sum(), all.Sum(), 1e-6 * all.Sum());
+  EXPECT_EQ(first.Min(), all.Min());
+  EXPECT_EQ(first.Max(), all.Max());
+  for (double q : kQuantiles) {
+    EXPECT_EQ(first.Quantile(q), all.Quantile(q)) << "q=" << q;
+  }
+  ExpectWithinAccuracy(first, values, DDSKETCH_DEFAULT_ACCURACY);
+}
+
+TEST(DDSketchTest, MergeIntoEmpty) {
+  DDSketch empty, other;
+  other.Add(3);
+  other.Add(7);
+  ASSERT_TRUE(empty.Merge(other).ok());
+  EXPECT_EQ(empty.Count(), 2);
+  EXPECT_EQ(empty.Min(), 3);
+  EXPECT_EQ(empty.Max(), 7);
+}
+
+TEST(DDSketchTest, MergeRejectsOtherAccuracy) {
+  DDSketch sketch(0.01), other(0.02);
+  other.Add(1);
+  EXPECT_FALSE(sketch.Merge(other).ok());
+  EXPECT_TRUE(sketch.Empty());
+}
+
+TEST(DDSketchTest, FoldsLowestBuckets) {
+  DDSketch sketch(DDSKETCH_DEFAULT_ACCURACY, 64);
+  std::vector<double> values;
+  // 1e-6 to 1e3, far more than 64 buckets at 1%.
+  for (int i = 0; i < 10000; i++) {
+    double value = std::pow(10, -6 + 9.0 * i / 10000);
+    values.push_back(value);
+    sketch.Add(value);
+  }
+  EXPECT_LE(sketch.Buckets(), 64);
+  EXPECT_EQ(sketch.Count(), values.size());
+  // High quantiles keep their accuracy.
+  for (double q : {0.99, 0.999}) {
+    double exact = Exact(values, q);
+    EXPECT_NEAR(sketch.Quantile(q), exact, exact * DDSKETCH_DEFAULT_ACCURACY);
+  }
+  // Low ones are counted in the lowest bucket kept, they are overestimated.
+  EXPECT_GT(sketch.Quantile(0.1), Exact(values, 0.1) * 1.5);
+}
+
+TEST(DDSketchTest, Clear) {
+  DDSketch sketch;
+  sketch.Add(5);
+  sketch.Clear();
+  EXPECT_TRUE(sketch.Empty());
+  EXPECT_EQ(sketch.Buckets(), 0);
+  sketch.Add(2);
+  EXPECT_EQ(sketch.Min(), 2);
+  EXPECT_EQ(sketch.Max(), 2);
+}
+
+}  // namespace
+}  // namespace prober
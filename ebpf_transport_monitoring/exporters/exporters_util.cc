@@ -21,7 +21,9 @@
 #include <sys/socket.h>
 
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -68,8 +70,12 @@ static absl::StatusOr<std::string> PrintTcpData(uint32_t event_type,
           congestion->rcv_cwnd, congestion->snd_wnd, congestion->snd_cwnd,
           congestion->srtt);
     }
+    case EC_TCP_EVENT_PACKET_DROP: {
+      const ec_tcp_drop_t *const drop =
+          static_cast<const ec_tcp_drop_t *>(event_info);
+      return absl::StrFormat("reason %u drops %u", drop->reason, drop->count);
+    }
     // There is no event specific data for following types
-    case EC_TCP_EVENT_PACKET_DROP:
     case EC_TCP_EVENT_RESET:
       break;
     case EC_TCP_EVENT_RETRANS:
@@ -134,66 +140,6 @@ static absl::StatusOr<std::string> PrintH2Data(uint32_t event_type,
   return "";
 }
 
-static std::string MetricValue(const void *const data, MetricType type) {
-  switch (type) {
-    case MetricType::kUnit8:
-      return absl::StrFormat("%u", *(uint8_t *)data);
-    case MetricType::kUint16:
-      return absl::StrFormat("%u", *(uint16_t *)data);
-    case MetricType::kUint32:
-      return absl::StrFormat("%u", *(uint32_t *)data);
-    case MetricType::kUint64:
-      return absl::StrFormat("%u", *(uint64_t *)data);
-    case MetricType::kInt8:
-      return absl::StrFormat("%d", *(int8_t *)data);
-    case MetricType::kInt16:
-      return absl::StrFormat("%d", *(int16_t *)data);
-    case MetricType::kInt32:
-      return absl::StrFormat("%d", *(int32_t *)data);
-    case MetricType::kInt64:
-      return absl::StrFormat("%d", *(int64_t *)data);
-    case MetricType::kFloat:
-      return absl::StrFormat("%f", *(float *)data);
-    case MetricType::kDouble:
-      return absl::StrFormat("%d", *(double *)data);
-    case MetricType::kInternal:
-      // This is an error condtion for external metrics
-      return "";
-  }
-  return "";
-}
-
-/* TODO: GCP only allows BOOL, INT64, DOUBLE, or DISTRIBUTION. At this point
-all metrics are uint64_t hence for now we live with this monstrosity*/
-int64_t ExportersUtil::GetMetric(const void *const data, MetricType type) {
-  switch (type) {
-    case MetricType::kUnit8:
-      return *(uint8_t *)data;
-    case MetricType::kUint16:
-      return *(uint16_t *)data;
-    case MetricType::kUint32:
-      return *(uint32_t *)data;
-    case MetricType::kUint64:
-      return *(uint64_t *)data;
-    case MetricType::kInt8:
-      return *(int8_t *)data;
-    case MetricType::kInt16:
-      return *(int16_t *)data;
-    case MetricType::kInt32:
-      return *(int32_t *)data;
-    case MetricType::kInt64:
-      return *(int64_t *)data;
-    case MetricType::kFloat:
-      return *(float *)data;
-    case MetricType::kDouble:
-      return *(double *)data;
-    case MetricType::kInternal:
-      // This is an error condtion for external metrics
-      return 0;
-  }
-  return 0;
-}
-
 uint64_t ExportersUtil::GetLogConnId(std::string &log_name,
                                      const void *const data) {
   const ec_ebpf_events_t *const events =
@@ -231,11 +177,10 @@ absl::StatusOr<std::string> ExportersUtil::GetLogString(
 }
 
 absl::StatusOr<std::string> ExportersUtil::GetMetricString(
-    std::string name, std::string uuid, const MetricDesc &desc,
+    std::string name, std::string uuid, const MetricDecoder &decoder,
     const void *const key, const void *const value) {
-  return absl::StrFormat(
-      "%s,%s,%s:%s%s", uuid, name, MetricValue(key, desc.key_type),
-      MetricValue(value, desc.value_type), GetUnitString(desc.unit));
+  return absl::StrFormat("%s,%s,%s:%s%s", uuid, name, decoder.format_key(key),
+                         decoder.format_value(value), decoder.unit);
 }
 
 absl::Time ExportersUtil::GetTimeFromBPFns(uint64_t timestamp) {
@@ -257,111 +202,139 @@ absl::Time ExportersUtil::GetLogTime(std::string &log_name,
   return GetTimeFromBPFns(events->mdata.timestamp);
 }
 
-absl::StatusOr<uint64_t> MetricTimeChecker::CheckMetricTime(
-    std::string &metric_name, std::string key, uint64_t timestamp) {
+// Number of connection state blocks allocated at once.
+#define CONN_STATE_SLAB_SIZE 64
+
+absl::StatusOr<uint32_t> ConnStateTable::AddMetric() {
+  if (num_metrics_ >= MAX_EXPORTED_METRICS) {
+    return absl::ResourceExhaustedError("Too many metrics registered");
+  }
+  return num_metrics_++;
+}
+
+ConnStateTable::MetricState &ConnStateTable::GetState(ConnHandle conn,
+                                                      uint32_t metric_id) {
+  uint32_t slab = conn.index / CONN_STATE_SLAB_SIZE;
+  while (slabs_.size() <= slab) {
+    slabs_.emplace_back(new ConnState[CONN_STATE_SLAB_SIZE]());
+  }
+  ConnState &state = slabs_[slab][conn.index % CONN_STATE_SLAB_SIZE];
+  if (!state.in_use || state.generation != conn.generation) {
+    memset(&state, 0, sizeof(state));
+    state.in_use = true;
+    state.generation = conn.generation;
+  }
+  return state.metrics[metric_id];
+}
+
+absl::StatusOr<uint64_t> ConnStateTable::CheckMetricTime(ConnHandle conn,
+                                                         uint32_t metric_id,
+                                                         uint64_t timestamp) {
   if (timestamp == 0) {
     return absl::InternalError("Collection not started");
   }
 
-  uuids_.insert(key);
-
-  auto timestamp_it = last_read_.find(metric_name);
-  if (timestamp_it == last_read_.end()) {
-    last_read_[metric_name][key] = timestamp;
+  MetricState &state = GetState(conn, metric_id);
+  if (state.last_read == 0) {
+    state.last_read = timestamp;
     // returning a dummy value for the first time
-    start_read_[metric_name][key] = absl::ToUnixNanos(
+    state.start_read = absl::ToUnixNanos(
         ExportersUtil::GetTimeFromBPFns(timestamp - kSecToNanosecFactor));
-    return start_read_[metric_name][key];
-  } else if (timestamp_it->second.find(key) == (timestamp_it->second.end())) {
-    last_read_[metric_name][key] = timestamp;
-    // returning a dummy value for the first time
-    start_read_[metric_name][key] = absl::ToUnixNanos(
-        ExportersUtil::GetTimeFromBPFns(timestamp - kSecToNanosecFactor));
-    return start_read_[metric_name][key];
-  } else if (last_read_[metric_name][key] >= timestamp) {
+    return state.start_read;
+  } else if (state.last_read >= timestamp) {
     // This section makes sure the last recoded value is sent for continuous
     // reporting
     struct timespec time;
     clock_gettime(CLOCK_MONOTONIC, &time);
     uint64_t mono_time_val = kSecToNanosecFactor * time.tv_sec + time.tv_nsec;
-    uint64_t old_timestamp = last_read_[metric_name][key];
+    uint64_t old_timestamp = state.last_read;
     // Sometimes the same value is sent twice in quick succession.
     // Make sure there is atleast 1 second between the times.
     if (mono_time_val - old_timestamp > kSecToNanosecFactor) {
-      last_read_[metric_name][key] = mono_time_val;
+      state.last_read = mono_time_val;
       return old_timestamp;
     }
-  } else if (last_read_[metric_name][key] < timestamp &&
-             (timestamp - last_read_[metric_name][key]) > kSecToNanosecFactor) {
-    uint64_t old_timestamp = last_read_[metric_name][key];
-    last_read_[metric_name][key] = timestamp;
+  } else if ((timestamp - state.last_read) > kSecToNanosecFactor) {
+    uint64_t old_timestamp = state.last_read;
+    state.last_read = timestamp;
     return old_timestamp;
   }
 
   return absl::UnknownError("");
 }
 
-absl::StatusOr<uint64_t> MetricTimeChecker::GetMetricStartTime(
-    std::string &metric_name, std::string key) {
-  auto timestamp_it = start_read_.find(metric_name);
-  if (timestamp_it != start_read_.end()) {
-    if (timestamp_it->second.find(key) != (timestamp_it->second.end())) {
-      return start_read_[metric_name][key];
-    }
-  }
-  return absl::UnknownError("");
+uint64_t ConnStateTable::GetMetricStartTime(ConnHandle conn,
+                                            uint32_t metric_id) {
+  return GetState(conn, metric_id).start_read;
 }
 
-void MetricTimeChecker::DeleteValue(std::string uuid) {
-  for (auto it = start_read_.begin(); it != start_read_.end(); it++) {
-    it->second.erase(uuid);
-  }
-
-  for (auto it = last_read_.begin(); it != start_read_.end(); it++) {
-    it->second.erase(uuid);
-  }
-
-  uuids_.erase(uuid);
+uint64_t ConnStateTable::GetMetricTime(ConnHandle conn, uint32_t metric_id) {
+  return GetState(conn, metric_id).last_read;
 }
 
-absl::flat_hash_set<std::string> MetricTimeChecker::GetUUID() { return uuids_; }
+uint64_t ConnStateTable::StoreAndGetValue(ConnHandle conn, uint32_t metric_id,
+                                          uint64_t data) {
+  MetricState &state = GetState(conn, metric_id);
+  uint64_t old_data = state.last_value;
+  state.last_value = data;
+  return old_data;
+}
 
-absl::StatusOr<uint64_t> MetricTimeChecker::GetMetricTime(
-    std::string &metric_name, std::string key) {
-  auto timestamp_it = start_read_.find(metric_name);
-  if (timestamp_it != start_read_.end()) {
-    if (timestamp_it->second.find(key) != (timestamp_it->second.end())) {
-      return last_read_[metric_name][key];
+std::vector<ConnHandle> ConnStateTable::GetConnHandles() {
+  std::vector<ConnHandle> handles;
+  for (uint32_t slab = 0; slab < slabs_.size(); slab++) {
+    for (uint32_t i = 0; i < CONN_STATE_SLAB_SIZE; i++) {
+      if (slabs_[slab][i].in_use) {
+        handles.push_back(
+            {slab * CONN_STATE_SLAB_SIZE + i, slabs_[slab][i].generation});
+      }
     }
   }
-  return absl::UnknownError("");
+  return handles;
 }
 
-uint64_t MetricDataMemory::StoreAndGetValue(std::string &metric_name,
-                                            std::string uuid, uint64_t data) {
-  auto data_it = data_memory_.find(metric_name);
-  uuids_.insert(uuid);
-  if (data_it == data_memory_.end()) {
-    data_memory_[metric_name][uuid] = data;
-    return 0;
-  } else if (data_it->second.find(uuid) == (data_it->second.end())) {
-    data_memory_[metric_name][uuid] = data;
-    return 0;
-  } else {
-    auto old_data = data_memory_[metric_name][uuid];
-    data_memory_[metric_name][uuid] = data;
-    return old_data;
+void ConnStateTable::DeleteValue(ConnHandle conn) {
+  uint32_t slab = conn.index / CONN_STATE_SLAB_SIZE;
+  if (slab >= slabs_.size()) {
+    return;
+  }
+  ConnState &state = slabs_[slab][conn.index % CONN_STATE_SLAB_SIZE];
+  if (state.generation == conn.generation) {
+    state.in_use = false;
   }
-  return 0;
 }
 
-void MetricDataMemory::DeleteValue(std::string uuid) {
-  for (auto it = data_memory_.begin(); it != data_memory_.end(); it++) {
-    it->second.erase(uuid);
+metric_hist_t HistogramDeltaTable::Delta(ConnHandle conn, uint32_t metric_id,
+                                         const void* const data) {
+  metric_hist_t hist;
+  memcpy(&hist, data, sizeof(hist));
+  Last& last = last_[conn.index];
+  if (last.generation != conn.generation) {
+    last.generation = conn.generation;
+    last.metrics.clear();
+  }
+  auto it = last.metrics.find(metric_id);
+  if (it == last.metrics.end()) {
+    last.metrics.insert({metric_id, hist});
+    return hist;
   }
-  uuids_.erase(uuid);
+  metric_hist_t delta = hist;
+  if (hist.count >= it->second.count) {
+    delta.count -= it->second.count;
+    delta.sum -= it->second.sum;
+    for (uint32_t i = 0; i < METRIC_HIST_BUCKETS; i++) {
+      delta.buckets[i] -= it->second.buckets[i];
+    }
+  }
+  it->second = hist;
+  return delta;
 }
 
-absl::flat_hash_set<std::string> MetricDataMemory::GetUUID() { return uuids_; }
+void HistogramDeltaTable::DeleteValue(ConnHandle conn) {
+  auto it = last_.find(conn.index);
+  if (it != last_.end() && it->second.generation == conn.generation) {
+    last_.erase(it);
+  }
+}
 
 }  // namespace prober
@@ -16,67 +16,105 @@
 #define _EXPORTERS_EXPORTERS_UTIL_H_
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "exporters/metric_decoder.h"
 #include "loader/exporter/data_types.h"
 
 namespace prober {
 
+// Metric registered with an exporter along with its ConnStateTable id and
+// decoder.
+struct ExportedMetric {
+  MetricDesc desc;
+  uint32_t id;
+  MetricDecoder decoder;
+};
+
 class ExportersUtil {
  public:
   static absl::StatusOr<std::string> GetLogString(std::string& log_name,
                                                   std::string uuid,
                                                   const void* const data);
   static uint64_t GetLogConnId(std::string& log_name, const void* const data);
-  static absl::StatusOr<std::string> GetMetricString(std::string name,
-                                                     std::string uuid,
-                                                     const MetricDesc& desc,
-                                                     const void* const key,
-                                                     const void* const value);
+  static absl::StatusOr<std::string> GetMetricString(
+      std::string name, std::string uuid, const MetricDecoder& decoder,
+      const void* const key, const void* const value);
   static absl::Time GetLogTime(std::string& log_name, const void* const data);
   static absl::Time GetTimeFromBPFns(uint64_t timestamp);
-  static int64_t GetMetric(const void* const data, MetricType type);
 };
 
-class MetricTimeChecker {
+// Upper bound of metrics an exporter can register. It sizes the per
+// connection state block.
+#define MAX_EXPORTED_METRICS 32
+
+/* Per connection state kept by metric exporters. State blocks are allocated
+  from slabs and indexed by the connection handle given by the correlator,
+  each block holds a dense array indexed by the metric id returned by
+  AddMetric. */
+class ConnStateTable {
  public:
-  MetricTimeChecker() = default;
+  ConnStateTable() = default;
+  absl::StatusOr<uint32_t> AddMetric();
   // The Checker returns the last metric timestamp or error
-  absl::StatusOr<uint64_t> CheckMetricTime(std::string& metric_name,
-                                           std::string uuid,
+  absl::StatusOr<uint64_t> CheckMetricTime(ConnHandle conn, uint32_t metric_id,
                                            uint64_t timestamp);
-  absl::StatusOr<uint64_t> GetMetricStartTime(std::string& metric_name,
-                                              std::string uuid);
-  absl::StatusOr<uint64_t> GetMetricTime(std::string& metric_name,
-                                         std::string uuid);
-  absl::flat_hash_set<std::string> GetUUID();
-  void DeleteValue(std::string uuid);
+  uint64_t GetMetricStartTime(ConnHandle conn, uint32_t metric_id);
+  uint64_t GetMetricTime(ConnHandle conn, uint32_t metric_id);
+  // Stores the cumulative value and returns the previous one, 0 the first
+  // time.
+  uint64_t StoreAndGetValue(ConnHandle conn, uint32_t metric_id,
+                            uint64_t data);
+  std::vector<ConnHandle> GetConnHandles();
+  void DeleteValue(ConnHandle conn);
 
  private:
-  absl::flat_hash_map<std::string, absl::flat_hash_map<std::string, uint64_t> >
-      last_read_;
-  absl::flat_hash_map<std::string, absl::flat_hash_map<std::string, uint64_t> >
-      start_read_;
-  absl::flat_hash_set<std::string> uuids_;
+  struct MetricState {
+    uint64_t last_read;
+    uint64_t start_read;
+    uint64_t last_value;
+  };
+  struct ConnState {
+    bool in_use;
+    uint32_t generation;
+    MetricState metrics[MAX_EXPORTED_METRICS];
+  };
+
+  // Returns the state of the connection, reset if the handle index was
+  // reused for a new connection.
+  MetricState& GetState(ConnHandle conn, uint32_t metric_id);
+
+  std::vector<std::unique_ptr<ConnState[]>> slabs_;
+  uint32_t num_metrics_ = 0;
 };
 
-class MetricDataMemory {
+/* Turns the cumulative MetricType::kLog2Histogram values of connections into
+  the samples added since the previous read, for exporters that record
+  individual samples. */
+class HistogramDeltaTable {
  public:
-  MetricDataMemory() = default;
-  // The Checker returns the last metric timestamp or error
-  uint64_t StoreAndGetValue(std::string& metric_name, std::string uuid,
-                            uint64_t data);
-  absl::flat_hash_set<std::string> GetUUID();
-  void DeleteValue(std::string uuid);
+  HistogramDeltaTable() = default;
+  // Everything is new the first time and when the histogram went backwards,
+  // i.e. its map entry was evicted and recreated.
+  metric_hist_t Delta(ConnHandle conn, uint32_t metric_id,
+                      const void* const data);
+  void DeleteValue(ConnHandle conn);
 
  private:
-  absl::flat_hash_map<std::string, absl::flat_hash_map<std::string, uint64_t> >
-      data_memory_;
-  absl::flat_hash_set<std::string> uuids_;
+  struct Last {
+    uint32_t generation;
+    absl::flat_hash_map<uint32_t, metric_hist_t> metrics;
+  };
+  // Indexed by the connection handle index.
+  absl::flat_hash_map<uint32_t, Last> last_;
 };
 
 }  // namespace prober
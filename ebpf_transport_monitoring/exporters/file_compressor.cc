@@ -0,0 +1,246 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/file_compressor.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "loader/exporter/self_metrics.h"
+#include "zlib.h"
+
+namespace prober {
+
+#define COMPRESS_CHUNK_SIZE (64 * 1024)
+#define PENDING_SUFFIX ".pending"
+
+static absl::Duration ThreadCpuTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return absl::DurationFromTimespec(ts);
+}
+
+FileCompressor::FileCompressor(std::string archive_prefix,
+                               uint32_t max_archives)
+    : archive_prefix_(archive_prefix),
+      max_archives_(max_archives ? max_archives : 1),
+      sequence_(0),
+      stop_(false) {
+  auto pos = archive_prefix_.rfind('/');
+  if (pos == std::string::npos) {
+    directory_ = ".";
+    archive_base_ = archive_prefix_;
+  } else {
+    directory_ = archive_prefix_.substr(0, pos);
+    archive_base_ = archive_prefix_.substr(pos + 1);
+  }
+}
+
+FileCompressor::~FileCompressor() {
+  {
+    absl::MutexLock lock(&mu_);
+    stop_ = true;
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+absl::Status FileCompressor::Start() {
+  if (worker_.joinable()) {
+    return absl::AlreadyExistsError("compressor already started");
+  }
+  RecoverPending();
+  worker_ = std::thread(&FileCompressor::Run, this);
+  return absl::OkStatus();
+}
+
+std::string FileCompressor::NextArchiveName() {
+  return absl::StrFormat(
+      "%s.%s.%06d.gz", archive_prefix_,
+      absl::FormatTime("%Y%m%d%H%M%S", absl::Now(), absl::UTCTimeZone()),
+      sequence_++ % 1000000);
+}
+
+void FileCompressor::Submit(const std::string& file) {
+  if (access(file.c_str(), F_OK) != 0) {
+    return;
+  }
+  auto archive = NextArchiveName();
+  // The rotation chain reuses the file name, keep ours out of its way.
+  auto pending = archive + PENDING_SUFFIX;
+  if (rename(file.c_str(), pending.c_str()) != 0) {
+    std::cerr << "Could not move rotated file " << file << ": "
+              << strerror(errno) << std::endl;
+    return;
+  }
+  absl::MutexLock lock(&mu_);
+  queue_.push_back({pending, archive});
+}
+
+void FileCompressor::RecoverPending() {
+  std::deque<std::pair<std::string, std::string>> jobs;
+  for (const auto& name : ListArchives()) {
+    if (absl::EndsWith(name, PENDING_SUFFIX)) {
+      auto pending = directory_ + "/" + name;
+      auto archive = pending.substr(0, pending.size() - strlen(PENDING_SUFFIX));
+      // A partial archive of an interrupted compression is overwritten.
+      jobs.push_back({pending, archive});
+    }
+  }
+  absl::MutexLock lock(&mu_);
+  queue_.insert(queue_.begin(), jobs.begin(), jobs.end());
+}
+
+void FileCompressor::Run() {
+  auto has_work = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stop_ || !queue_.empty();
+  };
+  while (true) {
+    std::pair<std::string, std::string> job;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(&has_work));
+      // Queued files are still compressed on shutdown.
+      if (queue_.empty()) {
+        return;
+      }
+      job = queue_.front();
+      queue_.pop_front();
+    }
+    auto status = Compress(job.first, job.second);
+    // Retention may remove pending files while they are queued.
+    if (absl::IsNotFound(status)) {
+      continue;
+    }
+    if (!status.ok()) {
+      SelfMetrics::GetInstance().Increment("file_compress_failures");
+      std::cerr << status << std::endl;
+      continue;
+    }
+    EnforceRetention();
+  }
+}
+
+absl::Status FileCompressor::Compress(const std::string& src,
+                                      const std::string& dst) {
+  FILE* in = fopen(src.c_str(), "rb");
+  if (in == nullptr) {
+    return absl::NotFoundError(
+        absl::StrFormat("Cannot open %s: %s", src, strerror(errno)));
+  }
+  gzFile out = gzopen(dst.c_str(), "wb6");
+  if (out == nullptr) {
+    fclose(in);
+    return absl::InternalError(absl::StrFormat("Cannot open %s", dst));
+  }
+
+  auto cpu_start = ThreadCpuTime();
+  std::vector<char> buffer(COMPRESS_CHUNK_SIZE);
+  uint64_t in_bytes = 0;
+  size_t len;
+  bool failed = false;
+  while ((len = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+    if (gzwrite(out, buffer.data(), len) != static_cast<int>(len)) {
+      failed = true;
+      break;
+    }
+    in_bytes += len;
+  }
+  failed |= ferror(in) != 0;
+  fclose(in);
+  if (gzclose(out) != Z_OK || failed) {
+    unlink(dst.c_str());
+    return absl::InternalError(absl::StrFormat("Could not compress %s", src));
+  }
+  unlink(src.c_str());
+
+  struct stat st;
+  uint64_t out_bytes = 0;
+  if (stat(dst.c_str(), &st) == 0) {
+    out_bytes = st.st_size;
+  }
+
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.RecordLatency("file_compress_cpu_time",
+                             ThreadCpuTime() - cpu_start);
+  self_metrics.Increment("file_compress_input_bytes", in_bytes);
+  self_metrics.Increment("file_compress_output_bytes", out_bytes);
+  if (out_bytes) {
+    self_metrics.SetGauge("file_compress_ratio_x100",
+                          in_bytes * 100 / out_bytes);
+  }
+  return absl::OkStatus();
+}
+
+std::vector<std::string> FileCompressor::ListArchives() {
+  std::vector<std::string> archives;
+  DIR* dir = opendir(directory_.c_str());
+  if (dir == nullptr) {
+    return archives;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (absl::StartsWith(name, archive_base_ + ".") &&
+        (absl::EndsWith(name, ".gz") ||
+         absl::EndsWith(name, ".gz" PENDING_SUFFIX))) {
+      archives.push_back(name);
+    }
+  }
+  closedir(dir);
+  // The UTC time and sequence in the names sort oldest first.
+  std::sort(archives.begin(), archives.end());
+  return archives;
+}
+
+void FileCompressor::EnforceRetention() {
+  // A pending file and the partial archive of an interrupted compression of
+  // it are one archive.
+  std::vector<std::string> archives;
+  for (auto& name : ListArchives()) {
+    if (absl::EndsWith(name, PENDING_SUFFIX)) {
+      name.resize(name.size() - strlen(PENDING_SUFFIX));
+    }
+    if (archives.empty() || archives.back() != name) {
+      archives.push_back(name);
+    }
+  }
+  if (archives.size() <= max_archives_) {
+    return;
+  }
+  for (size_t i = 0; i < archives.size() - max_archives_; i++) {
+    auto archive = directory_ + "/" + archives[i];
+    unlink(archive.c_str());
+    unlink((archive + PENDING_SUFFIX).c_str());
+  }
+}
+
+}  // namespace prober
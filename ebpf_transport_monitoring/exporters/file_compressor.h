@@ -0,0 +1,71 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_FILE_COMPRESSOR_H_
+#define _EXPORTERS_FILE_COMPRESSOR_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace prober {
+
+/* Gzips rotated exporter files on a background thread so the event loop never
+  waits on compression. Archives are named
+  <archive_prefix>.<utc time>.<sequence>.gz and only the newest max_archives
+  are kept. Files a previous run queued but did not compress are compressed
+  on Start and count against max_archives until then. */
+class FileCompressor {
+ public:
+  FileCompressor() = delete;
+  FileCompressor(std::string archive_prefix, uint32_t max_archives);
+  ~FileCompressor();
+  absl::Status Start();
+
+  // Takes the file out of the rotation chain with a rename and queues it.
+  // Missing files are ignored.
+  void Submit(const std::string& file);
+
+ private:
+  void Run();
+  // Queues the .pending files left in directory_ by a previous run.
+  void RecoverPending();
+  absl::Status Compress(const std::string& src, const std::string& dst);
+  // Names of the archives and pending files in directory_, oldest first.
+  std::vector<std::string> ListArchives();
+  void EnforceRetention();
+  std::string NextArchiveName();
+
+  std::string archive_prefix_;
+  std::string directory_;
+  std::string archive_base_;
+  uint32_t max_archives_;
+  uint64_t sequence_;
+
+  absl::Mutex mu_;
+  // Pending file and archive name pairs.
+  std::deque<std::pair<std::string, std::string>> queue_ ABSL_GUARDED_BY(mu_);
+  bool stop_ ABSL_GUARDED_BY(mu_);
+  std::thread worker_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_FILE_COMPRESSOR_H_
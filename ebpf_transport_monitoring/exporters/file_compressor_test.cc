@@ -0,0 +1,122 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/file_compressor.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zlib.h"
+
+namespace prober {
+namespace {
+
+class FileCompressorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = ::testing::TempDir() + "/" +
+           ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    mkdir(dir_.c_str(), 0755);
+    for (const auto& name : List()) {
+      unlink((dir_ + "/" + name).c_str());
+    }
+    prefix_ = dir_ + "/events.log";
+  }
+
+  void Write(const std::string& name, const std::string& content) {
+    FILE* file = fopen((dir_ + "/" + name).c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+  }
+
+  std::string Gunzip(const std::string& name) {
+    gzFile file = gzopen((dir_ + "/" + name).c_str(), "rb");
+    if (file == nullptr) {
+      return "";
+    }
+    std::string content;
+    char buffer[256];
+    int len;
+    while ((len = gzread(file, buffer, sizeof(buffer))) > 0) {
+      content.append(buffer, len);
+    }
+    gzclose(file);
+    return content;
+  }
+
+  std::vector<std::string> List() {
+    std::vector<std::string> names;
+    DIR* dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+      return names;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        names.push_back(name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  std::string dir_;
+  std::string prefix_;
+};
+
+TEST_F(FileCompressorTest, RecoversPendingFilesOnStart) {
+  Write("events.log.20200101000000.000000.gz.pending", "first");
+  // Partial archive of a compression the previous run did not finish.
+  Write("events.log.20200101000000.000000.gz", "\x1f\x8b");
+  Write("events.log.20200101000001.000001.gz.pending", "second");
+  {
+    FileCompressor compressor(prefix_, 10);
+    ASSERT_TRUE(compressor.Start().ok());
+  }
+  EXPECT_EQ(List(), (std::vector<std::string>{
+                        "events.log.20200101000000.000000.gz",
+                        "events.log.20200101000001.000001.gz"}));
+  EXPECT_EQ(Gunzip("events.log.20200101000000.000000.gz"), "first");
+  EXPECT_EQ(Gunzip("events.log.20200101000001.000001.gz"), "second");
+}
+
+TEST_F(FileCompressorTest, CountsPendingFilesAgainstRetention) {
+  Write("events.log.20200101000000.000000.gz", "");
+  Write("events.log.20200101000001.000001.gz.pending", "old");
+  Write("events.log.20200101000002.000002.gz.pending", "newer");
+  Write("events.log.1", "rotated");
+  {
+    FileCompressor compressor(prefix_, 2);
+    ASSERT_TRUE(compressor.Start().ok());
+    compressor.Submit(dir_ + "/events.log.1");
+  }
+  std::vector<std::string> names = List();
+  ASSERT_EQ(names.size(), 2);
+  EXPECT_EQ(names[0], "events.log.20200101000002.000002.gz");
+  EXPECT_EQ(Gunzip(names[0]), "newer");
+  EXPECT_EQ(Gunzip(names[1]), "rotated");
+}
+
+}  // namespace
+}  // namespace prober
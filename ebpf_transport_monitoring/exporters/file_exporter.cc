@@ -15,38 +15,167 @@
 
 #include "exporters/file_exporter.h"
 
+#include <cerrno>
 #include <cstdio>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
 #include "events.h"
 #include "exporters/exporters_util.h"
+#include "exporters/file_compressor.h"
+#include "exporters/log_encoder.h"
+#include "exporters/segment_writer.h"
 #include "loader/exporter/data_types.h"
+#include "spdlog/details/file_helper.h"
+#include "spdlog/details/null_mutex.h"
+#include "spdlog/details/os.h"
 #include "spdlog/fmt/bin_to_hex.h"
+#include "spdlog/sinks/base_sink.h"
 #include "spdlog/sinks/rotating_file_sink.h"
 #include "spdlog/spdlog.h"
 
 namespace prober {
 
+// Hands the file spdlog just rotated out to the compressor. spdlog renames
+// the files before re-opening the base file, so before_open sees file.1.
+static spdlog::file_event_handlers CompressHandlers(
+    FileCompressor* compressor) {
+  spdlog::file_event_handlers handlers;
+  if (compressor != nullptr) {
+    handlers.before_open = [compressor](const spdlog::filename_t& filename) {
+      compressor->Submit(
+          spdlog::sinks::rotating_file_sink_st::calc_filename(filename, 1));
+    };
+  }
+  return handlers;
+}
+
+/* Rotating file sink for lines that are formatted already, rotated like
+  rotating_file_sink. rotating_file_sink formats every message into a buffer
+  with 250 bytes inline, which allocates for longer lines such as JSON events.
+  This one appends the payload to a buffer it keeps. */
+class LineSink : public spdlog::sinks::base_sink<spdlog::details::null_mutex> {
+ public:
+  LineSink(std::string path, size_t max_size, size_t max_files,
+           const spdlog::file_event_handlers& handlers)
+      : path_(path),
+        max_size_(max_size),
+        max_files_(max_files),
+        file_helper_(handlers) {
+    file_helper_.open(path_, false);
+    size_ = file_helper_.size();
+    // The active file of an earlier run is rotated instead of appended to.
+    if (size_ > 0) {
+      Rotate();
+    }
+  }
+
+ protected:
+  void sink_it_(const spdlog::details::log_msg& msg) override {
+    line_.clear();
+    line_.append(msg.payload.begin(), msg.payload.end());
+    line_.push_back('\n');
+    if (size_ > 0 && size_ + line_.size() > max_size_) {
+      Rotate();
+    }
+    file_helper_.write(line_);
+    size_ += line_.size();
+  }
+
+  void flush_() override { file_helper_.flush(); }
+
+ private:
+  void Rotate() {
+    using spdlog::sinks::rotating_file_sink_st;
+    file_helper_.close();
+    for (size_t i = max_files_; i > 0; i--) {
+      auto src = rotating_file_sink_st::calc_filename(path_, i - 1);
+      if (!spdlog::details::os::path_exists(src)) {
+        continue;
+      }
+      auto dst = rotating_file_sink_st::calc_filename(path_, i);
+      if (spdlog::details::os::rename(src, dst) != 0) {
+        spdlog::throw_spdlog_ex("rotating: failed renaming " + src + " to " +
+                                    dst,
+                                errno);
+      }
+    }
+    file_helper_.reopen(true);
+    size_ = 0;
+  }
+
+  std::string path_;
+  size_t max_size_;
+  size_t max_files_;
+  spdlog::details::file_helper file_helper_;
+  size_t size_;
+  spdlog::memory_buf_t line_;
+};
+
+// Rotated files are compressed as soon as they leave the active file, so the
+// compressor is set up before the writer opens it.
+static absl::Status StartCompressor(const std::string& file,
+                                    uint32_t max_archives,
+                                    std::unique_ptr<FileCompressor>* out) {
+  if (max_archives == 0) {
+    return absl::OkStatus();
+  }
+  *out = std::make_unique<FileCompressor>(file, max_archives);
+  return (*out)->Start();
+}
+
 FileLogger::FileLogger() {
   file_size_ = 1048576 * 50;
   max_files_ = 2;
   directory_ = "/tmp";
+  format_ = FileFormat::kText;
+  max_archives_ = 0;
 }
 FileLogger::FileLogger(uint8_t max_files, uint32_t file_size,
-                       std::string dir_name)
-    : max_files_(max_files), file_size_(file_size), directory_(dir_name) {}
+                       std::string dir_name, FileFormat format,
+                       uint32_t max_archives)
+    : max_files_(max_files),
+      file_size_(file_size),
+      directory_(dir_name),
+      format_(format),
+      max_archives_(max_archives) {}
 
 absl::Status FileLogger::Init() {
-  spdlog::file_event_handlers handlers;
-  logger_ = spdlog::rotating_logger_st("file_logger", directory_ + "/ebpf.txt",
-                                       file_size_, max_files_, true, handlers);
-  if (logger_ == nullptr) {
-    return absl::InternalError("Could not create file logger");
+  if (format_ == FileFormat::kSegment) {
+    auto path = directory_ + "/ebpf_logs.seg";
+    auto status = StartCompressor(path, max_archives_, &compressor_);
+    if (!status.ok()) {
+      return status;
+    }
+    segment_ = std::make_unique<SegmentWriter>(path, segment::Kind::kLog,
+                                               file_size_, max_files_);
+    if (compressor_ != nullptr) {
+      auto compressor = compressor_.get();
+      segment_->SetRotateHandler(
+          [compressor](const std::string& file) { compressor->Submit(file); });
+    }
+    return segment_->Open();
+  }
+  auto path = directory_ + (format_ == FileFormat::kJson ? "/ebpf_logs.jsonl"
+                                                         : "/ebpf_logs.txt");
+  auto status = StartCompressor(path, max_archives_, &compressor_);
+  if (!status.ok()) {
+    return status;
+  }
+  try {
+    logger_ = std::make_shared<spdlog::logger>(
+        "file_logger",
+        std::make_shared<LineSink>(path, file_size_, max_files_,
+                                   CompressHandlers(compressor_.get())));
+  } catch (const spdlog::spdlog_ex& e) {
+    return absl::InternalError(
+        absl::StrFormat("Could not create file logger: %s", e.what()));
   }
-  logger_->set_pattern("%v");
   return absl::OkStatus();
 }
 
@@ -54,7 +183,10 @@ absl::Status FileLogger::RegisterLog(std::string name, LogDesc& log_desc) {
   if (logs_.find(name) != logs_.end()) {
     return absl::AlreadyExistsError("log already registered");
   }
-  logs_[name] = true;
+  logs_[name] = 0;
+  if (segment_ != nullptr) {
+    logs_[name] = segment_->AddName(name);
+  }
   return absl::OkStatus();
 }
 
@@ -64,25 +196,53 @@ absl::Status FileLogger::HandleData(std::string log_name,
   static uint32_t counter;
   absl::Status status;
 
-  if (logs_.find(log_name) == logs_.end()) {
+  auto log_it = logs_.find(log_name);
+  if (log_it == logs_.end()) {
     return absl::NotFoundError("log not registered");
   }
 
   auto conn_id = ExportersUtil::GetLogConnId(log_name, data);
 
-  auto uuid = correlator_->GetUUID(conn_id);
+  if (segment_ != nullptr) {
+    auto conn = correlator_->GetConnHandle(conn_id);
+    if (!conn.ok()) {
+      return absl::OkStatus();
+    }
+    if (!segment_->HasConn(*conn)) {
+      segment_->AddConn(*conn, correlator_->GetUUID(*conn));
+    }
+    status = segment_->AppendLog(log_it->second, *conn,
+                                 static_cast<const ec_ebpf_events_t*>(data));
+    if (counter++ > 100) {
+      counter = 0;
+      auto flush_status = segment_->Flush();
+      if (status.ok()) {
+        status = flush_status;
+      }
+    }
+    return status;
+  }
 
-  if (!uuid.ok()) {
+  if (!correlator_->CopyUUID(conn_id, &uuid_)) {
     return absl::OkStatus();
   }
 
-  auto log_data = ExportersUtil::GetLogString(log_name, *uuid, data);
+  if (format_ == FileFormat::kJson) {
+    auto json = LogEncoder::EncodeJson(log_name, uuid_, data);
+    if (!json.ok()) {
+      return json.status();
+    }
+    logger_->log(spdlog::level::info,
+                 spdlog::string_view_t(json->data(), json->size()));
+  } else {
+    auto log_data = ExportersUtil::GetLogString(log_name, uuid_, data);
 
-  if (!log_data.ok()) {
-    return log_data.status();
-  }
+    if (!log_data.ok()) {
+      return log_data.status();
+    }
 
-  logger_->info("{}", *log_data);
+    logger_->log(spdlog::level::info, *log_data);
+  }
   if (counter++ > 100) {
     logger_->flush();
     counter = 0;
@@ -94,15 +254,46 @@ FileMetricExporter::FileMetricExporter() {
   file_size_ = 1048576 * 50;
   max_files_ = 2;
   directory_ = "/tmp";
+  format_ = FileFormat::kText;
+  max_archives_ = 0;
 }
 
 FileMetricExporter::FileMetricExporter(uint8_t max_files, uint32_t file_size,
-                                       std::string dir_name)
-    : max_files_(max_files), file_size_(file_size), directory_(dir_name) {}
+                                       std::string dir_name, FileFormat format,
+                                       uint32_t max_archives)
+    : max_files_(max_files),
+      file_size_(file_size),
+      directory_(dir_name),
+      format_(format),
+      max_archives_(max_archives) {}
 
 absl::Status FileMetricExporter::Init() {
-  logger_ = spdlog::rotating_logger_st("file_metric", directory_ + "/ebpf.txt",
-                                       file_size_, max_files_);
+  if (format_ == FileFormat::kJson) {
+    return absl::UnimplementedError("JSON is only supported for logs");
+  }
+  if (format_ == FileFormat::kSegment) {
+    auto path = directory_ + "/ebpf_metrics.seg";
+    auto status = StartCompressor(path, max_archives_, &compressor_);
+    if (!status.ok()) {
+      return status;
+    }
+    segment_ = std::make_unique<SegmentWriter>(path, segment::Kind::kMetric,
+                                               file_size_, max_files_);
+    if (compressor_ != nullptr) {
+      auto compressor = compressor_.get();
+      segment_->SetRotateHandler(
+          [compressor](const std::string& file) { compressor->Submit(file); });
+    }
+    return segment_->Open();
+  }
+  auto path = directory_ + "/ebpf_metrics.txt";
+  auto status = StartCompressor(path, max_archives_, &compressor_);
+  if (!status.ok()) {
+    return status;
+  }
+  logger_ = spdlog::rotating_logger_st("file_metric", path, file_size_,
+                                       max_files_, false,
+                                       CompressHandlers(compressor_.get()));
   if (logger_ == nullptr) {
     return absl::InternalError("Could not create file metric exporter");
   }
@@ -115,7 +306,15 @@ absl::Status FileMetricExporter::RegisterMetric(std::string name,
   if (metrics_.find(name) != metrics_.end()) {
     return absl::AlreadyExistsError("metric already registered");
   }
-  metrics_[name] = desc;
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+  metrics_[name] = {desc, *id, GetMetricDecoder(desc)};
+  if (segment_ != nullptr) {
+    segment_names_.resize(*id + 1);
+    segment_names_[*id] = segment_->AddName(name);
+  }
   return absl::OkStatus();
 }
 
@@ -129,18 +328,29 @@ absl::Status FileMetricExporter::HandleData(std::string metric_name, void* key,
 
   metric_format_t* metric = (metric_format_t*)value;
 
-  auto uuid = correlator_->GetUUID(*(uint64_t*)key);
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
 
-  if (!uuid.ok()) {
+  if (!conn.ok()) {
     return absl::OkStatus();
   }
 
-  if (!last_read_.CheckMetricTime(metric_name, *uuid, metric->timestamp).ok()) {
+  if (!conn_state_.CheckMetricTime(*conn, it->second.id, metric->timestamp)
+           .ok()) {
     return absl::OkStatus();
   }
 
+  if (segment_ != nullptr) {
+    if (!segment_->HasConn(*conn)) {
+      segment_->AddConn(*conn, correlator_->GetUUID(*conn));
+    }
+    return segment_->AppendMetric(segment_names_[it->second.id], *conn,
+                                  metric->timestamp,
+                                  it->second.decoder.value(&(metric->data)));
+  }
+
   auto metric_str = ExportersUtil::GetMetricString(
-      metric_name, *uuid, it->second, key, &(metric->data));
+      metric_name, correlator_->GetUUID(*conn), it->second.decoder, key,
+      &(metric->data));
   if (!metric_str.ok()) {
     return metric_str.status();
   }
@@ -155,11 +365,21 @@ absl::Status FileMetricExporter::HandleData(std::string metric_name, void* key,
   return absl::OkStatus();
 }
 
+void FileMetricExporter::Flush(std::string metric_name) {
+  if (segment_ == nullptr) {
+    return;
+  }
+  auto status = segment_->Flush();
+  if (!status.ok()) {
+    std::cerr << status << std::endl;
+  }
+}
+
 void FileMetricExporter::Cleanup() {
-  auto uuids = last_read_.GetUUID();
-  for (auto uuid : uuids) {
-    if (!correlator_->CheckUUID(uuid)) {
-      last_read_.DeleteValue(uuid);
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
     }
   }
 }
@@ -18,18 +18,34 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "exporters/exporters_util.h"
+#include "exporters/file_compressor.h"
+#include "exporters/segment_writer.h"
 #include "loader/exporter/log_exporter.h"
 #include "loader/exporter/metric_exporter.h"
 #include "spdlog/spdlog.h"
 
 namespace prober {
 
+enum class FileFormat {
+  // One line of text per record.
+  kText,
+  // Binary column blocks, see segment_format.h.
+  kSegment,
+  // One JSON object per line, see log_encoder.h. Only FileLogger supports it.
+  kJson,
+};
+
 class FileLogger : public LogExporterInterface {
  public:
   FileLogger();
-  FileLogger(uint8_t max_files, uint32_t file_size, std::string dir_name);
+  // max_archives > 0 gzips rotated files in the background and keeps that many
+  // archives.
+  FileLogger(uint8_t max_files, uint32_t file_size, std::string dir_name,
+             FileFormat format = FileFormat::kText,
+             uint32_t max_archives = 0);
   ~FileLogger() { spdlog::shutdown(); }
   absl::Status Init() override;
 
@@ -38,33 +54,49 @@ class FileLogger : public LogExporterInterface {
                           const uint32_t size) override;
 
  private:
-  absl::flat_hash_map<std::string, bool> logs_;
+  // Log name to its segment name id.
+  absl::flat_hash_map<std::string, uint32_t> logs_;
   uint8_t max_files_;
   uint32_t file_size_;
   std::string directory_;
+  FileFormat format_;
+  uint32_t max_archives_;
+  std::unique_ptr<FileCompressor> compressor_;
   std::shared_ptr<spdlog::logger> logger_;
+  std::unique_ptr<SegmentWriter> segment_;
+  // Reused for every event.
+  std::string uuid_;
 };
 
 class FileMetricExporter : public MetricExporterInterface {
  public:
   FileMetricExporter();
   FileMetricExporter(uint8_t max_files, uint32_t file_size,
-                     std::string dir_name);
+                     std::string dir_name,
+                     FileFormat format = FileFormat::kText,
+                     uint32_t max_archives = 0);
   ~FileMetricExporter() { spdlog::shutdown(); }
   absl::Status Init() override;
   absl::Status RegisterMetric(std::string name,
                               const MetricDesc& desc) override;
   absl::Status HandleData(std::string metric_name, void* key,
                           void* value) override;
+  void Flush(std::string metric_name) override;
   void Cleanup();
 
  private:
-  absl::flat_hash_map<std::string, MetricDesc> metrics_;
-  MetricTimeChecker last_read_;
+  absl::flat_hash_map<std::string, ExportedMetric> metrics_;
+  ConnStateTable conn_state_;
   uint8_t max_files_;
   uint32_t file_size_;
   std::string directory_;
+  FileFormat format_;
+  uint32_t max_archives_;
+  std::unique_ptr<FileCompressor> compressor_;
   std::shared_ptr<spdlog::logger> logger_;
+  std::unique_ptr<SegmentWriter> segment_;
+  // Segment name ids indexed by metric id.
+  std::vector<uint32_t> segment_names_;
 };
 
 }  // namespace prober
@@ -16,8 +16,11 @@
 
 #include <cstdio>
 #include <fstream>
+#include <iostream>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -26,16 +29,24 @@
 #include "events.h"
 #include "exporters/exporters_util.h"
 #include "exporters/gce_metadata.h"
+#include "exporters/log_encoder.h"
+#include "exporters/metric_decoder.h"
+#include "exporters/spool.h"
 #include "google/cloud/common_options.h"
 #include "google/cloud/credentials.h"
 #include "google/cloud/logging/logging_service_v2_client.h"
 #include "google/cloud/monitoring/metric_client.h"
 #include "google/cloud/project.h"
+#include "google/protobuf/struct.pb.h"
 #include "google/protobuf/util/time_util.h"
 #include "loader/exporter/data_types.h"
+#include "loader/exporter/self_metrics.h"
 
 #define LOGGING_INTERVAL absl::Minutes(1)
 #define LOGS_PER_REQUEST 199
+// Cloud Monitoring accepts at most 200 time series per CreateTimeSeries.
+#define TIME_SERIES_PER_REQUEST 200
+#define MAX_IN_FLIGHT_REQUESTS 4
 
 namespace prober {
 
@@ -58,15 +69,65 @@ static google::api::MonitoredResource CreateMontioredResource(
   return resource;
 }
 
-GCPLogger::GCPLogger(std::string project_name) : project_(project_name) {
+// google::cloud and absl share the canonical status codes.
+static absl::Status ToAbslStatus(const google::cloud::Status& status) {
+  return absl::Status(static_cast<absl::StatusCode>(status.code()),
+                      status.message());
+}
+
+namespace {
+
+// Sets the log fields on a protobuf Struct for jsonPayload.
+class StructSink : public LogFieldSink {
+ public:
+  explicit StructSink(google::protobuf::Struct* payload) : payload_(payload) {}
+  void String(absl::string_view key, absl::string_view value) override {
+    Field(key).set_string_value(value.data(), value.size());
+  }
+  void Number(absl::string_view key, uint64_t value) override {
+    // JSON numbers are doubles, ids and timestamps would lose precision.
+    if (value > (1ULL << 53)) {
+      Field(key).set_string_value(absl::StrCat(value));
+      return;
+    }
+    Field(key).set_number_value(value);
+  }
+
+ private:
+  google::protobuf::Value& Field(absl::string_view key) {
+    return (*payload_->mutable_fields())[std::string(key)];
+  }
+
+  google::protobuf::Struct* payload_;
+};
+
+}  // namespace
+
+GCPLogger::GCPLogger(std::string project_name)
+    : project_(project_name),
+      json_payload_(false),
+      spool_max_bytes_(SPOOL_DEFAULT_MAX_BYTES),
+      spool_replay_rate_(SPOOL_DEFAULT_REPLAY_RATE) {
   monitored_resource_ = CreateMontioredResource(project_.FullName());
 }
 
-GCPLogger::GCPLogger(std::string project_name, std::string service_file_path)
-    : project_(project_name), service_file_path_(service_file_path) {
+GCPLogger::GCPLogger(std::string project_name, std::string service_file_path,
+                     bool json_payload)
+    : project_(project_name),
+      service_file_path_(service_file_path),
+      json_payload_(json_payload),
+      spool_max_bytes_(SPOOL_DEFAULT_MAX_BYTES),
+      spool_replay_rate_(SPOOL_DEFAULT_REPLAY_RATE) {
   monitored_resource_ = CreateMontioredResource(project_.FullName());
 }
 
+void GCPLogger::EnableSpool(std::string dir, uint64_t max_bytes,
+                            uint32_t replay_rate) {
+  spool_dir_ = dir;
+  spool_max_bytes_ = max_bytes;
+  spool_replay_rate_ = replay_rate;
+}
+
 absl::Status GCPLogger::Init() {
   try {
     if (service_file_path_.empty()) {
@@ -100,6 +161,28 @@ absl::Status GCPLogger::Init() {
     gethostname(hostname, HOST_NAME_MAX);
     labels_["hostname"] = hostname;
   }
+
+  if (!spool_dir_.empty()) {
+    spool_ = std::make_unique<Spool>("gcp_logs", spool_dir_, spool_max_bytes_,
+                                     spool_replay_rate_);
+    auto status = spool_->Init();
+    if (!status.ok()) {
+      return status;
+    }
+    // HandleData keeps using log_client_, the replay thread gets its own
+    // copy sharing the connection.
+    logging::LoggingServiceV2Client client = *log_client_;
+    status = spool_->Start([client](const std::string& record) mutable {
+      google::logging::v2::WriteLogEntriesRequest request;
+      if (!request.ParseFromString(record)) {
+        return absl::DataLossError("Cannot parse spooled log request");
+      }
+      return ToAbslStatus(client.WriteLogEntries(request).status());
+    });
+    if (!status.ok()) {
+      return status;
+    }
+  }
   return absl::OkStatus();
 }
 
@@ -126,13 +209,21 @@ absl::Status GCPLogger::HandleData(std::string log_name, const void* const data,
     return absl::OkStatus();
   }
 
-  auto log_data = ExportersUtil::GetLogString(log_name, *uuid, data);
+  auto log_entry = google::logging::v2::LogEntry();
+  if (json_payload_) {
+    StructSink sink(log_entry.mutable_json_payload());
+    status = LogEncoder::VisitFields(log_name, *uuid, data, sink);
+    if (!status.ok()) {
+      return status;
+    }
+  } else {
+    auto log_data = ExportersUtil::GetLogString(log_name, *uuid, data);
 
-  if (!log_data.ok()) {
-    return log_data.status();
+    if (!log_data.ok()) {
+      return log_data.status();
+    }
+    log_entry.set_text_payload(*log_data);
   }
-
-  auto log_entry = google::logging::v2::LogEntry();
   *log_entry.mutable_resource() = monitored_resource_;
 
   auto log_time = ExportersUtil::GetLogTime(log_name, data);
@@ -143,26 +234,38 @@ absl::Status GCPLogger::HandleData(std::string log_name, const void* const data,
                        absl::Nanoseconds(1));
 
   log_entry.set_severity(google::logging::type::LogSeverity::INFO);
-  log_entry.set_text_payload(*log_data);
 
-  log_entries_.emplace_back(log_entry);
+  log_entries_.emplace_back(std::move(log_entry));
 
   // TODO: This should Ideally be done as async but for now so we let it be.
   if (log_entries_.size() > LOGS_PER_REQUEST ||
       (absl::Now() - last_log_sent_) > LOGGING_INTERVAL) {
-    std::map<std::string, std::string> labels;
+    google::logging::v2::WriteLogEntriesRequest request;
+    request.set_log_name(absl::StrCat(
+        absl::Substitute(kCloudLoggingPathTemplate, project_.project_id()),
+        "ebpf_prober"));
+    *request.mutable_resource() = monitored_resource_;
+    auto& labels = *request.mutable_labels();
     labels["source"] = "ebpf";
     for (auto& label : labels_) {
-      labels[label.first] = labels[label.second];
+      labels[label.first] = label.second;
+    }
+    for (auto& entry : log_entries_) {
+      request.mutable_entries()->Add(std::move(entry));
     }
-    last_log_sent_ = absl::Now();
-    auto response = log_client_->WriteLogEntries(
-        absl::StrCat(
-            absl::Substitute(kCloudLoggingPathTemplate, project_.project_id()),
-            "ebpf_prober"),
-        monitored_resource_, labels, log_entries_);
     log_entries_.clear();
+    last_log_sent_ = absl::Now();
+
+    // Keep spooling until the backlog is replayed so entries stay in order.
+    if (spool_ != nullptr && !spool_->Empty()) {
+      return spool_->Append(request.SerializeAsString());
+    }
+    auto response = log_client_->WriteLogEntries(request);
     if (!response.ok()) {
+      auto error = ToAbslStatus(response.status());
+      if (spool_ != nullptr && Spool::IsRetryable(error)) {
+        return spool_->Append(request.SerializeAsString());
+      }
       return absl::InternalError(response.status().message());
     }
   }
@@ -170,19 +273,52 @@ absl::Status GCPLogger::HandleData(std::string log_name, const void* const data,
 }
 
 GCPMetricExporter::GCPMetricExporter(std::string project_name)
-    : project_(project_name) {
+    : project_(project_name),
+      sender_(MAX_IN_FLIGHT_REQUESTS),
+      spool_max_bytes_(SPOOL_DEFAULT_MAX_BYTES),
+      spool_replay_rate_(SPOOL_DEFAULT_REPLAY_RATE) {
   monitored_resource_ = CreateMontioredResource(project_.FullName());
 }
 
 GCPMetricExporter::GCPMetricExporter(std::string project_name,
                                      std::string service_file_path)
-    : project_(project_name), service_file_path_(service_file_path) {
+    : project_(project_name),
+      service_file_path_(service_file_path),
+      sender_(MAX_IN_FLIGHT_REQUESTS),
+      spool_max_bytes_(SPOOL_DEFAULT_MAX_BYTES),
+      spool_replay_rate_(SPOOL_DEFAULT_REPLAY_RATE) {
+  monitored_resource_ = CreateMontioredResource(project_.FullName());
+}
+
+GCPMetricExporter::GCPMetricExporter(
+    std::string project_name,
+    std::shared_ptr<monitoring::MetricServiceConnection> connection)
+    : project_(project_name),
+      connection_(connection),
+      sender_(MAX_IN_FLIGHT_REQUESTS),
+      spool_max_bytes_(SPOOL_DEFAULT_MAX_BYTES),
+      spool_replay_rate_(SPOOL_DEFAULT_REPLAY_RATE) {
   monitored_resource_ = CreateMontioredResource(project_.FullName());
 }
 
+GCPMetricExporter::~GCPMetricExporter() {
+  SendPending();
+  sender_.Drain();
+}
+
+void GCPMetricExporter::EnableSpool(std::string dir, uint64_t max_bytes,
+                                    uint32_t replay_rate) {
+  spool_dir_ = dir;
+  spool_max_bytes_ = max_bytes;
+  spool_replay_rate_ = replay_rate;
+}
+
 absl::Status GCPMetricExporter::Init() {
   try {
-    if (service_file_path_.empty()) {
+    if (connection_ != nullptr) {
+      metric_client_ =
+          std::make_unique<monitoring::MetricServiceClient>(connection_);
+    } else if (service_file_path_.empty()) {
       metric_client_ = std::make_unique<monitoring::MetricServiceClient>(
           monitoring::MakeMetricServiceConnection());
     } else {
@@ -213,6 +349,27 @@ absl::Status GCPMetricExporter::Init() {
     labels_["hostname"] = hostname;
   }
 
+  if (!spool_dir_.empty()) {
+    spool_ = std::make_unique<Spool>("gcp_metrics", spool_dir_,
+                                     spool_max_bytes_, spool_replay_rate_);
+    auto status = spool_->Init();
+    if (!status.ok()) {
+      return status;
+    }
+    // Clients are only safe to use from one thread at a time, copies share
+    // the connection.
+    monitoring::MetricServiceClient client = *metric_client_;
+    status = spool_->Start([client](const std::string& record) mutable {
+      google::monitoring::v3::CreateTimeSeriesRequest request;
+      if (!request.ParseFromString(record)) {
+        return absl::DataLossError("Cannot parse spooled time series");
+      }
+      return ToAbslStatus(client.CreateTimeSeries(request));
+    });
+    if (!status.ok()) {
+      return status;
+    }
+  }
   return absl::OkStatus();
 }
 
@@ -251,8 +408,12 @@ static std::string GcpGetUnitString(MetricUnit_t unit) {
 }
 
 static google::api::MetricDescriptor::MetricKind GetGCPMetricKind(
-    MetricKind kind) {
-  switch (kind) {
+    const MetricDesc& desc) {
+  // The kernel histogram is cumulative since the connection was first seen.
+  if (desc.value_type == MetricType::kLog2Histogram) {
+    return google::api::MetricDescriptor::CUMULATIVE;
+  }
+  switch (desc.kind) {
     case MetricKind::kNone:
       // This is an error case we must bail out earlier. However, for now we
       // will
@@ -268,6 +429,20 @@ static google::api::MetricDescriptor::MetricKind GetGCPMetricKind(
   return google::api::MetricDescriptor::GAUGE;
 }
 
+// Bounds of the buckets of a MetricType::kLog2Histogram. A Cloud Monitoring
+// bucket includes its lower bound, bucket i of the kernel histogram holds
+// [2^(i-1), 2^i) and its first bucket, the underflow one, holds 0.
+static const std::vector<double>& Log2Bounds() {
+  static const std::vector<double>* bounds = [] {
+    auto bounds = new std::vector<double>();
+    for (uint32_t i = 0; i < METRIC_HIST_BUCKETS - 1; i++) {
+      bounds->push_back(Log2BucketMax(i) + 1);
+    }
+    return bounds;
+  }();
+  return *bounds;
+}
+
 absl::StatusOr<google::api::MetricDescriptor>
 GCPMetricExporter::CreateMetricDesciptor(std::string name,
                                          const MetricDesc& desc) {
@@ -290,9 +465,12 @@ GCPMetricExporter::CreateMetricDesciptor(std::string name,
     metric_label->set_key(label.first);
     metric_label->set_value_type(google::api::LabelDescriptor::STRING);
   }
-  // For now everything is a GAUGE with INT64 but will change in the future
-  metric_descriptor->set_metric_kind(GetGCPMetricKind(desc.kind));
-  metric_descriptor->set_value_type(google::api::MetricDescriptor::INT64);
+  // Log2 histograms are distributions, everything else is INT64.
+  metric_descriptor->set_metric_kind(GetGCPMetricKind(desc));
+  metric_descriptor->set_value_type(
+      desc.value_type == MetricType::kLog2Histogram
+          ? google::api::MetricDescriptor::DISTRIBUTION
+          : google::api::MetricDescriptor::INT64);
   metric_descriptor->set_unit(GcpGetUnitString(desc.unit));
   auto response = metric_client_->CreateMetricDescriptor(request);
   if (!response.ok()) {
@@ -312,6 +490,11 @@ absl::Status GCPMetricExporter::RegisterMetric(std::string name,
     return absl::InternalError("Invalid Metric Kind");
   }
 
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+
   auto response = CreateMetricDesciptor(name, desc);
   if (!response.ok()) {
     return absl::InternalError(
@@ -320,6 +503,8 @@ absl::Status GCPMetricExporter::RegisterMetric(std::string name,
   metrics_[name] = {};
   metrics_[name].desc = desc;
   metrics_[name].metric_descriptor = *response;
+  metrics_[name].id = *id;
+  metrics_[name].decoder = GetMetricDecoder(desc);
 
   return absl::OkStatus();
 }
@@ -332,30 +517,34 @@ absl::Status GCPMetricExporter::HandleData(std::string metric_name, void* key,
   }
 
   metric_format_t* metric = (metric_format_t*)value;
-  auto metric_desc = metrics_.find(metric_name);
+  auto metric_desc = it;
 
-  auto uuid = correlator_->GetUUID(*(uint64_t*)key);
-  if (!uuid.ok()) {
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
+  if (!conn.ok()) {
     return absl::OkStatus();
   }
 
   // This line also checks if a metric was just read.
-  auto old_timestamp =
-      last_read_.CheckMetricTime(metric_name, *uuid, metric->timestamp);
+  auto old_timestamp = conn_state_.CheckMetricTime(*conn, it->second.id,
+                                                   metric->timestamp);
   if (!old_timestamp.ok()) {
     return absl::OkStatus();
   }
+  auto uuid = correlator_->GetUUID(*conn);
 
-  google::monitoring::v3::CreateTimeSeriesRequest request;
-  request.set_name(project_.FullName());
+  auto series_key = std::make_pair(it->second.id, conn->index);
+  if (pending_series_.find(series_key) != pending_series_.end()) {
+    SendPending();
+  }
 
-  auto time_series = request.add_time_series();
+  google::monitoring::v3::TimeSeries series;
+  auto time_series = &series;
 
   auto metric_series = time_series->mutable_metric();
   metric_series->set_type(metric_desc->second.metric_descriptor.type());
   auto labels = metric_series->mutable_labels();
 
-  labels->insert({"conn_id", *uuid});
+  labels->insert({"conn_id", uuid});
 
   for (auto& label : labels_) {
     labels->insert({label.first, label.second});
@@ -363,8 +552,26 @@ absl::Status GCPMetricExporter::HandleData(std::string metric_name, void* key,
 
   time_series->mutable_resource()->set_type("global");
   auto point = time_series->add_points();
-  point->mutable_value()->set_int64_value(ExportersUtil::GetMetric(
-      &(metric->data), metric_desc->second.desc.value_type));
+  bool cumulative = metric_desc->second.desc.kind == MetricKind::kCumulative;
+  if (metric_desc->second.desc.value_type == MetricType::kLog2Histogram) {
+    cumulative = true;
+    const metric_hist_t& hist = ((metric_hist_format_t*)value)->data;
+    auto distribution = point->mutable_value()->mutable_distribution_value();
+    distribution->set_count(hist.count);
+    if (hist.count != 0) {
+      distribution->set_mean(static_cast<double>(hist.sum) / hist.count);
+    }
+    const auto& bounds = Log2Bounds();
+    distribution->mutable_bucket_options()
+        ->mutable_explicit_buckets()
+        ->mutable_bounds()
+        ->Add(bounds.begin(), bounds.end());
+    distribution->mutable_bucket_counts()->Add(
+        hist.buckets, hist.buckets + METRIC_HIST_BUCKETS);
+  } else {
+    point->mutable_value()->set_int64_value(
+        metric_desc->second.decoder.value(&(metric->data)));
+  }
 
   absl::Time t1;
   int64_t sec;
@@ -377,46 +584,97 @@ absl::Status GCPMetricExporter::HandleData(std::string metric_name, void* key,
                          absl::Nanoseconds(1));
   }
 
-  auto end_timestamp = last_read_.GetMetricTime(metric_name, *uuid);
-  if (!end_timestamp.ok()) {
-    std::cout << "Invalid end time" << std::endl;
-    return absl::OkStatus();
-  }
+  auto end_timestamp = conn_state_.GetMetricTime(*conn, it->second.id);
   auto timestamp = point->mutable_interval()->mutable_end_time();
-  t1 = ExportersUtil::GetTimeFromBPFns(*end_timestamp);
+  t1 = ExportersUtil::GetTimeFromBPFns(end_timestamp);
   sec = absl::ToUnixSeconds(t1);
   timestamp->set_seconds(sec);
   timestamp->set_nanos((t1 - absl::FromUnixSeconds(sec)) /
                        absl::Nanoseconds(1));
 
-  auto start_timestamp = last_read_.GetMetricStartTime(metric_name, *uuid);
-  if (!start_timestamp.ok()) {
-    std::cout << "Invalid start time" << std::endl;
-    return absl::OkStatus();
-  }
+  auto start_timestamp = conn_state_.GetMetricStartTime(*conn, it->second.id);
 
-  if (metric_desc->second.desc.kind == MetricKind::kCumulative) {
+  if (cumulative) {
     auto timestamp = point->mutable_interval()->mutable_start_time();
-    t1 = absl::FromUnixNanos(*start_timestamp);
+    t1 = absl::FromUnixNanos(start_timestamp);
     sec = absl::ToUnixSeconds(t1);
     timestamp->set_seconds(sec);
     timestamp->set_nanos((t1 - absl::FromUnixSeconds(sec)) /
                          absl::Nanoseconds(1));
   }
 
-  auto status = metric_client_->CreateTimeSeries(request);
-  if (!status.ok()) {
-    return absl::InternalError(
-        absl::StrCat("sending time series:", status.message()));
+  pending_.push_back(std::move(series));
+  pending_series_.insert(series_key);
+  if (pending_.size() >= TIME_SERIES_PER_REQUEST) {
+    SendPending();
   }
   return absl::OkStatus();
 }
 
+void GCPMetricExporter::Flush(std::string metric_name) { SendPending(); }
+
+void GCPMetricExporter::SendPending() {
+  if (pending_.empty()) {
+    return;
+  }
+  google::monitoring::v3::CreateTimeSeriesRequest request;
+  request.set_name(project_.FullName());
+  for (auto& series : pending_) {
+    *request.add_time_series() = std::move(series);
+  }
+  pending_.clear();
+  pending_series_.clear();
+
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.SetGauge("gcp_metric_batch_size", request.time_series_size());
+  self_metrics.Increment("gcp_metric_series", request.time_series_size());
+
+  auto spool = spool_.get();
+  // Points of a series must be written in order, keep spooling until the
+  // backlog is replayed.
+  if (spool != nullptr && !spool->Empty()) {
+    auto status = spool->Append(request.SerializeAsString());
+    if (!status.ok()) {
+      std::cerr << "spooling time series: " << status << std::endl;
+    }
+    return;
+  }
+  // Each request gets its own copy of the client, see Init.
+  monitoring::MetricServiceClient client = *metric_client_;
+  sender_.Run([client, spool, request = std::move(request)]() mutable {
+    // A request that failed after this one was queued may have started the
+    // backlog, this one has to be replayed after it.
+    if (spool != nullptr && !spool->Empty()) {
+      auto status = spool->Append(request.SerializeAsString());
+      if (!status.ok()) {
+        std::cerr << "spooling time series: " << status << std::endl;
+      }
+      return;
+    }
+    auto& self_metrics = SelfMetrics::GetInstance();
+    auto start = absl::Now();
+    auto status = client.CreateTimeSeries(request);
+    self_metrics.RecordLatency("gcp_metric_rpc_latency", absl::Now() - start);
+    self_metrics.Increment("gcp_metric_requests");
+    if (!status.ok()) {
+      self_metrics.Increment("gcp_metric_request_failures");
+      if (spool != nullptr && Spool::IsRetryable(ToAbslStatus(status))) {
+        auto spool_status = spool->Append(request.SerializeAsString());
+        if (spool_status.ok()) {
+          return;
+        }
+      }
+      std::cerr << "sending time series:" << status.message() << std::endl;
+    }
+  });
+  self_metrics.SetGauge("gcp_metric_requests_in_flight", sender_.InFlight());
+}
+
 void GCPMetricExporter::Cleanup() {
-  auto uuids = last_read_.GetUUID();
-  for (auto uuid : uuids) {
-    if (!correlator_->CheckUUID(uuid)) {
-      last_read_.DeleteValue(uuid);
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
     }
   }
 }
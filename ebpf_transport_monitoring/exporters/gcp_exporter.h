@@ -18,10 +18,15 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "absl/status/statusor.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/time/time.h"
+#include "exporters/bounded_async.h"
 #include "exporters/exporters_util.h"
+#include "exporters/spool.h"
 #include "google/cloud/logging/logging_service_v2_client.h"
 #include "google/cloud/monitoring/metric_client.h"
 #include "google/cloud/project.h"
@@ -34,9 +39,14 @@ class GCPLogger : public LogExporterInterface {
  public:
   GCPLogger() = delete;
   GCPLogger(std::string project_name);
-  GCPLogger(std::string project_name, std::string service_file_path);
+  // json_payload sends typed fields as jsonPayload instead of textPayload.
+  GCPLogger(std::string project_name, std::string service_file_path,
+            bool json_payload = false);
   ~GCPLogger() override = default;
   absl::Status Init() override;
+  // Requests that fail with a retryable error are spooled under dir and
+  // replayed once Cloud Logging is reachable again. Call before Init.
+  void EnableSpool(std::string dir, uint64_t max_bytes, uint32_t replay_rate);
   absl::Status RegisterLog(std::string name, LogDesc& log_desc) override;
   absl::Status HandleData(std::string log_name, const void* const data,
                           const uint32_t size) override;
@@ -50,6 +60,12 @@ class GCPLogger : public LogExporterInterface {
   std::unique_ptr<google::cloud::logging::LoggingServiceV2Client> log_client_;
   absl::Time last_log_sent_;
   absl::flat_hash_map<std::string, std::string> labels_;
+  bool json_payload_;
+  std::string spool_dir_;
+  uint64_t spool_max_bytes_;
+  uint32_t spool_replay_rate_;
+  // Declared after the client so the replayer is stopped first.
+  std::unique_ptr<Spool> spool_;
 };
 
 class GCPMetricExporter : public MetricExporterInterface {
@@ -57,36 +73,62 @@ class GCPMetricExporter : public MetricExporterInterface {
   GCPMetricExporter() = delete;
   GCPMetricExporter(std::string project_name);
   GCPMetricExporter(std::string project_name, std::string service_file_path);
+  // Uses the given connection instead of creating one in Init. Useful to
+  // point the exporter at a fake MetricService.
+  GCPMetricExporter(
+      std::string project_name,
+      std::shared_ptr<google::cloud::monitoring::MetricServiceConnection>
+          connection);
 
-  ~GCPMetricExporter() override = default;
+  ~GCPMetricExporter() override;
   absl::Status Init() override;
+  // Same as GCPLogger::EnableSpool for CreateTimeSeries requests.
+  void EnableSpool(std::string dir, uint64_t max_bytes, uint32_t replay_rate);
   absl::Status RegisterMetric(std::string name,
                               const MetricDesc& desc) override;
   absl::Status HandleData(std::string metric_name, void* key,
                           void* value) override;
+  void Flush(std::string metric_name) override;
   void Cleanup();
 
  private:
   typedef struct __GCP_metric_metadata {
     MetricDesc desc;
     google::api::MetricDescriptor metric_descriptor;
+    uint32_t id;
+    MetricDecoder decoder;
   } GCP_metric_metadata_t;
 
-  MetricTimeChecker last_read_;
+  ConnStateTable conn_state_;
 
   absl::StatusOr<google::api::MetricDescriptor> CreateMetricDesciptor(
       std::string name, const MetricDesc& desc);
+  // Sends all pending time series as a single CreateTimeSeries request.
+  void SendPending();
 
   absl::flat_hash_map<std::string, GCP_metric_metadata_t> metrics_;
 
   google::cloud::Project project_;
   std::string service_file_path_;
   google::api::MonitoredResource monitored_resource_;
+  std::shared_ptr<google::cloud::monitoring::MetricServiceConnection>
+      connection_;
   std::unique_ptr<::google::cloud::monitoring::MetricServiceClient>
       metric_client_;
   absl::flat_hash_map<std::string, std::string> labels_;
+
+  // Time series waiting to be sent and the (metric id, connection index)
+  // pairs they belong to. A request may not carry two points of the same
+  // series.
+  std::vector<google::monitoring::v3::TimeSeries> pending_;
+  absl::flat_hash_set<std::pair<uint32_t, uint32_t>> pending_series_;
+  BoundedAsync sender_;
+  std::string spool_dir_;
+  uint64_t spool_max_bytes_;
+  uint32_t spool_replay_rate_;
+  std::unique_ptr<Spool> spool_;
 };
 
 }  // namespace prober
 
-#endif  // _EXPORTERS_FILE_EXPORTER_H_
+#endif  // _EXPORTERS_GCP_EXPORTER_H_
@@ -0,0 +1,245 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/gcp_exporter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "events.h"
+#include "gmock/gmock.h"
+#include "google/cloud/monitoring/mocks/mock_metric_connection.h"
+#include "gtest/gtest.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/self_metrics.h"
+
+namespace prober {
+namespace {
+
+using ::google::cloud::monitoring_mocks::MockMetricServiceConnection;
+using ::testing::ElementsAre;
+using ::testing::Return;
+
+constexpr uint64_t kSecond = 1000 * 1000 * 1000;
+
+// Correlator that knows the connections it is told about.
+class FakeCorrelator : public CorrelatorInterface {
+ public:
+  void AddConnection(uint64_t conn_id, const std::string& uuid) {
+    absl::MutexLock lock(&mu_);
+    connection_map_[conn_id] = NewConnHandle(uuid);
+  }
+
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override {
+    return absl::OkStatus();
+  }
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override {
+    return absl::OkStatus();
+  }
+  void Cleanup() override {}
+  bool CheckUUID(std::string uuid) override { return true; }
+  absl::flat_hash_map<std::string, std::string> GetLabels(
+      std::string uuid) override {
+    return {};
+  }
+  std::vector<std::string> GetLabelKeys() override { return {}; }
+  std::vector<DataCtx*>& GetLogSources() override { return sources_; }
+  std::vector<DataCtx*>& GetMetricSources() override { return sources_; }
+  absl::Status Init() override { return absl::OkStatus(); }
+
+ private:
+  std::vector<DataCtx*> sources_;
+};
+
+class GCPMetricExporterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock_ = std::make_shared<MockMetricServiceConnection>();
+    EXPECT_CALL(*mock_, options())
+        .WillRepeatedly(Return(google::cloud::Options{}));
+    EXPECT_CALL(*mock_, CreateMetricDescriptor)
+        .WillRepeatedly(
+            [](google::monitoring::v3::CreateMetricDescriptorRequest const&
+                   request) {
+              return google::cloud::StatusOr<google::api::MetricDescriptor>(
+                  request.metric_descriptor());
+            });
+  }
+
+  // Sizes of the CreateTimeSeries requests sent, answering with status.
+  void ExpectRequests(google::cloud::Status status) {
+    EXPECT_CALL(*mock_, CreateTimeSeries)
+        .WillRepeatedly(
+            [this, status](
+                google::monitoring::v3::CreateTimeSeriesRequest const&
+                    request) {
+              absl::MutexLock lock(&mu_);
+              sizes_.push_back(request.time_series_size());
+              last_request_ = request;
+              return status;
+            });
+  }
+
+  std::unique_ptr<GCPMetricExporter> NewExporter() {
+    auto exporter = std::make_unique<GCPMetricExporter>("test-project", mock_);
+    exporter->RegisterCorrelator(&correlator_);
+    EXPECT_TRUE(exporter->Init().ok());
+    EXPECT_TRUE(exporter
+                    ->RegisterMetric("tcp_snd_bytes",
+                                     MetricDesc{MetricType::kUint64,
+                                                MetricType::kUint64,
+                                                MetricKind::kGauge,
+                                                {MetricUnitType::kNone}})
+                    .ok());
+    return exporter;
+  }
+
+  void HandlePoint(GCPMetricExporter* exporter, uint64_t conn_id,
+                   uint64_t timestamp) {
+    metric_format_t value = {timestamp, conn_id};
+    EXPECT_TRUE(
+        exporter->HandleData("tcp_snd_bytes", &conn_id, &value).ok());
+  }
+
+  std::vector<int> Sizes() {
+    absl::MutexLock lock(&mu_);
+    std::vector<int> sizes = sizes_;
+    std::sort(sizes.begin(), sizes.end());
+    return sizes;
+  }
+
+  google::monitoring::v3::CreateTimeSeriesRequest LastRequest() {
+    absl::MutexLock lock(&mu_);
+    return last_request_;
+  }
+
+  std::shared_ptr<MockMetricServiceConnection> mock_;
+  FakeCorrelator correlator_;
+  absl::Mutex mu_;
+  std::vector<int> sizes_ ABSL_GUARDED_BY(mu_);
+  google::monitoring::v3::CreateTimeSeriesRequest last_request_
+      ABSL_GUARDED_BY(mu_);
+};
+
+TEST_F(GCPMetricExporterTest, PacksUpTo200SeriesPerRequest) {
+  ExpectRequests(google::cloud::Status());
+  {
+    auto exporter = NewExporter();
+    for (uint64_t conn_id = 1; conn_id <= 450; conn_id++) {
+      correlator_.AddConnection(conn_id, absl::StrCat("conn", conn_id));
+      HandlePoint(exporter.get(), conn_id, 10 * kSecond);
+    }
+    exporter->Flush("tcp_snd_bytes");
+    // The destructor waits for the requests in flight.
+  }
+  EXPECT_THAT(Sizes(), ElementsAre(50, 200, 200));
+}
+
+TEST_F(GCPMetricExporterTest, SendsNothingWithoutPoints) {
+  EXPECT_CALL(*mock_, CreateTimeSeries).Times(0);
+  auto exporter = NewExporter();
+  exporter->Flush("tcp_snd_bytes");
+}
+
+TEST_F(GCPMetricExporterTest, SplitsTwoPointsOfOneSeries) {
+  ExpectRequests(google::cloud::Status());
+  {
+    auto exporter = NewExporter();
+    correlator_.AddConnection(1, "conn1");
+    correlator_.AddConnection(2, "conn2");
+    HandlePoint(exporter.get(), 1, 10 * kSecond);
+    HandlePoint(exporter.get(), 2, 10 * kSecond);
+    // A request may not carry two points of the same series.
+    HandlePoint(exporter.get(), 1, 20 * kSecond);
+    exporter->Flush("tcp_snd_bytes");
+  }
+  EXPECT_THAT(Sizes(), ElementsAre(1, 2));
+}
+
+TEST_F(GCPMetricExporterTest, CountsFailedRequests) {
+  auto failures = [] {
+    auto snapshot = SelfMetrics::GetInstance().Snapshot();
+    auto it = snapshot.find("gcp_metric_request_failures");
+    return it == snapshot.end() ? 0 : it->second.value;
+  };
+  int64_t before = failures();
+  ExpectRequests(google::cloud::Status(
+      google::cloud::StatusCode::kUnavailable, "unavailable"));
+  {
+    auto exporter = NewExporter();
+    correlator_.AddConnection(1, "conn1");
+    HandlePoint(exporter.get(), 1, 10 * kSecond);
+    exporter->Flush("tcp_snd_bytes");
+  }
+  EXPECT_THAT(Sizes(), ElementsAre(1));
+  EXPECT_EQ(failures(), before + 1);
+}
+
+TEST_F(GCPMetricExporterTest, ExportsLog2HistogramAsDistribution) {
+  ExpectRequests(google::cloud::Status());
+  {
+    auto exporter = NewExporter();
+    MetricUnit_t usec = {MetricUnitType::kTime};
+    usec.time = MetricTimeType::kusec;
+    ASSERT_TRUE(exporter
+                    ->RegisterMetric("tcp_rtt",
+                                     MetricDesc{MetricType::kUint64,
+                                                MetricType::kLog2Histogram,
+                                                MetricKind::kDistribution,
+                                                usec})
+                    .ok());
+    correlator_.AddConnection(1, "conn1");
+    // A 0 and two samples of 6us.
+    metric_hist_format_t value = {};
+    value.timestamp = 10 * kSecond;
+    value.data.count = 3;
+    value.data.sum = 12;
+    value.data.buckets[0] = 1;
+    value.data.buckets[3] = 2;
+    uint64_t conn_id = 1;
+    ASSERT_TRUE(exporter->HandleData("tcp_rtt", &conn_id, &value).ok());
+    exporter->Flush("tcp_rtt");
+  }
+  auto request = LastRequest();
+  ASSERT_EQ(request.time_series_size(), 1);
+  const auto& point = request.time_series(0).points(0);
+  EXPECT_TRUE(point.interval().has_start_time());
+  ASSERT_TRUE(point.value().has_distribution_value());
+  const auto& distribution = point.value().distribution_value();
+  EXPECT_EQ(distribution.count(), 3);
+  EXPECT_DOUBLE_EQ(distribution.mean(), 4);
+  const auto& bounds =
+      distribution.bucket_options().explicit_buckets().bounds();
+  ASSERT_EQ(bounds.size(), METRIC_HIST_BUCKETS - 1);
+  // Bucket 3 holds [4, 8).
+  EXPECT_EQ(bounds[0], 1);
+  EXPECT_EQ(bounds[2], 4);
+  EXPECT_EQ(bounds[3], 8);
+  ASSERT_EQ(distribution.bucket_counts_size(), METRIC_HIST_BUCKETS);
+  EXPECT_EQ(distribution.bucket_counts(0), 1);
+  EXPECT_EQ(distribution.bucket_counts(3), 2);
+}
+
+}  // namespace
+}  // namespace prober
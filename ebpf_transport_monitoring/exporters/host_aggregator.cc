@@ -0,0 +1,76 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/host_aggregator.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "exporters/ddsketch.h"
+
+namespace prober {
+
+absl::string_view HostAggregator::RemoteEndpoint(absl::string_view uuid) {
+  size_t pos = uuid.find("->");
+  if (pos == absl::string_view::npos) {
+    return "";
+  }
+  absl::string_view remote = uuid.substr(pos + 2);
+  pos = remote.rfind(':');
+  if (pos != absl::string_view::npos) {
+    remote = remote.substr(0, pos);
+  }
+  return remote;
+}
+
+void HostAggregator::Add(const std::string& metric, absl::string_view uuid,
+                         double value, uint64_t count) {
+  auto& endpoints = intervals_[metric];
+  absl::string_view remote = RemoteEndpoint(uuid);
+  auto it = endpoints.find(remote);
+  if (it == endpoints.end()) {
+    if (endpoints.size() >= max_endpoints_) {
+      remote = "other";
+      it = endpoints.find(remote);
+    }
+    if (it == endpoints.end()) {
+      it = endpoints
+               .insert({std::string(remote), DDSketch(relative_accuracy_)})
+               .first;
+    }
+  }
+  it->second.Add(value, count);
+}
+
+std::vector<HostAggregator::Rollup> HostAggregator::TakeInterval(
+    const std::string& metric) {
+  std::vector<Rollup> rollups;
+  auto it = intervals_.find(metric);
+  if (it == intervals_.end() || it->second.empty()) {
+    return rollups;
+  }
+  rollups.reserve(it->second.size() + 1);
+  rollups.push_back({"", DDSketch(relative_accuracy_)});
+  for (auto& endpoint : it->second) {
+    // Same accuracy, cannot fail.
+    rollups[0].sketch.Merge(endpoint.second).IgnoreError();
+    rollups.push_back({endpoint.first, std::move(endpoint.second)});
+  }
+  it->second.clear();
+  return rollups;
+}
+
+}  // namespace prober
@@ -0,0 +1,64 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_HOST_AGGREGATOR_H_
+#define _EXPORTERS_HOST_AGGREGATOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "exporters/ddsketch.h"
+
+#define HOST_AGG_MAX_ENDPOINTS 1024
+
+namespace prober {
+
+/* Folds the per connection samples of distribution metrics into sketches for
+  the current interval, one per remote endpoint (the remote address without
+  its port). The host wide sketch is merged from those when the interval is
+  taken. Endpoints beyond max_endpoints are counted under "other" so memory
+  does not grow with the number of peers or connections. */
+class HostAggregator {
+ public:
+  struct Rollup {
+    // Empty for the host wide rollup.
+    std::string remote;
+    DDSketch sketch;
+  };
+
+  explicit HostAggregator(double relative_accuracy = DDSKETCH_DEFAULT_ACCURACY,
+                          uint32_t max_endpoints = HOST_AGG_MAX_ENDPOINTS)
+      : relative_accuracy_(relative_accuracy), max_endpoints_(max_endpoints) {}
+
+  void Add(const std::string& metric, absl::string_view uuid, double value,
+           uint64_t count = 1);
+  // Returns the host wide rollup followed by the endpoint ones collected since
+  // the last call, nothing if there were no samples.
+  std::vector<Rollup> TakeInterval(const std::string& metric);
+
+  static absl::string_view RemoteEndpoint(absl::string_view uuid);
+
+ private:
+  double relative_accuracy_;
+  uint32_t max_endpoints_;
+  absl::flat_hash_map<std::string, absl::flat_hash_map<std::string, DDSketch>>
+      intervals_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_HOST_AGGREGATOR_H_
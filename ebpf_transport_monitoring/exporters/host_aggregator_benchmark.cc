@@ -0,0 +1,100 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cost of folding one poll of 50k connections into host and endpoint
+// rollups and taking the interval, and the memory the rollups hold.
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "exporters/ddsketch.h"
+#include "exporters/host_aggregator.h"
+
+namespace prober {
+namespace {
+
+constexpr uint32_t kConnections = 50000;
+
+// kConnections connections spread over endpoints remote addresses.
+std::vector<std::string> Uuids(uint32_t endpoints) {
+  std::vector<std::string> uuids;
+  for (uint32_t i = 0; i < kConnections; i++) {
+    uint32_t remote = i % endpoints;
+    uuids.push_back(absl::StrCat("10.0.0.1:", 10000 + i, "->10.",
+                                 remote / 65536, ".", remote / 256 % 256, ".",
+                                 remote % 256, ":443"));
+  }
+  return uuids;
+}
+
+void BM_HostAggregatorPoll(benchmark::State& state) {
+  std::vector<std::string> uuids = Uuids(state.range(0));
+  std::mt19937 rng(1);
+  std::lognormal_distribution<double> dist(0, 1.5);
+  std::vector<double> values;
+  for (uint32_t i = 0; i < kConnections; i++) {
+    values.push_back(dist(rng));
+  }
+  HostAggregator aggregator;
+  size_t buckets = 0;
+  size_t rollups = 0;
+  for (auto _ : state) {
+    for (uint32_t i = 0; i < kConnections; i++) {
+      aggregator.Add("tcp_rtt", uuids[i], values[i]);
+    }
+    auto interval = aggregator.TakeInterval("tcp_rtt");
+    rollups = interval.size();
+    buckets = 0;
+    for (const auto& rollup : interval) {
+      buckets += rollup.sketch.Buckets();
+    }
+    benchmark::DoNotOptimize(interval);
+  }
+  state.SetItemsProcessed(state.iterations() * kConnections);
+  state.counters["rollups"] = rollups;
+  state.counters["bucket_bytes"] = buckets * sizeof(uint64_t);
+}
+BENCHMARK(BM_HostAggregatorPoll)
+    ->Arg(1)
+    ->Arg(100)
+    ->Arg(HOST_AGG_MAX_ENDPOINTS)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+
+// Per connection sketches, what the rollups replace.
+void BM_PerConnectionSketches(benchmark::State& state) {
+  std::mt19937 rng(1);
+  std::lognormal_distribution<double> dist(0, 1.5);
+  std::vector<DDSketch> sketches(kConnections);
+  size_t buckets = 0;
+  for (auto _ : state) {
+    for (auto& sketch : sketches) {
+      sketch.Add(dist(rng));
+    }
+    buckets = 0;
+    for (auto& sketch : sketches) {
+      buckets += sketch.Buckets();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kConnections);
+  state.counters["bucket_bytes"] = buckets * sizeof(uint64_t);
+}
+BENCHMARK(BM_PerConnectionSketches)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace prober
@@ -0,0 +1,99 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/host_aggregator.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "exporters/ddsketch.h"
+#include "gtest/gtest.h"
+
+namespace prober {
+namespace {
+
+TEST(HostAggregatorTest, RemoteEndpoint) {
+  EXPECT_EQ(HostAggregator::RemoteEndpoint("10.0.0.1:1234->10.0.0.2:443"),
+            "10.0.0.2");
+  EXPECT_EQ(HostAggregator::RemoteEndpoint("[::1]:1234->[fe80::1]:443"),
+            "[fe80::1]");
+  EXPECT_EQ(HostAggregator::RemoteEndpoint("10.0.0.1:1234"), "");
+}
+
+TEST(HostAggregatorTest, RollsUpPerEndpointAndHost) {
+  HostAggregator aggregator;
+  for (int i = 0; i < 100; i++) {
+    aggregator.Add("rtt", absl::StrCat("10.0.0.1:", 1000 + i, "->10.0.0.2:443"),
+                   1);
+  }
+  aggregator.Add("rtt", "10.0.0.1:2000->10.0.0.3:443", 100, 10);
+  aggregator.Add("other_metric", "10.0.0.1:2000->10.0.0.3:443", 5);
+
+  auto rollups = aggregator.TakeInterval("rtt");
+  ASSERT_EQ(rollups.size(), 3);
+  EXPECT_EQ(rollups[0].remote, "");
+  EXPECT_EQ(rollups[0].sketch.Count(), 110);
+  EXPECT_EQ(rollups[0].sketch.Max(), 100);
+  for (size_t i = 1; i < rollups.size(); i++) {
+    if (rollups[i].remote == "10.0.0.2") {
+      EXPECT_EQ(rollups[i].sketch.Count(), 100);
+      EXPECT_EQ(rollups[i].sketch.Max(), 1);
+    } else {
+      EXPECT_EQ(rollups[i].remote, "10.0.0.3");
+      EXPECT_EQ(rollups[i].sketch.Count(), 10);
+    }
+  }
+
+  // Intervals start empty and metrics are kept apart.
+  EXPECT_TRUE(aggregator.TakeInterval("rtt").empty());
+  EXPECT_EQ(aggregator.TakeInterval("other_metric").size(), 2);
+  EXPECT_TRUE(aggregator.TakeInterval("unknown").empty());
+}
+
+TEST(HostAggregatorTest, EndpointsOverTheCapGoToOther) {
+  HostAggregator aggregator(DDSKETCH_DEFAULT_ACCURACY, 2);
+  aggregator.Add("rtt", "a:1->10.0.0.1:443", 1);
+  aggregator.Add("rtt", "a:1->10.0.0.2:443", 2);
+  aggregator.Add("rtt", "a:1->10.0.0.3:443", 3);
+  aggregator.Add("rtt", "a:1->10.0.0.4:443", 4);
+  // Endpoints seen before the cap keep their rollup.
+  aggregator.Add("rtt", "a:2->10.0.0.1:443", 5);
+
+  auto rollups = aggregator.TakeInterval("rtt");
+  ASSERT_EQ(rollups.size(), 4);
+  EXPECT_EQ(rollups[0].sketch.Count(), 5);
+  for (size_t i = 1; i < rollups.size(); i++) {
+    const auto& rollup = rollups[i];
+    if (rollup.remote == "other") {
+      EXPECT_EQ(rollup.sketch.Count(), 2);
+      EXPECT_EQ(rollup.sketch.Min(), 3);
+      EXPECT_EQ(rollup.sketch.Max(), 4);
+    } else if (rollup.remote == "10.0.0.1") {
+      EXPECT_EQ(rollup.sketch.Count(), 2);
+    } else {
+      EXPECT_EQ(rollup.remote, "10.0.0.2");
+      EXPECT_EQ(rollup.sketch.Count(), 1);
+    }
+  }
+
+  // The cap applies again in the next interval.
+  aggregator.Add("rtt", "a:1->10.0.0.4:443", 4);
+  rollups = aggregator.TakeInterval("rtt");
+  ASSERT_EQ(rollups.size(), 2);
+  EXPECT_EQ(rollups[1].remote, "10.0.0.4");
+}
+
+}  // namespace
+}  // namespace prober
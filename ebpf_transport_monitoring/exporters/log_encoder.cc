@@ -0,0 +1,234 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/log_encoder.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "events.h"
+
+namespace prober {
+
+static const char* GetStreamStateName(ec_h2_stream_state_t state) {
+  switch (state) {
+    case EC_H2_STREAM_BEGIN:
+      return "begin";
+    case EC_H2_STREAM_END:
+      return "end";
+    case EC_H2_STREAM_WINDOW_UPDATE:
+      return "window_update";
+    case EC_H2_STREAM_RESET:
+      return "reset";
+    case EC_H2_STREAM_UNKNOWN:
+    case EC_H2_STREAM_MAX:
+    default:
+      return "unknown";
+  }
+}
+
+static absl::Status VisitTcpFields(uint32_t event_type,
+                                   const void* const event_info,
+                                   LogFieldSink& sink) {
+  switch (event_type) {
+    case EC_TCP_EVENT_START: {
+      char src_address[INET6_ADDRSTRLEN];
+      char dst_address[INET6_ADDRSTRLEN];
+      const ec_tcp_start_t* const start =
+          static_cast<const ec_tcp_start_t*>(event_info);
+
+      if ((inet_ntop(start->family, &start->saddr6, &src_address[0],
+                     INET6_ADDRSTRLEN) == nullptr) ||
+          (inet_ntop(start->family, &start->daddr6, &dst_address[0],
+                     INET6_ADDRSTRLEN) == nullptr)) {
+        return absl::InternalError("Invalid ip address");
+      }
+      sink.String("event", "start");
+      sink.String("family", start->family == AF_INET6 ? "ipv6" : "ipv4");
+      sink.String("saddr", src_address);
+      sink.Number("sport", start->sport);
+      sink.String("daddr", dst_address);
+      sink.Number("dport", start->dport);
+      return absl::OkStatus();
+    }
+    case EC_TCP_EVENT_STATE_CHANGE: {
+      const ec_tcp_state_change_t* const state_change =
+          static_cast<const ec_tcp_state_change_t*>(event_info);
+      sink.String("event", "state_change");
+      sink.Number("old_state", state_change->old_state);
+      sink.Number("new_state", state_change->new_state);
+      return absl::OkStatus();
+    }
+    case EC_TCP_EVENT_CONGESTION: {
+      const ec_tcp_congestion_t* const congestion =
+          static_cast<const ec_tcp_congestion_t*>(event_info);
+      sink.String("event", "congestion");
+      sink.Number("bytes_received", congestion->bytes_received);
+      sink.Number("bytes_sent", congestion->bytes_sent);
+      sink.Number("rcv_cwnd", congestion->rcv_cwnd);
+      sink.Number("snd_wnd", congestion->snd_wnd);
+      sink.Number("snd_cwnd", congestion->snd_cwnd);
+      sink.Number("srtt", congestion->srtt);
+      return absl::OkStatus();
+    }
+    case EC_TCP_EVENT_PACKET_DROP: {
+      const ec_tcp_drop_t* const drop =
+          static_cast<const ec_tcp_drop_t*>(event_info);
+      sink.String("event", "packet_drop");
+      sink.Number("reason", drop->reason);
+      sink.Number("count", drop->count);
+      return absl::OkStatus();
+    }
+    case EC_TCP_EVENT_RESET:
+      sink.String("event", "reset");
+      return absl::OkStatus();
+    case EC_TCP_EVENT_RETRANS:
+      return absl::InternalError("Event should not generate Log");
+    case EC_TCP_EVENT_MAX:
+    default:
+      return absl::InternalError("Unknown event type");
+  }
+}
+
+static absl::Status VisitH2Fields(uint32_t event_type,
+                                  const void* const event_info,
+                                  LogFieldSink& sink) {
+  switch (event_type) {
+    case EC_H2_EVENT_START:
+      sink.String("event", "start");
+      return absl::OkStatus();
+    case EC_H2_EVENT_CLOSE:
+      sink.String("event", "close");
+      return absl::OkStatus();
+    case EC_H2_EVENT_STREAM_STATE: {
+      const ec_h2_state_t* const state =
+          static_cast<const ec_h2_state_t*>(event_info);
+      sink.String("event", "stream_state");
+      sink.String("stream_state", GetStreamStateName(state->state));
+      sink.Number("stream_id", state->stream_id);
+      sink.Number("value", state->value);
+      return absl::OkStatus();
+    }
+    case EC_H2_EVENT_GO_AWAY: {
+      const ec_h2_go_away_t* const go_away =
+          static_cast<const ec_h2_go_away_t*>(event_info);
+      sink.String("event", "go_away");
+      sink.Number("last_stream_id", go_away->last_stream_id);
+      sink.Number("error_code", go_away->error_code);
+      return absl::OkStatus();
+    }
+    case EC_H2_EVENT_WINDOW_UPDATE:
+      sink.String("event", "window_update");
+      return absl::OkStatus();
+    case EC_H2_EVENT_SETTINGS:
+      sink.String("event", "settings");
+      return absl::OkStatus();
+    default:
+      return absl::InternalError("Unknown event type");
+  }
+}
+
+absl::Status LogEncoder::VisitFields(absl::string_view log_name,
+                                     absl::string_view uuid,
+                                     const void* const data,
+                                     LogFieldSink& sink) {
+  const ec_ebpf_events_t* const events =
+      static_cast<const ec_ebpf_events_t*>(data);
+
+  sink.String("log", log_name);
+  sink.String("uuid", uuid);
+  sink.Number("timestamp", events->mdata.timestamp);
+  sink.Number("conn_id", events->mdata.connection_id);
+  sink.Number("pid", events->mdata.pid);
+  sink.String("direction", events->mdata.sent_recv == 1 ? "recv" : "sent");
+  switch (events->mdata.event_category) {
+    case EC_CAT_TCP:
+      sink.String("category", "tcp");
+      return VisitTcpFields(events->mdata.event_type, events->event_info,
+                            sink);
+    case EC_CAT_HTTP2:
+      sink.String("category", "h2");
+      return VisitH2Fields(events->mdata.event_type, events->event_info, sink);
+    default:
+      return absl::UnimplementedError("event category not known");
+  }
+}
+
+namespace {
+
+class JsonSink : public LogFieldSink {
+ public:
+  explicit JsonSink(std::string* buffer) : buffer_(buffer) {}
+  void String(absl::string_view key, absl::string_view value) override {
+    Key(key);
+    AppendQuoted(value);
+  }
+  void Number(absl::string_view key, uint64_t value) override {
+    Key(key);
+    absl::StrAppend(buffer_, value);
+  }
+
+ private:
+  void Key(absl::string_view key) {
+    buffer_->push_back(buffer_->empty() ? '{' : ',');
+    AppendQuoted(key);
+    buffer_->push_back(':');
+  }
+  void AppendQuoted(absl::string_view value) {
+    static const char kHex[] = "0123456789abcdef";
+    buffer_->push_back('"');
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        buffer_->push_back('\\');
+        buffer_->push_back(c);
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        buffer_->append("\\u00");
+        buffer_->push_back(kHex[(c >> 4) & 0xf]);
+        buffer_->push_back(kHex[c & 0xf]);
+      } else {
+        buffer_->push_back(c);
+      }
+    }
+    buffer_->push_back('"');
+  }
+
+  std::string* buffer_;
+};
+
+}  // namespace
+
+absl::StatusOr<absl::string_view> LogEncoder::EncodeJson(
+    absl::string_view log_name, absl::string_view uuid,
+    const void* const data) {
+  // clear() keeps the capacity, the buffer stops growing after a few events.
+  static thread_local std::string buffer;
+  buffer.clear();
+  JsonSink sink(&buffer);
+  auto status = VisitFields(log_name, uuid, data, sink);
+  if (!status.ok()) {
+    return status;
+  }
+  buffer.push_back('}');
+  return absl::string_view(buffer);
+}
+
+}  // namespace prober
@@ -0,0 +1,54 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_LOG_ENCODER_H_
+#define _EXPORTERS_LOG_ENCODER_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace prober {
+
+/* Receives the typed fields of a log event. Values passed as string_view are
+  only valid for the duration of the call. */
+class LogFieldSink {
+ public:
+  virtual ~LogFieldSink() = default;
+  virtual void String(absl::string_view key, absl::string_view value) = 0;
+  virtual void Number(absl::string_view key, uint64_t value) = 0;
+};
+
+class LogEncoder {
+ public:
+  // Calls sink for every field of the ec_ebpf_events_t in data: log name,
+  // uuid, metadata and the event specific fields (addresses and ports, stream
+  // id, error codes, congestion window...). Does not allocate.
+  static absl::Status VisitFields(absl::string_view log_name,
+                                  absl::string_view uuid,
+                                  const void* const data, LogFieldSink& sink);
+
+  // Returns the event as a single line JSON object without the newline. The
+  // view points into a per thread buffer reused by the next call, so steady
+  // state encoding does not allocate.
+  static absl::StatusOr<absl::string_view> EncodeJson(
+      absl::string_view log_name, absl::string_view uuid,
+      const void* const data);
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_LOG_ENCODER_H_
@@ -0,0 +1,203 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Heap allocations per event logged as JSON Lines through
+// StdoutEventExporter and FileLogger. Steady state must not allocate, the
+// JSON benchmarks fail if it does. The text path is there for comparison.
+// Allocations are counted by replacing the global operator new.
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "exporters/file_exporter.h"
+#include "exporters/stdout_event_logger.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { free(ptr); }
+
+namespace prober {
+namespace {
+
+constexpr uint64_t kConnId = 0xffff888012345678;
+
+class FakeCorrelator : public CorrelatorInterface {
+ public:
+  FakeCorrelator() {
+    absl::MutexLock lock(&mu_);
+    connection_map_[kConnId] =
+        NewConnHandle("10.128.0.12:45678->10.128.0.99:443");
+  }
+
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override {
+    return absl::OkStatus();
+  }
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override {
+    return absl::OkStatus();
+  }
+  void Cleanup() override {}
+  bool CheckUUID(std::string uuid) override { return true; }
+  absl::flat_hash_map<std::string, std::string> GetLabels(
+      std::string uuid) override {
+    return {};
+  }
+  std::vector<std::string> GetLabelKeys() override { return {}; }
+  std::vector<DataCtx*>& GetLogSources() override { return sources_; }
+  std::vector<DataCtx*>& GetMetricSources() override { return sources_; }
+  absl::Status Init() override { return absl::OkStatus(); }
+
+ private:
+  std::vector<DataCtx*> sources_;
+};
+
+// Discards what is written to std::cout.
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    return n;
+  }
+};
+
+// A congestion and a start event, the largest TCP events.
+std::vector<ec_ebpf_events_t> Events() {
+  std::vector<ec_ebpf_events_t> events(2);
+  for (auto& event : events) {
+    memset(&event, 0, sizeof(event));
+    event.mdata.event_category = EC_CAT_TCP;
+    event.mdata.version = EC_EVENT_VERSION;
+    event.mdata.pid = 4242;
+    event.mdata.timestamp = 1234567890123;
+    event.mdata.connection_id = kConnId;
+  }
+  events[0].mdata.event_type = EC_TCP_EVENT_CONGESTION;
+  events[0].mdata.length = sizeof(ec_tcp_congestion_t);
+  ec_tcp_congestion_t congestion = {10, 65535, 2500, 131072, 1 << 30, 1 << 29};
+  memcpy(events[0].event_info, &congestion, sizeof(congestion));
+
+  events[1].mdata.event_type = EC_TCP_EVENT_START;
+  events[1].mdata.length = sizeof(ec_tcp_start_t);
+  ec_tcp_start_t start = {};
+  start.family = AF_INET;
+  start.sport = 45678;
+  start.dport = 443;
+  inet_pton(AF_INET, "10.128.0.12", &start.saddr);
+  inet_pton(AF_INET, "10.128.0.99", &start.daddr);
+  memcpy(events[1].event_info, &start, sizeof(start));
+  return events;
+}
+
+// Logs the events through exporter, once to warm up buffers, then counts
+// the allocations of the timed loop.
+void LogEvents(benchmark::State& state, LogExporterInterface* exporter,
+               bool must_not_allocate) {
+  FakeCorrelator correlator;
+  exporter->RegisterCorrelator(&correlator);
+  std::string log_name = "tcp_events";
+  LogDesc desc = {};
+  exporter->RegisterLog(log_name, desc).IgnoreError();
+  std::vector<ec_ebpf_events_t> events = Events();
+  for (const auto& event : events) {
+    if (!exporter->HandleData(log_name, &event, sizeof(event)).ok()) {
+      state.SkipWithError("event not logged");
+      return;
+    }
+  }
+
+  uint64_t start = allocations.load();
+  for (auto _ : state) {
+    for (const auto& event : events) {
+      exporter->HandleData(log_name, &event, sizeof(event)).IgnoreError();
+    }
+  }
+  uint64_t logged = state.iterations() * events.size();
+  double per_event = static_cast<double>(allocations.load() - start) / logged;
+  state.counters["allocs_per_event"] = per_event;
+  state.SetItemsProcessed(logged);
+  if (must_not_allocate && per_event != 0) {
+    state.SkipWithError("steady state logging allocated");
+  }
+}
+
+void BM_StdoutJson(benchmark::State& state) {
+  NullBuffer null_buffer;
+  auto* cout_buffer = std::cout.rdbuf(&null_buffer);
+  StdoutEventExporter exporter(true);
+  LogEvents(state, &exporter, true);
+  std::cout.rdbuf(cout_buffer);
+}
+BENCHMARK(BM_StdoutJson);
+
+void BM_StdoutText(benchmark::State& state) {
+  NullBuffer null_buffer;
+  auto* cout_buffer = std::cout.rdbuf(&null_buffer);
+  StdoutEventExporter exporter(false);
+  LogEvents(state, &exporter, false);
+  std::cout.rdbuf(cout_buffer);
+}
+BENCHMARK(BM_StdoutText);
+
+// Files are large enough not to rotate within the iterations.
+void BM_FileLoggerJson(benchmark::State& state) {
+  char dir[] = "/tmp/log_encoder_benchmark.XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    state.SkipWithError("cannot create directory");
+    return;
+  }
+  {
+    FileLogger logger(2, 1 << 30, dir, FileFormat::kJson);
+    if (!logger.Init().ok()) {
+      state.SkipWithError("cannot open log file");
+      return;
+    }
+    LogEvents(state, &logger, true);
+  }
+  unlink(absl::StrCat(dir, "/ebpf_logs.jsonl").c_str());
+  rmdir(dir);
+}
+BENCHMARK(BM_FileLoggerJson)->Iterations(100000);
+
+}  // namespace
+}  // namespace prober
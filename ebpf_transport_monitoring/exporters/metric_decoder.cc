@@ -0,0 +1,251 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/metric_decoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "events.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+
+namespace {
+
+// Values read from maps are not guaranteed to be aligned for T.
+template <typename T>
+T Load(const void* const data) {
+  T val;
+  memcpy(&val, data, sizeof(T));
+  return val;
+}
+
+template <typename T>
+int64_t Decode(const void* const data) {
+  return static_cast<int64_t>(Load<T>(data));
+}
+
+// Decodes and scales by kMul / kDiv. Floating point values are scaled
+// before they are truncated, 1.5 sec is 1500 ms and not 1000.
+template <typename T, int64_t kMul, int64_t kDiv>
+int64_t DecodeScaled(const void* const data) {
+  if (std::is_floating_point<T>::value) {
+    return static_cast<int64_t>(static_cast<double>(Load<T>(data)) * kMul /
+                                kDiv);
+  }
+  return static_cast<int64_t>(Load<T>(data)) * kMul / kDiv;
+}
+
+template <typename T>
+std::string Format(const void* const data) {
+  return absl::StrFormat("%d", Load<T>(data));
+}
+
+template <>
+std::string Format<float>(const void* const data) {
+  return absl::StrFormat("%f", Load<float>(data));
+}
+
+template <>
+std::string Format<double>(const void* const data) {
+  return absl::StrFormat("%f", Load<double>(data));
+}
+
+int64_t DecodeNone(const void* const data) { return 0; }
+
+// Histograms decode to their last sample.
+template <int64_t kMul, int64_t kDiv>
+int64_t DecodeHistogram(const void* const data) {
+  const char* last = (const char*)data + offsetof(metric_hist_t, last);
+  return static_cast<int64_t>(Load<uint64_t>(last)) * kMul / kDiv;
+}
+
+// last:<sample> count:<n> sum:<sum> followed by <bucket max>:<count> for every
+// bucket in use.
+std::string FormatHistogram(const void* const data) {
+  metric_hist_t hist = Load<metric_hist_t>(data);
+  std::string out = absl::StrFormat("last:%d count:%d sum:%d", hist.last,
+                                    hist.count, hist.sum);
+  for (uint32_t i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    if (hist.buckets[i]) {
+      absl::StrAppend(&out, " ", Log2BucketMax(i), ":", hist.buckets[i]);
+    }
+  }
+  return out;
+}
+
+MetricDecodeFn GetHistogramMsDecoder(MetricTimeType type) {
+  switch (type) {
+    case MetricTimeType::knsec:
+      return DecodeHistogram<1, 1000000>;
+    case MetricTimeType::kusec:
+      return DecodeHistogram<1, 1000>;
+    case MetricTimeType::kmsec:
+      return DecodeHistogram<1, 1>;
+    case MetricTimeType::ksec:
+      return DecodeHistogram<1000, 1>;
+    case MetricTimeType::kmin:
+      return DecodeHistogram<60 * 1000, 1>;
+    case MetricTimeType::khour:
+      return DecodeHistogram<3600 * 1000, 1>;
+  }
+  return DecodeHistogram<1, 1>;
+}
+
+std::string FormatNone(const void* const data) { return ""; }
+
+template <typename T>
+MetricDecodeFn GetMsDecoder(MetricTimeType type) {
+  switch (type) {
+    case MetricTimeType::knsec:
+      return DecodeScaled<T, 1, 1000000>;
+    case MetricTimeType::kusec:
+      return DecodeScaled<T, 1, 1000>;
+    case MetricTimeType::kmsec:
+      return Decode<T>;
+    case MetricTimeType::ksec:
+      return DecodeScaled<T, 1000, 1>;
+    case MetricTimeType::kmin:
+      return DecodeScaled<T, 60 * 1000, 1>;
+    case MetricTimeType::khour:
+      return DecodeScaled<T, 3600 * 1000, 1>;
+  }
+  return Decode<T>;
+}
+
+double MsPerUnit(MetricTimeType type) {
+  switch (type) {
+    case MetricTimeType::knsec:
+      return 1e-6;
+    case MetricTimeType::kusec:
+      return 1e-3;
+    case MetricTimeType::kmsec:
+      return 1;
+    case MetricTimeType::ksec:
+      return 1000;
+    case MetricTimeType::kmin:
+      return 60 * 1000;
+    case MetricTimeType::khour:
+      return 3600 * 1000;
+  }
+  return 1;
+}
+
+template <typename T>
+void BindValue(const MetricDesc& desc, MetricDecoder& decoder) {
+  decoder.value = Decode<T>;
+  decoder.format_value = Format<T>;
+  decoder.value_ms = Decode<T>;
+  if (desc.unit.type == MetricUnitType::kTime) {
+    decoder.value_ms = GetMsDecoder<T>(desc.unit.time);
+    decoder.ms_per_unit = MsPerUnit(desc.unit.time);
+  }
+}
+
+MetricFormatFn GetFormatter(MetricType type) {
+  switch (type) {
+    case MetricType::kUnit8:
+      return Format<uint8_t>;
+    case MetricType::kUint16:
+      return Format<uint16_t>;
+    case MetricType::kUint32:
+      return Format<uint32_t>;
+    case MetricType::kUint64:
+      return Format<uint64_t>;
+    case MetricType::kInt8:
+      return Format<int8_t>;
+    case MetricType::kInt16:
+      return Format<int16_t>;
+    case MetricType::kInt32:
+      return Format<int32_t>;
+    case MetricType::kInt64:
+      return Format<int64_t>;
+    case MetricType::kFloat:
+      return Format<float>;
+    case MetricType::kDouble:
+      return Format<double>;
+    case MetricType::kInternal:
+      // This is an error condtion for external metrics
+      return FormatNone;
+    case MetricType::kLog2Histogram:
+      return FormatHistogram;
+  }
+  return FormatNone;
+}
+
+}  // namespace
+
+MetricDecoder GetMetricDecoder(const MetricDesc& desc) {
+  MetricDecoder decoder;
+  decoder.value = DecodeNone;
+  decoder.value_ms = DecodeNone;
+  decoder.ms_per_unit = 1;
+  decoder.format_value = FormatNone;
+  decoder.format_key = GetFormatter(desc.key_type);
+  decoder.unit = GetUnitString(desc.unit);
+
+  switch (desc.value_type) {
+    case MetricType::kUnit8:
+      BindValue<uint8_t>(desc, decoder);
+      break;
+    case MetricType::kUint16:
+      BindValue<uint16_t>(desc, decoder);
+      break;
+    case MetricType::kUint32:
+      BindValue<uint32_t>(desc, decoder);
+      break;
+    case MetricType::kUint64:
+      BindValue<uint64_t>(desc, decoder);
+      break;
+    case MetricType::kInt8:
+      BindValue<int8_t>(desc, decoder);
+      break;
+    case MetricType::kInt16:
+      BindValue<int16_t>(desc, decoder);
+      break;
+    case MetricType::kInt32:
+      BindValue<int32_t>(desc, decoder);
+      break;
+    case MetricType::kInt64:
+      BindValue<int64_t>(desc, decoder);
+      break;
+    case MetricType::kFloat:
+      BindValue<float>(desc, decoder);
+      break;
+    case MetricType::kDouble:
+      BindValue<double>(desc, decoder);
+      break;
+    case MetricType::kInternal:
+      // This is an error condtion for external metrics
+      break;
+    case MetricType::kLog2Histogram:
+      decoder.value = DecodeHistogram<1, 1>;
+      decoder.value_ms = DecodeHistogram<1, 1>;
+      decoder.format_value = FormatHistogram;
+      if (desc.unit.type == MetricUnitType::kTime) {
+        decoder.value_ms = GetHistogramMsDecoder(desc.unit.time);
+        decoder.ms_per_unit = MsPerUnit(desc.unit.time);
+      }
+      break;
+  }
+  return decoder;
+}
+
+}  // namespace prober
@@ -0,0 +1,59 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_METRIC_DECODER_H_
+#define _EXPORTERS_METRIC_DECODER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+
+typedef int64_t (*MetricDecodeFn)(const void* const data);
+typedef std::string (*MetricFormatFn)(const void* const data);
+
+/* Functions specialized for one MetricDesc. They are picked once when a
+  metric is registered so decoding a data point is a single indirect call
+  instead of a switch on MetricType and unit. */
+struct MetricDecoder {
+  // Raw value as an int64.
+  MetricDecodeFn value;
+  // Value converted to milliseconds for time metrics, same as value
+  // otherwise.
+  MetricDecodeFn value_ms;
+  // Milliseconds per unit of value for time metrics, 1 otherwise. Used where
+  // value_ms would round sub millisecond values away.
+  double ms_per_unit;
+  MetricFormatFn format_key;
+  MetricFormatFn format_value;
+  std::string unit;
+};
+
+MetricDecoder GetMetricDecoder(const MetricDesc& desc);
+
+/* MetricType::kLog2Histogram values are decoded as their last sample by the
+  functions above. Bucket i counts samples in [2^(i-1), 2^i), bucket 0 zeros.
+*/
+// Largest sample counted in bucket i.
+inline uint64_t Log2BucketMax(uint32_t i) { return (1ULL << i) - 1; }
+// Value the samples of bucket i are accounted as.
+inline double Log2BucketMid(uint32_t i) {
+  return i == 0 ? 0 : ((1ULL << (i - 1)) + Log2BucketMax(i)) / 2.0;
+}
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_METRIC_DECODER_H_
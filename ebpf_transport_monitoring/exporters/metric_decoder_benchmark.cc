@@ -0,0 +1,148 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Decoding a 100k point snapshot to milliseconds with the decoder bound at
+// registration versus the per point MetricType and unit switches it
+// replaced.
+
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "exporters/metric_decoder.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+namespace {
+
+constexpr uint32_t kPoints = 100000;
+
+// The switch based path, ExportersUtil::GetMetric followed by GetMs.
+int64_t SwitchGetMetric(const void* const data, MetricType type) {
+  switch (type) {
+    case MetricType::kUnit8:
+      return *(uint8_t*)data;
+    case MetricType::kUint16:
+      return *(uint16_t*)data;
+    case MetricType::kUint32:
+      return *(uint32_t*)data;
+    case MetricType::kUint64:
+      return *(uint64_t*)data;
+    case MetricType::kInt8:
+      return *(int8_t*)data;
+    case MetricType::kInt16:
+      return *(int16_t*)data;
+    case MetricType::kInt32:
+      return *(int32_t*)data;
+    case MetricType::kInt64:
+      return *(int64_t*)data;
+    case MetricType::kFloat:
+      return *(float*)data;
+    case MetricType::kDouble:
+      return *(double*)data;
+    case MetricType::kInternal:
+    case MetricType::kLog2Histogram:
+      return 0;
+  }
+  return 0;
+}
+
+int64_t SwitchGetMs(int64_t val, MetricTimeType type) {
+  switch (type) {
+    case MetricTimeType::knsec:
+      return val / 1000000;
+    case MetricTimeType::kusec:
+      return val / 1000;
+    case MetricTimeType::kmsec:
+      return val;
+    case MetricTimeType::ksec:
+      return val * 1000;
+    case MetricTimeType::kmin:
+      return val * 60 * 1000;
+    case MetricTimeType::khour:
+      return val * 3600 * 1000;
+  }
+  return 0;
+}
+
+// Snapshot points come from several metrics, as a poll of all maps would.
+std::vector<MetricDesc> Descs() {
+  std::vector<MetricDesc> descs;
+  const MetricType types[] = {MetricType::kUint64, MetricType::kUint32,
+                              MetricType::kInt64, MetricType::kUint64};
+  const MetricTimeType times[] = {MetricTimeType::knsec, MetricTimeType::kusec,
+                                  MetricTimeType::kmsec, MetricTimeType::ksec};
+  for (uint32_t i = 0; i < 4; i++) {
+    MetricDesc desc = {MetricType::kUint64, types[i], MetricKind::kGauge,
+                       {MetricUnitType::kTime}};
+    desc.unit.time = times[i];
+    descs.push_back(desc);
+  }
+  descs.push_back({MetricType::kUint64, MetricType::kUint32,
+                   MetricKind::kCumulative, {MetricUnitType::kNone}});
+  return descs;
+}
+
+struct Point {
+  uint32_t metric;
+  metric_format_t value;
+};
+
+std::vector<Point> Snapshot(uint32_t num_metrics) {
+  std::vector<Point> points(kPoints);
+  for (uint32_t i = 0; i < kPoints; i++) {
+    points[i] = {(i * 7) % num_metrics, {i + 1ULL, i * 7919ULL}};
+  }
+  return points;
+}
+
+void BM_SwitchDecode(benchmark::State& state) {
+  const std::vector<MetricDesc> descs = Descs();
+  const std::vector<Point> points = Snapshot(descs.size());
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& point : points) {
+      const MetricDesc& desc = descs[point.metric];
+      int64_t val = SwitchGetMetric(&point.value.data, desc.value_type);
+      if (desc.unit.type == MetricUnitType::kTime) {
+        val = SwitchGetMs(val, desc.unit.time);
+      }
+      sum += val;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kPoints);
+}
+BENCHMARK(BM_SwitchDecode);
+
+void BM_BoundDecode(benchmark::State& state) {
+  std::vector<MetricDecoder> decoders;
+  for (const auto& desc : Descs()) {
+    decoders.push_back(GetMetricDecoder(desc));
+  }
+  const std::vector<Point> points = Snapshot(decoders.size());
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& point : points) {
+      sum += decoders[point.metric].value_ms(&point.value.data);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kPoints);
+}
+BENCHMARK(BM_BoundDecode);
+
+}  // namespace
+}  // namespace prober
@@ -0,0 +1,173 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/metric_decoder.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "events.h"
+#include "gtest/gtest.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+namespace {
+
+MetricDesc Desc(MetricType value_type) {
+  return {MetricType::kUint64, value_type, MetricKind::kGauge,
+          {MetricUnitType::kNone}};
+}
+
+MetricDesc TimeDesc(MetricType value_type, MetricTimeType time) {
+  MetricDesc desc = Desc(value_type);
+  desc.unit.type = MetricUnitType::kTime;
+  desc.unit.time = time;
+  return desc;
+}
+
+// Copies val one byte into a buffer, map values need not be aligned.
+template <typename T>
+const void* Unaligned(T val, char (&buffer)[sizeof(T) + 1]) {
+  memcpy(buffer + 1, &val, sizeof(T));
+  return buffer + 1;
+}
+
+template <typename T>
+void ExpectDecodes(MetricType type, T val, int64_t expected,
+                   const std::string& formatted) {
+  MetricDecoder decoder = GetMetricDecoder(Desc(type));
+  char buffer[sizeof(T) + 1];
+  const void* data = Unaligned(val, buffer);
+  EXPECT_EQ(decoder.value(data), expected);
+  EXPECT_EQ(decoder.value_ms(data), expected);
+  EXPECT_EQ(decoder.ms_per_unit, 1);
+  EXPECT_EQ(decoder.format_value(data), formatted);
+  EXPECT_EQ(decoder.unit, "");
+}
+
+TEST(MetricDecoderTest, DecodesEveryIntegerType) {
+  ExpectDecodes<uint8_t>(MetricType::kUnit8, 200, 200, "200");
+  ExpectDecodes<uint16_t>(MetricType::kUint16, 60000, 60000, "60000");
+  ExpectDecodes<uint32_t>(MetricType::kUint32, 4000000000, 4000000000,
+                          "4000000000");
+  ExpectDecodes<uint64_t>(MetricType::kUint64, 1ULL << 40, 1LL << 40,
+                          "1099511627776");
+  ExpectDecodes<int8_t>(MetricType::kInt8, -100, -100, "-100");
+  ExpectDecodes<int16_t>(MetricType::kInt16, -30000, -30000, "-30000");
+  ExpectDecodes<int32_t>(MetricType::kInt32, -2000000000, -2000000000,
+                         "-2000000000");
+  ExpectDecodes<int64_t>(MetricType::kInt64, -(1LL << 40), -(1LL << 40),
+                         "-1099511627776");
+}
+
+TEST(MetricDecoderTest, DecodesFloatingPointTypes) {
+  ExpectDecodes<float>(MetricType::kFloat, 2.5f, 2, "2.500000");
+  ExpectDecodes<double>(MetricType::kDouble, -7.25, -7, "-7.250000");
+}
+
+TEST(MetricDecoderTest, InternalDecodesToNothing) {
+  MetricDecoder decoder = GetMetricDecoder(Desc(MetricType::kInternal));
+  uint64_t val = 5;
+  EXPECT_EQ(decoder.value(&val), 0);
+  EXPECT_EQ(decoder.value_ms(&val), 0);
+  EXPECT_EQ(decoder.format_value(&val), "");
+}
+
+TEST(MetricDecoderTest, FormatsKey) {
+  MetricDesc desc = Desc(MetricType::kUint64);
+  desc.key_type = MetricType::kInt32;
+  MetricDecoder decoder = GetMetricDecoder(desc);
+  int32_t key = -3;
+  EXPECT_EQ(decoder.format_key(&key), "-3");
+}
+
+TEST(MetricDecoderTest, ConvertsEveryTimeUnitToMs) {
+  struct {
+    MetricTimeType time;
+    uint64_t val;
+    int64_t ms;
+    double ms_per_unit;
+    const char* unit;
+  } cases[] = {
+      {MetricTimeType::knsec, 3500000, 3, 1e-6, "ns"},
+      {MetricTimeType::kusec, 3500, 3, 1e-3, "us"},
+      {MetricTimeType::kmsec, 3, 3, 1, "ms"},
+      {MetricTimeType::ksec, 3, 3000, 1000, "s"},
+      {MetricTimeType::kmin, 3, 180000, 60 * 1000, "min"},
+      {MetricTimeType::khour, 3, 10800000, 3600 * 1000, "h"},
+  };
+  for (const auto& c : cases) {
+    MetricDecoder decoder =
+        GetMetricDecoder(TimeDesc(MetricType::kUint64, c.time));
+    EXPECT_EQ(decoder.value(&c.val), c.val);
+    EXPECT_EQ(decoder.value_ms(&c.val), c.ms) << c.unit;
+    EXPECT_DOUBLE_EQ(decoder.ms_per_unit, c.ms_per_unit) << c.unit;
+    EXPECT_EQ(decoder.unit, c.unit);
+  }
+}
+
+TEST(MetricDecoderTest, ScalesFloatingPointBeforeTruncating) {
+  float seconds = 1.5f;
+  EXPECT_EQ(GetMetricDecoder(TimeDesc(MetricType::kFloat,
+                                      MetricTimeType::ksec))
+                .value_ms(&seconds),
+            1500);
+  double minutes = 0.25;
+  EXPECT_EQ(GetMetricDecoder(TimeDesc(MetricType::kDouble,
+                                      MetricTimeType::kmin))
+                .value_ms(&minutes),
+            15000);
+  double ns = 2500000.0;
+  EXPECT_EQ(GetMetricDecoder(TimeDesc(MetricType::kDouble,
+                                      MetricTimeType::knsec))
+                .value_ms(&ns),
+            2);
+}
+
+TEST(MetricDecoderTest, ScalesSignedTimes) {
+  int32_t val = -2;
+  EXPECT_EQ(
+      GetMetricDecoder(TimeDesc(MetricType::kInt32, MetricTimeType::ksec))
+          .value_ms(&val),
+      -2000);
+}
+
+TEST(MetricDecoderTest, DecodesLastSampleOfHistogram) {
+  metric_hist_t hist = {};
+  hist.count = 3;
+  hist.sum = 7000000;
+  hist.last = 4000000;
+  hist.buckets[0] = 1;
+  hist.buckets[22] = 2;
+  MetricDecoder decoder = GetMetricDecoder(
+      TimeDesc(MetricType::kLog2Histogram, MetricTimeType::knsec));
+  EXPECT_EQ(decoder.value(&hist), 4000000);
+  EXPECT_EQ(decoder.value_ms(&hist), 4);
+  EXPECT_DOUBLE_EQ(decoder.ms_per_unit, 1e-6);
+  EXPECT_EQ(decoder.format_value(&hist),
+            "last:4000000 count:3 sum:7000000 0:1 4194303:2");
+}
+
+TEST(MetricDecoderTest, Log2Buckets) {
+  EXPECT_EQ(Log2BucketMax(0), 0);
+  EXPECT_EQ(Log2BucketMax(1), 1);
+  EXPECT_EQ(Log2BucketMax(4), 15);
+  EXPECT_EQ(Log2BucketMid(0), 0);
+  EXPECT_EQ(Log2BucketMid(1), 1);
+  EXPECT_EQ(Log2BucketMid(4), 11.5);
+}
+
+}  // namespace
+}  // namespace prober
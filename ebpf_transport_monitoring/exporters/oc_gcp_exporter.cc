@@ -16,8 +16,11 @@
 
 #include <cstdio>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -26,6 +29,7 @@
 #include "events.h"
 #include "exporters/exporters_util.h"
 #include "exporters/gce_metadata.h"
+#include "exporters/host_aggregator.h"
 #include "google/monitoring/v3/metric_service.grpc.pb.h"
 #include "grpcpp/grpcpp.h"
 #include "grpcpp/security/credentials.h"
@@ -35,16 +39,25 @@
 
 #define LOGGING_INTERVAL absl::Minutes(1)
 #define LOGS_PER_REQUEST 199
+// Most measurements recorded per connection for one read of a log2
+// histogram, bucket counts are scaled down to fit.
+#define HIST_MAX_RECORDS 32
 
 namespace prober {
 
 using ::opencensus::stats::Aggregation;
 using ::opencensus::stats::AggregationWindow;
 using ::opencensus::stats::BucketBoundaries;
+using ::opencensus::stats::MeasureDouble;
 using ::opencensus::stats::MeasureInt64;
 using ::opencensus::stats::ViewDescriptor;
 
 const char kStatsPrefix[] = "ebpf_prober/";
+// Quantiles exported for host level distributions.
+const struct {
+  const char* name;
+  double q;
+} kHostQuantiles[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"max", 1}};
 constexpr char kGoogleStackdriverStatsAddress[] = "monitoring.googleapis.com";
 
 static std::string OCDataTypeString(MetricDataType type) {
@@ -89,15 +102,14 @@ Aggregation CountDistributionAggregation() {
 
 OCGCPMetricExporter::OCGCPMetricExporter(std::string project_name,
                                          AggregationLevel agg)
-    : project_(project_name), agg_(agg), default_tag_map_(nullptr) {}
+    : project_(project_name), agg_(agg) {}
 
 OCGCPMetricExporter::OCGCPMetricExporter(std::string project_name,
                                          std::string service_file_path,
                                          AggregationLevel agg)
     : project_(project_name),
       service_file_path_(service_file_path),
-      agg_(agg),
-      default_tag_map_(nullptr) {}
+      agg_(agg) {}
 
 std::unique_ptr<google::monitoring::v3::MetricService::StubInterface>
 OCGCPMetricExporter::MakeMetricServiceStub(std::string& json_text) {
@@ -170,18 +182,30 @@ void OCGCPMetricExporter::GetTags() {
   }
 
   if (!gce_metadata_.empty()) {
-    for (auto it : gce_metadata_) {
-      auto tag = opencensus::tags::TagKey::Register(it.first);
-      default_tag_vector_.push_back(std::make_pair(tag, it.second));
+    for (auto& it : gce_metadata_) {
+      default_tag_vector_.push_back(
+          std::make_pair(GetTagKey(it.first), it.second));
     }
   } else {
     char hostname[HOST_NAME_MAX];
     gethostname(hostname, HOST_NAME_MAX);
-    auto tag = opencensus::tags::TagKey::Register("hostname");
-    default_tag_vector_.push_back(std::make_pair(tag, hostname));
+    default_tag_vector_.push_back(
+        std::make_pair(GetTagKey("hostname"), hostname));
   }
 
-  default_tag_map_ = new opencensus::tags::TagMap(default_tag_vector_);
+  default_tag_map_ =
+      std::make_unique<opencensus::tags::TagMap>(default_tag_vector_);
+}
+
+const opencensus::tags::TagKey& OCGCPMetricExporter::GetTagKey(
+    const std::string& name) {
+  auto it = tag_keys_.find(name);
+  if (it == tag_keys_.end()) {
+    it = tag_keys_
+             .insert({name, opencensus::tags::TagKey::Register(name)})
+             .first;
+  }
+  return it->second;
 }
 
 absl::StatusOr<opencensus::stats::Aggregation> GetAggregation(
@@ -229,9 +253,35 @@ absl::Status OCGCPMetricExporter::RegisterMetric(std::string name,
     return absl::InternalError("Invalid Metric Kind");
   }
 
-  metrics_[name] = desc;
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+  metrics_[name] = {desc, *id, GetMetricDecoder(desc)};
 
   GetMesure(name, desc);
+  if (agg_ == AggregationLevel::kHost &&
+      desc.kind == MetricKind::kDistribution) {
+    auto measure = MeasureDouble::Register(
+        absl::StrCat(kStatsPrefix, "measure/", name, "_quantiles"), "",
+        OCGetUnitString(desc.unit));
+    quantile_measures_.insert({name, measure});
+    auto descriptor =
+        opencensus::stats::ViewDescriptor()
+            .set_name(absl::StrCat(kStatsPrefix, "desc/", name, "_quantiles"))
+            .set_measure(
+                absl::StrCat(kStatsPrefix, "measure/", name, "_quantiles"))
+            .set_aggregation(Aggregation::LastValue());
+    descriptor.set_expiry_duration(absl::Seconds(120));
+    for (auto& tag : default_tag_vector_) {
+      descriptor.add_column(tag.first);
+    }
+    descriptor.add_column(GetTagKey("remote_endpoint"));
+    descriptor.add_column(GetTagKey("quantile"));
+    descriptor.RegisterForExport();
+    return absl::OkStatus();
+  }
+
   auto descriptor =
       opencensus::stats::ViewDescriptor()
           .set_name(absl::StrCat(kStatsPrefix, "desc/", name))
@@ -251,65 +301,80 @@ absl::Status OCGCPMetricExporter::RegisterMetric(std::string name,
 
   if (agg_ == AggregationLevel::kConnection) {
     auto labels = correlator_->GetLabelKeys();
-    for (auto it : labels) {
-      descriptor.add_column(opencensus::tags::TagKey::Register(it));
+    for (auto& it : labels) {
+      descriptor.add_column(GetTagKey(it));
     }
-    descriptor.add_column(opencensus::tags::TagKey::Register("local_ip"));
-    descriptor.add_column(opencensus::tags::TagKey::Register("remote_ip"));
+    descriptor.add_column(GetTagKey("local_ip"));
+    descriptor.add_column(GetTagKey("remote_ip"));
   }
   descriptor.RegisterForExport();
   return absl::OkStatus();
 }
 
-opencensus::tags::TagMap& OCGCPMetricExporter::GetTagMap(const std::string& uuid) {
-  if (agg_ == AggregationLevel::kConnection) {
-    auto it = tag_maps_.find(uuid);
-    if (it != tag_maps_.end()) {
+static uint64_t TopKKey(ConnHandle conn) {
+  return ((uint64_t)conn.generation << 32) | conn.index;
+}
+
+const opencensus::tags::TagMap& OCGCPMetricExporter::GetOtherTagMap(
+    ConnHandle conn) {
+  auto uuid = correlator_->GetUUID(conn);
+  std::string remote(HostAggregator::RemoteEndpoint(uuid));
+  auto it = other_tag_maps_.find(remote);
+  if (it != other_tag_maps_.end()) {
+    return *(it->second);
+  }
+  if (other_tag_maps_.size() >= HOST_AGG_MAX_ENDPOINTS) {
+    remote = "other";
+    it = other_tag_maps_.find(remote);
+    if (it != other_tag_maps_.end()) {
       return *(it->second);
     }
+  }
+  auto tag_vector = default_tag_vector_;
+  tag_vector.push_back(std::make_pair(GetTagKey("local_ip"), "other"));
+  tag_vector.push_back(std::make_pair(GetTagKey("remote_ip"), remote));
+  auto& tag_map = other_tag_maps_[remote];
+  tag_map = std::make_unique<opencensus::tags::TagMap>(std::move(tag_vector));
+  return *tag_map;
+}
 
-    auto tag_vector = default_tag_vector_;
-
-    size_t pos = uuid.find("->");
+const opencensus::tags::TagMap& OCGCPMetricExporter::GetTagMap(
+    ConnHandle conn) {
+  if (agg_ != AggregationLevel::kConnection) {
+    return *default_tag_map_;
+  }
+  if (top_k_ != nullptr && !top_k_->IsTop(TopKKey(conn))) {
+    return GetOtherTagMap(conn);
+  }
 
-    std::string local_ip = uuid.substr(0, pos);
-    std::string remote_ip = uuid.substr(pos+2);
+  auto it = tag_maps_.find(conn.index);
+  if (it != tag_maps_.end() && it->second.generation == conn.generation) {
+    return *(it->second.tag_map);
+  }
 
+  auto uuid = correlator_->GetUUID(conn);
+  auto tag_vector = default_tag_vector_;
+  size_t pos = uuid.find("->");
+  if (pos == std::string::npos) {
+    tag_vector.push_back(std::make_pair(GetTagKey("local_ip"), uuid));
+    tag_vector.push_back(std::make_pair(GetTagKey("remote_ip"), ""));
+  } else {
     tag_vector.push_back(
-        std::make_pair(opencensus::tags::TagKey::Register("local_ip"), local_ip));
+        std::make_pair(GetTagKey("local_ip"), uuid.substr(0, pos)));
     tag_vector.push_back(
-        std::make_pair(opencensus::tags::TagKey::Register("remote_ip"), remote_ip));
-
-    auto labels = correlator_->GetLabels(uuid);
-
-    for (auto label : labels) {
-      tag_vector.push_back(std::make_pair(
-          opencensus::tags::TagKey::Register(label.first), label.second));
-    }
+        std::make_pair(GetTagKey("remote_ip"), uuid.substr(pos + 2)));
+  }
 
-    tag_maps_[uuid] = new opencensus::tags::TagMap(tag_vector);
-    return *tag_maps_[uuid];
+  auto labels = correlator_->GetLabels(uuid);
+  for (auto& label : labels) {
+    tag_vector.push_back(std::make_pair(GetTagKey(label.first), label.second));
   }
-  return *default_tag_map_;
-}
 
-static uint64_t GetMs(uint64_t val, MetricTimeType type) {
-  switch (type) {
-    case MetricTimeType::knsec:
-      return val / 1000000;
-    case MetricTimeType::kusec:
-      return val / 1000;
-    case MetricTimeType::kmsec:
-      return val;
-    case MetricTimeType::ksec:
-      return val * 1000;
-    case MetricTimeType::kmin:
-      return val * 60 * 000;
-    case MetricTimeType::khour:
-      return val * 3600 * 1000;
-  }
-  // This will not happen;
-  return 0;
+  auto& tag_map = tag_maps_[conn.index];
+  tag_map.generation = conn.generation;
+  tag_map.tag_map =
+      std::make_unique<opencensus::tags::TagMap>(std::move(tag_vector));
+  return *tag_map.tag_map;
 }
 
 absl::Status OCGCPMetricExporter::HandleData(std::string metric_name, void* key,
@@ -320,16 +385,16 @@ absl::Status OCGCPMetricExporter::HandleData(std::string metric_name, void* key,
   }
 
   metric_format_t* metric = (metric_format_t*)value;
-  auto metric_desc = metrics_.find(metric_name);
+  const MetricDesc& desc = it->second.desc;
 
-  auto uuid = correlator_->GetUUID(*(uint64_t*)key);
-  if (!uuid.ok()) {
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
+  if (!conn.ok()) {
     return absl::OkStatus();
   }
 
   // This line also checks if a metric was just read.
   auto old_timestamp =
-      last_read_.CheckMetricTime(metric_name, *uuid, metric->timestamp);
+      conn_state_.CheckMetricTime(*conn, it->second.id, metric->timestamp);
   if (!old_timestamp.ok()) {
     return absl::OkStatus();
   }
@@ -339,27 +404,58 @@ absl::Status OCGCPMetricExporter::HandleData(std::string metric_name, void* key,
     return absl::NotFoundError("metric measure not found");
   }
 
-  absl::StatusOr<uint64_t> val =
-      ExportersUtil::GetMetric(&(metric->data), metric_desc->second.value_type);
-  if (!val.ok()) {
-    return val.status();
+  if (desc.value_type == MetricType::kLog2Histogram) {
+    RecordHistogram(metric_name, it->second, *conn, value);
+    return absl::OkStatus();
   }
 
-  if (metric_desc->second.unit.type == MetricUnitType::kTime) {
-    *val = GetMs(*val, metric_desc->second.unit.time);
+  auto q_it = quantile_measures_.find(metric_name);
+  if (q_it != quantile_measures_.end()) {
+    aggregator_.Add(metric_name, correlator_->GetUUID(*conn),
+                    it->second.decoder.value(&(metric->data)) *
+                        it->second.decoder.ms_per_unit);
+    return absl::OkStatus();
   }
 
-  if (metric_desc->second.kind == MetricKind::kCumulative) {
-    *val = *val - data_memeory_.StoreAndGetValue(metric_name, *uuid, *val);
-  }
+  // Time metrics are always exported in milliseconds.
+  uint64_t val = it->second.decoder.value_ms(&(metric->data));
 
-  auto tagMap = GetTagMap(*uuid);
+  if (desc.kind == MetricKind::kCumulative) {
+    val = val - conn_state_.StoreAndGetValue(*conn, it->second.id, val);
+  }
+  if (top_k_ != nullptr && metric_name == top_k_metric_) {
+    top_k_->Add(TopKKey(*conn), val);
+  }
 
-  opencensus::stats::Record({{ms_it->second, *val}}, tagMap);
+  opencensus::stats::Record({{ms_it->second, val}}, GetTagMap(*conn));
 
   return absl::OkStatus();
 }
 
+void OCGCPMetricExporter::Flush(std::string metric_name) {
+  if (top_k_ != nullptr && metric_name == top_k_metric_) {
+    top_k_->Refresh();
+  }
+  auto q_it = quantile_measures_.find(metric_name);
+  if (q_it == quantile_measures_.end()) {
+    return;
+  }
+  auto rollups = aggregator_.TakeInterval(metric_name);
+  for (auto& rollup : rollups) {
+    auto tag_vector = default_tag_vector_;
+    tag_vector.push_back(std::make_pair(
+        GetTagKey("remote_endpoint"),
+        rollup.remote.empty() ? std::string("all") : rollup.remote));
+    tag_vector.push_back(std::make_pair(GetTagKey("quantile"), ""));
+    for (auto& quantile : kHostQuantiles) {
+      tag_vector.back().second = quantile.name;
+      opencensus::stats::Record(
+          {{q_it->second, rollup.sketch.Quantile(quantile.q)}},
+          opencensus::tags::TagMap(tag_vector));
+    }
+  }
+}
+
 absl::Status OCGCPMetricExporter::CustomLabels(
     const absl::flat_hash_map<std::string, std::string>& labels) {
   for (auto& tag : default_tag_vector_) {
@@ -369,22 +465,83 @@ absl::Status OCGCPMetricExporter::CustomLabels(
   }
 
   for (auto& label : labels) {
-    auto tag = opencensus::tags::TagKey::Register(label.first);
-    default_tag_vector_.push_back(std::make_pair(tag, label.second));
+    default_tag_vector_.push_back(
+        std::make_pair(GetTagKey(label.first), label.second));
   }
 
-  free(default_tag_map_);
-  default_tag_map_ = new opencensus::tags::TagMap(default_tag_vector_);
+  default_tag_map_ =
+      std::make_unique<opencensus::tags::TagMap>(default_tag_vector_);
+  // Connection TagMaps embed the default tags, rebuild them lazily.
+  tag_maps_.clear();
+  other_tag_maps_.clear();
+  return absl::OkStatus();
+}
+
+absl::Status OCGCPMetricExporter::TopConnections(uint32_t k,
+                                                 std::string metric) {
+  if (agg_ != AggregationLevel::kConnection) {
+    return absl::InvalidArgumentError(
+        "Top connections need connection level aggregation");
+  }
+  if (k == 0) {
+    return absl::InvalidArgumentError("k must be positive");
+  }
+  top_k_ = std::make_unique<TopK>(k);
+  top_k_metric_ = metric;
   return absl::OkStatus();
 }
 
+void OCGCPMetricExporter::RecordHistogram(const std::string& metric_name,
+                                          const ExportedMetric& exported,
+                                          ConnHandle conn,
+                                          const void* const data) {
+  metric_hist_t delta = hist_deltas_.Delta(
+      conn, exported.id, &((const metric_hist_format_t*)data)->data);
+  if (delta.count == 0) {
+    return;
+  }
+  double ms_per_unit = exported.decoder.ms_per_unit;
+  if (quantile_measures_.find(metric_name) != quantile_measures_.end()) {
+    std::string uuid = correlator_->GetUUID(conn);
+    for (uint32_t i = 0; i < METRIC_HIST_BUCKETS; i++) {
+      if (delta.buckets[i] != 0) {
+        aggregator_.Add(metric_name, uuid, Log2BucketMid(i) * ms_per_unit,
+                        delta.buckets[i]);
+      }
+    }
+    return;
+  }
+
+  const MeasureInt64& measure = measures_.find(metric_name)->second;
+  const opencensus::tags::TagMap& tags = GetTagMap(conn);
+  for (uint32_t i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    if (delta.buckets[i] == 0) {
+      continue;
+    }
+    uint64_t records = delta.buckets[i];
+    if (delta.count > HIST_MAX_RECORDS) {
+      records = (records * HIST_MAX_RECORDS + delta.count - 1) / delta.count;
+    }
+    int64_t val = Log2BucketMid(i) * ms_per_unit;
+    for (uint64_t r = 0; r < records; r++) {
+      opencensus::stats::Record({{measure, val}}, tags);
+    }
+  }
+}
+
 void OCGCPMetricExporter::Cleanup() {
-  auto uuids = last_read_.GetUUID();
-  for (auto uuid : uuids) {
-    if (!correlator_->CheckUUID(uuid)) {
-      last_read_.DeleteValue(uuid);
-      data_memeory_.DeleteValue(uuid);
-      tag_maps_.erase(uuid);
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
+      hist_deltas_.DeleteValue(conn);
+      if (top_k_ != nullptr) {
+        top_k_->Remove(TopKKey(conn));
+      }
+      auto it = tag_maps_.find(conn.index);
+      if (it != tag_maps_.end() && it->second.generation == conn.generation) {
+        tag_maps_.erase(it);
+      }
     }
   }
 }
@@ -21,6 +21,8 @@
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
 #include "exporters/exporters_util.h"
+#include "exporters/host_aggregator.h"
+#include "exporters/top_k.h"
 #include "google/monitoring/v3/metric_service.grpc.pb.h"
 #include "loader/exporter/metric_exporter.h"
 #include "opencensus/stats/stats.h"
@@ -40,33 +42,65 @@ class OCGCPMetricExporter : public MetricExporterInterface {
   absl::Status Init() override;
   absl::Status CustomLabels(
       const absl::flat_hash_map<std::string, std::string>& labels);
+  /* With kConnection, keeps connection labels only for the k connections
+    with the most of metric (its increase for cumulative metrics). The others
+    are recorded with local_ip "other" and their remote address without the
+    port. The ranking is refreshed every time metric is read. */
+  absl::Status TopConnections(uint32_t k, std::string metric);
   absl::Status RegisterMetric(std::string name,
                               const MetricDesc& desc) override;
   absl::Status HandleData(std::string metric_name, void* key,
                           void* value) override;
+  void Flush(std::string metric_name) override;
   void Cleanup();
 
  private:
   void GetTags();
-  opencensus::tags::TagMap& GetTagMap(const std::string& uuid);
+  // TagKeys are registered once and cached by name.
+  const opencensus::tags::TagKey& GetTagKey(const std::string& name);
+  // TagMaps are built once per connection and owned by tag_maps_.
+  const opencensus::tags::TagMap& GetTagMap(ConnHandle conn);
+  // TagMap connections outside of the top k are recorded with.
+  const opencensus::tags::TagMap& GetOtherTagMap(ConnHandle conn);
   void GetMesure(std::string& name, const MetricDesc& desc);
+  // Records the samples a MetricType::kLog2Histogram gained since its last
+  // read.
+  void RecordHistogram(const std::string& metric_name,
+                       const ExportedMetric& exported, ConnHandle conn,
+                       const void* const data);
   std::unique_ptr<google::monitoring::v3::MetricService::StubInterface>
   MakeMetricServiceStub(std::string& json_text);
   std::string project_;
   std::string service_file_path_;
   AggregationLevel agg_;
-  MetricTimeChecker last_read_;
+  ConnStateTable conn_state_;
+  HistogramDeltaTable hist_deltas_;
 
   absl::flat_hash_map<std::string, opencensus::stats::MeasureInt64> measures_;
+  // With kHost, distribution metrics are folded into aggregator_ and exported
+  // as quantiles per interval instead of one measurement per connection.
+  absl::flat_hash_map<std::string, opencensus::stats::MeasureDouble>
+      quantile_measures_;
+  HostAggregator aggregator_;
+  std::unique_ptr<TopK> top_k_;
+  std::string top_k_metric_;
+  // Indexed by remote address, at most HOST_AGG_MAX_ENDPOINTS.
+  absl::flat_hash_map<std::string, std::unique_ptr<opencensus::tags::TagMap>>
+      other_tag_maps_;
   absl::flat_hash_map<std::string, std::string> gce_metadata_;
-  absl::flat_hash_map<std::string, opencensus::tags::TagMap*> tag_maps_;
+  absl::flat_hash_map<std::string, opencensus::tags::TagKey> tag_keys_;
+  struct ConnTagMap {
+    uint32_t generation;
+    std::unique_ptr<opencensus::tags::TagMap> tag_map;
+  };
+  // Indexed by the connection handle index.
+  absl::flat_hash_map<uint32_t, ConnTagMap> tag_maps_;
   std::vector<std::pair<opencensus::tags::TagKey, std::string>>
       default_tag_vector_;
-  opencensus::tags::TagMap* default_tag_map_;
-  absl::flat_hash_map<std::string, MetricDesc> metrics_;
-  MetricDataMemory data_memeory_;
+  std::unique_ptr<opencensus::tags::TagMap> default_tag_map_;
+  absl::flat_hash_map<std::string, ExportedMetric> metrics_;
 };
 
 }  // namespace prober
 
-#endif  // _EXPORTERS_FILE_EXPORTER_H_
+#endif  // _EXPORTERS_OC_GCP_EXPORTER_H_
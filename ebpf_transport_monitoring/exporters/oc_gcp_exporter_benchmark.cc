@@ -0,0 +1,163 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Heap allocations per point recorded by OCGCPMetricExporter::HandleData,
+// once the TagMap of the connection is cached and for the first point of a
+// connection that builds it. Allocations are counted by replacing the global
+// operator new.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "exporters/oc_gcp_exporter.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { free(ptr); }
+
+namespace prober {
+namespace {
+
+constexpr uint64_t kConnections = 1000;
+// BPF timestamps of consecutive polls, points read less than a second after
+// the previous one are skipped.
+constexpr uint64_t kPollInterval = 2ULL * 1000 * 1000 * 1000;
+
+// Correlator that knows connections 1 to kConnections and can replace them.
+class FakeCorrelator : public CorrelatorInterface {
+ public:
+  FakeCorrelator() { Reconnect(); }
+
+  // Gives every connection a new handle, as if all were closed and reopened.
+  void Reconnect() {
+    absl::MutexLock lock(&mu_);
+    for (uint64_t conn_id = 1; conn_id <= kConnections; conn_id++) {
+      auto it = connection_map_.find(conn_id);
+      if (it != connection_map_.end()) {
+        FreeConnHandle(it->second);
+      }
+      connection_map_[conn_id] = NewConnHandle(
+          absl::StrCat("10.0.0.1:", 30000 + conn_id, "->10.0.1.1:443"));
+    }
+  }
+
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override {
+    return absl::OkStatus();
+  }
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override {
+    return absl::OkStatus();
+  }
+  void Cleanup() override {}
+  bool CheckUUID(std::string uuid) override { return true; }
+  absl::flat_hash_map<std::string, std::string> GetLabels(
+      std::string uuid) override {
+    return {{"pod", "frontend-1"}, {"container", "server"}};
+  }
+  std::vector<std::string> GetLabelKeys() override {
+    return {"pod", "container"};
+  }
+  std::vector<DataCtx*>& GetLogSources() override { return sources_; }
+  std::vector<DataCtx*>& GetMetricSources() override { return sources_; }
+  absl::Status Init() override { return absl::OkStatus(); }
+
+ private:
+  std::vector<DataCtx*> sources_;
+};
+
+// Init is skipped, it would look up GCE metadata and register the
+// Stackdriver exporter.
+void Register(OCGCPMetricExporter* exporter, FakeCorrelator* correlator) {
+  MetricUnit_t unit = {MetricUnitType::kTime};
+  unit.time = MetricTimeType::kusec;
+  exporter->RegisterCorrelator(correlator);
+  exporter
+      ->RegisterMetric("tcp_srtt", {MetricType::kUint64, MetricType::kUint32,
+                                    MetricKind::kGauge, unit})
+      .IgnoreError();
+}
+
+// Records a point for every connection with timestamp.
+void Poll(OCGCPMetricExporter* exporter, uint64_t timestamp) {
+  for (uint64_t conn_id = 1; conn_id <= kConnections; conn_id++) {
+    metric_format_t value = {timestamp, conn_id * 100};
+    exporter->HandleData("tcp_srtt", &conn_id, &value).IgnoreError();
+  }
+}
+
+void BM_RecordCachedTagMap(benchmark::State& state) {
+  FakeCorrelator correlator;
+  OCGCPMetricExporter exporter("benchmark", AggregationLevel::kConnection);
+  Register(&exporter, &correlator);
+  uint64_t timestamp = kPollInterval;
+  Poll(&exporter, timestamp);
+  timestamp += kPollInterval;
+  uint64_t start = allocations.load();
+  for (auto _ : state) {
+    Poll(&exporter, timestamp);
+    timestamp += kPollInterval;
+  }
+  uint64_t points = state.iterations() * kConnections;
+  state.counters["allocs_per_point"] =
+      static_cast<double>(allocations.load() - start) / points;
+  state.SetItemsProcessed(points);
+}
+BENCHMARK(BM_RecordCachedTagMap);
+
+void BM_RecordNewConnection(benchmark::State& state) {
+  FakeCorrelator correlator;
+  OCGCPMetricExporter exporter("benchmark", AggregationLevel::kConnection);
+  Register(&exporter, &correlator);
+  uint64_t timestamp = kPollInterval;
+  uint64_t allocated = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    correlator.Reconnect();
+    state.ResumeTiming();
+    uint64_t start = allocations.load();
+    Poll(&exporter, timestamp);
+    timestamp += kPollInterval;
+    allocated += allocations.load() - start;
+  }
+  uint64_t points = state.iterations() * kConnections;
+  state.counters["allocs_per_point"] = static_cast<double>(allocated) / points;
+  state.SetItemsProcessed(points);
+}
+BENCHMARK(BM_RecordNewConnection);
+
+}  // namespace
+}  // namespace prober
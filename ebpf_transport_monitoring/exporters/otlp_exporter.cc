@@ -0,0 +1,520 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/otlp_exporter.h"
+
+#include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "exporters/exporters_util.h"
+#include "exporters/log_encoder.h"
+#include "grpcpp/grpcpp.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/self_metrics.h"
+
+#define OTLP_RPC_TIMEOUT std::chrono::seconds(10)
+
+namespace prober {
+
+namespace otlp_collector_logs = ::opentelemetry::proto::collector::logs::v1;
+namespace otlp_collector_metrics =
+    ::opentelemetry::proto::collector::metrics::v1;
+namespace otlp_common = ::opentelemetry::proto::common::v1;
+namespace otlp_logs = ::opentelemetry::proto::logs::v1;
+namespace otlp_metrics = ::opentelemetry::proto::metrics::v1;
+namespace otlp_resource = ::opentelemetry::proto::resource::v1;
+
+typedef google::protobuf::RepeatedPtrField<otlp_common::KeyValue> Attributes;
+
+static std::shared_ptr<grpc::Channel> CreateChannel(
+    const OtlpOptions& options) {
+  grpc::ChannelArguments args;
+  args.SetUserAgentPrefix("lightfoot");
+  if (options.gzip) {
+    args.SetCompressionAlgorithm(GRPC_COMPRESS_GZIP);
+  }
+  // The collector normally runs on the node, credentials are not needed.
+  return grpc::CreateCustomChannel(
+      options.endpoint, grpc::InsecureChannelCredentials(), args);
+}
+
+static void AddAttribute(Attributes* attributes, absl::string_view key,
+                         absl::string_view value) {
+  auto attribute = attributes->Add();
+  attribute->set_key(key.data(), key.size());
+  attribute->mutable_value()->set_string_value(value.data(), value.size());
+}
+
+static void SetResource(otlp_resource::Resource* resource) {
+  char hostname[HOST_NAME_MAX];
+  gethostname(hostname, HOST_NAME_MAX);
+  AddAttribute(resource->mutable_attributes(), "service.name", "lightfoot");
+  AddAttribute(resource->mutable_attributes(), "host.name", hostname);
+}
+
+static void SetScope(otlp_common::InstrumentationScope* scope) {
+  scope->set_name("lightfoot");
+}
+
+namespace {
+
+// Adds the typed log fields as attributes of a LogRecord.
+class AttributeSink : public LogFieldSink {
+ public:
+  explicit AttributeSink(Attributes* attributes) : attributes_(attributes) {}
+  void String(absl::string_view key, absl::string_view value) override {
+    AddAttribute(attributes_, key, value);
+  }
+  void Number(absl::string_view key, uint64_t value) override {
+    // Connection ids are kernel pointers which do not fit an int64.
+    if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+      AddAttribute(attributes_, key, absl::StrCat(value));
+      return;
+    }
+    auto attribute = attributes_->Add();
+    attribute->set_key(key.data(), key.size());
+    attribute->mutable_value()->set_int_value(value);
+  }
+
+ private:
+  Attributes* attributes_;
+};
+
+}  // namespace
+
+OtlpLogger::OtlpLogger(OtlpOptions options)
+    : options_(options),
+      scope_(nullptr),
+      last_sent_(absl::Now()),
+      sender_(options.max_in_flight) {}
+
+OtlpLogger::~OtlpLogger() {
+  SendPending();
+  sender_.Drain();
+}
+
+absl::Status OtlpLogger::Init() {
+  stub_ = otlp_collector_logs::LogsService::NewStub(CreateChannel(options_));
+  if (stub_ == nullptr) {
+    return absl::InternalError("Could not create OTLP logs stub");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status OtlpLogger::RegisterLog(std::string name, LogDesc& log_desc) {
+  if (logs_.find(name) != logs_.end()) {
+    return absl::AlreadyExistsError("log already registered");
+  }
+  logs_[name] = true;
+  return absl::OkStatus();
+}
+
+absl::Status OtlpLogger::HandleData(std::string log_name,
+                                    const void* const data,
+                                    const uint32_t size) {
+  if (logs_.find(log_name) == logs_.end()) {
+    return absl::NotFoundError("log not registered");
+  }
+
+  auto conn_id = ExportersUtil::GetLogConnId(log_name, data);
+  auto uuid = correlator_->GetUUID(conn_id);
+  if (!uuid.ok()) {
+    return absl::OkStatus();
+  }
+
+  if (pending_ == nullptr) {
+    pending_ = std::make_unique<otlp_collector_logs::ExportLogsServiceRequest>();
+    auto resource_logs = pending_->add_resource_logs();
+    SetResource(resource_logs->mutable_resource());
+    scope_ = resource_logs->add_scope_logs();
+    SetScope(scope_->mutable_scope());
+  }
+
+  auto record = scope_->add_log_records();
+  record->set_time_unix_nano(
+      absl::ToUnixNanos(ExportersUtil::GetLogTime(log_name, data)));
+  record->set_observed_time_unix_nano(absl::GetCurrentTimeNanos());
+  record->set_severity_number(otlp_logs::SEVERITY_NUMBER_INFO);
+  record->set_severity_text("INFO");
+  record->mutable_body()->set_string_value(log_name);
+  AttributeSink sink(record->mutable_attributes());
+  auto status = LogEncoder::VisitFields(log_name, *uuid, data, sink);
+  if (!status.ok()) {
+    scope_->mutable_log_records()->RemoveLast();
+    return status;
+  }
+
+  if (static_cast<uint32_t>(scope_->log_records_size()) >=
+          options_.batch_size ||
+      absl::Now() - last_sent_ >= options_.flush_interval) {
+    SendPending();
+  }
+  return absl::OkStatus();
+}
+
+void OtlpLogger::SendPending() {
+  last_sent_ = absl::Now();
+  if (pending_ == nullptr) {
+    return;
+  }
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.SetGauge("otlp_log_batch_size", scope_->log_records_size());
+  self_metrics.Increment("otlp_log_records", scope_->log_records_size());
+
+  std::shared_ptr<otlp_collector_logs::ExportLogsServiceRequest> request(
+      std::move(pending_));
+  scope_ = nullptr;
+  auto stub = stub_.get();
+  sender_.Run([stub, request]() {
+    auto& self_metrics = SelfMetrics::GetInstance();
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + OTLP_RPC_TIMEOUT);
+    otlp_collector_logs::ExportLogsServiceResponse response;
+    auto start = absl::Now();
+    auto status = stub->Export(&context, *request, &response);
+    self_metrics.RecordLatency("otlp_log_rpc_latency", absl::Now() - start);
+    self_metrics.Increment("otlp_log_requests");
+    if (!status.ok()) {
+      self_metrics.Increment("otlp_log_request_failures");
+      std::cerr << "sending OTLP logs: " << status.error_message()
+                << std::endl;
+      return;
+    }
+    if (response.has_partial_success()) {
+      self_metrics.Increment(
+          "otlp_log_records_rejected",
+          response.partial_success().rejected_log_records());
+    }
+  });
+  self_metrics.SetGauge("otlp_log_requests_in_flight", sender_.InFlight());
+}
+
+// Same boundaries as the opencensus exporter. Time is exported in ms.
+static const std::vector<double>& TimeBounds() {
+  static const std::vector<double>* bounds = new std::vector<double>(
+      {0,   0.01, 0.05, 0.1,  0.3,   0.6,   0.8,   1,     2,   3,   4,
+       5,   6,    8,    10,   13,    16,    20,    25,    30,  40,  50,
+       65,  80,   100,  130,  160,   200,   250,   300,   400, 500, 650,
+       800, 1000, 2000, 5000, 10000, 20000, 50000, 100000});
+  return *bounds;
+}
+
+// Bounds of the buckets of a MetricType::kLog2Histogram, in ms for time
+// metrics. Registration is single threaded.
+static const std::vector<double>& Log2Bounds(double ms_per_unit) {
+  static auto* cache =
+      new absl::flat_hash_map<double, std::unique_ptr<std::vector<double>>>();
+  auto& bounds = (*cache)[ms_per_unit];
+  if (bounds == nullptr) {
+    bounds.reset(new std::vector<double>());
+    for (uint32_t i = 0; i < METRIC_HIST_BUCKETS - 1; i++) {
+      bounds->push_back(Log2BucketMax(i) * ms_per_unit);
+    }
+  }
+  return *bounds;
+}
+
+static const std::vector<double>& DataBounds() {
+  static const std::vector<double>* bounds = new std::vector<double>(
+      {0, 1024, 2048, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+       67108864, 268435456, 1073741824, 4294967296});
+  return *bounds;
+}
+
+static const std::vector<double>& CountBounds() {
+  static const std::vector<double>* bounds = new std::vector<double>(
+      {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+       32768, 65536});
+  return *bounds;
+}
+
+OtlpMetricExporter::OtlpMetricExporter(OtlpOptions options)
+    : options_(options),
+      scope_(nullptr),
+      pending_points_(0),
+      last_sent_(absl::Now()),
+      sender_(options.max_in_flight) {}
+
+OtlpMetricExporter::OtlpMetricExporter(
+    OtlpOptions options,
+    std::unique_ptr<otlp_collector_metrics::MetricsService::StubInterface>
+        stub)
+    : options_(options),
+      stub_(std::move(stub)),
+      scope_(nullptr),
+      pending_points_(0),
+      last_sent_(absl::Now()),
+      sender_(options.max_in_flight) {}
+
+OtlpMetricExporter::~OtlpMetricExporter() {
+  SendPending();
+  sender_.Drain();
+}
+
+absl::Status OtlpMetricExporter::Init() {
+  if (stub_ != nullptr) {
+    return absl::OkStatus();
+  }
+  stub_ = otlp_collector_metrics::MetricsService::NewStub(
+      CreateChannel(options_));
+  if (stub_ == nullptr) {
+    return absl::InternalError("Could not create OTLP metrics stub");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status OtlpMetricExporter::RegisterMetric(std::string name,
+                                                const MetricDesc& desc) {
+  if (metrics_.find(name) != metrics_.end()) {
+    return absl::AlreadyExistsError("metric already registered");
+  }
+  if (desc.kind == MetricKind::kNone) {
+    return absl::InvalidArgumentError("Unknown metric kind");
+  }
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+  const std::vector<double>* bounds;
+  switch (desc.unit.type) {
+    case MetricUnitType::kTime:
+      bounds = &TimeBounds();
+      break;
+    case MetricUnitType::kData:
+      bounds = &DataBounds();
+      break;
+    case MetricUnitType::kNone:
+    default:
+      bounds = &CountBounds();
+      break;
+  }
+  MetricDecoder decoder = GetMetricDecoder(desc);
+  if (desc.value_type == MetricType::kLog2Histogram) {
+    bounds = &Log2Bounds(decoder.ms_per_unit);
+  }
+  metrics_[name] = {{desc, *id, decoder},
+                    absl::StrCat("lightfoot.", name),
+                    bounds,
+                    -1};
+  return absl::OkStatus();
+}
+
+absl::Status OtlpMetricExporter::HandleData(std::string metric_name,
+                                            void* key, void* value) {
+  auto it = metrics_.find(metric_name);
+  if (it == metrics_.end()) {
+    return absl::NotFoundError("metric_name not found");
+  }
+  OtlpMetric& otlp_metric = it->second;
+  const ExportedMetric& exported = otlp_metric.metric;
+  metric_format_t* metric = (metric_format_t*)value;
+
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
+  if (!conn.ok()) {
+    return absl::OkStatus();
+  }
+
+  // This line also checks if a metric was just read.
+  auto old_timestamp =
+      conn_state_.CheckMetricTime(*conn, exported.id, metric->timestamp);
+  if (!old_timestamp.ok()) {
+    return absl::OkStatus();
+  }
+
+  if (pending_ == nullptr) {
+    pending_ = std::make_unique<
+        otlp_collector_metrics::ExportMetricsServiceRequest>();
+    auto resource_metrics = pending_->add_resource_metrics();
+    SetResource(resource_metrics->mutable_resource());
+    scope_ = resource_metrics->add_scope_metrics();
+    SetScope(scope_->mutable_scope());
+  }
+
+  otlp_metrics::Metric* out;
+  if (otlp_metric.pending_index < 0) {
+    otlp_metric.pending_index = scope_->metrics_size();
+    out = scope_->add_metrics();
+    out->set_name(otlp_metric.name);
+    switch (exported.desc.unit.type) {
+      case MetricUnitType::kTime:
+        out->set_unit("ms");
+        break;
+      case MetricUnitType::kData:
+        out->set_unit(exported.decoder.unit);
+        break;
+      case MetricUnitType::kNone:
+        out->set_unit("1");
+        break;
+    }
+  } else {
+    out = scope_->mutable_metrics(otlp_metric.pending_index);
+  }
+
+  uint64_t end_time = absl::ToUnixNanos(ExportersUtil::GetTimeFromBPFns(
+      conn_state_.GetMetricTime(*conn, exported.id)));
+  // The first read of a connection returns its start time, later reads the
+  // previous BPF timestamp.
+  uint64_t start_time = conn_state_.GetMetricStartTime(*conn, exported.id);
+  uint64_t delta_start_time =
+      *old_timestamp == start_time
+          ? start_time
+          : absl::ToUnixNanos(ExportersUtil::GetTimeFromBPFns(*old_timestamp));
+  // Time metrics are always exported in milliseconds.
+  int64_t val = exported.decoder.value_ms(&(metric->data));
+  Attributes* attributes;
+
+  switch (exported.desc.kind) {
+    case MetricKind::kGauge: {
+      auto point = out->mutable_gauge()->add_data_points();
+      point->set_time_unix_nano(end_time);
+      point->set_as_int(val);
+      attributes = point->mutable_attributes();
+      break;
+    }
+    case MetricKind::kCumulative:
+    case MetricKind::kDelta: {
+      auto sum = out->mutable_sum();
+      bool cumulative = exported.desc.kind == MetricKind::kCumulative;
+      sum->set_is_monotonic(cumulative);
+      sum->set_aggregation_temporality(
+          cumulative ? otlp_metrics::AGGREGATION_TEMPORALITY_CUMULATIVE
+                     : otlp_metrics::AGGREGATION_TEMPORALITY_DELTA);
+      auto point = sum->add_data_points();
+      point->set_start_time_unix_nano(cumulative ? start_time
+                                                 : delta_start_time);
+      point->set_time_unix_nano(end_time);
+      point->set_as_int(val);
+      attributes = point->mutable_attributes();
+      break;
+    }
+    case MetricKind::kDistribution: {
+      auto histogram = out->mutable_histogram();
+      auto point = histogram->add_data_points();
+      point->set_time_unix_nano(end_time);
+      const auto& bounds = *otlp_metric.bounds;
+      point->mutable_explicit_bounds()->Add(bounds.begin(), bounds.end());
+      if (exported.desc.value_type == MetricType::kLog2Histogram) {
+        // The kernel histogram is cumulative since the connection was first
+        // seen.
+        const metric_hist_t& hist = ((metric_hist_format_t*)value)->data;
+        histogram->set_aggregation_temporality(
+            otlp_metrics::AGGREGATION_TEMPORALITY_CUMULATIVE);
+        point->set_start_time_unix_nano(start_time);
+        point->set_count(hist.count);
+        point->set_sum(hist.sum * exported.decoder.ms_per_unit);
+        point->mutable_bucket_counts()->Add(hist.buckets,
+                                            hist.buckets + METRIC_HIST_BUCKETS);
+      } else {
+        histogram->set_aggregation_temporality(
+            otlp_metrics::AGGREGATION_TEMPORALITY_DELTA);
+        point->set_start_time_unix_nano(delta_start_time);
+        point->set_count(1);
+        point->set_sum(val);
+        point->set_min(val);
+        point->set_max(val);
+        point->mutable_bucket_counts()->Resize(bounds.size() + 1, 0);
+        point->set_bucket_counts(
+            std::lower_bound(bounds.begin(), bounds.end(), val) -
+                bounds.begin(),
+            1);
+      }
+      attributes = point->mutable_attributes();
+      break;
+    }
+    case MetricKind::kNone:
+    default:
+      return absl::InternalError("Unknown metric kind");
+  }
+  AddAttribute(attributes, "uuid", correlator_->GetUUID(*conn));
+
+  if (++pending_points_ >= options_.batch_size) {
+    SendPending();
+  }
+  return absl::OkStatus();
+}
+
+void OtlpMetricExporter::Flush(std::string metric_name) {
+  if (absl::Now() - last_sent_ >= options_.flush_interval) {
+    SendPending();
+  }
+}
+
+void OtlpMetricExporter::SendPending() {
+  last_sent_ = absl::Now();
+  if (pending_ == nullptr) {
+    return;
+  }
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.SetGauge("otlp_metric_batch_size", pending_points_);
+  self_metrics.Increment("otlp_metric_points", pending_points_);
+
+  std::shared_ptr<otlp_collector_metrics::ExportMetricsServiceRequest> request(
+      std::move(pending_));
+  scope_ = nullptr;
+  pending_points_ = 0;
+  for (auto& metric : metrics_) {
+    metric.second.pending_index = -1;
+  }
+
+  auto stub = stub_.get();
+  sender_.Run([stub, request]() {
+    auto& self_metrics = SelfMetrics::GetInstance();
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + OTLP_RPC_TIMEOUT);
+    otlp_collector_metrics::ExportMetricsServiceResponse response;
+    auto start = absl::Now();
+    auto status = stub->Export(&context, *request, &response);
+    self_metrics.RecordLatency("otlp_metric_rpc_latency", absl::Now() - start);
+    self_metrics.Increment("otlp_metric_requests");
+    if (!status.ok()) {
+      self_metrics.Increment("otlp_metric_request_failures");
+      std::cerr << "sending OTLP metrics: " << status.error_message()
+                << std::endl;
+      return;
+    }
+    if (response.has_partial_success()) {
+      self_metrics.Increment(
+          "otlp_metric_points_rejected",
+          response.partial_success().rejected_data_points());
+    }
+  });
+  self_metrics.SetGauge("otlp_metric_requests_in_flight", sender_.InFlight());
+}
+
+void OtlpMetricExporter::Cleanup() {
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
+    }
+  }
+}
+
+}  // namespace prober
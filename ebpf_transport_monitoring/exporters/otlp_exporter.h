@@ -0,0 +1,127 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_OTLP_EXPORTER_H_
+#define _EXPORTERS_OTLP_EXPORTER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "exporters/bounded_async.h"
+#include "exporters/exporters_util.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/log_exporter.h"
+#include "loader/exporter/metric_exporter.h"
+#include "opentelemetry/proto/collector/logs/v1/logs_service.grpc.pb.h"
+#include "opentelemetry/proto/collector/metrics/v1/metrics_service.grpc.pb.h"
+
+namespace prober {
+
+struct OtlpOptions {
+  // gRPC target of the collector.
+  std::string endpoint = "localhost:4317";
+  // Records (log records or data points) per Export request.
+  uint32_t batch_size = 512;
+  // Partial batches are sent once they are this old.
+  absl::Duration flush_interval = absl::Seconds(10);
+  uint32_t max_in_flight = 4;
+  bool gzip = false;
+};
+
+/* Exports logs to an OpenTelemetry collector over OTLP/gRPC. Records are
+  batched and Export calls run off the event loop. */
+class OtlpLogger : public LogExporterInterface {
+ public:
+  OtlpLogger() = delete;
+  explicit OtlpLogger(OtlpOptions options);
+  ~OtlpLogger() override;
+  absl::Status Init() override;
+  absl::Status RegisterLog(std::string name, LogDesc& log_desc) override;
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override;
+
+ private:
+  void SendPending();
+
+  OtlpOptions options_;
+  absl::flat_hash_map<std::string, bool> logs_;
+  std::unique_ptr<
+      opentelemetry::proto::collector::logs::v1::LogsService::StubInterface>
+      stub_;
+  std::unique_ptr<
+      opentelemetry::proto::collector::logs::v1::ExportLogsServiceRequest>
+      pending_;
+  // Where records of the pending request go.
+  opentelemetry::proto::logs::v1::ScopeLogs* scope_;
+  absl::Time last_sent_;
+  BoundedAsync sender_;
+};
+
+/* Exports metrics to an OpenTelemetry collector over OTLP/gRPC. Cumulative
+  metrics keep their start time, deltas and distributions are sent with
+  delta temporality. */
+class OtlpMetricExporter : public MetricExporterInterface {
+ public:
+  OtlpMetricExporter() = delete;
+  explicit OtlpMetricExporter(OtlpOptions options);
+  // Uses the given stub instead of creating one in Init. Useful to point the
+  // exporter at a fake collector.
+  OtlpMetricExporter(OtlpOptions options,
+                     std::unique_ptr<opentelemetry::proto::collector::metrics::
+                                         v1::MetricsService::StubInterface>
+                         stub);
+  ~OtlpMetricExporter() override;
+  absl::Status Init() override;
+  absl::Status RegisterMetric(std::string name,
+                              const MetricDesc& desc) override;
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override;
+  void Flush(std::string metric_name) override;
+  void Cleanup();
+
+ private:
+  struct OtlpMetric {
+    ExportedMetric metric;
+    std::string name;
+    // Upper bounds of distribution buckets.
+    const std::vector<double>* bounds;
+    // Index of the metric in the pending request, -1 if not there yet.
+    int pending_index;
+  };
+
+  void SendPending();
+
+  OtlpOptions options_;
+  absl::flat_hash_map<std::string, OtlpMetric> metrics_;
+  ConnStateTable conn_state_;
+  std::unique_ptr<opentelemetry::proto::collector::metrics::v1::
+                      MetricsService::StubInterface>
+      stub_;
+  std::unique_ptr<
+      opentelemetry::proto::collector::metrics::v1::ExportMetricsServiceRequest>
+      pending_;
+  opentelemetry::proto::metrics::v1::ScopeMetrics* scope_;
+  uint32_t pending_points_;
+  absl::Time last_sent_;
+  BoundedAsync sender_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_OTLP_EXPORTER_H_
@@ -0,0 +1,118 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Stand-in for an OpenTelemetry collector. Accepts OTLP/gRPC logs and metrics
+// and prints a line per request, or the full request with -v, so the OTLP
+// exporters can be tried without running a collector.
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "absl/synchronization/mutex.h"
+#include "grpcpp/grpcpp.h"
+#include "opentelemetry/proto/collector/logs/v1/logs_service.grpc.pb.h"
+#include "opentelemetry/proto/collector/metrics/v1/metrics_service.grpc.pb.h"
+
+namespace otlp_logs = ::opentelemetry::proto::collector::logs::v1;
+namespace otlp_metrics = ::opentelemetry::proto::collector::metrics::v1;
+
+static absl::Mutex output_mu;
+
+class LogsSink final : public otlp_logs::LogsService::Service {
+ public:
+  explicit LogsSink(bool verbose) : verbose_(verbose) {}
+  grpc::Status Export(grpc::ServerContext* context,
+                      const otlp_logs::ExportLogsServiceRequest* request,
+                      otlp_logs::ExportLogsServiceResponse* response) override {
+    uint64_t records = 0;
+    for (const auto& resource : request->resource_logs()) {
+      for (const auto& scope : resource.scope_logs()) {
+        records += scope.log_records_size();
+      }
+    }
+    absl::MutexLock lock(&output_mu);
+    std::cout << "logs: " << records << " records, " << request->ByteSizeLong()
+              << " bytes" << std::endl;
+    if (verbose_) {
+      std::cout << request->DebugString() << std::endl;
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  bool verbose_;
+};
+
+class MetricsSink final : public otlp_metrics::MetricsService::Service {
+ public:
+  explicit MetricsSink(bool verbose) : verbose_(verbose) {}
+  grpc::Status Export(
+      grpc::ServerContext* context,
+      const otlp_metrics::ExportMetricsServiceRequest* request,
+      otlp_metrics::ExportMetricsServiceResponse* response) override {
+    uint64_t points = 0;
+    for (const auto& resource : request->resource_metrics()) {
+      for (const auto& scope : resource.scope_metrics()) {
+        for (const auto& metric : scope.metrics()) {
+          points += metric.gauge().data_points_size() +
+                    metric.sum().data_points_size() +
+                    metric.histogram().data_points_size();
+        }
+      }
+    }
+    absl::MutexLock lock(&output_mu);
+    std::cout << "metrics: " << points << " points, "
+              << request->ByteSizeLong() << " bytes" << std::endl;
+    if (verbose_) {
+      std::cout << request->DebugString() << std::endl;
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  bool verbose_;
+};
+
+int main(int argc, char** argv) {
+  std::string address = "localhost:4317";
+  bool verbose = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-h") == 0) {
+      std::cout << "Usage: ./otlp_sink [address] [-v]" << std::endl;
+      return 0;
+    } else {
+      address = argv[i];
+    }
+  }
+
+  LogsSink logs(verbose);
+  MetricsSink metrics(verbose);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&logs);
+  builder.RegisterService(&metrics);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  if (server == nullptr) {
+    std::cerr << "Could not listen on " << address << std::endl;
+    return -1;
+  }
+  std::cout << "Listening on " << address << std::endl;
+  server->Wait();
+  return 0;
+}
@@ -0,0 +1,459 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/prometheus_exporter.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "exporters/metric_decoder.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/self_metrics.h"
+
+namespace prober {
+
+// Shortest of %.15g and %.17g that parses back to the same double, so le
+// labels keep matching the bounds samples were bucketed against.
+static std::string FormatBound(double bound) {
+  std::string text = absl::StrFormat("%.15g", bound);
+  double parsed;
+  if (!absl::SimpleAtod(text, &parsed) || parsed != bound) {
+    text = absl::StrFormat("%.17g", bound);
+  }
+  return text;
+}
+
+struct PrometheusBuckets {
+  PrometheusBuckets(std::vector<double> upper_bounds)
+      : bounds(upper_bounds) {
+    for (double bound : bounds) {
+      le.push_back(absl::StrCat(",le=\"", FormatBound(bound), "\"} "));
+    }
+  }
+  std::vector<double> bounds;
+  // Rendered le label of every bound.
+  std::vector<std::string> le;
+};
+
+// Same boundaries as the opencensus exporter, in seconds and bytes.
+static const PrometheusBuckets& TimeBuckets() {
+  static const PrometheusBuckets* buckets = new PrometheusBuckets(
+      {0,    0.00001, 0.00005, 0.0001, 0.0003, 0.0006, 0.0008, 0.001,
+       0.002, 0.003,  0.004,   0.005,  0.006,  0.008,  0.01,   0.013,
+       0.016, 0.02,   0.025,   0.03,   0.04,   0.05,   0.065,  0.08,
+       0.1,   0.13,   0.16,    0.2,    0.25,   0.3,    0.4,    0.5,
+       0.65,  0.8,    1,       2,      5,      10,     20,     50,
+       100});
+  return *buckets;
+}
+
+static const PrometheusBuckets& DataBuckets() {
+  static const PrometheusBuckets* buckets = new PrometheusBuckets(
+      {0, 1024, 2048, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+       67108864, 268435456, 1073741824, 4294967296});
+  return *buckets;
+}
+
+static const PrometheusBuckets& CountBuckets() {
+  static const PrometheusBuckets* buckets = new PrometheusBuckets(
+      {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+       32768, 65536});
+  return *buckets;
+}
+
+// Bounds of the buckets of a MetricType::kLog2Histogram in seconds or bytes,
+// the last bucket is +Inf. Registration is single threaded.
+static const PrometheusBuckets& Log2Buckets(double scale) {
+  static auto* cache =
+      new absl::flat_hash_map<double, std::unique_ptr<PrometheusBuckets>>();
+  auto& buckets = (*cache)[scale];
+  if (buckets == nullptr) {
+    std::vector<double> bounds;
+    for (uint32_t i = 0; i < METRIC_HIST_BUCKETS - 1; i++) {
+      bounds.push_back(Log2BucketMax(i) * scale);
+    }
+    buckets.reset(new PrometheusBuckets(bounds));
+  }
+  return *buckets;
+}
+
+static double TimeScale(MetricTimeType time) {
+  switch (time) {
+    case MetricTimeType::knsec:
+      return 1e-9;
+    case MetricTimeType::kusec:
+      return 1e-6;
+    case MetricTimeType::kmsec:
+      return 1e-3;
+    case MetricTimeType::ksec:
+      return 1;
+    case MetricTimeType::kmin:
+      return 60;
+    case MetricTimeType::khour:
+      return 3600;
+  }
+  return 1;
+}
+
+static double DataScale(MetricDataType data) {
+  switch (data) {
+    case MetricDataType::kbytes:
+      return 1;
+    case MetricDataType::kkbytes:
+      return 1024;
+    case MetricDataType::kmbytes:
+      return 1024 * 1024;
+    case MetricDataType::kgbytes:
+      return 1024 * 1024 * 1024;
+    case MetricDataType::kbits:
+      return 1.0 / 8;
+    case MetricDataType::kkbits:
+      return 1024.0 / 8;
+    case MetricDataType::kmbits:
+      return 1024.0 * 1024 / 8;
+    case MetricDataType::kgbits:
+      return 1024.0 * 1024 * 1024 / 8;
+  }
+  return 1;
+}
+
+static void AppendLabelValue(std::string* out, const std::string& value) {
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      default:
+        out->push_back(c);
+    }
+  }
+}
+
+PrometheusMetricExporter::PrometheusMetricExporter(struct event_base* base,
+                                                   uint16_t port,
+                                                   uint32_t max_series)
+    : base_(base),
+      port_(port),
+      max_series_(max_series),
+      num_series_(0),
+      http_(nullptr),
+      front_(0) {
+  render_event_ = event_new(base_, -1, 0, HandleRender, this);
+}
+
+PrometheusMetricExporter::~PrometheusMetricExporter() {
+  if (http_ != nullptr) {
+    evhttp_free(http_);
+  }
+  if (render_event_ != nullptr) {
+    event_free(render_event_);
+  }
+}
+
+absl::Status PrometheusMetricExporter::Init() {
+  http_ = evhttp_new(base_);
+  if (http_ == nullptr) {
+    return absl::InternalError("Could not create http server");
+  }
+  if (evhttp_bind_socket(http_, "0.0.0.0", port_) != 0) {
+    return absl::UnavailableError(
+        absl::StrFormat("Could not bind to port %d", port_));
+  }
+  evhttp_set_allowed_methods(http_, EVHTTP_REQ_GET);
+  evhttp_set_cb(http_, "/metrics", ServeMetrics, this);
+  RenderPage();
+  return absl::OkStatus();
+}
+
+void PrometheusMetricExporter::ServeMetrics(struct evhttp_request* request,
+                                            void* arg) {
+  auto exporter = static_cast<PrometheusMetricExporter*>(arg);
+  const std::string& page = exporter->Page();
+  // The page is copied, the next Flush may reuse its buffer before the
+  // response is written out.
+  struct evbuffer* buffer = evbuffer_new();
+  evbuffer_add(buffer, page.data(), page.size());
+  evhttp_add_header(evhttp_request_get_output_headers(request),
+                    "Content-Type", "text/plain; version=0.0.4");
+  evhttp_send_reply(request, HTTP_OK, "OK", buffer);
+  evbuffer_free(buffer);
+  SelfMetrics::GetInstance().Increment("prometheus_scrapes");
+}
+
+absl::Status PrometheusMetricExporter::RegisterMetric(std::string name,
+                                                      const MetricDesc& desc) {
+  if (metric_ids_.find(name) != metric_ids_.end()) {
+    return absl::AlreadyExistsError("metric already registered");
+  }
+
+  Metric metric = {};
+  metric.desc = desc;
+  metric.decoder = GetMetricDecoder(desc);
+  metric.name = absl::StrCat("lightfoot_", name);
+  metric.scale = 1;
+  std::string suffix;
+  switch (desc.unit.type) {
+    case MetricUnitType::kTime:
+      metric.scale = TimeScale(desc.unit.time);
+      suffix = "_seconds";
+      metric.buckets = &TimeBuckets();
+      break;
+    case MetricUnitType::kData:
+      metric.scale = DataScale(desc.unit.data);
+      suffix = "_bytes";
+      metric.buckets = &DataBuckets();
+      break;
+    case MetricUnitType::kNone:
+      metric.buckets = &CountBuckets();
+      break;
+  }
+  if (!absl::EndsWith(metric.name, suffix)) {
+    absl::StrAppend(&metric.name, suffix);
+  }
+  // The kernel already bucketed the samples.
+  if (desc.value_type == MetricType::kLog2Histogram) {
+    metric.buckets = &Log2Buckets(metric.scale);
+  }
+
+  const char* type;
+  switch (desc.kind) {
+    case MetricKind::kGauge:
+      type = "gauge";
+      break;
+    // Deltas are summed up into a counter.
+    case MetricKind::kDelta:
+    case MetricKind::kCumulative:
+      type = "counter";
+      absl::StrAppend(&metric.name, "_total");
+      break;
+    case MetricKind::kDistribution:
+      type = "histogram";
+      break;
+    case MetricKind::kNone:
+    default:
+      return absl::InvalidArgumentError("Unknown metric kind");
+  }
+  metric.header = absl::StrFormat("# HELP %s lightfoot %s\n# TYPE %s %s\n",
+                                  metric.name, name, metric.name, type);
+
+  metric_ids_[name] = metrics_.size();
+  metrics_.push_back(std::move(metric));
+  return absl::OkStatus();
+}
+
+absl::Status PrometheusMetricExporter::HandleData(std::string metric_name,
+                                                  void* key, void* value) {
+  auto it = metric_ids_.find(metric_name);
+  if (it == metric_ids_.end()) {
+    return absl::NotFoundError("metric_name not found");
+  }
+  Metric& metric = metrics_[it->second];
+  metric_format_t* data = (metric_format_t*)value;
+  if (data->timestamp == 0) {
+    return absl::OkStatus();
+  }
+
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
+  if (!conn.ok()) {
+    return absl::OkStatus();
+  }
+
+  auto series_it = metric.series.find(conn->index);
+  if (series_it == metric.series.end()) {
+    if (num_series_ >= max_series_) {
+      SelfMetrics::GetInstance().Increment("prometheus_series_dropped");
+      return absl::OkStatus();
+    }
+    num_series_++;
+    series_it = metric.series.insert({conn->index, Series{}}).first;
+    // Forces a reset below.
+    series_it->second.generation = conn->generation + 1;
+  }
+  Series& series = series_it->second;
+  if (series.generation != conn->generation) {
+    series = Series{};
+    series.generation = conn->generation;
+    series.labels = "{uuid=\"";
+    AppendLabelValue(&series.labels, correlator_->GetUUID(*conn));
+    series.labels.push_back('"');
+    if (metric.desc.kind == MetricKind::kDistribution) {
+      series.buckets.resize(metric.buckets->bounds.size() + 1);
+    }
+  }
+  series.poll = metric.poll;
+
+  if (metric.desc.value_type == MetricType::kLog2Histogram) {
+    const metric_hist_t& hist = ((metric_hist_format_t*)value)->data;
+    // Cumulative since the connection was first seen, only copied.
+    std::copy(hist.buckets, hist.buckets + METRIC_HIST_BUCKETS,
+              series.buckets.begin());
+    series.count = hist.count;
+    series.value = hist.sum * metric.scale;
+    series.last_timestamp = data->timestamp;
+    RenderSeries(metric, series);
+    return absl::OkStatus();
+  }
+
+  bool new_sample = data->timestamp > series.last_timestamp;
+  if (new_sample) {
+    series.last_timestamp = data->timestamp;
+  }
+  double val = metric.decoder.value(&data->data) * metric.scale;
+  switch (metric.desc.kind) {
+    case MetricKind::kGauge:
+    case MetricKind::kCumulative:
+      series.value = val;
+      break;
+    case MetricKind::kDelta:
+      if (new_sample) {
+        series.value += val;
+      }
+      break;
+    case MetricKind::kDistribution:
+      if (new_sample) {
+        auto& bounds = metric.buckets->bounds;
+        series.buckets[std::lower_bound(bounds.begin(), bounds.end(), val) -
+                       bounds.begin()]++;
+        series.value += val;
+        series.count++;
+      }
+      break;
+    case MetricKind::kNone:
+      break;
+  }
+  RenderSeries(metric, series);
+  return absl::OkStatus();
+}
+
+void PrometheusMetricExporter::RenderSeries(Metric& metric,
+                                            const Series& series) {
+  std::string& out = metric.building;
+  if (metric.desc.kind != MetricKind::kDistribution) {
+    absl::StrAppendFormat(&out, "%s%s} %.15g\n", metric.name, series.labels,
+                          series.value);
+    return;
+  }
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < metric.buckets->le.size(); i++) {
+    cumulative += series.buckets[i];
+    absl::StrAppend(&out, metric.name, "_bucket", series.labels,
+                    metric.buckets->le[i], cumulative, "\n");
+  }
+  absl::StrAppend(&out, metric.name, "_bucket", series.labels,
+                  ",le=\"+Inf\"} ", series.count, "\n");
+  absl::StrAppendFormat(&out, "%s_sum%s} %.15g\n", metric.name, series.labels,
+                        series.value);
+  absl::StrAppend(&out, metric.name, "_count", series.labels, "} ",
+                  series.count, "\n");
+}
+
+void PrometheusMetricExporter::Flush(std::string metric_name) {
+  auto it = metric_ids_.find(metric_name);
+  if (it == metric_ids_.end()) {
+    return;
+  }
+  Metric& metric = metrics_[it->second];
+  std::swap(metric.building, metric.rendered);
+  metric.building.clear();
+  // Connections missing from this poll are gone.
+  for (auto series = metric.series.begin(); series != metric.series.end();) {
+    if (series->second.poll != metric.poll) {
+      metric.series.erase(series++);
+      num_series_--;
+    } else {
+      ++series;
+    }
+  }
+  metric.poll++;
+  SelfMetrics::GetInstance().SetGauge("prometheus_series", num_series_);
+  // Activating an active event is a no-op, so the page is rendered once for
+  // all the metrics flushed in this loop iteration.
+  event_active(render_event_, EV_TIMEOUT, 0);
+}
+
+void PrometheusMetricExporter::HandleRender(evutil_socket_t, short,  // NOLINT
+                                            void* arg) {
+  static_cast<PrometheusMetricExporter*>(arg)->RenderPage();
+}
+
+void PrometheusMetricExporter::Cleanup() {
+  for (auto& metric : metrics_) {
+    for (auto series = metric.series.begin(); series != metric.series.end();) {
+      if (!correlator_->CheckConnHandle(
+              {series->first, series->second.generation})) {
+        metric.series.erase(series++);
+        num_series_--;
+      } else {
+        ++series;
+      }
+    }
+  }
+}
+
+void PrometheusMetricExporter::RenderPage() {
+  std::string& page = pages_[front_ ^ 1];
+  page.clear();
+  for (const auto& metric : metrics_) {
+    page.append(metric.header);
+    page.append(metric.rendered);
+  }
+
+  auto self_metrics = SelfMetrics::GetInstance().Snapshot();
+  for (const auto& self_metric : self_metrics) {
+    const SelfMetrics::Value& value = self_metric.second;
+    std::string name = absl::StrCat("lightfoot_self_", self_metric.first);
+    switch (value.kind) {
+      case SelfMetrics::Kind::kCounter:
+        absl::StrAppend(&page, "# TYPE ", name, "_total counter\n", name,
+                        "_total ", value.value, "\n");
+        break;
+      case SelfMetrics::Kind::kGauge:
+        absl::StrAppend(&page, "# TYPE ", name, " gauge\n", name, " ",
+                        value.value, "\n");
+        break;
+      case SelfMetrics::Kind::kLatency:
+        absl::StrAppendFormat(
+            &page, "# TYPE %s_seconds summary\n%s_seconds_sum %.15g\n"
+            "%s_seconds_count %d\n",
+            name, name, absl::ToDoubleSeconds(value.sum), name, value.count);
+        break;
+    }
+  }
+  front_ ^= 1;
+}
+
+}  // namespace prober
@@ -0,0 +1,113 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_PROMETHEUS_EXPORTER_H_
+#define _EXPORTERS_PROMETHEUS_EXPORTER_H_
+
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "exporters/metric_decoder.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/metric_exporter.h"
+
+#define PROMETHEUS_MAX_SERIES 100000
+
+namespace prober {
+
+struct PrometheusBuckets;
+
+/* Serves metrics in the Prometheus text exposition format on
+  http://<host>:<port>/metrics from the event base lightfoot already runs.
+  Each metric's series are rendered while its map is read. Metrics polled
+  together are flushed in the same event loop iteration, the page is then
+  assembled once into a second buffer, so a scrape only copies the last
+  complete page. */
+class PrometheusMetricExporter : public MetricExporterInterface {
+ public:
+  PrometheusMetricExporter() = delete;
+  PrometheusMetricExporter(struct event_base* base, uint16_t port,
+                           uint32_t max_series = PROMETHEUS_MAX_SERIES);
+  ~PrometheusMetricExporter() override;
+  absl::Status Init() override;
+  absl::Status RegisterMetric(std::string name,
+                              const MetricDesc& desc) override;
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override;
+  void Flush(std::string metric_name) override;
+  void Cleanup();
+
+  // Last complete exposition page.
+  const std::string& Page() const { return pages_[front_]; }
+
+ private:
+  struct Series {
+    uint32_t generation;
+    // Poll in which the series was last seen.
+    uint32_t poll;
+    uint64_t last_timestamp;
+    // Pre-rendered labels without the closing brace.
+    std::string labels;
+    // Gauge, counter or distribution sum in base units.
+    double value;
+    // Distribution only, per bucket counts.
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+  };
+  struct Metric {
+    MetricDesc desc;
+    MetricDecoder decoder;
+    // Exposition name and # HELP/# TYPE lines.
+    std::string name;
+    std::string header;
+    // Multiplier from the raw value to seconds or bytes.
+    double scale;
+    // Distribution only.
+    const PrometheusBuckets* buckets;
+    uint32_t poll;
+    // Keyed by connection handle index.
+    absl::flat_hash_map<uint32_t, Series> series;
+    // Series of the poll in progress and of the last complete poll.
+    std::string building;
+    std::string rendered;
+  };
+
+  static void ServeMetrics(struct evhttp_request* request, void* arg);
+  static void RenderSeries(Metric& metric, const Series& series);
+  static void HandleRender(evutil_socket_t, short, void* arg);  // NOLINT
+  void RenderPage();
+
+  struct event_base* base_;
+  uint16_t port_;
+  uint32_t max_series_;
+  uint32_t num_series_;
+  struct evhttp* http_;
+  // Activated by Flush, renders the page after the other flushes of the poll.
+  struct event* render_event_;
+  absl::flat_hash_map<std::string, uint32_t> metric_ids_;
+  std::vector<Metric> metrics_;
+  // Double buffered page, pages_[front_] is served.
+  std::string pages_[2];
+  int front_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_PROMETHEUS_EXPORTER_H_
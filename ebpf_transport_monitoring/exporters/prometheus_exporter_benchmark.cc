@@ -0,0 +1,174 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cost of a poll of the Prometheus exporter with 100k series: every series
+// is rendered while the map is read and the page is assembled once the
+// metrics of the poll are flushed.
+
+#include <event2/event.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "exporters/prometheus_exporter.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+namespace {
+
+constexpr uint32_t kSeries = 100000;
+
+// Correlator that knows kSeries connections with ids 1 to kSeries.
+class FakeCorrelator : public CorrelatorInterface {
+ public:
+  FakeCorrelator() {
+    absl::MutexLock lock(&mu_);
+    for (uint64_t conn_id = 1; conn_id <= kSeries; conn_id++) {
+      connection_map_[conn_id] =
+          NewConnHandle(absl::StrCat("uuid-", conn_id));
+    }
+  }
+
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override {
+    return absl::OkStatus();
+  }
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override {
+    return absl::OkStatus();
+  }
+  void Cleanup() override {}
+  bool CheckUUID(std::string uuid) override { return true; }
+  absl::flat_hash_map<std::string, std::string> GetLabels(
+      std::string uuid) override {
+    return {};
+  }
+  std::vector<std::string> GetLabelKeys() override { return {}; }
+  std::vector<DataCtx*>& GetLogSources() override { return sources_; }
+  std::vector<DataCtx*>& GetMetricSources() override { return sources_; }
+  absl::Status Init() override { return absl::OkStatus(); }
+
+ private:
+  std::vector<DataCtx*> sources_;
+};
+
+FakeCorrelator& Correlator() {
+  static FakeCorrelator* correlator = new FakeCorrelator();
+  return *correlator;
+}
+
+// The page is rendered from the event loop, as in lightfoot.
+struct event_base* Base() {
+  static struct event_base* base = event_base_new();
+  return base;
+}
+
+std::unique_ptr<PrometheusMetricExporter> NewExporter(const MetricDesc& desc) {
+  auto exporter =
+      std::make_unique<PrometheusMetricExporter>(Base(), 0, kSeries);
+  exporter->RegisterCorrelator(&Correlator());
+  exporter->RegisterMetric("metric", desc).IgnoreError();
+  return exporter;
+}
+
+void BM_PollGauge(benchmark::State& state) {
+  MetricUnit_t unit = {MetricUnitType::kData};
+  unit.data = MetricDataType::kbytes;
+  auto exporter = NewExporter(
+      {MetricType::kUint64, MetricType::kUint64, MetricKind::kGauge, unit});
+  uint64_t timestamp = 1;
+  for (auto _ : state) {
+    for (uint64_t conn_id = 1; conn_id <= kSeries; conn_id++) {
+      metric_format_t value = {timestamp, conn_id * 1024};
+      exporter->HandleData("metric", &conn_id, &value).IgnoreError();
+    }
+    exporter->Flush("metric");
+    event_base_loop(Base(), EVLOOP_NONBLOCK);
+    timestamp++;
+  }
+  state.SetItemsProcessed(state.iterations() * kSeries);
+  state.SetBytesProcessed(state.iterations() * exporter->Page().size());
+}
+BENCHMARK(BM_PollGauge)->Unit(benchmark::kMillisecond);
+
+void BM_PollLog2Histogram(benchmark::State& state) {
+  MetricUnit_t unit = {MetricUnitType::kTime};
+  unit.time = MetricTimeType::knsec;
+  auto exporter =
+      NewExporter({MetricType::kUint64, MetricType::kLog2Histogram,
+                   MetricKind::kDistribution, unit});
+  metric_hist_format_t value = {};
+  for (uint32_t i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    value.data.buckets[i] = i;
+    value.data.count += i;
+  }
+  value.data.sum = 1000000;
+  for (auto _ : state) {
+    value.timestamp++;
+    for (uint64_t conn_id = 1; conn_id <= kSeries; conn_id++) {
+      exporter->HandleData("metric", &conn_id, &value).IgnoreError();
+    }
+    exporter->Flush("metric");
+    event_base_loop(Base(), EVLOOP_NONBLOCK);
+  }
+  state.SetItemsProcessed(state.iterations() * kSeries);
+  state.SetBytesProcessed(state.iterations() * exporter->Page().size());
+}
+BENCHMARK(BM_PollLog2Histogram)->Unit(benchmark::kMillisecond);
+
+// kSeries series spread over the metrics of a poll, the page is assembled
+// once and not on every metric's Flush.
+void BM_PollMetrics(benchmark::State& state) {
+  const int metrics = state.range(0);
+  MetricUnit_t unit = {MetricUnitType::kData};
+  unit.data = MetricDataType::kbytes;
+  MetricDesc desc = {MetricType::kUint64, MetricType::kUint64,
+                     MetricKind::kGauge, unit};
+  auto exporter =
+      std::make_unique<PrometheusMetricExporter>(Base(), 0, kSeries);
+  exporter->RegisterCorrelator(&Correlator());
+  std::vector<std::string> names;
+  for (int i = 0; i < metrics; i++) {
+    names.push_back(absl::StrCat("metric_", i));
+    exporter->RegisterMetric(names.back(), desc).IgnoreError();
+  }
+  uint64_t timestamp = 1;
+  for (auto _ : state) {
+    for (uint64_t conn_id = 1; conn_id <= kSeries; conn_id++) {
+      metric_format_t value = {timestamp, conn_id * 1024};
+      exporter->HandleData(names[conn_id % metrics], &conn_id, &value)
+          .IgnoreError();
+    }
+    for (const auto& name : names) {
+      exporter->Flush(name);
+    }
+    event_base_loop(Base(), EVLOOP_NONBLOCK);
+    timestamp++;
+  }
+  state.SetItemsProcessed(state.iterations() * kSeries);
+  state.SetBytesProcessed(state.iterations() * exporter->Page().size());
+}
+BENCHMARK(BM_PollMetrics)->Arg(16)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace prober
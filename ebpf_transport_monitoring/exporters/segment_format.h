@@ -0,0 +1,101 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_SEGMENT_FORMAT_H_
+#define _EXPORTERS_SEGMENT_FORMAT_H_
+
+#include <cstdint>
+#include <string>
+
+/* Segment files written by the file exporters.
+
+  A segment starts with a header:
+    "LFSG" | u8 version | u8 kind | u8 column count |
+    (u8 column, u8 encoding) per column | zigzag varint realtime offset
+  The realtime offset converts the CLOCK_MONOTONIC timestamps reported by
+  eBPF to unix time in ns.
+
+  It is followed by records: u8 type | varint length | payload.
+    kName:  varint id | name            Source/metric name dictionary.
+    kConn:  varint id | uuid            Connection dictionary.
+    kBlock: varint rows | varint min ts | varint max ts |
+            (varint length | data) per column in header order.
+  Dictionaries are local to a segment so every file can be read on its own.
+  The min/max time of each block lets readers skip blocks without decoding
+  them. */
+
+namespace prober {
+namespace segment {
+
+constexpr char kMagic[] = "LFSG";
+constexpr uint8_t kVersion = 1;
+
+enum class Kind : uint8_t { kLog = 0, kMetric = 1 };
+
+enum class RecordType : uint8_t { kName = 1, kConn = 2, kBlock = 3 };
+
+enum class Column : uint8_t {
+  kTimestamp = 0,
+  kConn = 1,
+  kName = 2,
+  kValue = 3,
+  kEvent = 4,
+};
+
+enum class Encoding : uint8_t {
+  // Zigzag varint of the difference to the previous row, the first row is
+  // relative to the block min time.
+  kDeltaVarint = 0,
+  kVarint = 1,
+  kZigZagVarint = 2,
+  // varint packed sent_recv, category and type | varint pid | varint length |
+  // event bytes.
+  kEvent = 3,
+};
+
+inline uint64_t ZigZag(int64_t val) {
+  return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t val) {
+  return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
+
+inline void PutVarint(std::string* out, uint64_t val) {
+  while (val >= 0x80) {
+    out->push_back(static_cast<char>(val | 0x80));
+    val >>= 7;
+  }
+  out->push_back(static_cast<char>(val));
+}
+
+// Returns false if the input ends before the varint does.
+inline bool GetVarint(const char** data, const char* end, uint64_t* val) {
+  uint64_t result = 0;
+  for (uint32_t shift = 0; shift < 64 && *data < end; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(**data);
+    (*data)++;
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *val = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace segment
+}  // namespace prober
+
+#endif  // _EXPORTERS_SEGMENT_FORMAT_H_
@@ -0,0 +1,202 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/segment_reader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "events.h"
+#include "exporters/segment_format.h"
+#include "zlib.h"
+
+namespace prober {
+
+using segment::GetVarint;
+using segment::UnZigZag;
+
+static const std::string kUnknown = "unknown";
+
+SegmentReader::SegmentReader(std::string path)
+    : path_(path), offset_(0), kind_(segment::Kind::kLog),
+      realtime_offset_(0) {}
+
+absl::Status SegmentReader::Open() {
+  // gzread passes uncompressed files through, so compressed archives of
+  // rotated segments can be read directly.
+  gzFile file = gzopen(path_.c_str(), "rb");
+  if (file == nullptr) {
+    return absl::NotFoundError(absl::StrFormat("Cannot open %s", path_));
+  }
+  char buffer[64 * 1024];
+  int len;
+  contents_.clear();
+  while ((len = gzread(file, buffer, sizeof(buffer))) > 0) {
+    contents_.append(buffer, len);
+  }
+  gzclose(file);
+  if (len < 0) {
+    return absl::DataLossError(absl::StrFormat("Cannot read %s", path_));
+  }
+
+  const char* data = contents_.data();
+  const char* end = data + contents_.size();
+  if (contents_.size() < 7 || memcmp(data, segment::kMagic, 4) != 0) {
+    return absl::InvalidArgumentError("Not a segment file");
+  }
+  if (static_cast<uint8_t>(data[4]) != segment::kVersion) {
+    return absl::UnimplementedError(
+        absl::StrFormat("Unsupported segment version %d", data[4]));
+  }
+  kind_ = static_cast<segment::Kind>(data[5]);
+  uint8_t columns = data[6];
+  data += 7;
+  // Columns are always written in the same order, the header only needs to
+  // be skipped once their number is known.
+  if (columns != 4) {
+    return absl::UnimplementedError(
+        absl::StrFormat("Unsupported segment with %d columns", columns));
+  }
+  if (end - data < columns * 2) {
+    return absl::DataLossError("Truncated segment header");
+  }
+  data += columns * 2;
+  uint64_t offset;
+  if (!GetVarint(&data, end, &offset)) {
+    return absl::DataLossError("Truncated segment header");
+  }
+  realtime_offset_ = UnZigZag(offset);
+  offset_ = data - contents_.data();
+  return absl::OkStatus();
+}
+
+absl::Status SegmentReader::Read(
+    uint64_t from, uint64_t to,
+    const std::function<void(const SegmentRow&)>& row_fn) {
+  const char* data = contents_.data() + offset_;
+  const char* end = contents_.data() + contents_.size();
+  while (data < end) {
+    auto type = static_cast<segment::RecordType>(*data++);
+    uint64_t length;
+    if (!GetVarint(&data, end, &length) ||
+        length > static_cast<uint64_t>(end - data)) {
+      // The writer may have been stopped in the middle of a record.
+      return absl::DataLossError("Truncated segment record");
+    }
+    const char* record_end = data + length;
+    switch (type) {
+      case segment::RecordType::kName:
+      case segment::RecordType::kConn: {
+        uint64_t id;
+        if (!GetVarint(&data, record_end, &id)) {
+          return absl::DataLossError("Corrupted dictionary record");
+        }
+        auto& dict = type == segment::RecordType::kName ? names_ : conns_;
+        dict[id] = std::string(data, record_end - data);
+        break;
+      }
+      case segment::RecordType::kBlock: {
+        auto status = ReadBlock(data, record_end, from, to, row_fn);
+        if (!status.ok()) {
+          return status;
+        }
+        break;
+      }
+      default:
+        // Unknown records are skipped for forward compatibility.
+        break;
+    }
+    data = record_end;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SegmentReader::ReadBlock(
+    const char* data, const char* end, uint64_t from, uint64_t to,
+    const std::function<void(const SegmentRow&)>& row_fn) {
+  uint64_t rows, min_ts, max_ts;
+  if (!GetVarint(&data, end, &rows) || !GetVarint(&data, end, &min_ts) ||
+      !GetVarint(&data, end, &max_ts)) {
+    return absl::DataLossError("Corrupted block header");
+  }
+  if (max_ts + realtime_offset_ < from || min_ts + realtime_offset_ > to) {
+    return absl::OkStatus();
+  }
+
+  const char* columns[4];
+  const char* column_ends[4];
+  for (int i = 0; i < 4; i++) {
+    uint64_t length;
+    if (!GetVarint(&data, end, &length) ||
+        length > static_cast<uint64_t>(end - data)) {
+      return absl::DataLossError("Corrupted block column");
+    }
+    columns[i] = data;
+    column_ends[i] = data + length;
+    data += length;
+  }
+
+  SegmentRow row = {};
+  uint64_t ts = min_ts;
+  for (uint64_t i = 0; i < rows; i++) {
+    uint64_t delta, conn, name, val;
+    if (!GetVarint(&columns[0], column_ends[0], &delta) ||
+        !GetVarint(&columns[1], column_ends[1], &conn) ||
+        !GetVarint(&columns[2], column_ends[2], &name)) {
+      return absl::DataLossError("Corrupted block row");
+    }
+    ts += UnZigZag(delta);
+    if (kind_ == segment::Kind::kMetric) {
+      if (!GetVarint(&columns[3], column_ends[3], &val)) {
+        return absl::DataLossError("Corrupted block row");
+      }
+      row.value = UnZigZag(val);
+    } else {
+      uint64_t meta, pid, length;
+      if (!GetVarint(&columns[3], column_ends[3], &meta) ||
+          !GetVarint(&columns[3], column_ends[3], &pid) ||
+          !GetVarint(&columns[3], column_ends[3], &length) ||
+          length > static_cast<uint64_t>(column_ends[3] - columns[3])) {
+        return absl::DataLossError("Corrupted block row");
+      }
+      if (length > EC_MAX_EVENT_DATA_SIZE) {
+        return absl::DataLossError("Event length too large");
+      }
+      row.sent_recv = meta & 0x1;
+      row.event_category = (meta >> 1) & 0xf;
+      row.event_type = (meta >> 5) & 0x7f;
+      row.pid = pid;
+      row.event_info.assign(columns[3], length);
+      columns[3] += length;
+    }
+
+    uint64_t timestamp = ts + realtime_offset_;
+    if (timestamp < from || timestamp > to) {
+      continue;
+    }
+    row.timestamp = timestamp;
+    auto name_it = names_.find(name);
+    row.name = name_it == names_.end() ? &kUnknown : &name_it->second;
+    auto conn_it = conns_.find(conn);
+    row.uuid = conn_it == conns_.end() ? &kUnknown : &conn_it->second;
+    row_fn(row);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace prober
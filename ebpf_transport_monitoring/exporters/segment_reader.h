@@ -0,0 +1,73 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_SEGMENT_READER_H_
+#define _EXPORTERS_SEGMENT_READER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "exporters/segment_format.h"
+
+namespace prober {
+
+struct SegmentRow {
+  // Unix time in ns.
+  uint64_t timestamp;
+  const std::string* name;
+  const std::string* uuid;
+  // Only valid for metric segments.
+  int64_t value;
+  // Only valid for log segments.
+  uint8_t sent_recv;
+  uint8_t event_category;
+  uint8_t event_type;
+  uint32_t pid;
+  std::string event_info;
+};
+
+/* Reads a segment file written by SegmentWriter. */
+class SegmentReader {
+ public:
+  SegmentReader() = delete;
+  explicit SegmentReader(std::string path);
+  absl::Status Open();
+  segment::Kind kind() const { return kind_; }
+
+  // Calls row_fn for every row with timestamp in [from, to] (unix ns).
+  // Blocks entirely outside the range are skipped without being decoded.
+  absl::Status Read(uint64_t from, uint64_t to,
+                    const std::function<void(const SegmentRow&)>& row_fn);
+
+ private:
+  absl::Status ReadBlock(const char* data, const char* end, uint64_t from,
+                         uint64_t to,
+                         const std::function<void(const SegmentRow&)>& row_fn);
+
+  std::string path_;
+  std::string contents_;
+  size_t offset_;
+  segment::Kind kind_;
+  int64_t realtime_offset_;
+  absl::flat_hash_map<uint64_t, std::string> names_;
+  absl::flat_hash_map<uint64_t, std::string> conns_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_SEGMENT_READER_H_
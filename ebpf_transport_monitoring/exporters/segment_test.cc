@@ -0,0 +1,239 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "events.h"
+#include "exporters/segment_format.h"
+#include "exporters/segment_reader.h"
+#include "exporters/segment_writer.h"
+#include "gtest/gtest.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+namespace {
+
+constexpr uint64_t kSecond = 1000 * 1000 * 1000;
+
+struct Row {
+  uint64_t timestamp;
+  std::string name;
+  std::string uuid;
+  int64_t value;
+  uint8_t sent_recv;
+  uint8_t event_category;
+  uint8_t event_type;
+  uint32_t pid;
+  std::string event_info;
+};
+
+class SegmentTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::string dir =
+        ::testing::TempDir() + "/" +
+        ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    mkdir(dir.c_str(), 0755);
+    path_ = dir + "/rows.seg";
+    unlink(path_.c_str());
+    unlink((path_ + ".1").c_str());
+  }
+
+  absl::Status Read(uint64_t from, uint64_t to, std::vector<Row>* rows) {
+    SegmentReader reader(path_);
+    auto status = reader.Open();
+    if (!status.ok()) {
+      return status;
+    }
+    return reader.Read(from, to, [rows](const SegmentRow& row) {
+      rows->push_back({row.timestamp, *row.name, *row.uuid, row.value,
+                       row.sent_recv, row.event_category, row.event_type,
+                       row.pid, row.event_info});
+    });
+  }
+
+  // Writes one metric row per second for bpf times 1s to 10s, in two blocks.
+  void WriteMetrics() {
+    SegmentWriter writer(path_, segment::Kind::kMetric, 1 << 20, 2);
+    ASSERT_TRUE(writer.Open().ok());
+    uint32_t name = writer.AddName("tcp_srtt");
+    ConnHandle conn = {3, 1};
+    writer.AddConn(conn, "conn-a");
+    for (uint64_t i = 1; i <= 10; i++) {
+      ASSERT_TRUE(writer.AppendMetric(name, conn, i * kSecond, i * 10).ok());
+      if (i == 5) {
+        ASSERT_TRUE(writer.Flush().ok());
+      }
+    }
+  }
+
+  void Append(const std::string& data) {
+    FILE* file = fopen(path_.c_str(), "ab");
+    ASSERT_NE(file, nullptr);
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+  }
+
+  std::string path_;
+};
+
+TEST_F(SegmentTest, ReadsMetricRows) {
+  {
+    SegmentWriter writer(path_, segment::Kind::kMetric, 1 << 20, 2);
+    ASSERT_TRUE(writer.Open().ok());
+    uint32_t srtt = writer.AddName("tcp_srtt");
+    uint32_t cwnd = writer.AddName("tcp_snd_cwnd");
+    ConnHandle a = {1, 1};
+    ConnHandle b = {2, 7};
+    writer.AddConn(a, "conn-a");
+    writer.AddConn(b, "conn-b");
+    ASSERT_TRUE(writer.AppendMetric(srtt, a, 2 * kSecond, 1500).ok());
+    ASSERT_TRUE(writer.AppendMetric(cwnd, b, 3 * kSecond, -4).ok());
+    // Rows are not required to be in time order.
+    ASSERT_TRUE(writer.AppendMetric(srtt, b, kSecond, 0).ok());
+  }
+
+  std::vector<Row> rows;
+  ASSERT_TRUE(Read(0, UINT64_MAX, &rows).ok());
+  ASSERT_EQ(rows.size(), 3);
+  EXPECT_EQ(rows[0].name, "tcp_srtt");
+  EXPECT_EQ(rows[0].uuid, "conn-a");
+  EXPECT_EQ(rows[0].value, 1500);
+  EXPECT_EQ(rows[1].name, "tcp_snd_cwnd");
+  EXPECT_EQ(rows[1].uuid, "conn-b");
+  EXPECT_EQ(rows[1].value, -4);
+  EXPECT_EQ(rows[2].name, "tcp_srtt");
+  EXPECT_EQ(rows[2].uuid, "conn-b");
+  EXPECT_EQ(rows[2].value, 0);
+  // All timestamps are shifted by the same realtime offset.
+  EXPECT_EQ(rows[1].timestamp - rows[0].timestamp, kSecond);
+  EXPECT_EQ(rows[0].timestamp - rows[2].timestamp, kSecond);
+}
+
+TEST_F(SegmentTest, ReadsLogRows) {
+  ec_ebpf_events_t event;
+  memset(&event, 0, sizeof(event));
+  event.mdata.sent_recv = 1;
+  event.mdata.event_category = 2;
+  event.mdata.event_type = 5;
+  event.mdata.pid = 4242;
+  event.mdata.timestamp = 5 * kSecond;
+  event.mdata.length = 6;
+  memcpy(event.event_info, "abc\0de", 6);
+  {
+    SegmentWriter writer(path_, segment::Kind::kLog, 1 << 20, 2);
+    ASSERT_TRUE(writer.Open().ok());
+    uint32_t name = writer.AddName("tcp_events");
+    ConnHandle conn = {1, 1};
+    writer.AddConn(conn, "conn-a");
+    ASSERT_TRUE(writer.AppendLog(name, conn, &event).ok());
+    event.mdata.length = EC_MAX_EVENT_DATA_SIZE + 1;
+    EXPECT_FALSE(writer.AppendLog(name, conn, &event).ok());
+  }
+
+  SegmentReader reader(path_);
+  ASSERT_TRUE(reader.Open().ok());
+  EXPECT_EQ(reader.kind(), segment::Kind::kLog);
+  std::vector<Row> rows;
+  ASSERT_TRUE(Read(0, UINT64_MAX, &rows).ok());
+  ASSERT_EQ(rows.size(), 1);
+  EXPECT_EQ(rows[0].name, "tcp_events");
+  EXPECT_EQ(rows[0].uuid, "conn-a");
+  EXPECT_EQ(rows[0].sent_recv, 1);
+  EXPECT_EQ(rows[0].event_category, 2);
+  EXPECT_EQ(rows[0].event_type, 5);
+  EXPECT_EQ(rows[0].pid, 4242);
+  EXPECT_EQ(rows[0].event_info, std::string("abc\0de", 6));
+}
+
+TEST_F(SegmentTest, FiltersByTimeRange) {
+  WriteMetrics();
+  std::vector<Row> all;
+  ASSERT_TRUE(Read(0, UINT64_MAX, &all).ok());
+  ASSERT_EQ(all.size(), 10);
+  // Unix time of bpf time 0.
+  uint64_t base = all[0].timestamp - kSecond;
+
+  // Spans both blocks.
+  std::vector<Row> rows;
+  ASSERT_TRUE(Read(base + 4 * kSecond, base + 7 * kSecond, &rows).ok());
+  ASSERT_EQ(rows.size(), 4);
+  EXPECT_EQ(rows[0].value, 40);
+  EXPECT_EQ(rows[3].value, 70);
+
+  // Only in the second block.
+  rows.clear();
+  ASSERT_TRUE(Read(base + 9 * kSecond, UINT64_MAX, &rows).ok());
+  ASSERT_EQ(rows.size(), 2);
+  EXPECT_EQ(rows[0].value, 90);
+  EXPECT_EQ(rows[1].value, 100);
+
+  rows.clear();
+  ASSERT_TRUE(Read(base + 11 * kSecond, UINT64_MAX, &rows).ok());
+  EXPECT_TRUE(rows.empty());
+}
+
+TEST_F(SegmentTest, RejectsTruncatedBlock) {
+  WriteMetrics();
+  struct stat st;
+  ASSERT_EQ(stat(path_.c_str(), &st), 0);
+  ASSERT_EQ(truncate(path_.c_str(), st.st_size - 3), 0);
+
+  std::vector<Row> rows;
+  auto status = Read(0, UINT64_MAX, &rows);
+  EXPECT_EQ(status.code(), absl::StatusCode::kDataLoss);
+  // Rows of the complete first block are still read.
+  EXPECT_EQ(rows.size(), 5);
+}
+
+TEST_F(SegmentTest, RejectsCorruptBlock) {
+  WriteMetrics();
+  // A block claiming 5 rows with empty columns.
+  std::string block;
+  segment::PutVarint(&block, 5);
+  segment::PutVarint(&block, kSecond);
+  segment::PutVarint(&block, 2 * kSecond);
+  for (int i = 0; i < 4; i++) {
+    segment::PutVarint(&block, 0);
+  }
+  std::string record(1, static_cast<char>(segment::RecordType::kBlock));
+  segment::PutVarint(&record, block.size());
+  Append(record + block);
+
+  std::vector<Row> rows;
+  auto status = Read(0, UINT64_MAX, &rows);
+  EXPECT_EQ(status.code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(rows.size(), 10);
+}
+
+TEST_F(SegmentTest, RejectsOtherFiles) {
+  FILE* file = fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  fputs("time=1 name=tcp_srtt value=10\n", file);
+  fclose(file);
+
+  SegmentReader reader(path_);
+  EXPECT_EQ(reader.Open().code(), absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace prober
@@ -0,0 +1,97 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <ostream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "exporters/exporters_util.h"
+#include "exporters/segment_reader.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cout << "Usage: ./segment_tool <segment_file> [from unix seconds] "
+                 "[to unix seconds] [name] [connection]"
+              << std::endl;
+    return 0;
+  }
+
+  uint64_t from = 0;
+  uint64_t to = std::numeric_limits<uint64_t>::max();
+  if (argc > 2) {
+    from = strtoull(argv[2], nullptr, 10) * 1000000000;
+  }
+  if (argc > 3) {
+    to = strtoull(argv[3], nullptr, 10) * 1000000000;
+  }
+  std::string name_filter = argc > 4 ? argv[4] : "";
+  std::string conn_filter = argc > 5 ? argv[5] : "";
+
+  prober::SegmentReader reader(argv[1]);
+  absl::Status status = reader.Open();
+  if (!status.ok()) {
+    std::cout << status << std::endl;
+    return -1;
+  }
+
+  bool is_log = reader.kind() == prober::segment::Kind::kLog;
+  status = reader.Read(from, to, [&](const prober::SegmentRow& row) {
+    if (!name_filter.empty() && *row.name != name_filter) {
+      return;
+    }
+    if (!conn_filter.empty() && *row.uuid != conn_filter) {
+      return;
+    }
+    std::string time = absl::FormatTime(absl::FromUnixNanos(row.timestamp));
+    if (!is_log) {
+      std::cout << time << "," << *row.uuid << "," << *row.name << ","
+                << row.value << "\n";
+      return;
+    }
+    // Rebuild the event so logs print the same as the text exporters.
+    if (row.event_info.size() > EC_MAX_EVENT_DATA_SIZE) {
+      std::cout << time << ","
+                << absl::DataLossError("Event length too large") << "\n";
+      return;
+    }
+    ec_ebpf_events_t event = {};
+    event.mdata.sent_recv = row.sent_recv;
+    event.mdata.event_category = row.event_category;
+    event.mdata.event_type = row.event_type;
+    event.mdata.length = row.event_info.size();
+    event.mdata.pid = row.pid;
+    memcpy(event.event_info, row.event_info.data(), row.event_info.size());
+    event.mdata.timestamp = row.timestamp;
+    std::string name = *row.name;
+    auto log = prober::ExportersUtil::GetLogString(name, *row.uuid, &event);
+    if (!log.ok()) {
+      std::cout << time << "," << log.status() << "\n";
+      return;
+    }
+    std::cout << time << "," << *log << "\n";
+  });
+  if (!status.ok()) {
+    std::cout << status << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,296 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/segment_writer.h"
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "events.h"
+#include "exporters/segment_format.h"
+
+namespace prober {
+
+// Rows buffered before a block is written.
+#define SEGMENT_BLOCK_ROWS 4096
+
+using segment::PutVarint;
+using segment::ZigZag;
+
+static constexpr uint64_t kSecToNanosecFactor = 1000 * 1000 * 1000;
+
+static std::string RotatedName(const std::string& path, uint32_t index) {
+  if (index == 0) {
+    return path;
+  }
+  return absl::StrFormat("%s.%d", path, index);
+}
+
+SegmentWriter::SegmentWriter(std::string path, segment::Kind kind,
+                             uint32_t max_file_size, uint8_t max_files)
+    : path_(path),
+      kind_(kind),
+      max_file_size_(max_file_size),
+      max_files_(max_files),
+      file_(nullptr),
+      file_size_(0),
+      rows_(0),
+      min_ts_(0),
+      max_ts_(0) {}
+
+SegmentWriter::~SegmentWriter() {
+  if (file_ != nullptr) {
+    Flush().IgnoreError();
+    fclose(file_);
+  }
+}
+
+absl::Status SegmentWriter::Open() {
+  // The active segment of an earlier run is rotated instead of truncated.
+  struct stat st;
+  if (stat(path_.c_str(), &st) == 0 && st.st_size > 0) {
+    auto status = RenameFiles();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  file_ = fopen(path_.c_str(), "wb");
+  if (file_ == nullptr) {
+    return absl::InternalError(
+        absl::StrFormat("Could not open %s: %s", path_, strerror(errno)));
+  }
+  file_size_ = 0;
+  conn_ids_.clear();
+  conns_.clear();
+  auto status = WriteHeader();
+  if (!status.ok()) {
+    return status;
+  }
+  return WriteDictionary();
+}
+
+absl::Status SegmentWriter::WriteHeader() {
+  std::string header(segment::kMagic, 4);
+  header.push_back(segment::kVersion);
+  header.push_back(static_cast<char>(kind_));
+  header.push_back(4);
+  header.push_back(static_cast<char>(segment::Column::kTimestamp));
+  header.push_back(static_cast<char>(segment::Encoding::kDeltaVarint));
+  header.push_back(static_cast<char>(segment::Column::kConn));
+  header.push_back(static_cast<char>(segment::Encoding::kVarint));
+  header.push_back(static_cast<char>(segment::Column::kName));
+  header.push_back(static_cast<char>(segment::Encoding::kVarint));
+  if (kind_ == segment::Kind::kMetric) {
+    header.push_back(static_cast<char>(segment::Column::kValue));
+    header.push_back(static_cast<char>(segment::Encoding::kZigZagVarint));
+  } else {
+    header.push_back(static_cast<char>(segment::Column::kEvent));
+    header.push_back(static_cast<char>(segment::Encoding::kEvent));
+  }
+
+  struct timespec mono, real;
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  int64_t offset = (real.tv_sec - mono.tv_sec) * kSecToNanosecFactor +
+                   (real.tv_nsec - mono.tv_nsec);
+  PutVarint(&header, ZigZag(offset));
+
+  if (fwrite(header.data(), 1, header.size(), file_) != header.size()) {
+    return absl::InternalError("Could not write segment header");
+  }
+  file_size_ += header.size();
+  return absl::OkStatus();
+}
+
+absl::Status SegmentWriter::WriteRecord(segment::RecordType type,
+                                        const std::string& data) {
+  std::string record;
+  record.push_back(static_cast<char>(type));
+  PutVarint(&record, data.size());
+  record.append(data);
+  if (fwrite(record.data(), 1, record.size(), file_) != record.size()) {
+    return absl::InternalError("Could not write segment record");
+  }
+  file_size_ += record.size();
+  return absl::OkStatus();
+}
+
+absl::Status SegmentWriter::WriteDictionary() {
+  for (uint32_t i = 0; i < names_.size(); i++) {
+    std::string data;
+    PutVarint(&data, i);
+    data.append(names_[i]);
+    auto status = WriteRecord(segment::RecordType::kName, data);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+uint32_t SegmentWriter::AddName(const std::string& name) {
+  auto it = name_ids_.find(name);
+  if (it != name_ids_.end()) {
+    return it->second;
+  }
+  uint32_t id = names_.size();
+  names_.push_back(name);
+  name_ids_[name] = id;
+  if (file_ != nullptr) {
+    std::string data;
+    PutVarint(&data, id);
+    data.append(name);
+    WriteRecord(segment::RecordType::kName, data).IgnoreError();
+  }
+  return id;
+}
+
+bool SegmentWriter::HasConn(ConnHandle conn) {
+  return conn_ids_.find(ConnKey(conn)) != conn_ids_.end();
+}
+
+void SegmentWriter::AddConn(ConnHandle conn, const std::string& uuid) {
+  uint32_t id = conns_.size();
+  conns_.push_back(uuid);
+  conn_ids_[ConnKey(conn)] = id;
+  if (file_ != nullptr) {
+    std::string data;
+    PutVarint(&data, id);
+    data.append(uuid);
+    WriteRecord(segment::RecordType::kConn, data).IgnoreError();
+  }
+}
+
+void SegmentWriter::AddRow(uint32_t name_id, ConnHandle conn,
+                           uint64_t timestamp) {
+  if (rows_ == 0 || timestamp < min_ts_) {
+    min_ts_ = timestamp;
+  }
+  if (rows_ == 0 || timestamp > max_ts_) {
+    max_ts_ = timestamp;
+  }
+  rows_++;
+  timestamps_.push_back(timestamp);
+  PutVarint(&conn_column_, conn_ids_[ConnKey(conn)]);
+  PutVarint(&name_column_, name_id);
+}
+
+absl::Status SegmentWriter::AppendMetric(uint32_t name_id, ConnHandle conn,
+                                         uint64_t timestamp, int64_t value) {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("Segment not open");
+  }
+  AddRow(name_id, conn, timestamp);
+  PutVarint(&value_column_, ZigZag(value));
+  if (rows_ >= SEGMENT_BLOCK_ROWS) {
+    return Flush();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SegmentWriter::AppendLog(uint32_t name_id, ConnHandle conn,
+                                      const ec_ebpf_events_t* const event) {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("Segment not open");
+  }
+  uint32_t length = event->mdata.length;
+  if (length > EC_MAX_EVENT_DATA_SIZE) {
+    return absl::InvalidArgumentError("Event length too large");
+  }
+  AddRow(name_id, conn, event->mdata.timestamp);
+  PutVarint(&value_column_, event->mdata.sent_recv |
+                                (event->mdata.event_category << 1) |
+                                (event->mdata.event_type << 5));
+  PutVarint(&value_column_, event->mdata.pid);
+  PutVarint(&value_column_, length);
+  value_column_.append(reinterpret_cast<const char*>(event->event_info),
+                       length);
+  if (rows_ >= SEGMENT_BLOCK_ROWS) {
+    return Flush();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SegmentWriter::Flush() {
+  if (file_ == nullptr || rows_ == 0) {
+    return absl::OkStatus();
+  }
+  std::string ts_column;
+  uint64_t prev = min_ts_;
+  for (auto ts : timestamps_) {
+    PutVarint(&ts_column, ZigZag(static_cast<int64_t>(ts - prev)));
+    prev = ts;
+  }
+
+  std::string block;
+  PutVarint(&block, rows_);
+  PutVarint(&block, min_ts_);
+  PutVarint(&block, max_ts_);
+  for (auto column : {&ts_column, &conn_column_, &name_column_,
+                      &value_column_}) {
+    PutVarint(&block, column->size());
+    block.append(*column);
+  }
+
+  rows_ = 0;
+  timestamps_.clear();
+  conn_column_.clear();
+  name_column_.clear();
+  value_column_.clear();
+
+  auto status = WriteRecord(segment::RecordType::kBlock, block);
+  if (!status.ok()) {
+    return status;
+  }
+  fflush(file_);
+  if (file_size_ >= max_file_size_) {
+    return Rotate();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SegmentWriter::Rotate() {
+  fclose(file_);
+  file_ = nullptr;
+  return Open();
+}
+
+absl::Status SegmentWriter::RenameFiles() {
+  for (int i = max_files_; i > 0; i--) {
+    auto src = RotatedName(path_, i - 1);
+    auto dst = RotatedName(path_, i);
+    if (access(src.c_str(), F_OK) != 0) {
+      continue;
+    }
+    if (rename(src.c_str(), dst.c_str()) != 0) {
+      return absl::InternalError(absl::StrFormat(
+          "Could not rename %s to %s: %s", src, dst, strerror(errno)));
+    }
+  }
+  if (rotate_handler_) {
+    rotate_handler_(RotatedName(path_, 1));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace prober
@@ -0,0 +1,97 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_SEGMENT_WRITER_H_
+#define _EXPORTERS_SEGMENT_WRITER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "events.h"
+#include "exporters/segment_format.h"
+#include "loader/exporter/data_types.h"
+
+namespace prober {
+
+/* Writes rows into column blocks of a segment file (see segment_format.h).
+  Files are rotated like spdlog's rotating sink: path, path.1, ... up to
+  max_files. Not thread safe. */
+class SegmentWriter {
+ public:
+  SegmentWriter() = delete;
+  SegmentWriter(std::string path, segment::Kind kind, uint32_t max_file_size,
+                uint8_t max_files);
+  ~SegmentWriter();
+  absl::Status Open();
+
+  // Returns the id rows of the source/metric name must use.
+  uint32_t AddName(const std::string& name);
+  bool HasConn(ConnHandle conn);
+  void AddConn(ConnHandle conn, const std::string& uuid);
+
+  // The connection must have been added with AddConn.
+  absl::Status AppendMetric(uint32_t name_id, ConnHandle conn,
+                            uint64_t timestamp, int64_t value);
+  absl::Status AppendLog(uint32_t name_id, ConnHandle conn,
+                         const ec_ebpf_events_t* const event);
+  // Writes buffered rows as a block.
+  absl::Status Flush();
+  // Called with the name of the most recently rotated file (path.1).
+  void SetRotateHandler(std::function<void(const std::string&)> handler) {
+    rotate_handler_ = handler;
+  }
+
+ private:
+  static uint64_t ConnKey(ConnHandle conn) {
+    return (static_cast<uint64_t>(conn.index) << 32) | conn.generation;
+  }
+  absl::Status WriteHeader();
+  absl::Status WriteRecord(segment::RecordType type, const std::string& data);
+  absl::Status WriteDictionary();
+  absl::Status Rotate();
+  // Moves path to path.1, path.1 to path.2 and so on.
+  absl::Status RenameFiles();
+  void AddRow(uint32_t name_id, ConnHandle conn, uint64_t timestamp);
+
+  std::string path_;
+  segment::Kind kind_;
+  uint32_t max_file_size_;
+  uint8_t max_files_;
+  std::function<void(const std::string&)> rotate_handler_;
+  FILE* file_;
+  uint64_t file_size_;
+
+  std::vector<std::string> names_;
+  absl::flat_hash_map<std::string, uint32_t> name_ids_;
+  absl::flat_hash_map<uint64_t, uint32_t> conn_ids_;
+  std::vector<std::string> conns_;
+
+  // Columns of the block being built.
+  uint32_t rows_;
+  uint64_t min_ts_;
+  uint64_t max_ts_;
+  std::vector<uint64_t> timestamps_;
+  std::string conn_column_;
+  std::string name_column_;
+  std::string value_column_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_SEGMENT_WRITER_H_
@@ -0,0 +1,439 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/shm_exporter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "events.h"
+#include "exporters/exporters_util.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/self_metrics.h"
+
+namespace prober {
+
+static uint64_t RoundUpPowerOfTwo(uint64_t value) {
+  uint64_t result = 4096;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+ShmRing::ShmRing(struct event_base* base, std::string socket_path,
+                 uint64_t capacity)
+    : base_(base),
+      socket_path_(socket_path),
+      capacity_(RoundUpPowerOfTwo(capacity)),
+      memfd_(-1),
+      listen_fd_(-1),
+      reader_fd_(-1),
+      accept_event_(nullptr),
+      reader_event_(nullptr),
+      header_(nullptr),
+      data_(nullptr),
+      head_(0),
+      tail_(0),
+      reserved_(0),
+      written_(0),
+      dropped_(0) {}
+
+ShmRing::~ShmRing() {
+  DetachReader();
+  if (accept_event_ != nullptr) {
+    event_free(accept_event_);
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+  if (header_ != nullptr) {
+    munmap(header_, sizeof(struct ebpf_shm_header) + capacity_);
+  }
+  if (memfd_ >= 0) {
+    close(memfd_);
+  }
+}
+
+absl::Status ShmRing::Init() {
+  struct sockaddr_un addr;
+  if (socket_path_.size() >= sizeof(addr.sun_path)) {
+    return absl::InvalidArgumentError("shm socket path too long");
+  }
+  size_t size = sizeof(struct ebpf_shm_header) + capacity_;
+
+  memfd_ = memfd_create("lightfoot_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd_ < 0) {
+    return absl::InternalError(
+        absl::StrFormat("memfd_create: %s", strerror(errno)));
+  }
+  if (ftruncate(memfd_, size) < 0) {
+    return absl::InternalError(
+        absl::StrFormat("ftruncate: %s", strerror(errno)));
+  }
+  // Readers map the whole file, make sure it can't change under them.
+  if (fcntl(memfd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) <
+      0) {
+    return absl::InternalError(
+        absl::StrFormat("sealing memfd: %s", strerror(errno)));
+  }
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+  if (map == MAP_FAILED) {
+    return absl::InternalError(absl::StrFormat("mmap: %s", strerror(errno)));
+  }
+  header_ = static_cast<struct ebpf_shm_header*>(map);
+  data_ = static_cast<uint8_t*>(map) + sizeof(struct ebpf_shm_header);
+  header_->magic = EBPF_SHM_MAGIC;
+  header_->version = EBPF_SHM_VERSION;
+  header_->capacity = capacity_;
+
+  listen_fd_ =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd_ < 0) {
+    return absl::InternalError(absl::StrFormat("socket: %s", strerror(errno)));
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(socket_path_.c_str());
+  if (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd_, 4) < 0) {
+    return absl::UnavailableError(absl::StrFormat(
+        "Could not listen on %s: %s", socket_path_, strerror(errno)));
+  }
+  accept_event_ =
+      event_new(base_, listen_fd_, EV_READ | EV_PERSIST, HandleAccept, this);
+  if (accept_event_ == nullptr || event_add(accept_event_, nullptr) != 0) {
+    return absl::InternalError("Could not add shm accept event");
+  }
+  return absl::OkStatus();
+}
+
+void ShmRing::HandleAccept(evutil_socket_t fd, short what, void* arg) {
+  ShmRing* ring = static_cast<ShmRing*>(arg);
+  int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (conn < 0) {
+    return;
+  }
+  // Single consumer, the reader sees EOF instead of the memfd.
+  if (ring->reader_fd_ >= 0) {
+    close(conn);
+    return;
+  }
+
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &ring->memfd_, sizeof(int));
+  if (sendmsg(conn, &msg, MSG_NOSIGNAL) != 1) {
+    std::cerr << "Could not send shm fd: " << strerror(errno) << std::endl;
+    close(conn);
+    return;
+  }
+
+  ring->reader_event_ =
+      event_new(ring->base_, conn, EV_READ | EV_PERSIST, HandleReader, ring);
+  if (ring->reader_event_ == nullptr ||
+      event_add(ring->reader_event_, nullptr) != 0) {
+    if (ring->reader_event_ != nullptr) {
+      event_free(ring->reader_event_);
+      ring->reader_event_ = nullptr;
+    }
+    close(conn);
+    return;
+  }
+  ring->reader_fd_ = conn;
+  SelfMetrics::GetInstance().SetGauge("shm_readers", 1);
+}
+
+// The connection is only kept to notice the reader going away.
+void ShmRing::HandleReader(evutil_socket_t fd, short what, void* arg) {
+  ShmRing* ring = static_cast<ShmRing*>(arg);
+  char buf[64];
+  ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+  if (ret > 0 || (ret < 0 && (errno == EAGAIN || errno == EINTR))) {
+    return;
+  }
+  ring->DetachReader();
+}
+
+void ShmRing::DetachReader() {
+  if (reader_event_ != nullptr) {
+    event_free(reader_event_);
+    reader_event_ = nullptr;
+  }
+  if (reader_fd_ >= 0) {
+    close(reader_fd_);
+    reader_fd_ = -1;
+    SelfMetrics::GetInstance().SetGauge("shm_readers", 0);
+  }
+}
+
+void* ShmRing::Reserve(uint16_t type, absl::string_view name,
+                       absl::string_view uuid, uint32_t data_len) {
+  if (header_ == nullptr) {
+    return nullptr;
+  }
+  uint64_t length = sizeof(struct ebpf_shm_record) + name.size() +
+                    uuid.size() + data_len;
+  length = (length + EBPF_SHM_ALIGN - 1) & ~(uint64_t)(EBPF_SHM_ALIGN - 1);
+  uint64_t offset = head_ & (capacity_ - 1);
+  // Records are contiguous, pad to the end of the ring if it does not fit.
+  uint64_t pad = capacity_ - offset < length ? capacity_ - offset : 0;
+  if (name.size() > UINT8_MAX || uuid.size() > UINT8_MAX ||
+      length > capacity_ / 2) {
+    dropped_++;
+    __atomic_fetch_add(&header_->dropped, 1, __ATOMIC_RELAXED);
+    return nullptr;
+  }
+  if (capacity_ - (head_ - tail_) < pad + length) {
+    tail_ = __atomic_load_n(&header_->tail, __ATOMIC_ACQUIRE);
+    // head_ - tail_ larger than the ring means the reader wrote garbage.
+    if (head_ - tail_ > capacity_ ||
+        capacity_ - (head_ - tail_) < pad + length) {
+      dropped_++;
+      __atomic_fetch_add(&header_->dropped, 1, __ATOMIC_RELAXED);
+      return nullptr;
+    }
+  }
+
+  struct ebpf_shm_record* record;
+  if (pad != 0) {
+    record = reinterpret_cast<struct ebpf_shm_record*>(data_ + offset);
+    memset(record, 0, sizeof(*record));
+    record->length = pad;
+    record->type = EBPF_SHM_PAD;
+    head_ += pad;
+    offset = 0;
+  }
+  record = reinterpret_cast<struct ebpf_shm_record*>(data_ + offset);
+  record->length = length;
+  record->type = type;
+  record->name_len = name.size();
+  record->uuid_len = uuid.size();
+  record->data_len = data_len;
+  record->reserved = 0;
+  uint8_t* out = reinterpret_cast<uint8_t*>(record + 1);
+  memcpy(out, name.data(), name.size());
+  out += name.size();
+  memcpy(out, uuid.data(), uuid.size());
+  reserved_ = length;
+  return out + uuid.size();
+}
+
+void ShmRing::Commit() {
+  head_ += reserved_;
+  reserved_ = 0;
+  written_++;
+  __atomic_store_n(&header_->head, head_, __ATOMIC_RELEASE);
+}
+
+void ShmRing::ReportStats() {
+  if (header_ == nullptr) {
+    return;
+  }
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.Increment("shm_records_written", written_);
+  self_metrics.Increment("shm_records_dropped", dropped_);
+  self_metrics.SetGauge(
+      "shm_ring_used_bytes",
+      head_ - __atomic_load_n(&header_->tail, __ATOMIC_RELAXED));
+  written_ = 0;
+  dropped_ = 0;
+}
+
+absl::Status ShmLogger::Init() { return absl::OkStatus(); }
+
+absl::Status ShmLogger::RegisterLog(std::string name, LogDesc& log_desc) {
+  if (logs_.find(name) != logs_.end()) {
+    return absl::AlreadyExistsError("log already registered");
+  }
+  logs_[name] = true;
+  return absl::OkStatus();
+}
+
+absl::Status ShmLogger::HandleData(std::string log_name,
+                                   const void* const data,
+                                   const uint32_t size) {
+  if (logs_.find(log_name) == logs_.end()) {
+    return absl::NotFoundError("log not registered");
+  }
+
+  auto conn_id = ExportersUtil::GetLogConnId(log_name, data);
+  auto uuid = correlator_->GetUUID(conn_id);
+  if (!uuid.ok()) {
+    return absl::OkStatus();
+  }
+
+  uint8_t* out = static_cast<uint8_t*>(ring_->Reserve(
+      EBPF_SHM_LOG, log_name, *uuid, sizeof(struct ebpf_shm_log) + size));
+  if (out == nullptr) {
+    return absl::OkStatus();
+  }
+  struct ebpf_shm_log log;
+  log.time_ns = absl::ToUnixNanos(ExportersUtil::GetLogTime(log_name, data));
+  log.conn_id = conn_id;
+  memcpy(out, &log, sizeof(log));
+  memcpy(out + sizeof(log), data, size);
+  ring_->Commit();
+  return absl::OkStatus();
+}
+
+absl::Status ShmMetricExporter::Init() { return absl::OkStatus(); }
+
+absl::Status ShmMetricExporter::RegisterMetric(std::string name,
+                                               const MetricDesc& desc) {
+  if (metrics_.find(name) != metrics_.end()) {
+    return absl::AlreadyExistsError("metric already registered");
+  }
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+  metrics_[name] = {desc, *id, GetMetricDecoder(desc)};
+  return absl::OkStatus();
+}
+
+absl::Status ShmMetricExporter::HandleData(std::string metric_name, void* key,
+                                           void* value) {
+  auto it = metrics_.find(metric_name);
+  if (it == metrics_.end()) {
+    return absl::NotFoundError("metric_name not found");
+  }
+  const ExportedMetric& exported = it->second;
+  metric_format_t* metric = (metric_format_t*)value;
+
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
+  if (!conn.ok()) {
+    return absl::OkStatus();
+  }
+  if (exported.desc.value_type == MetricType::kLog2Histogram) {
+    return HandleHistogram(metric_name, exported, *conn,
+                           (metric_hist_format_t*)value);
+  }
+
+  // This line also checks if a metric was just read.
+  auto old_timestamp =
+      conn_state_.CheckMetricTime(*conn, exported.id, metric->timestamp);
+  if (!old_timestamp.ok()) {
+    return absl::OkStatus();
+  }
+
+  struct ebpf_shm_metric out;
+  memset(&out, 0, sizeof(out));
+  out.time_ns = absl::ToUnixNanos(ExportersUtil::GetTimeFromBPFns(
+      conn_state_.GetMetricTime(*conn, exported.id)));
+  // The first read of a connection returns its start time, later reads the
+  // previous BPF timestamp.
+  uint64_t start_time = conn_state_.GetMetricStartTime(*conn, exported.id);
+  if (exported.desc.kind == MetricKind::kCumulative ||
+      *old_timestamp == start_time) {
+    out.start_time_ns = start_time;
+  } else {
+    out.start_time_ns =
+        absl::ToUnixNanos(ExportersUtil::GetTimeFromBPFns(*old_timestamp));
+  }
+  out.value = exported.decoder.value_ms(&(metric->data));
+  out.kind = static_cast<uint32_t>(exported.desc.kind);
+  switch (exported.desc.unit.type) {
+    case MetricUnitType::kTime:
+      strncpy(out.unit, "ms", sizeof(out.unit));
+      break;
+    case MetricUnitType::kData:
+      strncpy(out.unit, exported.decoder.unit.c_str(), sizeof(out.unit));
+      break;
+    case MetricUnitType::kNone:
+      break;
+  }
+
+  void* data = ring_->Reserve(EBPF_SHM_METRIC, metric_name,
+                              correlator_->GetUUID(*conn), sizeof(out));
+  if (data == nullptr) {
+    return absl::OkStatus();
+  }
+  memcpy(data, &out, sizeof(out));
+  ring_->Commit();
+  return absl::OkStatus();
+}
+
+absl::Status ShmMetricExporter::HandleHistogram(
+    const std::string& metric_name, const ExportedMetric& exported,
+    ConnHandle conn, const metric_hist_format_t* metric) {
+  if (!conn_state_.CheckMetricTime(conn, exported.id, metric->timestamp)
+           .ok()) {
+    return absl::OkStatus();
+  }
+
+  struct ebpf_shm_histogram out;
+  memset(&out, 0, sizeof(out));
+  out.start_time_ns = conn_state_.GetMetricStartTime(conn, exported.id);
+  out.time_ns = absl::ToUnixNanos(ExportersUtil::GetTimeFromBPFns(
+      conn_state_.GetMetricTime(conn, exported.id)));
+  out.count = metric->data.count;
+  out.sum = metric->data.sum;
+  memcpy(out.buckets, metric->data.buckets, sizeof(out.buckets));
+  strncpy(out.unit, exported.decoder.unit.c_str(), sizeof(out.unit));
+
+  void* data = ring_->Reserve(EBPF_SHM_HISTOGRAM, metric_name,
+                              correlator_->GetUUID(conn), sizeof(out));
+  if (data == nullptr) {
+    return absl::OkStatus();
+  }
+  memcpy(data, &out, sizeof(out));
+  ring_->Commit();
+  return absl::OkStatus();
+}
+
+void ShmMetricExporter::Flush(std::string metric_name) {
+  ring_->ReportStats();
+}
+
+void ShmMetricExporter::Cleanup() {
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
+    }
+  }
+}
+
+}  // namespace prober
@@ -0,0 +1,128 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_SHM_EXPORTER_H_
+#define _EXPORTERS_SHM_EXPORTER_H_
+
+#include <event2/event.h>
+
+#include <cstdint>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "events.h"
+#include "exporters/exporters_util.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/log_exporter.h"
+#include "loader/exporter/metric_exporter.h"
+#include "sidechannel/libebpf_shm/ebpf_shm.h"
+
+#define SHM_DEFAULT_CAPACITY (64 * 1024 * 1024)
+
+namespace prober {
+
+/* Producer side of the ring described in sidechannel/libebpf_shm/ebpf_shm.h.
+  The memfd is handed to a reader connecting to socket_path, one reader at a
+  time. Both the ring and the socket are only used from the event loop
+  thread. */
+class ShmRing {
+ public:
+  ShmRing() = delete;
+  // capacity is rounded up to a power of two.
+  ShmRing(struct event_base* base, std::string socket_path,
+          uint64_t capacity = SHM_DEFAULT_CAPACITY);
+  ~ShmRing();
+  ShmRing(const ShmRing&) = delete;
+  ShmRing& operator=(const ShmRing&) = delete;
+  absl::Status Init();
+
+  /* Reserves a record and returns where its data_len bytes of data go, or
+    nullptr if the ring is full. The record is visible to the reader after
+    Commit. */
+  void* Reserve(uint16_t type, absl::string_view name, absl::string_view uuid,
+                uint32_t data_len);
+  void Commit();
+
+  // Updates self metrics with the records written since the last call.
+  void ReportStats();
+
+ private:
+  static void HandleAccept(evutil_socket_t fd, short what, void* arg);
+  static void HandleReader(evutil_socket_t fd, short what, void* arg);
+  void DetachReader();
+
+  struct event_base* base_;
+  std::string socket_path_;
+  uint64_t capacity_;
+  int memfd_;
+  int listen_fd_;
+  int reader_fd_;
+  struct event* accept_event_;
+  struct event* reader_event_;
+  struct ebpf_shm_header* header_;
+  uint8_t* data_;
+  uint64_t head_;
+  // Last tail read from the reader, refreshed when the ring looks full.
+  uint64_t tail_;
+  // Length of the reserved record, 0 if none.
+  uint32_t reserved_;
+  uint64_t written_;
+  uint64_t dropped_;
+};
+
+/* Publishes logs as EBPF_SHM_LOG records, the event is copied as is after
+  its time and connection id. */
+class ShmLogger : public LogExporterInterface {
+ public:
+  ShmLogger() = delete;
+  explicit ShmLogger(ShmRing* ring) : ring_(ring) {}
+  absl::Status Init() override;
+  absl::Status RegisterLog(std::string name, LogDesc& log_desc) override;
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override;
+
+ private:
+  ShmRing* ring_;
+  absl::flat_hash_map<std::string, bool> logs_;
+};
+
+/* Publishes decoded data points as EBPF_SHM_METRIC records and
+  MetricType::kLog2Histogram values as EBPF_SHM_HISTOGRAM records. */
+class ShmMetricExporter : public MetricExporterInterface {
+ public:
+  ShmMetricExporter() = delete;
+  explicit ShmMetricExporter(ShmRing* ring) : ring_(ring) {}
+  absl::Status Init() override;
+  absl::Status RegisterMetric(std::string name,
+                              const MetricDesc& desc) override;
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override;
+  void Flush(std::string metric_name) override;
+  void Cleanup();
+
+ private:
+  absl::Status HandleHistogram(const std::string& metric_name,
+                               const ExportedMetric& exported, ConnHandle conn,
+                               const metric_hist_format_t* metric);
+
+  ShmRing* ring_;
+  absl::flat_hash_map<std::string, ExportedMetric> metrics_;
+  ConnStateTable conn_state_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_SHM_EXPORTER_H_
@@ -0,0 +1,263 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cost of exporting a poll of connection metrics through the --shm ring, OTLP
+// and a file. The ring is drained by a reader built on ebpf_shm in another
+// thread. The OTLP collector is replaced by a stub that only serializes the
+// request, so the RPC itself is left out.
+
+#include <event2/event.h>
+#include <grpcpp/grpcpp.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "exporters/file_exporter.h"
+#include "exporters/otlp_exporter.h"
+#include "exporters/shm_exporter.h"
+#include "loader/correlator/correlator.h"
+#include "loader/exporter/data_types.h"
+#include "loader/exporter/metric_exporter.h"
+#include "opentelemetry/proto/collector/metrics/v1/metrics_service.grpc.pb.h"
+#include "sidechannel/libebpf_shm/ebpf_shm.h"
+
+namespace prober {
+namespace {
+
+namespace otlp_metrics = opentelemetry::proto::collector::metrics::v1;
+
+constexpr uint64_t kConnections = 10000;
+// BPF timestamps of consecutive polls, exporters skip points read less than a
+// second after the previous one.
+constexpr uint64_t kPollInterval = 2ULL * 1000 * 1000 * 1000;
+
+// Correlator that knows connections 1 to kConnections.
+class FakeCorrelator : public CorrelatorInterface {
+ public:
+  FakeCorrelator() {
+    absl::MutexLock lock(&mu_);
+    for (uint64_t conn_id = 1; conn_id <= kConnections; conn_id++) {
+      connection_map_[conn_id] = NewConnHandle(
+          absl::StrCat("10.0.0.1:", 30000 + conn_id, "->10.0.1.1:443"));
+    }
+  }
+
+  absl::Status HandleData(std::string log_name, const void* const data,
+                          const uint32_t size) override {
+    return absl::OkStatus();
+  }
+  absl::Status HandleData(std::string metric_name, void* key,
+                          void* value) override {
+    return absl::OkStatus();
+  }
+  void Cleanup() override {}
+  bool CheckUUID(std::string uuid) override { return true; }
+  absl::flat_hash_map<std::string, std::string> GetLabels(
+      std::string uuid) override {
+    return {};
+  }
+  std::vector<std::string> GetLabelKeys() override { return {}; }
+  std::vector<DataCtx*>& GetLogSources() override { return sources_; }
+  std::vector<DataCtx*>& GetMetricSources() override { return sources_; }
+  absl::Status Init() override { return absl::OkStatus(); }
+
+ private:
+  std::vector<DataCtx*> sources_;
+};
+
+// Collector stub that serializes requests and accepts them.
+class FakeMetricsStub : public otlp_metrics::MetricsService::StubInterface {
+ public:
+  explicit FakeMetricsStub(std::atomic<uint64_t>* bytes) : bytes_(bytes) {}
+
+  grpc::Status Export(
+      grpc::ClientContext* context,
+      const otlp_metrics::ExportMetricsServiceRequest& request,
+      otlp_metrics::ExportMetricsServiceResponse* response) override {
+    std::string wire;
+    request.SerializeToString(&wire);
+    bytes_->fetch_add(wire.size(), std::memory_order_relaxed);
+    return grpc::Status::OK;
+  }
+
+ private:
+  grpc::ClientAsyncResponseReaderInterface<
+      otlp_metrics::ExportMetricsServiceResponse>*
+  AsyncExportRaw(grpc::ClientContext* context,
+                 const otlp_metrics::ExportMetricsServiceRequest& request,
+                 grpc::CompletionQueue* cq) override {
+    return nullptr;
+  }
+  grpc::ClientAsyncResponseReaderInterface<
+      otlp_metrics::ExportMetricsServiceResponse>*
+  PrepareAsyncExportRaw(
+      grpc::ClientContext* context,
+      const otlp_metrics::ExportMetricsServiceRequest& request,
+      grpc::CompletionQueue* cq) override {
+    return nullptr;
+  }
+
+  std::atomic<uint64_t>* bytes_;
+};
+
+void Register(MetricExporterInterface* exporter, FakeCorrelator* correlator) {
+  MetricUnit_t unit = {MetricUnitType::kTime};
+  unit.time = MetricTimeType::kusec;
+  exporter->RegisterCorrelator(correlator);
+  exporter
+      ->RegisterMetric("tcp_srtt", {MetricType::kUint64, MetricType::kUint32,
+                                    MetricKind::kGauge, unit})
+      .IgnoreError();
+}
+
+// Hands a point of every connection to exporter, as one poll of the map
+// would, then flushes.
+void Poll(MetricExporterInterface* exporter, uint64_t timestamp) {
+  for (uint64_t conn_id = 1; conn_id <= kConnections; conn_id++) {
+    metric_format_t value = {timestamp, conn_id * 100};
+    exporter->HandleData("tcp_srtt", &conn_id, &value).IgnoreError();
+  }
+  exporter->Flush("tcp_srtt");
+}
+
+void BM_ShmExport(benchmark::State& state) {
+  char dir[] = "/tmp/shm_benchmarkXXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    state.SkipWithError("mkdtemp failed");
+    return;
+  }
+  std::string socket_path = absl::StrCat(dir, "/lightfoot.sock");
+  struct event_base* base = event_base_new();
+  uint64_t dropped = 0;
+  uint64_t read = 0;
+  {
+    ShmRing ring(base, socket_path);
+    if (!ring.Init().ok()) {
+      state.SkipWithError("could not create the ring");
+    } else {
+      std::atomic<bool> done{false};
+      std::atomic<bool> attached{false};
+      std::thread reader_thread([&]() {
+        struct ebpf_shm_reader* reader = ebpf_shm_open(socket_path.c_str());
+        attached = true;
+        if (reader == nullptr) {
+          return;
+        }
+        while (true) {
+          const struct ebpf_shm_record* record = ebpf_shm_peek(reader);
+          if (record == nullptr) {
+            if (done) {
+              break;
+            }
+            continue;
+          }
+          benchmark::DoNotOptimize(ebpf_shm_record_data(record));
+          read++;
+          ebpf_shm_release(reader);
+        }
+        dropped = ebpf_shm_dropped(reader);
+        ebpf_shm_close(reader);
+      });
+      // Runs the accept of the reader.
+      while (!attached) {
+        event_base_loop(base, EVLOOP_NONBLOCK);
+      }
+
+      FakeCorrelator correlator;
+      ShmMetricExporter exporter(&ring);
+      Register(&exporter, &correlator);
+      uint64_t timestamp = kPollInterval;
+      for (auto _ : state) {
+        Poll(&exporter, timestamp);
+        timestamp += kPollInterval;
+      }
+      done = true;
+      reader_thread.join();
+    }
+  }
+  event_base_free(base);
+  unlink(socket_path.c_str());
+  rmdir(dir);
+  uint64_t points = state.iterations() * kConnections;
+  state.counters["read_per_point"] = static_cast<double>(read) / points;
+  state.counters["dropped"] = dropped;
+  state.SetItemsProcessed(points);
+}
+BENCHMARK(BM_ShmExport)->UseRealTime();
+
+void BM_OtlpExport(benchmark::State& state) {
+  std::atomic<uint64_t> bytes{0};
+  uint64_t points = 0;
+  {
+    FakeCorrelator correlator;
+    OtlpMetricExporter exporter(OtlpOptions(),
+                                std::make_unique<FakeMetricsStub>(&bytes));
+    exporter.Init().IgnoreError();
+    Register(&exporter, &correlator);
+    uint64_t timestamp = kPollInterval;
+    for (auto _ : state) {
+      Poll(&exporter, timestamp);
+      timestamp += kPollInterval;
+    }
+    points = state.iterations() * kConnections;
+    // The destructor sends what is left and waits for the requests.
+  }
+  state.counters["bytes_per_point"] = static_cast<double>(bytes) / points;
+  state.SetItemsProcessed(points);
+}
+BENCHMARK(BM_OtlpExport)->UseRealTime();
+
+void BM_FileExport(benchmark::State& state) {
+  char dir[] = "/tmp/file_benchmarkXXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    state.SkipWithError("mkdtemp failed");
+    return;
+  }
+  {
+    FakeCorrelator correlator;
+    FileMetricExporter exporter(2, 64 * 1024 * 1024, dir);
+    if (!exporter.Init().ok()) {
+      state.SkipWithError("could not create the file exporter");
+    } else {
+      Register(&exporter, &correlator);
+      uint64_t timestamp = kPollInterval;
+      for (auto _ : state) {
+        Poll(&exporter, timestamp);
+        timestamp += kPollInterval;
+      }
+    }
+  }
+  for (const char* name : {"ebpf_metrics.txt", "ebpf_metrics.1.txt",
+                           "ebpf_metrics.2.txt"}) {
+    unlink(absl::StrCat(dir, "/", name).c_str());
+  }
+  rmdir(dir);
+  state.SetItemsProcessed(state.iterations() * kConnections);
+}
+BENCHMARK(BM_FileExport)->UseRealTime();
+
+}  // namespace
+}  // namespace prober
@@ -0,0 +1,430 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/spool.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "loader/exporter/self_metrics.h"
+#include "zlib.h"
+
+namespace prober {
+
+#define SPOOL_MAGIC "LFSPOOL1"
+#define SPOOL_MAGIC_SIZE 8
+#define SPOOL_MAX_RECORD (64 * 1024 * 1024)
+#define SPOOL_MAX_SEGMENT_BYTES (16 * 1024 * 1024)
+#define SPOOL_RETRY_INTERVAL absl::Seconds(5)
+
+namespace {
+
+// Precedes every record in a segment.
+struct SpoolFrame {
+  uint32_t length;
+  // CRC32 of time_ns and the record.
+  uint32_t crc;
+  uint64_t time_ns;
+};
+
+uint32_t FrameCrc(uint64_t time_ns, const char* data, size_t size) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(&time_ns), sizeof(time_ns));
+  return crc32(crc, reinterpret_cast<const Bytef*>(data), size);
+}
+
+// Reads the next record, false at the end of the segment or if the frame is
+// truncated or corrupt.
+bool ReadFrame(FILE* file, std::string* record, SpoolFrame* frame) {
+  if (fread(frame, sizeof(*frame), 1, file) != 1 ||
+      frame->length > SPOOL_MAX_RECORD) {
+    return false;
+  }
+  record->resize(frame->length);
+  if (frame->length != 0 &&
+      fread(&(*record)[0], frame->length, 1, file) != 1) {
+    return false;
+  }
+  return FrameCrc(frame->time_ns, record->data(), record->size()) ==
+         frame->crc;
+}
+
+FILE* OpenSegment(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  char magic[SPOOL_MAGIC_SIZE];
+  if (fread(magic, sizeof(magic), 1, file) != 1 ||
+      memcmp(magic, SPOOL_MAGIC, SPOOL_MAGIC_SIZE) != 0) {
+    fclose(file);
+    return nullptr;
+  }
+  return file;
+}
+
+}  // namespace
+
+Spool::Spool(std::string name, std::string dir, uint64_t max_bytes,
+             uint32_t replay_rate)
+    : name_(name),
+      dir_(dir),
+      max_bytes_(max_bytes),
+      segment_bytes_(std::min<uint64_t>(
+          std::max<uint64_t>(max_bytes / 8, 64 * 1024),
+          SPOOL_MAX_SEGMENT_BYTES)),
+      replay_rate_(replay_rate ? replay_rate : 1),
+      active_(nullptr),
+      next_seq_(0),
+      bytes_(0),
+      records_(0),
+      stop_(false) {}
+
+Spool::~Spool() {
+  {
+    absl::MutexLock lock(&mu_);
+    stop_ = true;
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+  absl::MutexLock lock(&mu_);
+  SealActive();
+}
+
+std::string Spool::SegmentPath(uint64_t seq) {
+  return absl::StrFormat("%s/spool.%016d.seg", dir_, seq);
+}
+
+absl::Status Spool::Init() {
+  std::string path;
+  for (auto part : absl::StrSplit(dir_, '/')) {
+    path = absl::StrCat(path, part, "/");
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+      return absl::InternalError(absl::StrFormat(
+          "Could not create spool dir %s: %s", path, strerror(errno)));
+    }
+  }
+
+  DIR* dir = opendir(dir_.c_str());
+  if (dir == nullptr) {
+    return absl::InternalError(
+        absl::StrFormat("Could not open %s: %s", dir_, strerror(errno)));
+  }
+  std::vector<uint64_t> seqs;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    unsigned long long seq;  // NOLINT
+    char suffix[8];
+    if (sscanf(entry->d_name, "spool.%llu.%7s", &seq, suffix) == 2 &&
+        strcmp(suffix, "seg") == 0) {
+      seqs.push_back(seq);
+    }
+  }
+  closedir(dir);
+  std::sort(seqs.begin(), seqs.end());
+
+  for (auto seq : seqs) {
+    auto status = LoadSegment(seq);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+    }
+  }
+  absl::MutexLock lock(&mu_);
+  if (!seqs.empty()) {
+    next_seq_ = seqs.back() + 1;
+  }
+  Evict();
+  ReportDepth();
+  return absl::OkStatus();
+}
+
+absl::Status Spool::LoadSegment(uint64_t seq) {
+  auto path = SegmentPath(seq);
+  FILE* file = OpenSegment(path);
+  if (file == nullptr) {
+    unlink(path.c_str());
+    return absl::DataLossError(
+        absl::StrFormat("Dropping unreadable spool segment %s", path));
+  }
+  Segment segment = {seq, SPOOL_MAGIC_SIZE, 0, absl::InfiniteFuture()};
+  std::string record;
+  SpoolFrame frame;
+  // A crash may leave a partial frame at the end, replay stops there too.
+  while (ReadFrame(file, &record, &frame)) {
+    if (segment.records == 0) {
+      segment.oldest = absl::FromUnixNanos(frame.time_ns);
+    }
+    segment.records++;
+    segment.bytes += sizeof(frame) + frame.length;
+  }
+  fclose(file);
+  if (segment.records == 0) {
+    unlink(path.c_str());
+    return absl::OkStatus();
+  }
+  absl::MutexLock lock(&mu_);
+  segments_.push_back(segment);
+  bytes_ += segment.bytes;
+  records_ += segment.records;
+  return absl::OkStatus();
+}
+
+absl::Status Spool::Start(ReplayFn replay) {
+  if (worker_.joinable()) {
+    return absl::AlreadyExistsError("spool already started");
+  }
+  replay_ = std::move(replay);
+  worker_ = std::thread(&Spool::Run, this);
+  return absl::OkStatus();
+}
+
+bool Spool::IsRetryable(const absl::Status& status) {
+  return absl::IsUnavailable(status) || absl::IsDeadlineExceeded(status) ||
+         absl::IsResourceExhausted(status);
+}
+
+bool Spool::Empty() {
+  absl::MutexLock lock(&mu_);
+  return records_ == 0;
+}
+
+absl::Status Spool::Append(absl::string_view record) {
+  if (record.size() > SPOOL_MAX_RECORD) {
+    return absl::InvalidArgumentError("record too large to spool");
+  }
+  SpoolFrame frame;
+  frame.length = record.size();
+  frame.time_ns = absl::GetCurrentTimeNanos();
+  frame.crc = FrameCrc(frame.time_ns, record.data(), record.size());
+
+  absl::MutexLock lock(&mu_);
+  if (active_ != nullptr && segments_.back().bytes >= segment_bytes_) {
+    SealActive();
+  }
+  if (active_ == nullptr) {
+    uint64_t seq = next_seq_++;
+    auto path = SegmentPath(seq);
+    active_ = fopen(path.c_str(), "wb");
+    if (active_ == nullptr ||
+        fwrite(SPOOL_MAGIC, SPOOL_MAGIC_SIZE, 1, active_) != 1) {
+      SealActive();
+      unlink(path.c_str());
+      return absl::InternalError(
+          absl::StrFormat("Could not create %s: %s", path, strerror(errno)));
+    }
+    segments_.push_back(
+        {seq, SPOOL_MAGIC_SIZE, 0, absl::FromUnixNanos(frame.time_ns)});
+    bytes_ += SPOOL_MAGIC_SIZE;
+  }
+  if (fwrite(&frame, sizeof(frame), 1, active_) != 1 ||
+      (!record.empty() &&
+       fwrite(record.data(), record.size(), 1, active_) != 1) ||
+      fflush(active_) != 0) {
+    // Replay stops at the partial frame, later records go to a new segment.
+    SealActive();
+    SelfMetrics::GetInstance().Increment(
+        absl::StrCat("spool_", name_, "_append_failures"));
+    return absl::InternalError(
+        absl::StrFormat("Could not write to spool: %s", strerror(errno)));
+  }
+
+  Segment& segment = segments_.back();
+  if (segment.records == 0) {
+    segment.oldest = absl::FromUnixNanos(frame.time_ns);
+  }
+  segment.bytes += sizeof(frame) + record.size();
+  segment.records++;
+  bytes_ += sizeof(frame) + record.size();
+  records_++;
+  SelfMetrics::GetInstance().Increment(
+      absl::StrCat("spool_", name_, "_appended_records"));
+  Evict();
+  ReportDepth();
+  return absl::OkStatus();
+}
+
+void Spool::SealActive() {
+  if (active_ != nullptr) {
+    fclose(active_);
+    active_ = nullptr;
+  }
+}
+
+void Spool::PopFront() {
+  const Segment& front = segments_.front();
+  if (active_ != nullptr && segments_.size() == 1) {
+    SealActive();
+  }
+  unlink(SegmentPath(front.seq).c_str());
+  bytes_ -= front.bytes;
+  records_ -= front.records;
+  segments_.pop_front();
+}
+
+void Spool::Evict() {
+  // The segment being written is kept, so the spool may go over max_bytes
+  // by up to one segment.
+  uint64_t evicted = 0;
+  while (bytes_ > max_bytes_ && segments_.size() > 1) {
+    evicted += segments_.front().records;
+    PopFront();
+  }
+  if (evicted) {
+    SelfMetrics::GetInstance().Increment(
+        absl::StrCat("spool_", name_, "_evicted_records"), evicted);
+  }
+}
+
+void Spool::ReportDepth() {
+  auto& self_metrics = SelfMetrics::GetInstance();
+  self_metrics.SetGauge(absl::StrCat("spool_", name_, "_depth_bytes"), bytes_);
+  self_metrics.SetGauge(absl::StrCat("spool_", name_, "_depth_records"),
+                        records_);
+  int64_t age_ms = 0;
+  if (records_ != 0) {
+    age_ms = absl::ToInt64Milliseconds(absl::Now() - segments_.front().oldest);
+  }
+  self_metrics.SetGauge(absl::StrCat("spool_", name_, "_oldest_age_ms"),
+                        std::max<int64_t>(age_ms, 0));
+}
+
+bool Spool::Wait(absl::Duration d) {
+  absl::MutexLock lock(&mu_);
+  return !mu_.AwaitWithTimeout(absl::Condition(&stop_), d);
+}
+
+void Spool::Run() {
+  auto has_work = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stop_ || records_ != 0;
+  };
+  auto& self_metrics = SelfMetrics::GetInstance();
+  FILE* file = nullptr;
+  uint64_t seq = 0;
+  std::string record;
+  SpoolFrame frame;
+
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(&has_work));
+      // Whatever is left stays on disk for the next run.
+      if (stop_) {
+        break;
+      }
+      // Only sealed segments are read.
+      if (active_ != nullptr && segments_.size() == 1) {
+        SealActive();
+      }
+      // Evicted while we were reading it.
+      if (file != nullptr && seq != segments_.front().seq) {
+        fclose(file);
+        file = nullptr;
+      }
+      if (file == nullptr) {
+        seq = segments_.front().seq;
+        file = OpenSegment(SegmentPath(seq));
+        if (file == nullptr) {
+          PopFront();
+          continue;
+        }
+      }
+    }
+
+    long pos = ftell(file);  // NOLINT
+    if (!ReadFrame(file, &record, &frame)) {
+      absl::MutexLock lock(&mu_);
+      // What is left of the segment can't be trusted.
+      if (!segments_.empty() && segments_.front().seq == seq) {
+        self_metrics.Increment(absl::StrCat("spool_", name_, "_lost_records"),
+                               segments_.front().records);
+        PopFront();
+        ReportDepth();
+      }
+      fclose(file);
+      file = nullptr;
+      continue;
+    }
+    {
+      absl::MutexLock lock(&mu_);
+      if (!segments_.empty() && segments_.front().seq == seq) {
+        segments_.front().oldest = absl::FromUnixNanos(frame.time_ns);
+      }
+    }
+
+    auto start = absl::Now();
+    auto status = replay_(record);
+    self_metrics.RecordLatency(absl::StrCat("spool_", name_, "_replay_latency"),
+                               absl::Now() - start);
+    if (IsRetryable(status)) {
+      self_metrics.Increment(
+          absl::StrCat("spool_", name_, "_replay_failures"));
+      fseek(file, pos, SEEK_SET);
+      if (!Wait(SPOOL_RETRY_INTERVAL)) {
+        break;
+      }
+      continue;
+    }
+    if (status.ok()) {
+      self_metrics.Increment(
+          absl::StrCat("spool_", name_, "_replayed_records"));
+    } else {
+      self_metrics.Increment(
+          absl::StrCat("spool_", name_, "_replay_dropped_records"));
+      std::cerr << "Dropping spooled " << name_ << " record: " << status
+                << std::endl;
+    }
+
+    {
+      absl::MutexLock lock(&mu_);
+      if (!segments_.empty() && segments_.front().seq == seq) {
+        Segment& front = segments_.front();
+        front.bytes -= sizeof(frame) + frame.length;
+        front.records--;
+        bytes_ -= sizeof(frame) + frame.length;
+        records_--;
+        if (front.records == 0) {
+          PopFront();
+          fclose(file);
+          file = nullptr;
+        }
+      }
+      ReportDepth();
+    }
+    if (!Wait(absl::Seconds(1) / replay_rate_)) {
+      break;
+    }
+  }
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+}  // namespace prober
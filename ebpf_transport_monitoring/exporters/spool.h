@@ -0,0 +1,115 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_SPOOL_H_
+#define _EXPORTERS_SPOOL_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+#define SPOOL_DEFAULT_MAX_BYTES (256ULL * 1024 * 1024)
+#define SPOOL_DEFAULT_REPLAY_RATE 10
+
+namespace prober {
+
+/* Bounded on-disk queue of requests an exporter could not send. Records are
+  appended to segments in dir, each framed with its length, a CRC32 and the
+  time it was spooled. A background thread hands records back to the
+  exporter oldest first, at most replay_rate per second, and waits while the
+  exporter says the backend is still unavailable. Once the spool is over
+  max_bytes the oldest segments are deleted.
+
+  Replay is at least once: a record is only dropped from the spool once it
+  was sent, and records of a segment that was being replayed when lightfoot
+  stopped are sent again on the next start.
+
+  Metrics are reported as spool_<name>_*. */
+class Spool {
+ public:
+  /* Returns OkStatus once the record was sent. UNAVAILABLE,
+    DEADLINE_EXCEEDED and RESOURCE_EXHAUSTED keep the record and pause the
+    replay, any other error drops it. */
+  typedef std::function<absl::Status(const std::string& record)> ReplayFn;
+
+  Spool() = delete;
+  Spool(std::string name, std::string dir,
+        uint64_t max_bytes = SPOOL_DEFAULT_MAX_BYTES,
+        uint32_t replay_rate = SPOOL_DEFAULT_REPLAY_RATE);
+  ~Spool();
+  Spool(const Spool&) = delete;
+  Spool& operator=(const Spool&) = delete;
+
+  // Creates dir and picks up segments left by an earlier run.
+  absl::Status Init();
+  absl::Status Start(ReplayFn replay);
+
+  // Thread safe.
+  absl::Status Append(absl::string_view record);
+  // True if nothing is waiting to be replayed. Exporters keep spooling while
+  // this is false so records are replayed in order.
+  bool Empty();
+
+  // Errors worth retrying later.
+  static bool IsRetryable(const absl::Status& status);
+
+ private:
+  struct Segment {
+    uint64_t seq;
+    // Bytes and records not replayed yet.
+    uint64_t bytes;
+    uint64_t records;
+    // Spool time of the oldest record not replayed yet.
+    absl::Time oldest;
+  };
+
+  void Run();
+  std::string SegmentPath(uint64_t seq);
+  absl::Status LoadSegment(uint64_t seq);
+  void SealActive() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void PopFront() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Evict() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void ReportDepth() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Waits for d or until the spool is stopped, returns false if stopped.
+  bool Wait(absl::Duration d) ABSL_LOCKS_EXCLUDED(mu_);
+
+  std::string name_;
+  std::string dir_;
+  uint64_t max_bytes_;
+  uint64_t segment_bytes_;
+  uint32_t replay_rate_;
+  ReplayFn replay_;
+
+  absl::Mutex mu_;
+  // Oldest first, the last one is being written if active_ is set.
+  std::deque<Segment> segments_ ABSL_GUARDED_BY(mu_);
+  FILE* active_ ABSL_GUARDED_BY(mu_);
+  uint64_t next_seq_ ABSL_GUARDED_BY(mu_);
+  uint64_t bytes_ ABSL_GUARDED_BY(mu_);
+  uint64_t records_ ABSL_GUARDED_BY(mu_);
+  bool stop_ ABSL_GUARDED_BY(mu_);
+  std::thread worker_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_SPOOL_H_
@@ -0,0 +1,257 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/spool.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace prober {
+namespace {
+
+// Frames in a segment follow an 8 byte magic and start with a 16 byte header.
+constexpr size_t kMagicSize = 8;
+constexpr size_t kFrameSize = 16;
+constexpr uint32_t kReplayRate = 1000;
+
+// Records what the spool replays, answering with the statuses it is given.
+class Collector {
+ public:
+  Spool::ReplayFn Fn() {
+    return [this](const std::string& record) {
+      absl::MutexLock lock(&mu_);
+      calls_++;
+      if (!status_.ok()) {
+        return status_;
+      }
+      records_.push_back(record);
+      return absl::OkStatus();
+    };
+  }
+
+  void SetStatus(absl::Status status) {
+    absl::MutexLock lock(&mu_);
+    status_ = status;
+  }
+
+  std::vector<std::string> Records() {
+    absl::MutexLock lock(&mu_);
+    return records_;
+  }
+
+  int Calls() {
+    absl::MutexLock lock(&mu_);
+    return calls_;
+  }
+
+ private:
+  absl::Mutex mu_;
+  absl::Status status_;
+  std::vector<std::string> records_;
+  int calls_ = 0;
+};
+
+class SpoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = ::testing::TempDir() + "/" +
+           ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    mkdir(dir_.c_str(), 0755);
+    for (const auto& name : Segments()) {
+      unlink((dir_ + "/" + name).c_str());
+    }
+  }
+
+  std::vector<std::string> Segments() {
+    std::vector<std::string> names;
+    DIR* dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+      return names;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        names.push_back(name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  // Appends records and stops without replaying them.
+  void Spooled(const std::vector<std::string>& records,
+               uint64_t max_bytes = SPOOL_DEFAULT_MAX_BYTES) {
+    Spool spool("test", dir_, max_bytes, kReplayRate);
+    ASSERT_TRUE(spool.Init().ok());
+    for (const auto& record : records) {
+      ASSERT_TRUE(spool.Append(record).ok());
+    }
+  }
+
+  // Starts a spool on dir_ and waits until all of it was replayed.
+  std::vector<std::string> Replay() {
+    Collector collector;
+    Spool spool("test", dir_, SPOOL_DEFAULT_MAX_BYTES, kReplayRate);
+    EXPECT_TRUE(spool.Init().ok());
+    EXPECT_TRUE(spool.Start(collector.Fn()).ok());
+    absl::Time deadline = absl::Now() + absl::Seconds(10);
+    while (!spool.Empty() && absl::Now() < deadline) {
+      absl::SleepFor(absl::Milliseconds(5));
+    }
+    EXPECT_TRUE(spool.Empty());
+    return collector.Records();
+  }
+
+  void Overwrite(const std::string& name, long offset,  // NOLINT
+                 char byte) {
+    FILE* file = fopen((dir_ + "/" + name).c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    fseek(file, offset, SEEK_SET);
+    fputc(byte, file);
+    fclose(file);
+  }
+
+  std::string dir_;
+};
+
+TEST_F(SpoolTest, ReplaysOldestFirst) {
+  Collector collector;
+  {
+    Spool spool("test", dir_, SPOOL_DEFAULT_MAX_BYTES, kReplayRate);
+    ASSERT_TRUE(spool.Init().ok());
+    EXPECT_TRUE(spool.Empty());
+    ASSERT_TRUE(spool.Append("first").ok());
+    ASSERT_TRUE(spool.Append("").ok());
+    ASSERT_TRUE(spool.Append("third").ok());
+    EXPECT_FALSE(spool.Empty());
+    ASSERT_TRUE(spool.Start(collector.Fn()).ok());
+    absl::Time deadline = absl::Now() + absl::Seconds(10);
+    while (!spool.Empty() && absl::Now() < deadline) {
+      absl::SleepFor(absl::Milliseconds(5));
+    }
+  }
+  EXPECT_EQ(collector.Records(),
+            std::vector<std::string>({"first", "", "third"}));
+  EXPECT_TRUE(Segments().empty());
+}
+
+TEST_F(SpoolTest, ReplaysOnRestart) {
+  Spooled({"a", "b"});
+  ASSERT_EQ(Segments().size(), 1);
+  Spooled({"c"});
+  EXPECT_EQ(Replay(), std::vector<std::string>({"a", "b", "c"}));
+  EXPECT_TRUE(Segments().empty());
+}
+
+TEST_F(SpoolTest, RejectsBadCrc) {
+  Spooled({"good", "flipped", "after"});
+  auto segments = Segments();
+  ASSERT_EQ(segments.size(), 1);
+  // First byte of the second record, after the 4 bytes of "good".
+  Overwrite(segments[0], kMagicSize + kFrameSize + 4 + kFrameSize, 'F');
+  // The rest of the segment can't be trusted once a frame is bad.
+  EXPECT_EQ(Replay(), std::vector<std::string>({"good"}));
+}
+
+TEST_F(SpoolTest, StopsAtTruncatedTail) {
+  Spooled({"complete", "partial"});
+  auto segments = Segments();
+  ASSERT_EQ(segments.size(), 1);
+  std::string path = dir_ + "/" + segments[0];
+  struct stat st;
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  ASSERT_EQ(truncate(path.c_str(), st.st_size - 3), 0);
+  EXPECT_EQ(Replay(), std::vector<std::string>({"complete"}));
+}
+
+TEST_F(SpoolTest, EvictsOldestAtCap) {
+  // Segments are 64 KiB at least, the cap holds about four of them.
+  constexpr uint64_t kMaxBytes = 256 * 1024;
+  constexpr int kRecords = 1000;
+  std::vector<std::string> records;
+  for (int i = 0; i < kRecords; i++) {
+    records.push_back(absl::StrCat(i, ":", std::string(1000, 'x')));
+  }
+  Spooled(records, kMaxBytes);
+
+  uint64_t bytes = 0;
+  for (const auto& name : Segments()) {
+    struct stat st;
+    ASSERT_EQ(stat((dir_ + "/" + name).c_str(), &st), 0);
+    bytes += st.st_size;
+  }
+  // Only the segment being written may go over the cap.
+  EXPECT_LE(bytes, kMaxBytes + 64 * 1024);
+
+  auto replayed = Replay();
+  ASSERT_FALSE(replayed.empty());
+  EXPECT_LT(replayed.size(), kRecords);
+  // What is left is the newest records, in order.
+  size_t first = kRecords - replayed.size();
+  for (size_t i = 0; i < replayed.size(); i++) {
+    EXPECT_EQ(replayed[i], records[first + i]);
+  }
+}
+
+TEST_F(SpoolTest, PausesOnRetryableError) {
+  Spooled({"kept"});
+  {
+    Collector collector;
+    collector.SetStatus(absl::UnavailableError("backend down"));
+    Spool spool("test", dir_, SPOOL_DEFAULT_MAX_BYTES, kReplayRate);
+    ASSERT_TRUE(spool.Init().ok());
+    ASSERT_TRUE(spool.Start(collector.Fn()).ok());
+    absl::SleepFor(absl::Milliseconds(500));
+    // Waits before trying again instead of replaying at the full rate.
+    EXPECT_EQ(collector.Calls(), 1);
+    EXPECT_FALSE(spool.Empty());
+  }
+  EXPECT_EQ(Replay(), std::vector<std::string>({"kept"}));
+}
+
+TEST_F(SpoolTest, DropsOnOtherErrors) {
+  Spooled({"rejected", "sent"});
+  Collector collector;
+  collector.SetStatus(absl::InvalidArgumentError("bad request"));
+  Spool spool("test", dir_, SPOOL_DEFAULT_MAX_BYTES, kReplayRate);
+  ASSERT_TRUE(spool.Init().ok());
+  ASSERT_TRUE(spool.Start(collector.Fn()).ok());
+  absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (collector.Calls() == 0 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  collector.SetStatus(absl::OkStatus());
+  while (!spool.Empty() && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(5));
+  }
+  EXPECT_EQ(collector.Records(), std::vector<std::string>({"sent"}));
+}
+
+}  // namespace
+}  // namespace prober
@@ -22,6 +22,7 @@
 
 #include "absl/status/status.h"
 #include "exporters/exporters_util.h"
+#include "exporters/log_encoder.h"
 
 namespace prober {
 
@@ -44,13 +45,20 @@ absl::Status StdoutEventExporter::HandleData(std::string log_name,
 
   auto conn_id = ExportersUtil::GetLogConnId(log_name, data);
 
-  auto uuid = correlator_->GetUUID(conn_id);
+  if (!correlator_->CopyUUID(conn_id, &uuid_)) {
+    return absl::OkStatus();
+  }
 
-  if (!uuid.ok()) {
+  if (json_) {
+    auto json = LogEncoder::EncodeJson(log_name, uuid_, data);
+    if (!json.ok()) {
+      return json.status();
+    }
+    std::cout << *json << std::endl;
     return absl::OkStatus();
   }
 
-  auto log_data = ExportersUtil::GetLogString(log_name, *uuid, data);
+  auto log_data = ExportersUtil::GetLogString(log_name, uuid_, data);
   if (!log_data.ok()) {
     return log_data.status();
   }
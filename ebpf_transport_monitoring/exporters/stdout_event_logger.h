@@ -25,7 +25,8 @@ namespace prober {
 
 class StdoutEventExporter : public LogExporterInterface {
  public:
-  StdoutEventExporter() = default;
+  // json writes one JSON object per line instead of free form text.
+  explicit StdoutEventExporter(bool json = false) : json_(json) {}
   ~StdoutEventExporter() override = default;
   absl::Status Init() override { return absl::OkStatus(); }
 
@@ -35,6 +36,9 @@ class StdoutEventExporter : public LogExporterInterface {
 
  private:
   absl::flat_hash_map<std::string, bool> logs_;
+  bool json_;
+  // Reused for every event.
+  std::string uuid_;
 };
 
 }  // namespace prober
@@ -31,7 +31,11 @@ absl::Status StdoutMetricExporter::RegisterMetric(std::string name,
   if (metrics_.find(name) != metrics_.end()) {
     return absl::AlreadyExistsError("metric_name already registered");
   }
-  metrics_[name] = desc;
+  auto id = conn_state_.AddMetric();
+  if (!id.ok()) {
+    return id.status();
+  }
+  metrics_[name] = {desc, *id, GetMetricDecoder(desc)};
   return absl::OkStatus();
 }
 
@@ -44,18 +48,20 @@ absl::Status StdoutMetricExporter::HandleData(std::string metric_name,
 
   metric_format_t* metric = (metric_format_t*)value;
 
-  auto uuid = correlator_->GetUUID(*(uint64_t*)key);
+  auto conn = correlator_->GetConnHandle(*(uint64_t*)key);
 
-  if (!uuid.ok()) {
+  if (!conn.ok()) {
     return absl::OkStatus();
   }
 
-  if (!last_read_.CheckMetricTime(metric_name, *uuid, metric->timestamp).ok()) {
+  if (!conn_state_.CheckMetricTime(*conn, it->second.id, metric->timestamp)
+           .ok()) {
     return absl::OkStatus();
   }
 
   auto metric_str = ExportersUtil::GetMetricString(
-      metric_name, *uuid, it->second, key, &(metric->data));
+      metric_name, correlator_->GetUUID(*conn), it->second.decoder, key,
+      &(metric->data));
   if (!metric_str.ok()) {
     return metric_str.status();
   }
@@ -64,10 +70,10 @@ absl::Status StdoutMetricExporter::HandleData(std::string metric_name,
 }
 
 void StdoutMetricExporter::Cleanup() {
-  auto uuids = last_read_.GetUUID();
-  for (auto uuid : uuids) {
-    if (!correlator_->CheckUUID(uuid)) {
-      last_read_.DeleteValue(uuid);
+  auto conns = conn_state_.GetConnHandles();
+  for (auto conn : conns) {
+    if (!correlator_->CheckConnHandle(conn)) {
+      conn_state_.DeleteValue(conn);
     }
   }
 }
@@ -39,8 +39,8 @@ class StdoutMetricExporter : public MetricExporterInterface {
   void Cleanup();
 
  private:
-  absl::flat_hash_map<std::string, MetricDesc> metrics_;
-  MetricTimeChecker last_read_;
+  absl::flat_hash_map<std::string, ExportedMetric> metrics_;
+  ConnStateTable conn_state_;
 };
 
 }  // namespace prober
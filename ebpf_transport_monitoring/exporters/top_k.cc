@@ -0,0 +1,72 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/top_k.h"
+
+#include <cstdint>
+#include <set>
+#include <utility>
+
+namespace prober {
+
+TopK::TopK(uint32_t k)
+    : k_(k ? k : 1), monitored_((k ? k : 1) * TOPK_MONITOR_FACTOR) {}
+
+void TopK::Add(uint64_t key, double weight) {
+  if (weight <= 0) {
+    return;
+  }
+  auto it = counts_.find(key);
+  if (it != counts_.end()) {
+    order_.erase({it->second, key});
+    it->second += weight;
+    order_.insert({it->second, key});
+    return;
+  }
+  double count = weight;
+  if (counts_.size() >= monitored_) {
+    auto smallest = order_.begin();
+    count += smallest->first;
+    counts_.erase(smallest->second);
+    order_.erase(smallest);
+  }
+  counts_.insert({key, count});
+  order_.insert({count, key});
+}
+
+void TopK::Remove(uint64_t key) {
+  auto it = counts_.find(key);
+  if (it == counts_.end()) {
+    return;
+  }
+  order_.erase({it->second, key});
+  counts_.erase(it);
+  top_.erase(key);
+}
+
+void TopK::Refresh() {
+  top_.clear();
+  for (auto it = order_.rbegin(); it != order_.rend() && top_.size() < k_;
+       ++it) {
+    top_.insert(it->second);
+  }
+  std::set<std::pair<double, uint64_t>> order;
+  for (auto& count : counts_) {
+    count.second /= 2;
+    order.insert({count.second, count.first});
+  }
+  order_.swap(order);
+}
+
+}  // namespace prober
@@ -0,0 +1,60 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EXPORTERS_TOP_K_H_
+#define _EXPORTERS_TOP_K_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+
+// Keys monitored per top key, more lowers the overestimation of counts.
+#define TOPK_MONITOR_FACTOR 4
+
+namespace prober {
+
+/* Space-Saving heavy hitter tracking. At most k * TOPK_MONITOR_FACTOR keys
+  are counted; a new key takes the slot of the smallest one and inherits its
+  count, so memory does not depend on the number of keys seen. Refresh picks
+  the k largest and halves every count so the ranking follows recent
+  activity. */
+class TopK {
+ public:
+  TopK() = delete;
+  explicit TopK(uint32_t k);
+
+  void Add(uint64_t key, double weight);
+  void Remove(uint64_t key);
+  void Refresh();
+  // Whether key was among the k largest at the last Refresh.
+  bool IsTop(uint64_t key) const { return top_.contains(key); }
+  // Number of keys counted, at most k * TOPK_MONITOR_FACTOR.
+  size_t Monitored() const { return counts_.size(); }
+
+ private:
+  uint32_t k_;
+  uint32_t monitored_;
+  // Ordered by count, smallest first.
+  std::set<std::pair<double, uint64_t>> order_;
+  absl::flat_hash_map<uint64_t, double> counts_;
+  absl::flat_hash_set<uint64_t> top_;
+};
+
+}  // namespace prober
+
+#endif  // _EXPORTERS_TOP_K_H_
@@ -0,0 +1,112 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exporters/top_k.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace prober {
+namespace {
+
+TEST(TopKTest, BoundsMonitoredKeys) {
+  TopK top_k(2);
+  for (uint64_t key = 0; key < 10000; key++) {
+    top_k.Add(key, 1);
+    ASSERT_LE(top_k.Monitored(), 2 * TOPK_MONITOR_FACTOR);
+  }
+  EXPECT_EQ(top_k.Monitored(), 2 * TOPK_MONITOR_FACTOR);
+}
+
+TEST(TopKTest, KeepsHeavyHitters) {
+  TopK top_k(3);
+  // Heavy keys 1 to 3 are mixed with a stream of keys seen once.
+  uint64_t light = 100;
+  for (int round = 0; round < 1000; round++) {
+    for (uint64_t heavy = 1; heavy <= 3; heavy++) {
+      top_k.Add(heavy, 10);
+    }
+    for (int i = 0; i < 20; i++) {
+      top_k.Add(light++, 1);
+    }
+  }
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(1));
+  EXPECT_TRUE(top_k.IsTop(2));
+  EXPECT_TRUE(top_k.IsTop(3));
+  EXPECT_FALSE(top_k.IsTop(light - 1));
+  EXPECT_LE(top_k.Monitored(), 3 * TOPK_MONITOR_FACTOR);
+}
+
+TEST(TopKTest, NothingIsTopBeforeRefresh) {
+  TopK top_k(1);
+  top_k.Add(1, 5);
+  EXPECT_FALSE(top_k.IsTop(1));
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(1));
+}
+
+TEST(TopKTest, RefreshHalvesCounts) {
+  TopK top_k(1);
+  top_k.Add(1, 100);
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(1));
+  // Key 1 is down to 50, a recent key with less than its total overtakes it.
+  top_k.Add(2, 60);
+  top_k.Refresh();
+  EXPECT_FALSE(top_k.IsTop(1));
+  EXPECT_TRUE(top_k.IsTop(2));
+}
+
+TEST(TopKTest, IgnoresNonPositiveWeights) {
+  TopK top_k(1);
+  top_k.Add(1, 0);
+  top_k.Add(2, -3);
+  EXPECT_EQ(top_k.Monitored(), 0);
+}
+
+TEST(TopKTest, Remove) {
+  TopK top_k(1);
+  top_k.Add(1, 100);
+  top_k.Add(2, 1);
+  top_k.Refresh();
+  ASSERT_TRUE(top_k.IsTop(1));
+
+  top_k.Remove(1);
+  EXPECT_FALSE(top_k.IsTop(1));
+  EXPECT_EQ(top_k.Monitored(), 1);
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(2));
+
+  // A removed key starts again from its new weight.
+  top_k.Add(1, 0.1);
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(2));
+  EXPECT_FALSE(top_k.IsTop(1));
+  top_k.Remove(42);
+  EXPECT_EQ(top_k.Monitored(), 2);
+}
+
+TEST(TopKTest, ZeroKKeepsOne) {
+  TopK top_k(0);
+  top_k.Add(1, 1);
+  top_k.Add(2, 2);
+  top_k.Refresh();
+  EXPECT_TRUE(top_k.IsTop(2));
+  EXPECT_FALSE(top_k.IsTop(1));
+}
+
+}  // namespace
+}  // namespace prober
@@ -13,8 +13,10 @@
 // limitations under the License.
 
 #include <event2/event.h>
+#include <signal.h>
 #include <tclap/CmdLine.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <ostream>
@@ -22,31 +24,74 @@
 
 #include "correlators/h2_go_correlator.h"
 #include "data_manager.h"
+#include "exporters/async_exporter.h"
 #include "exporters/file_exporter.h"
 #include "exporters/gcp_exporter.h"
 #include "exporters/oc_gcp_exporter.h"
+#include "exporters/otlp_exporter.h"
+#include "exporters/prometheus_exporter.h"
+#include "exporters/shm_exporter.h"
 #include "exporters/stdout_event_logger.h"
 #include "exporters/stdout_metric_exporter.h"
 #include "loader/correlator/correlator.h"
 #include "loader/exporter/log_exporter.h"
 #include "loader/exporter/metric_exporter.h"
+#include "loader/exporter/self_metrics.h"
+#include "loader/source/cgroup_filter.h"
 #include "loader/source/data_source.h"
+#include "loader/source/event_control.h"
+#include "loader/source/map_capacity.h"
+#include "sources/common/defines.h"
 #include "sources/source_manager/h2_go_grpc_source.h"
 #include "sources/source_manager/tcp_source.h"
 #include "sources/source_manager/map_source.h"
 
 #include "absl/status/status.h"
+#include "absl/strings/strip.h"
+#include "absl/time/time.h"
+
+static void PrintSelfMetrics(evutil_socket_t, short, void *) {  // NOLINT
+  std::cout << prober::SelfMetrics::GetInstance().ToString() << std::flush;
+}
+
+static void SnapshotTcp(evutil_socket_t, short, void *arg) {  // NOLINT
+  auto source = static_cast<prober::TcpSource *>(arg);
+  absl::Status status = source->Snapshot();
+  if (!status.ok()) {
+    std::cerr << status << std::endl;
+  }
+}
+
+static void UpdateCgroupFilter(evutil_socket_t, short, void *arg) {  // NOLINT
+  auto filter = static_cast<prober::CgroupFilter *>(arg);
+  absl::Status status = filter->Update();
+  if (!status.ok()) {
+    std::cerr << "Cgroup filter not updated: " << status << std::endl;
+  }
+}
+
+static void ReloadEventControl(evutil_socket_t, short, void *arg) {  // NOLINT
+  auto control = static_cast<prober::EventControl *>(arg);
+  absl::Status status = control->Load();
+  if (!status.ok()) {
+    std::cerr << "Event control not reloaded: " << status << std::endl;
+    return;
+  }
+  std::cout << "Event control reloaded" << std::endl;
+}
 
 int main(int argc, char **argv) {
   prober::TcpSource tcp_source;
   struct event_base *base = event_base_new();
   prober::DataManager data_manager(base);
-  prober::LogExporterInterface *logger;
-  prober::MetricExporterInterface *metric_exporter;
+  std::vector<prober::LogExporterInterface *> loggers;
+  std::vector<prober::MetricExporterInterface *> metric_exporters;
   prober::H2GoCorrelator correlator;
   absl::Status status;
   bool file_logging;
   bool host_agg;
+  int topk;
+  std::string topk_metric;
 
   bool gcp_logging, oc_gcp_logging;
   std::string gcp_creds;
@@ -54,10 +99,48 @@ int main(int argc, char **argv) {
 
   std::vector<pid_t> pids;
   std::vector<std::string> custom_labels;
+  int self_metrics_interval;
+  std::string file_format;
+  int file_archives;
+  bool json_logs;
+  int prometheus_port;
+  int prometheus_max_series;
+  std::string otlp_endpoint;
+  int otlp_batch_size;
+  int otlp_flush_interval;
+  int otlp_max_in_flight;
+  bool otlp_gzip;
+  std::string shm_socket;
+  int shm_size;
+  std::string spool_dir;
+  int spool_max_mb;
+  int spool_replay_rate;
+  int exporter_queue;
+  int max_connections;
+  std::string event_control_file;
+  std::vector<std::string> cgroups;
+  std::string tcp_collection;
 
   try {
     TCLAP::CmdLine cmd("eBPF gRPC golang h2 and tcp tracer", ' ', "0.1");
     TCLAP::SwitchArg file_log_switch("f", "file", "Log to file", cmd, false);
+    std::vector<std::string> file_formats = {"text", "segment"};
+    TCLAP::ValuesConstraint<std::string> file_format_constraint(file_formats);
+    TCLAP::ValueArg<std::string> file_format_cmd(
+        "", "file_format", "Format of files written with -f", false, "text",
+        &file_format_constraint);
+    cmd.add(file_format_cmd);
+    TCLAP::ValueArg<int> file_archives_cmd(
+        "", "file_compress",
+        "Gzip files rotated with -f in the background and keep N archives, "
+        "0 disables",
+        false, 0, "archives");
+    cmd.add(file_archives_cmd);
+    TCLAP::SwitchArg json_switch(
+        "j", "json",
+        "Export logs as structured JSON (JSON Lines on stdout and -f, "
+        "jsonPayload on Cloud Logging)",
+        cmd, false);
     TCLAP::SwitchArg host_agg_switch("s", "host_level",
                                      "Aggregate at host level", cmd, false);
     TCLAP::SwitchArg gcp_log_switch(
@@ -76,8 +159,111 @@ int main(int argc, char **argv) {
         "Labels to attach to opencensus metrics <key>:<value>", false,
         "string");
     cmd.add(custom_labels_cmd);
+    TCLAP::ValueArg<int> topk_cmd(
+        "", "topk",
+        "With -o, keep connection labels only for the N busiest connections "
+        "and fold the others per remote address, 0 keeps all",
+        false, 0, "connections");
+    cmd.add(topk_cmd);
+    TCLAP::ValueArg<std::string> topk_metric_cmd(
+        "", "topk_metric", "Metric connections are ranked by for --topk",
+        false, "tcp_snd_bytes", "metric");
+    cmd.add(topk_metric_cmd);
+    TCLAP::ValueArg<int> prometheus_port_cmd(
+        "P", "prometheus_port",
+        "Serve metrics for Prometheus on http://0.0.0.0:<port>/metrics", false,
+        0, "port");
+    cmd.add(prometheus_port_cmd);
+    TCLAP::ValueArg<int> prometheus_max_series_cmd(
+        "", "prometheus_max_series",
+        "Maximum number of series served with -P, new series are dropped",
+        false, PROMETHEUS_MAX_SERIES, "series");
+    cmd.add(prometheus_max_series_cmd);
+    TCLAP::ValueArg<std::string> otlp_cmd(
+        "", "otlp", "Export logs and metrics over OTLP/gRPC to a collector",
+        false, "", "host:port");
+    cmd.add(otlp_cmd);
+    TCLAP::ValueArg<int> otlp_batch_size_cmd(
+        "", "otlp_batch_size", "Log records or data points per OTLP request",
+        false, 512, "records");
+    cmd.add(otlp_batch_size_cmd);
+    TCLAP::ValueArg<int> otlp_flush_interval_cmd(
+        "", "otlp_flush_interval",
+        "Send partial OTLP batches after N seconds", false, 10, "seconds");
+    cmd.add(otlp_flush_interval_cmd);
+    TCLAP::ValueArg<int> otlp_max_in_flight_cmd(
+        "", "otlp_max_in_flight",
+        "Maximum OTLP requests in flight per signal, further batches wait",
+        false, 4, "requests");
+    cmd.add(otlp_max_in_flight_cmd);
+    TCLAP::SwitchArg otlp_gzip_switch("", "otlp_gzip",
+                                      "Gzip compress OTLP requests", cmd,
+                                      false);
+    TCLAP::ValueArg<std::string> shm_cmd(
+        "", "shm",
+        "Publish logs and metrics to a shared memory ring handed out on this "
+        "unix socket",
+        false, "", "path");
+    cmd.add(shm_cmd);
+    TCLAP::ValueArg<int> shm_size_cmd("", "shm_size",
+                                      "Size of the --shm ring in MiB", false,
+                                      64, "MiB");
+    cmd.add(shm_size_cmd);
+    TCLAP::ValueArg<std::string> spool_dir_cmd(
+        "", "spool_dir",
+        "Spool requests to Cloud Logging/Monitoring that fail under this "
+        "directory and replay them once the backend is back (-g, -o logs)",
+        false, "", "path");
+    cmd.add(spool_dir_cmd);
+    TCLAP::ValueArg<int> spool_max_mb_cmd(
+        "", "spool_max_mb",
+        "Size of each spool, the oldest requests are dropped beyond it", false,
+        256, "MiB");
+    cmd.add(spool_max_mb_cmd);
+    TCLAP::ValueArg<int> spool_replay_rate_cmd(
+        "", "spool_replay_rate", "Spooled requests replayed per second", false,
+        SPOOL_DEFAULT_REPLAY_RATE, "requests");
+    cmd.add(spool_replay_rate_cmd);
+    TCLAP::ValueArg<int> exporter_queue_cmd(
+        "", "exporter_queue",
+        "Logs and data points queued per exporter thread, more are dropped",
+        false, EXPORTER_DEFAULT_QUEUE, "entries");
+    cmd.add(exporter_queue_cmd);
+    TCLAP::ValueArg<int> max_connections_cmd(
+        "", "max_connections",
+        "Connections the BPF maps have room for, 0 sizes them from the "
+        "sockets the traced processes have open",
+        false, 0, "connections");
+    cmd.add(max_connections_cmd);
+    TCLAP::ValueArg<std::string> event_control_cmd(
+        "", "event_control",
+        "File with the events to disable or sample, reread on SIGHUP", false,
+        "", "path");
+    cmd.add(event_control_cmd);
+    TCLAP::MultiArg<std::string> cgroup_cmd(
+        "", "cgroup",
+        "Trace every process of a cgroup v2 cgroup and its descendants, e.g. "
+        "a pod. Relative paths start at " CGROUP_ROOT ", can be repeated",
+        false, "path");
+    cmd.add(cgroup_cmd);
+    std::vector<std::string> tcp_collections = {"tcp_probe", "iter",
+                                                "sock_ops"};
+    TCLAP::ValuesConstraint<std::string> tcp_collection_constraint(
+        tcp_collections);
+    TCLAP::ValueArg<std::string> tcp_collection_cmd(
+        "", "tcp_collection",
+        "How TCP metrics are read: sampled from the tcp_probe tracepoint on "
+        "every packet, with a BPF iterator once per poll interval, or from "
+        "sock_ops callbacks of the traced cgroups",
+        false, "tcp_probe", &tcp_collection_constraint);
+    cmd.add(tcp_collection_cmd);
+    TCLAP::ValueArg<int> self_metrics_cmd(
+        "", "self_metrics_interval",
+        "Print lightfoot self metrics every N seconds, 0 disables", false, 0,
+        "seconds");
+    cmd.add(self_metrics_cmd);
     TCLAP::UnlabeledMultiArg<pid_t> pids_arg(
-        "pids", "List of PIDs to be traced.", true, "pid_t");
+        "pids", "List of PIDs to be traced.", false, "pid_t");
     cmd.add(pids_arg);
     cmd.add(gcp_creds_cmd);
     cmd.add(gcp_project_cmd);
@@ -93,23 +279,95 @@ int main(int argc, char **argv) {
     pids = pids_arg.getValue();
     custom_labels = custom_labels_cmd.getValue();
     host_agg = host_agg_switch.getValue();
+    topk = topk_cmd.getValue();
+    topk_metric = topk_metric_cmd.getValue();
+    self_metrics_interval = self_metrics_cmd.getValue();
+    file_format = file_format_cmd.getValue();
+    file_archives = file_archives_cmd.getValue();
+    json_logs = json_switch.getValue();
+    prometheus_port = prometheus_port_cmd.getValue();
+    prometheus_max_series = prometheus_max_series_cmd.getValue();
+    otlp_endpoint = otlp_cmd.getValue();
+    otlp_batch_size = otlp_batch_size_cmd.getValue();
+    otlp_flush_interval = otlp_flush_interval_cmd.getValue();
+    otlp_max_in_flight = otlp_max_in_flight_cmd.getValue();
+    otlp_gzip = otlp_gzip_switch.getValue();
+    shm_socket = shm_cmd.getValue();
+    shm_size = shm_size_cmd.getValue();
+    spool_dir = spool_dir_cmd.getValue();
+    spool_max_mb = spool_max_mb_cmd.getValue();
+    spool_replay_rate = spool_replay_rate_cmd.getValue();
+    exporter_queue = exporter_queue_cmd.getValue();
+    max_connections = max_connections_cmd.getValue();
+    event_control_file = event_control_cmd.getValue();
+    cgroups = cgroup_cmd.getValue();
+    tcp_collection = tcp_collection_cmd.getValue();
   } catch (TCLAP::ArgException &e) {
     std::cerr << "error: " << e.error() << " for arg " << e.argId()
               << std::endl;
     return -1;
   }
 
+  if (spool_max_mb <= 0 || spool_replay_rate <= 0) {
+    std::cerr << "--spool_max_mb and --spool_replay_rate must be positive"
+              << std::endl;
+    return -1;
+  }
+  uint64_t spool_max_bytes = (uint64_t)spool_max_mb * 1024 * 1024;
+  if (exporter_queue <= 0) {
+    std::cerr << "--exporter_queue must be positive" << std::endl;
+    return -1;
+  }
+
+  // Exporters that block (disk, RPCs) get their own thread so a slow backend
+  // only backs up its own queue. The logger and metric exporter of a backend
+  // share the thread.
+  auto add_async = [&](std::string name, prober::LogExporterInterface *logger,
+                       prober::MetricExporterInterface *metric_exporter) {
+    auto worker = new prober::ExporterWorker(name, exporter_queue);
+    if (logger != nullptr) {
+      loggers.push_back(new prober::AsyncLogExporter(logger, worker));
+    }
+    if (metric_exporter != nullptr) {
+      metric_exporters.push_back(
+          new prober::AsyncMetricExporter(metric_exporter, worker));
+    }
+  };
+
   if (file_logging) {
-    logger = new prober::FileLogger(1, 1048576 * 50, "./logs/");
-    metric_exporter =
-        new prober::FileMetricExporter(1, 1048576 * 50, "./metrics/");
-  } else if (gcp_logging) {
+    prober::FileFormat format = prober::FileFormat::kText;
+    if (file_format == "segment") {
+      format = prober::FileFormat::kSegment;
+    }
+    if (file_archives < 0) {
+      std::cerr << "--file_compress must not be negative" << std::endl;
+      return -1;
+    }
+    prober::FileFormat log_format = format;
+    if (json_logs && format == prober::FileFormat::kText) {
+      log_format = prober::FileFormat::kJson;
+    }
+    add_async("file",
+              new prober::FileLogger(1, 1048576 * 50, "./logs/", log_format,
+                                     file_archives),
+              new prober::FileMetricExporter(1, 1048576 * 50, "./metrics/",
+                                             format, file_archives));
+  }
+  if (gcp_logging) {
     if (gcp_project.empty()) {
       std::cerr << "GCP project name must be specified" << std::endl;
       return -1;
     }
-    logger = new prober::GCPLogger(gcp_project, gcp_creds);
-    metric_exporter = new prober::GCPMetricExporter(gcp_project, gcp_creds);
+    auto gcp_logger = new prober::GCPLogger(gcp_project, gcp_creds, json_logs);
+    auto gcp_metric_exporter =
+        new prober::GCPMetricExporter(gcp_project, gcp_creds);
+    if (!spool_dir.empty()) {
+      gcp_logger->EnableSpool(spool_dir + "/logs", spool_max_bytes,
+                              spool_replay_rate);
+      gcp_metric_exporter->EnableSpool(spool_dir + "/metrics",
+                                       spool_max_bytes, spool_replay_rate);
+    }
+    add_async("gcp", gcp_logger, gcp_metric_exporter);
   } else if (oc_gcp_logging) {
     if (gcp_project.empty()) {
       std::cerr << "GCP project name must be specified" << std::endl;
@@ -119,10 +377,13 @@ int main(int argc, char **argv) {
     if (host_agg) {
       agg = prober::AggregationLevel::kHost;
     }
-    logger = new prober::GCPLogger(gcp_project, gcp_creds);
+    auto gcp_logger = new prober::GCPLogger(gcp_project, gcp_creds, json_logs);
+    if (!spool_dir.empty()) {
+      gcp_logger->EnableSpool(spool_dir + "/logs", spool_max_bytes,
+                              spool_replay_rate);
+    }
     auto oc_metric_exporter =
         new prober::OCGCPMetricExporter(gcp_project, gcp_creds, agg);
-    metric_exporter = oc_metric_exporter;
     absl::flat_hash_map<std::string, std::string> oc_labels;
     for (auto label : custom_labels) {
       auto pos = label.find(":");
@@ -138,26 +399,181 @@ int main(int argc, char **argv) {
       std::cerr << "Error adding custom labels " << status << std::endl;
       return 0;
     }
-  } else {
-    logger = new prober::StdoutEventExporter();
-    metric_exporter = new prober::StdoutMetricExporter();
+    if (topk < 0) {
+      std::cerr << "--topk must not be negative" << std::endl;
+      return -1;
+    }
+    if (topk > 0) {
+      status = oc_metric_exporter->TopConnections(topk, topk_metric);
+      if (!status.ok()) {
+        std::cerr << status << std::endl;
+        return -1;
+      }
+    }
+    add_async("gcp", gcp_logger, oc_metric_exporter);
+  }
+  // Prometheus and shm only do memory work and are tied to the event loop.
+  if (prometheus_port > 0) {
+    if (prometheus_port > 65535 || prometheus_max_series <= 0) {
+      std::cerr << "Invalid prometheus port or max series" << std::endl;
+      return -1;
+    }
+    metric_exporters.push_back(new prober::PrometheusMetricExporter(
+        base, prometheus_port, prometheus_max_series));
+  }
+  if (!otlp_endpoint.empty()) {
+    if (otlp_batch_size <= 0 || otlp_flush_interval <= 0 ||
+        otlp_max_in_flight <= 0) {
+      std::cerr << "Invalid otlp batch size, flush interval or max in flight"
+                << std::endl;
+      return -1;
+    }
+    prober::OtlpOptions options;
+    options.endpoint = otlp_endpoint;
+    options.batch_size = otlp_batch_size;
+    options.flush_interval = absl::Seconds(otlp_flush_interval);
+    options.max_in_flight = otlp_max_in_flight;
+    options.gzip = otlp_gzip;
+    add_async("otlp", new prober::OtlpLogger(options),
+              new prober::OtlpMetricExporter(options));
+  }
+  if (!shm_socket.empty()) {
+    if (shm_size <= 0 || shm_size > 4096) {
+      std::cerr << "--shm_size must be between 1 and 4096" << std::endl;
+      return -1;
+    }
+    auto ring = new prober::ShmRing(base, shm_socket,
+                                    (uint64_t)shm_size * 1024 * 1024);
+    status = ring->Init();
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+    loggers.push_back(new prober::ShmLogger(ring));
+    metric_exporters.push_back(new prober::ShmMetricExporter(ring));
+  }
+  if (loggers.empty()) {
+    loggers.push_back(new prober::StdoutEventExporter(json_logs));
+  }
+  if (metric_exporters.empty()) {
+    metric_exporters.push_back(new prober::StdoutMetricExporter());
   }
 
-  if (logger == nullptr || metric_exporter == nullptr) {
-    std::cerr << "Count not create exporters" << std::endl;
+  for (auto logger : loggers) {
+    status = logger->Init();
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+  }
+  for (auto metric_exporter : metric_exporters) {
+    status = metric_exporter->Init();
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+  }
+
+  if (pids.empty() && cgroups.empty()) {
+    std::cerr << "Give the PIDs or a --cgroup to trace" << std::endl;
     return -1;
   }
+  prober::CgroupFilter cgroup_filter(cgroups);
+  std::vector<pid_t> cgroup_pids;
+  if (!cgroups.empty()) {
+    auto found = cgroup_filter.GetPids();
+    if (!found.ok()) {
+      std::cerr << found.status() << std::endl;
+      return -1;
+    }
+    cgroup_pids = *found;
+  }
 
-  status = logger->Init();
+  if (tcp_collection == "iter") {
+    status = tcp_source.UseIterator();
+  } else if (tcp_collection == "sock_ops") {
+    // Every --cgroup and the cgroup of every PID.
+    std::vector<std::string> sock_ops_cgroups = cgroup_filter.GetPaths();
+    for (pid_t pid : pids) {
+      auto cgroup = prober::CgroupFilter::GetCgroupOf(pid);
+      if (!cgroup.ok()) {
+        std::cerr << cgroup.status() << std::endl;
+        return -1;
+      }
+      if (std::find(sock_ops_cgroups.begin(), sock_ops_cgroups.end(),
+                    *cgroup) == sock_ops_cgroups.end()) {
+        sock_ops_cgroups.push_back(*cgroup);
+      }
+    }
+    // tcp_sockops enables its RTT and retransmit callbacks for every socket
+    // of the cgroups it is attached to, on the root that is the whole host.
+    for (const auto &cgroup : sock_ops_cgroups) {
+      if (absl::StripSuffix(cgroup, "/") == CGROUP_ROOT) {
+        std::cerr << "--tcp_collection sock_ops would attach to the root "
+                     "cgroup " CGROUP_ROOT
+                     " and run for every TCP socket of the host, give the "
+                     "--cgroup of the workload or use another "
+                     "--tcp_collection"
+                  << std::endl;
+        return -1;
+      }
+    }
+    status = tcp_source.UseSockOps(sock_ops_cgroups);
+  }
   if (!status.ok()) {
     std::cerr << status << std::endl;
     return -1;
   }
-  status = metric_exporter->Init();
+  uint64_t traced_pids = pids.size() + cgroup_pids.size();
+
+  if (max_connections < 0) {
+    std::cerr << "--max_connections must not be negative" << std::endl;
+    return -1;
+  }
+  if (max_connections == 0) {
+    // Twice the sockets open now, to leave room for new connections.
+    uint64_t sockets = 0;
+    for (pid_t pid : pids) {
+      auto count = prober::MapCapacity::CountSockets(pid);
+      if (count.ok()) {
+        sockets += *count;
+      }
+    }
+    for (pid_t pid : cgroup_pids) {
+      auto count = prober::MapCapacity::CountSockets(pid);
+      if (count.ok()) {
+        sockets += *count;
+      }
+    }
+    uint64_t entries = MAX_CONN_TRACED;
+    while (entries < 2 * sockets && entries < MAP_CAPACITY_MAX) {
+      entries <<= 1;
+    }
+    max_connections = entries;
+  }
+  auto& map_capacity = prober::MapCapacity::GetInstance();
+  status = map_capacity.Resize(MAX_CONN_TRACED, max_connections);
+  if (status.ok()) {
+    status = map_capacity.Resize(
+        MAX_H2_STREAMS, std::min<uint64_t>(MAP_CAPACITY_MAX,
+                                           (uint64_t)max_connections *
+                                               MAX_AVG_CONCURRENT_STREAMS));
+  }
+  if (status.ok()) {
+    status = map_capacity.Resize(
+        MAX_TCP_DROP_REASONS,
+        std::min<uint64_t>(MAP_CAPACITY_MAX,
+                           (uint64_t)max_connections * MAX_AVG_DROP_REASONS));
+  }
+  if (status.ok() && traced_pids > MAX_PID_TRACED) {
+    status = map_capacity.Resize(MAX_PID_TRACED, traced_pids);
+  }
   if (!status.ok()) {
     std::cerr << status << std::endl;
     return -1;
   }
+  std::cout << "BPF maps sized for " << max_connections << " connections"
+            << std::endl;
 
   prober::MapSource map_source;
   status = map_source.Init();
@@ -175,6 +591,28 @@ int main(int argc, char **argv) {
     std::cerr << status << std::endl;
     return -1;
   }
+  prober::EventControl event_control(event_control_file);
+  if (!event_control_file.empty()) {
+    status = event_control.Load();
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+    struct event *event =
+        evsignal_new(base, SIGHUP, ReloadEventControl, &event_control);
+    event_add(event, nullptr);
+  }
+  if (!cgroups.empty()) {
+    status = cgroup_filter.Update();
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+    struct event *event =
+        event_new(base, -1, EV_PERSIST, UpdateCgroupFilter, &cgroup_filter);
+    auto timeval = absl::ToTimeval(absl::Seconds(CGROUP_UPDATE_INTERVAL));
+    event_add(event, &timeval);
+  }
   
   std::vector<prober::DataSource *> sources;
   auto h2_source = new prober::H2GoGrpcSource();
@@ -189,9 +627,21 @@ int main(int argc, char **argv) {
       return -1;
     }
   }
+  // Not every process of a cgroup is a Go gRPC binary.
+  for (pid_t pid : cgroup_pids) {
+    status = h2_source->AddPID(pid);
+    if (!status.ok() && !absl::IsAlreadyExists(status)) {
+      std::cerr << "No HTTP/2 tracing for pid " << pid << ": " << status
+                << std::endl;
+    }
+  }
 
-  logger->RegisterCorrelator(&correlator);
-  metric_exporter->RegisterCorrelator(&correlator);
+  for (auto logger : loggers) {
+    logger->RegisterCorrelator(&correlator);
+  }
+  for (auto metric_exporter : metric_exporters) {
+    metric_exporter->RegisterCorrelator(&correlator);
+  }
   for (auto source : sources) {
     status = source->Init();
     if (!status.ok()) {
@@ -220,12 +670,14 @@ int main(int argc, char **argv) {
     auto log_sources = source->GetLogSources();
     for (uint32_t i = 0; i < log_sources.size(); i++) {
       if (log_sources[i]->internal_ == false) {
-        status = logger->RegisterLog(log_sources[i]->name_,
-                                     log_sources[i]->log_desc_);
-        if (!status.ok()) {
-          if (log_sources[i]->shared_ && !absl::IsAlreadyExists(status)){
-            std::cerr << status << std::endl;
-            return -1;
+        for (auto logger : loggers) {
+          status = logger->RegisterLog(log_sources[i]->name_,
+                                       log_sources[i]->log_desc_);
+          if (!status.ok()) {
+            if (log_sources[i]->shared_ && !absl::IsAlreadyExists(status)){
+              std::cerr << status << std::endl;
+              return -1;
+            }
           }
         }
       }
@@ -239,12 +691,15 @@ int main(int argc, char **argv) {
     auto metric_sources = source->GetMetricSources();
     for (uint32_t i = 0; i < metric_sources.size(); i++) {
       if (metric_sources[i]->internal_ == false) {
-        status = metric_exporter->RegisterMetric(
-            metric_sources[i]->name_, metric_sources[i]->metric_desc_);
-        if (!status.ok()) {
-          if (metric_sources[i]->shared_ && !absl::IsAlreadyExists(status)){
-            std::cerr << status << std::endl;
-            return -1;
+        for (auto metric_exporter : metric_exporters) {
+          status = metric_exporter->RegisterMetric(
+              metric_sources[i]->name_, metric_sources[i]->metric_desc_);
+          if (!status.ok()) {
+            if (metric_sources[i]->shared_ &&
+                !absl::IsAlreadyExists(status)) {
+              std::cerr << status << std::endl;
+              return -1;
+            }
           }
         }
       }
@@ -256,8 +711,12 @@ int main(int argc, char **argv) {
     }
   }
 
-  data_manager.AddExternalLogHandler(logger);
-  data_manager.AddExternalMetricHandler(metric_exporter);
+  for (auto logger : loggers) {
+    data_manager.AddExternalLogHandler(logger);
+  }
+  for (auto metric_exporter : metric_exporters) {
+    data_manager.AddExternalMetricHandler(metric_exporter);
+  }
 
   status = correlator.Init();
   if (!status.ok()) {
@@ -290,6 +749,20 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (tcp_collection == "iter") {
+    struct event *event =
+        event_new(base, -1, EV_PERSIST, SnapshotTcp, &tcp_source);
+    auto timeval = absl::ToTimeval(tcp_source.SnapshotInterval());
+    event_add(event, &timeval);
+  }
+
+  if (self_metrics_interval > 0) {
+    struct event *event =
+        event_new(base, -1, EV_PERSIST, PrintSelfMetrics, nullptr);
+    auto timeval = absl::ToTimeval(absl::Seconds(self_metrics_interval));
+    event_add(event, &timeval);
+  }
+
   event_base_dispatch(base);
 
   return 0;
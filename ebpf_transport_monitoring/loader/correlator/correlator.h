@@ -15,9 +15,13 @@
 #ifndef _LOADER_CORRELATOR_H_
 #define _LOADER_CORRELATOR_H_
 
+#include <string>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "loader/exporter/data_types.h"
 #include "loader/exporter/handlers.h"
 #include "loader/source/data_source.h"
 
@@ -25,6 +29,10 @@ namespace prober {
 
 enum class Layer { kHTTP2, kTCP, kTLS };
 
+/* Connections are added and removed on the event loop thread while
+  exporters running on their own threads look them up, so the lookups below
+  take mu_ shared and implementations hold it exclusively while changing
+  connection_map_ or handles. */
 class CorrelatorInterface : public LogHandlerInterface,
                             public MetricHandlerInterface {
  public:
@@ -33,11 +41,47 @@ class CorrelatorInterface : public LogHandlerInterface,
   }
 
   absl::StatusOr<std::string> GetUUID(uint64_t eBPF_conn_id) {
+    absl::ReaderMutexLock lock(&mu_);
     auto it = connection_map_.find(eBPF_conn_id);
     if (it == connection_map_.end()) {
       return absl::NotFoundError("conn id not registered");
     }
-    return connection_map_[eBPF_conn_id];
+    return handle_slots_[it->second.index].uuid;
+  }
+
+  // Same as GetUUID, assigns to uuid so a string reused across calls stops
+  // allocating once it is large enough. Returns false if not registered.
+  bool CopyUUID(uint64_t eBPF_conn_id, std::string *uuid) {
+    absl::ReaderMutexLock lock(&mu_);
+    auto it = connection_map_.find(eBPF_conn_id);
+    if (it == connection_map_.end()) {
+      return false;
+    }
+    uuid->assign(handle_slots_[it->second.index].uuid);
+    return true;
+  }
+
+  absl::StatusOr<ConnHandle> GetConnHandle(uint64_t eBPF_conn_id) {
+    absl::ReaderMutexLock lock(&mu_);
+    auto it = connection_map_.find(eBPF_conn_id);
+    if (it == connection_map_.end()) {
+      return absl::NotFoundError("conn id not registered");
+    }
+    return it->second;
+  }
+
+  std::string GetUUID(ConnHandle handle) {
+    absl::ReaderMutexLock lock(&mu_);
+    if (!CheckConnHandleLocked(handle)) {
+      return "";
+    }
+    return handle_slots_[handle.index].uuid;
+  }
+
+  // Returns false once the connection the handle was given for is gone.
+  bool CheckConnHandle(ConnHandle handle) {
+    absl::ReaderMutexLock lock(&mu_);
+    return CheckConnHandleLocked(handle);
   }
 
   virtual bool CheckUUID(std::string uuid) = 0;
@@ -50,8 +94,53 @@ class CorrelatorInterface : public LogHandlerInterface,
   virtual absl::Status Init() = 0;
 
  protected:
+  ConnHandle NewConnHandle(const std::string &uuid)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    uint32_t index;
+    if (!free_handles_.empty()) {
+      index = free_handles_.back();
+      free_handles_.pop_back();
+    } else {
+      index = handle_slots_.size();
+      handle_slots_.push_back({0, false, ""});
+    }
+    auto &slot = handle_slots_[index];
+    // Generation 0 is never handed out so zeroed state is never valid.
+    slot.generation++;
+    slot.in_use = true;
+    slot.uuid = uuid;
+    return {index, slot.generation};
+  }
+
+  void FreeConnHandle(ConnHandle handle) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (!CheckConnHandleLocked(handle)) {
+      return;
+    }
+    handle_slots_[handle.index].in_use = false;
+    handle_slots_[handle.index].uuid.clear();
+    free_handles_.push_back(handle.index);
+  }
+
   absl::flat_hash_map<Layer, std::vector<DataSource *>> sources_;
-  absl::flat_hash_map<uint64_t, std::string> connection_map_;
+  absl::Mutex mu_;
+  absl::flat_hash_map<uint64_t, ConnHandle> connection_map_
+      ABSL_GUARDED_BY(mu_);
+
+ private:
+  bool CheckConnHandleLocked(ConnHandle handle)
+      ABSL_SHARED_LOCKS_REQUIRED(mu_) {
+    return handle.index < handle_slots_.size() &&
+           handle_slots_[handle.index].in_use &&
+           handle_slots_[handle.index].generation == handle.generation;
+  }
+
+  struct HandleSlot {
+    uint32_t generation;
+    bool in_use;
+    std::string uuid;
+  };
+  std::vector<HandleSlot> handle_slots_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint32_t> free_handles_ ABSL_GUARDED_BY(mu_);
 };
 
 }  // namespace prober
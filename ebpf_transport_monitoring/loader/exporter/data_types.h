@@ -34,6 +34,9 @@ enum class MetricType {
   kFloat,
   kDouble,
   kInternal,
+  // The value is a metric_hist_t (events.h) of uint64 samples, only used
+  // with MetricKind::kDistribution.
+  kLog2Histogram,
 };
 
 enum class MetricUnitType { kNone, kTime, kData };
@@ -148,6 +151,9 @@ static __attribute__((unused)) size_t getSize(MetricType m) {
       return sizeof(double);
     case MetricType::kInternal:
       return 0;
+    case MetricType::kLog2Histogram:
+      // count, sum, last and the buckets of metric_hist_t.
+      return sizeof(uint64_t) * (3 + 32);
   }
   return 0;
 }
@@ -159,7 +165,19 @@ struct MetricDesc {
   MetricUnit_t unit;
 };
 
-struct LogDesc {};
+struct LogDesc {
+  // Records are not ec_ebpf_events_t and are passed on without being checked
+  // by EventDecoder.
+  bool opaque;
+};
+
+// Dense handle of a correlated connection handed out by the correlator. The
+// index is reused once a connection goes away, the generation is bumped every
+// time that happens so stale handles can be told apart.
+struct ConnHandle {
+  uint32_t index;
+  uint32_t generation;
+};
 
 }  // namespace prober
 
@@ -33,7 +33,9 @@ class MetricHandlerInterface {
   virtual void Cleanup() = 0;
   virtual absl::Status HandleData(std::string metric_name, void* key,
                                   void* value) = 0;
-
+  // Called once all entries of a metric map have been handed to HandleData.
+  // Exporters that batch data points can use this to send them.
+  virtual void Flush(std::string metric_name) {}
 };
 
 }  // namespace prober
@@ -29,7 +29,7 @@ class LogExporterInterface : public LogHandlerInterface {
   virtual absl::Status Init() = 0;
   virtual absl::Status RegisterLog(std::string name, LogDesc& log_desc) = 0;
   virtual ~LogExporterInterface() {}
-  void RegisterCorrelator(CorrelatorInterface* correlator) {
+  virtual void RegisterCorrelator(CorrelatorInterface* correlator) {
     correlator_ = correlator;
   }
 
@@ -0,0 +1,87 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "loader/exporter/self_metrics.h"
+
+#include <map>
+#include <string>
+
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace prober {
+
+void SelfMetrics::Increment(const std::string& name, int64_t value) {
+  absl::MutexLock lock(&mu_);
+  auto it = values_.find(name);
+  if (it == values_.end()) {
+    values_[name] = {Kind::kCounter, value, 0, absl::ZeroDuration(),
+                     absl::ZeroDuration()};
+    return;
+  }
+  it->second.value += value;
+}
+
+void SelfMetrics::SetGauge(const std::string& name, int64_t value) {
+  absl::MutexLock lock(&mu_);
+  values_[name] = {Kind::kGauge, value, 0, absl::ZeroDuration(),
+                   absl::ZeroDuration()};
+}
+
+void SelfMetrics::RecordLatency(const std::string& name,
+                                absl::Duration latency) {
+  absl::MutexLock lock(&mu_);
+  auto it = values_.find(name);
+  if (it == values_.end()) {
+    values_[name] = {Kind::kLatency, 0, 1, latency, latency};
+    return;
+  }
+  it->second.count++;
+  it->second.sum += latency;
+  if (latency > it->second.max) {
+    it->second.max = latency;
+  }
+}
+
+std::map<std::string, SelfMetrics::Value> SelfMetrics::Snapshot() {
+  absl::MutexLock lock(&mu_);
+  return values_;
+}
+
+std::string SelfMetrics::ToString() {
+  std::string out;
+  auto values = Snapshot();
+  for (auto& it : values) {
+    switch (it.second.kind) {
+      case Kind::kCounter:
+      case Kind::kGauge:
+        absl::StrAppendFormat(&out, "%s %d\n", it.first, it.second.value);
+        break;
+      case Kind::kLatency: {
+        absl::Duration avg = absl::ZeroDuration();
+        if (it.second.count) {
+          avg = it.second.sum / it.second.count;
+        }
+        absl::StrAppendFormat(&out, "%s count:%d avg:%s max:%s\n", it.first,
+                              it.second.count, absl::FormatDuration(avg),
+                              absl::FormatDuration(it.second.max));
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+}  // namespace prober
@@ -0,0 +1,70 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LOADER_EXPORTER_SELF_METRICS_H_
+#define _LOADER_EXPORTER_SELF_METRICS_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace prober {
+
+/* Metrics about the prober itself (exporter batch sizes, RPC latencies,
+  failures...). Exporters may run work on their own threads so every
+  accessor takes a lock. */
+class SelfMetrics {
+ public:
+  enum class Kind { kCounter, kGauge, kLatency };
+
+  struct Value {
+    Kind kind;
+    // Counter total or last gauge value.
+    int64_t value;
+    // Only valid for kLatency.
+    uint64_t count;
+    absl::Duration sum;
+    absl::Duration max;
+  };
+
+  static SelfMetrics& GetInstance() {
+    static SelfMetrics instance;
+    return instance;
+  }
+
+  void Increment(const std::string& name, int64_t value = 1);
+  void SetGauge(const std::string& name, int64_t value);
+  void RecordLatency(const std::string& name, absl::Duration latency);
+
+  // Returns a copy of every metric sorted by name.
+  std::map<std::string, Value> Snapshot();
+  std::string ToString();
+
+ private:
+  SelfMetrics() = default;
+  ~SelfMetrics() = default;
+  SelfMetrics(const SelfMetrics&) = delete;
+  SelfMetrics& operator=(const SelfMetrics&) = delete;
+
+  absl::Mutex mu_;
+  std::map<std::string, Value> values_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace prober
+
+#endif  // _LOADER_EXPORTER_SELF_METRICS_H_
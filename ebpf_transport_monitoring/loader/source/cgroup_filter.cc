@@ -0,0 +1,173 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "loader/source/cgroup_filter.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "bpf/bpf.h"
+#include "loader/source/map_memory.h"
+#include "sources/common/defines.h"
+
+// From linux/magic.h.
+#define CGROUP2_SUPER_MAGIC 0x63677270
+
+namespace prober {
+
+absl::Status CgroupFilter::Walk(const std::string& dir,
+                                std::vector<std::string>* dirs) {
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return absl::NotFoundError(
+        absl::StrFormat("Could not open cgroup %s: %s", dir, strerror(errno)));
+  }
+  dirs->push_back(dir);
+  std::vector<std::string> children;
+  struct dirent* entry;
+  while ((entry = readdir(d)) != nullptr) {
+    if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 &&
+        strcmp(entry->d_name, "..") != 0) {
+      children.push_back(absl::StrFormat("%s/%s", dir, entry->d_name));
+    }
+  }
+  closedir(d);
+  for (const auto& child : children) {
+    // A cgroup removed while walking is not an error.
+    auto status = Walk(child, dirs);
+    if (!status.ok() && !absl::IsNotFound(status)) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::vector<std::string> CgroupFilter::GetPaths() const {
+  std::vector<std::string> dirs;
+  for (const auto& path : paths_) {
+    dirs.push_back(absl::StartsWith(path, "/")
+                       ? path
+                       : absl::StrFormat("%s/%s", CGROUP_ROOT, path));
+  }
+  return dirs;
+}
+
+absl::StatusOr<std::string> CgroupFilter::GetCgroupOf(pid_t pid) {
+  std::string path = absl::StrFormat("/proc/%d/cgroup", pid);
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrFormat("Could not open %s", path));
+  }
+  // The cgroup v2 entry is the one of hierarchy 0, "0::<path>".
+  std::string line;
+  while (std::getline(file, line)) {
+    if (absl::StartsWith(line, "0::")) {
+      return absl::StrFormat("%s%s", CGROUP_ROOT, line.substr(3));
+    }
+  }
+  return absl::FailedPreconditionError(
+      absl::StrFormat("Process %d is not in a cgroup v2 cgroup", pid));
+}
+
+absl::StatusOr<std::vector<std::string>> CgroupFilter::ListCgroups() {
+  std::vector<std::string> dirs;
+  for (const auto& dir : GetPaths()) {
+    struct statfs fs;
+    if (statfs(dir.c_str(), &fs) != 0) {
+      return absl::NotFoundError(absl::StrFormat(
+          "Could not open cgroup %s: %s", dir, strerror(errno)));
+    }
+    if (fs.f_type != CGROUP2_SUPER_MAGIC) {
+      return absl::FailedPreconditionError(
+          absl::StrFormat("%s is not on a cgroup v2 file system", dir));
+    }
+    auto status = Walk(dir, &dirs);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return dirs;
+}
+
+absl::Status CgroupFilter::Update() {
+  auto fd = MapMemory::GetInstance().GetMap("cgroup_filter");
+  if (!fd.ok()) {
+    return fd.status();
+  }
+  auto dirs = ListCgroups();
+  if (!dirs.ok()) {
+    return dirs.status();
+  }
+
+  // The cgroup id the probes see is the inode number of its directory.
+  absl::flat_hash_set<uint64_t> ids;
+  for (const auto& dir : *dirs) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0) {
+      ids.insert(st.st_ino);
+    }
+  }
+  if (ids.size() > MAX_CGROUP_TRACED) {
+    return absl::ResourceExhaustedError(
+        absl::StrFormat("%d cgroups to trace, at most %d are supported",
+                        ids.size(), MAX_CGROUP_TRACED));
+  }
+
+  for (uint64_t id : ids_) {
+    if (!ids.contains(id)) {
+      bpf_map_delete_elem(*fd, &id);
+    }
+  }
+  uint8_t value = 1;
+  for (uint64_t id : ids) {
+    if (bpf_map_update_elem(*fd, &id, &value, BPF_ANY)) {
+      return absl::InternalError(absl::StrFormat(
+          "Could not add cgroup %d to filter: %s", id, strerror(errno)));
+    }
+  }
+  ids_ = std::move(ids);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<pid_t>> CgroupFilter::GetPids() {
+  auto dirs = ListCgroups();
+  if (!dirs.ok()) {
+    return dirs.status();
+  }
+  std::vector<pid_t> pids;
+  for (const auto& dir : *dirs) {
+    std::ifstream procs(absl::StrFormat("%s/cgroup.procs", dir));
+    pid_t pid;
+    while (procs >> pid) {
+      pids.push_back(pid);
+    }
+  }
+  return pids;
+}
+
+}  // namespace prober
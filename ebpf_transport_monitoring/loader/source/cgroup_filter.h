@@ -0,0 +1,74 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LOADER_SOURCE_CGROUP_FILTER_H_
+#define _LOADER_SOURCE_CGROUP_FILTER_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+// Mount point of the cgroup v2 hierarchy, relative cgroup paths start here.
+#define CGROUP_ROOT "/sys/fs/cgroup"
+// Seconds between two CgroupFilter::Update calls of lightfoot.
+#define CGROUP_UPDATE_INTERVAL 10
+
+namespace prober {
+
+/* Traces every process of a set of cgroup v2 cgroups, e.g. the cgroup of a
+  Kubernetes pod, through the cgroup_filter map the probes check next to
+  their PID filter. A cgroup is traced with all its descendants. The probes
+  only see the cgroup a process is directly in, so the ids of the
+  descendants are written to the map as well and Update has to be called
+  again to pick up cgroups created later, e.g. for a restarted container.
+
+  HTTP/2 probes are attached per process, only processes found by GetPids
+  get them. */
+class CgroupFilter {
+ public:
+  CgroupFilter() = delete;
+  explicit CgroupFilter(std::vector<std::string> paths)
+      : paths_(std::move(paths)) {}
+
+  // Syncs cgroup_filter with the cgroups that exist now. MapSource must be
+  // loaded.
+  absl::Status Update();
+  // Processes in the cgroups and their descendants.
+  absl::StatusOr<std::vector<pid_t>> GetPids();
+  // Absolute paths of the cgroups, without descendants.
+  std::vector<std::string> GetPaths() const;
+
+  // cgroup v2 directory pid is in.
+  static absl::StatusOr<std::string> GetCgroupOf(pid_t pid);
+
+ private:
+  // Appends dir and its descendants to dirs.
+  absl::Status Walk(const std::string& dir, std::vector<std::string>* dirs);
+  absl::StatusOr<std::vector<std::string>> ListCgroups();
+
+  std::vector<std::string> paths_;
+  // Ids in cgroup_filter.
+  absl::flat_hash_set<uint64_t> ids_;
+};
+
+}  // namespace prober
+
+#endif  // _LOADER_SOURCE_CGROUP_FILTER_H_
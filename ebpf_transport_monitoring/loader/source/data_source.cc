@@ -25,6 +25,7 @@
 #include "bpf/libbpf.h"
 #include "loader/exporter/data_types.h"
 #include "loader/source/probes.h"
+#include "loader/source/map_capacity.h"
 #include "loader/source/map_memory.h"
 #include "loader/source/source_helper.h"
 #include "loader/source/os_helper.h"
@@ -149,6 +150,11 @@ absl::Status DataSource::LoadObj() {
     return status;
   }
 
+  status = MapCapacity::GetInstance().Apply(obj_);
+  if (!status.ok()){
+    return status;
+  }
+
   auto err = bpf_object__load(obj_);
   if (err) {
     libbpf_strerror(err, errBuffer, sizeof(errBuffer));
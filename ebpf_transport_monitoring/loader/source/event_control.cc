@@ -0,0 +1,155 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "loader/source/event_control.h"
+
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "bpf/bpf.h"
+#include "events.h"
+#include "loader/source/map_memory.h"
+
+namespace prober {
+
+namespace {
+
+struct EventName {
+  const char* category;
+  const char* type;
+  uint32_t category_id;
+  uint32_t type_id;
+  // H2GoCorrelator adds and removes connections on these events, they are
+  // always sent.
+  bool correlated;
+};
+
+const EventName kEventNames[] = {
+    {"tcp", "start", EC_CAT_TCP, EC_TCP_EVENT_START, true},
+    {"tcp", "state_change", EC_CAT_TCP, EC_TCP_EVENT_STATE_CHANGE, true},
+    {"tcp", "retrans", EC_CAT_TCP, EC_TCP_EVENT_RETRANS, false},
+    {"tcp", "congestion", EC_CAT_TCP, EC_TCP_EVENT_CONGESTION, false},
+    {"tcp", "packet_drop", EC_CAT_TCP, EC_TCP_EVENT_PACKET_DROP, false},
+    {"tcp", "reset", EC_CAT_TCP, EC_TCP_EVENT_RESET, false},
+    {"h2", "start", EC_CAT_HTTP2, EC_H2_EVENT_START, false},
+    {"h2", "stream_state", EC_CAT_HTTP2, EC_H2_EVENT_STREAM_STATE, false},
+    {"h2", "settings", EC_CAT_HTTP2, EC_H2_EVENT_SETTINGS, false},
+    {"h2", "window_update", EC_CAT_HTTP2, EC_H2_EVENT_WINDOW_UPDATE, false},
+    {"h2", "go_away", EC_CAT_HTTP2, EC_H2_EVENT_GO_AWAY, false},
+    {"h2", "close", EC_CAT_HTTP2, EC_H2_EVENT_CLOSE, true},
+    {"tls", "state", EC_CAT_TLS, EC_TLS_EVENT_STATE, false},
+};
+
+const EventName* FindEvent(absl::string_view category,
+                           absl::string_view type) {
+  for (const auto& name : kEventNames) {
+    if (category == name.category && type == name.type) {
+      return &name;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+absl::Status EventControl::Parse(absl::string_view text,
+                                 ec_control_t* control) {
+  memset(control, 0, sizeof(*control));
+  int line_no = 0;
+  for (absl::string_view line : absl::StrSplit(text, '\n')) {
+    line_no++;
+    line = line.substr(0, line.find('#'));
+    std::vector<absl::string_view> words =
+        absl::StrSplit(line, absl::ByAnyChar(" \t\r"), absl::SkipEmpty());
+    if (words.empty()) {
+      continue;
+    }
+    if (words[0] == "tcp_sample_interval_ms" && words.size() == 2) {
+      uint32_t ms;
+      if (!absl::SimpleAtoi(words[1], &ms)) {
+        return absl::InvalidArgumentError(
+            absl::StrFormat("line %d: bad interval %s", line_no, words[1]));
+      }
+      control->tcp_sample_ns = (uint64_t)ms * 1000000;
+      continue;
+    }
+    if ((words[0] != "disable" || words.size() != 3) &&
+        (words[0] != "sample" || words.size() != 4)) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("line %d: could not parse \"%s\"", line_no, line));
+    }
+    const EventName* event = FindEvent(words[1], words[2]);
+    if (event == nullptr) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "line %d: unknown event %s %s", line_no, words[1], words[2]));
+    }
+    if (event->correlated) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "line %d: %s %s is needed to correlate connections and cannot be "
+          "disabled or sampled",
+          line_no, words[1], words[2]));
+    }
+    if (words[0] == "disable") {
+      control->disabled[event->category_id] |= 1U << event->type_id;
+      continue;
+    }
+    uint32_t every;
+    if (!absl::SimpleAtoi(words[3], &every) || every == 0) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("line %d: bad sampling rate %s", line_no, words[3]));
+    }
+    control->sample_every[event->category_id][event->type_id] = every;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EventControl::Load() {
+  std::ifstream file(path_);
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrFormat("Could not open %s", path_));
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+
+  ec_control_t control;
+  absl::Status status = Parse(text.str(), &control);
+  if (!status.ok()) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("%s: %s", path_, status.message()));
+  }
+
+  auto fd = MapMemory::GetInstance().GetMap("ec_control");
+  if (!fd.ok()) {
+    return fd.status();
+  }
+  uint32_t zero = 0;
+  if (bpf_map_update_elem(*fd, &zero, &control, BPF_ANY)) {
+    return absl::InternalError(
+        absl::StrFormat("Could not update ec_control: %s", strerror(errno)));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace prober
@@ -0,0 +1,54 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LOADER_SOURCE_EVENT_CONTROL_H_
+#define _LOADER_SOURCE_EVENT_CONTROL_H_
+
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "events.h"
+
+namespace prober {
+
+/* Writes the ec_control map read by the probes, see ec_control_t. The
+  control file has one setting per line, # starts a comment:
+
+    disable <tcp|h2|tls> <type>
+    sample <tcp|h2|tls> <type> <N>
+    tcp_sample_interval_ms <ms>
+
+  Types are the event names of events.h in lower case without their prefix,
+  e.g. state_change for EC_TCP_EVENT_STATE_CHANGE. A setting missing from
+  the file goes back to its default, so reloading an empty file enables
+  every event again. */
+class EventControl {
+ public:
+  EventControl() = delete;
+  explicit EventControl(std::string path) : path_(std::move(path)) {}
+
+  // The ec_control map must have been created, i.e. MapSource loaded.
+  absl::Status Load();
+
+  static absl::Status Parse(absl::string_view text, ec_control_t* control);
+
+ private:
+  std::string path_;
+};
+
+}  // namespace prober
+
+#endif  // _LOADER_SOURCE_EVENT_CONTROL_H_
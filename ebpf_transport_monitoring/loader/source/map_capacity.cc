@@ -0,0 +1,85 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "loader/source/map_capacity.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "bpf/libbpf.h"
+#include "loader/source/map_memory.h"
+
+namespace prober {
+
+absl::Status MapCapacity::Resize(uint32_t compiled, uint32_t entries) {
+  if (entries == 0 || entries > MAP_CAPACITY_MAX) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Map capacity %d out of range (1-%d)", entries, MAP_CAPACITY_MAX));
+  }
+  sizes_[compiled] = entries;
+  return absl::OkStatus();
+}
+
+absl::Status MapCapacity::Apply(struct bpf_object* obj) {
+  struct bpf_map* map;
+  bpf_object__for_each_map(map, obj) {
+    const char* name = bpf_map__name(map);
+    if (name == nullptr || MapMemory::GetInstance().GetMap(name).ok()) {
+      continue;
+    }
+    auto it = sizes_.find(bpf_map__max_entries(map));
+    if (it == sizes_.end()) {
+      continue;
+    }
+    int err = bpf_map__set_max_entries(map, it->second);
+    if (err) {
+      return absl::InternalError(absl::StrFormat(
+          "Could not resize map %s to %d entries: %d", name, it->second, err));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<uint32_t> MapCapacity::CountSockets(pid_t pid) {
+  std::string path = absl::StrFormat("/proc/%d/fd", pid);
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return absl::NotFoundError(absl::StrFormat("Could not open %s", path));
+  }
+  uint32_t sockets = 0;
+  char target[64];
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string fd_path = absl::StrFormat("%s/%s", path, entry->d_name);
+    ssize_t len = readlink(fd_path.c_str(), target, sizeof(target) - 1);
+    if (len <= 0) {
+      continue;
+    }
+    target[len] = '\0';
+    if (absl::StartsWith(target, "socket:")) {
+      sockets++;
+    }
+  }
+  closedir(dir);
+  return sockets;
+}
+
+}  // namespace prober
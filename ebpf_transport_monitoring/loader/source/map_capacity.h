@@ -0,0 +1,63 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _LOADER_SOURCE_MAP_CAPACITY_H_
+#define _LOADER_SOURCE_MAP_CAPACITY_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "bpf/libbpf.h"
+
+// Largest capacity a map is resized to.
+#define MAP_CAPACITY_MAX (1U << 22)
+
+namespace prober {
+
+/* Runtime sizes of BPF maps. The BPF sources size their maps with the
+  constants of sources/common/defines.h, e.g. MAX_CONN_TRACED. Those act as
+  markers here: every map compiled with max_entries equal to a resized
+  constant is created with the new capacity instead. Maps reused from an
+  object loaded earlier keep the size they were created with. */
+class MapCapacity {
+ public:
+  static MapCapacity& GetInstance() {
+    static MapCapacity instance;
+    return instance;
+  }
+
+  // Maps compiled with max_entries == compiled get entries instead.
+  absl::Status Resize(uint32_t compiled, uint32_t entries);
+  // Must be called between bpf_object__open and bpf_object__load.
+  absl::Status Apply(struct bpf_object* obj);
+
+  // Number of sockets pid has open, from /proc/<pid>/fd.
+  static absl::StatusOr<uint32_t> CountSockets(pid_t pid);
+
+ private:
+  MapCapacity() = default;
+  ~MapCapacity() = default;
+  MapCapacity(const MapCapacity&) = delete;
+  MapCapacity& operator=(const MapCapacity&) = delete;
+
+  absl::flat_hash_map<uint32_t, uint32_t> sizes_;
+};
+
+}  // namespace prober
+
+#endif  // _LOADER_SOURCE_MAP_CAPACITY_H_
@@ -14,13 +14,16 @@
 
 #ifndef _LOADER_SOURCE_PROBES_H_
 #define _LOADER_SOURCE_PROBES_H_
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <string>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_format.h"
+#include "bpf/bpf.h"
 #include "bpf/libbpf.h"
 
 namespace prober {
@@ -126,6 +129,91 @@ class UProbe : public Probe {
   }
 };
 
+// fentry, fexit and tp_btf programs, attached through a BPF trampoline to the
+// function named in their section.
+class TraceProbe : public Probe {
+ public:
+  explicit TraceProbe(std::string name) : Probe(name) {}
+  absl::Status Attach() override {
+    if (prog_ == nullptr) return absl::NotFoundError("Prog not set");
+    link_ = bpf_program__attach_trace(prog_);
+    if (link_ == nullptr) {
+      return absl::InternalError("Attach failed");
+    }
+    prog_fd_ = bpf_link__fd(link_);
+    if (prog_fd_ < 0) {
+      return absl::InternalError("Link file descriptor not found");
+    }
+    return absl::OkStatus();
+  }
+};
+
+// BPF iterator. Attaching only creates the link, the program runs over the
+// kernel objects every time Run is called.
+class IterProbe : public Probe {
+ public:
+  explicit IterProbe(std::string name) : Probe(name) {}
+  absl::Status Attach() override {
+    if (prog_ == nullptr) return absl::NotFoundError("Prog not set");
+    link_ = bpf_program__attach_iter(prog_, nullptr);
+    if (link_ == nullptr) {
+      return absl::InternalError("Attach failed");
+    }
+    prog_fd_ = bpf_link__fd(link_);
+    if (prog_fd_ < 0) {
+      return absl::InternalError("Link file descriptor not found");
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Run() {
+    if (link_ == nullptr) return absl::FailedPreconditionError("Not attached");
+    int fd = bpf_iter_create(prog_fd_);
+    if (fd < 0) {
+      return absl::InternalError(
+          absl::StrFormat("Could not create iterator %s", name_));
+    }
+    // The program does not print anything, reading drives the iteration.
+    char buf[64];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+    }
+    close(fd);
+    if (len < 0) {
+      return absl::InternalError(
+          absl::StrFormat("Iterator %s failed", name_));
+    }
+    return absl::OkStatus();
+  }
+};
+
+// cgroup programs such as sock_ops, attached to the cgroup v2 directory path.
+class CgroupProbe : public Probe {
+  std::string cgroup_path_;
+
+ public:
+  CgroupProbe(std::string name, std::string cgroup_path)
+      : Probe(name), cgroup_path_(cgroup_path) {}
+  absl::Status Attach() override {
+    if (prog_ == nullptr) return absl::NotFoundError("Prog not set");
+    int cgroup_fd = open(cgroup_path_.c_str(), O_RDONLY);
+    if (cgroup_fd < 0) {
+      return absl::NotFoundError(
+          absl::StrFormat("Could not open cgroup %s", cgroup_path_));
+    }
+    link_ = bpf_program__attach_cgroup(prog_, cgroup_fd);
+    close(cgroup_fd);
+    if (link_ == nullptr) {
+      return absl::InternalError("Attach failed");
+    }
+    prog_fd_ = bpf_link__fd(link_);
+    if (prog_fd_ < 0) {
+      return absl::InternalError("Link file descriptor not found");
+    }
+    return absl::OkStatus();
+  }
+};
+
 class KProbe : public Probe {
   std::string function_name_;
   bool retprobe_;
@@ -21,6 +21,7 @@
 #include "re2/re2.h"
 
 #include "bpf/bpf.h"
+#include "bpf/btf.h"
 #include "bpf/libbpf.h"
 
 namespace prober{
@@ -83,4 +84,18 @@ bool SourceHelper::VmlinuxExists() {
   return false;
 }
 
+bool SourceHelper::FentrySupported() {
+  return VmlinuxExists() && TestProgType(BPF_PROG_TYPE_TRACING);
+}
+
+bool SourceHelper::TcpIterSupported() {
+  if (!FentrySupported()) return false;
+  struct btf *btf = btf__load_vmlinux_btf();
+  if (btf == nullptr) return false;
+  bool found =
+      btf__find_by_name_kind(btf, "bpf_iter__tcp", BTF_KIND_STRUCT) > 0;
+  btf__free(btf);
+  return found;
+}
+
 }
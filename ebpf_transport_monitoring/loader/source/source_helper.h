@@ -33,6 +33,11 @@ class SourceHelper {
     /usr/include/linux/version.h */
   static absl::StatusOr<uint32_t> GetKernelVersion();
   static bool VmlinuxExists(void);
+  /* fentry/fexit need BPF trampolines and the BTF of the running kernel,
+    a reduced BTF file is not enough to find the function to attach to. */
+  static bool FentrySupported(void);
+  // iter/tcp programs, Linux 5.9 and later.
+  static bool TcpIterSupported(void);
 };
 
 } // namespace prober
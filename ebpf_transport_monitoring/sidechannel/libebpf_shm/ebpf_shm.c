@@ -0,0 +1,218 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ebpf_shm.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct ebpf_shm_reader {
+  int sock;
+  struct ebpf_shm_header* header;
+  uint8_t* data;
+  size_t map_size;
+  uint64_t mask;
+  uint64_t tail;
+  /* Length of the record returned by the last peek, 0 if none. */
+  uint32_t peeked;
+};
+
+static int ebpf_shm_connect(const char* socket_path) {
+  struct sockaddr_un addr;
+  int sock;
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/* lightfoot sends one byte with the memfd attached, or closes the connection
+  when a reader is already attached. */
+static int ebpf_shm_receive_fd(int sock) {
+  char byte;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  ssize_t ret;
+  int fd;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  do {
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    return -1;
+  }
+  if (ret == 0) {
+    errno = EBUSY;
+    return -1;
+  }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+    errno = EPROTO;
+    return -1;
+  }
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+  return fd;
+}
+
+struct ebpf_shm_reader* ebpf_shm_open(const char* socket_path) {
+  struct ebpf_shm_reader* reader;
+  struct stat st;
+  void* map;
+  int sock, fd, err;
+
+  sock = ebpf_shm_connect(socket_path);
+  if (sock < 0) {
+    return NULL;
+  }
+  fd = ebpf_shm_receive_fd(sock);
+  if (fd < 0) {
+    goto close_sock;
+  }
+  if (fstat(fd, &st) < 0) {
+    goto close_fd;
+  }
+  if ((size_t)st.st_size < sizeof(struct ebpf_shm_header)) {
+    errno = EPROTO;
+    goto close_fd;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    goto close_fd;
+  }
+  /* The mapping keeps the memfd alive. */
+  close(fd);
+
+  reader = calloc(1, sizeof(*reader));
+  if (reader == NULL) {
+    errno = ENOMEM;
+    goto unmap;
+  }
+  reader->sock = sock;
+  reader->header = map;
+  reader->map_size = st.st_size;
+  reader->data = (uint8_t*)map + sizeof(struct ebpf_shm_header);
+  if (reader->header->magic != EBPF_SHM_MAGIC ||
+      reader->header->version != EBPF_SHM_VERSION ||
+      reader->header->capacity == 0 ||
+      (reader->header->capacity & (reader->header->capacity - 1)) != 0 ||
+      reader->header->capacity + sizeof(struct ebpf_shm_header) !=
+          reader->map_size) {
+    free(reader);
+    errno = EPROTO;
+    goto unmap;
+  }
+  reader->mask = reader->header->capacity - 1;
+  reader->tail = __atomic_load_n(&reader->header->tail, __ATOMIC_ACQUIRE);
+  return reader;
+
+unmap:
+  err = errno;
+  munmap(map, st.st_size);
+  close(sock);
+  errno = err;
+  return NULL;
+close_fd:
+  err = errno;
+  close(fd);
+  errno = err;
+close_sock:
+  err = errno;
+  close(sock);
+  errno = err;
+  return NULL;
+}
+
+const struct ebpf_shm_record* ebpf_shm_peek(struct ebpf_shm_reader* reader) {
+  const struct ebpf_shm_record* record;
+  uint64_t head, offset;
+
+  if (reader->peeked != 0) {
+    return (const struct ebpf_shm_record*)(reader->data +
+                                           (reader->tail & reader->mask));
+  }
+  for (;;) {
+    head = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+    if (head == reader->tail) {
+      return NULL;
+    }
+    offset = reader->tail & reader->mask;
+    record = (const struct ebpf_shm_record*)(reader->data + offset);
+    if (record->length < sizeof(*record) ||
+        record->length % EBPF_SHM_ALIGN != 0 ||
+        record->length > head - reader->tail ||
+        offset + record->length > reader->header->capacity) {
+      errno = EPROTO;
+      return NULL;
+    }
+    if (record->type != EBPF_SHM_PAD) {
+      reader->peeked = record->length;
+      return record;
+    }
+    reader->tail += record->length;
+    __atomic_store_n(&reader->header->tail, reader->tail, __ATOMIC_RELEASE);
+  }
+}
+
+void ebpf_shm_release(struct ebpf_shm_reader* reader) {
+  if (reader->peeked == 0) {
+    return;
+  }
+  reader->tail += reader->peeked;
+  reader->peeked = 0;
+  __atomic_store_n(&reader->header->tail, reader->tail, __ATOMIC_RELEASE);
+}
+
+uint64_t ebpf_shm_dropped(const struct ebpf_shm_reader* reader) {
+  return __atomic_load_n(&reader->header->dropped, __ATOMIC_RELAXED);
+}
+
+void ebpf_shm_close(struct ebpf_shm_reader* reader) {
+  if (reader == NULL) {
+    return;
+  }
+  munmap(reader->header, reader->map_size);
+  close(reader->sock);
+  free(reader);
+}
@@ -0,0 +1,160 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _EBPF_SHM_
+#define _EBPF_SHM_
+
+/* Layout of the shared memory ring lightfoot writes with --shm and a small
+  client to read it. The ring is a memfd handed to one reader at a time over
+  a unix socket. lightfoot is the only producer and the reader the only
+  consumer, each of them stores one counter:
+
+    head: bytes ever written, stored by lightfoot after a record is complete.
+    tail: bytes ever consumed, stored by the reader once it is done with a
+          record.
+
+  Records are never split across the end of the ring, the writer fills the
+  rest of the ring with an EBPF_SHM_PAD record instead. Records that do not
+  fit are dropped and counted, lightfoot never waits for the reader. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EBPF_SHM_MAGIC 0x4d53464cU /* "LFSM" */
+#define EBPF_SHM_VERSION 1
+#define EBPF_SHM_CACHELINE 64
+#define EBPF_SHM_ALIGN 16
+
+enum ebpf_shm_record_type {
+  EBPF_SHM_PAD = 0,
+  /* data is struct ebpf_shm_log followed by the event from events.h the
+    record name refers to. */
+  EBPF_SHM_LOG = 1,
+  /* data is struct ebpf_shm_metric. */
+  EBPF_SHM_METRIC = 2,
+  /* data is struct ebpf_shm_histogram. */
+  EBPF_SHM_HISTOGRAM = 3,
+};
+
+/* Same values as prober::MetricKind. */
+enum ebpf_shm_metric_kind {
+  EBPF_SHM_GAUGE = 1,
+  EBPF_SHM_DELTA = 2,
+  EBPF_SHM_CUMULATIVE = 3,
+  EBPF_SHM_DISTRIBUTION = 4,
+};
+
+struct ebpf_shm_header {
+  uint32_t magic;
+  uint32_t version;
+  /* Size of the data area following the header, a power of two. */
+  uint64_t capacity;
+  uint8_t pad0[EBPF_SHM_CACHELINE - 16];
+  uint64_t head;
+  /* Records dropped because the ring was full. */
+  uint64_t dropped;
+  uint8_t pad1[EBPF_SHM_CACHELINE - 16];
+  uint64_t tail;
+  uint8_t pad2[EBPF_SHM_CACHELINE - 8];
+};
+
+struct ebpf_shm_record {
+  /* Bytes taken in the ring including this header, a multiple of
+    EBPF_SHM_ALIGN. */
+  uint32_t length;
+  uint16_t type;
+  uint8_t name_len;
+  uint8_t uuid_len;
+  uint32_t data_len;
+  uint32_t reserved;
+  /* name, uuid and data follow, in that order and not NUL terminated. */
+};
+
+struct ebpf_shm_log {
+  /* Unix time of the event in ns. */
+  uint64_t time_ns;
+  uint64_t conn_id;
+};
+
+struct ebpf_shm_metric {
+  /* Unix times in ns. start_time_ns is the start of the connection for
+    cumulative metrics and the previous read otherwise. */
+  uint64_t start_time_ns;
+  uint64_t time_ns;
+  /* Time metrics are in ms, data metrics in the unit below. */
+  int64_t value;
+  uint32_t kind;
+  uint32_t reserved;
+  char unit[16];
+};
+
+#define EBPF_SHM_HISTOGRAM_BUCKETS 32
+
+/* Cumulative log2 histogram of a connection. Bucket 0 counts zeros and
+  bucket i samples in [2^(i-1), 2^i), the last bucket also counts everything
+  above. Samples and sum are in unit, time metrics are not converted to ms. */
+struct ebpf_shm_histogram {
+  /* Unix times in ns, start_time_ns is the start of the connection. */
+  uint64_t start_time_ns;
+  uint64_t time_ns;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[EBPF_SHM_HISTOGRAM_BUCKETS];
+  char unit[16];
+};
+
+static inline const char* ebpf_shm_record_name(
+    const struct ebpf_shm_record* record) {
+  return (const char*)(record + 1);
+}
+
+static inline const char* ebpf_shm_record_uuid(
+    const struct ebpf_shm_record* record) {
+  return ebpf_shm_record_name(record) + record->name_len;
+}
+
+static inline const void* ebpf_shm_record_data(
+    const struct ebpf_shm_record* record) {
+  return ebpf_shm_record_uuid(record) + record->uuid_len;
+}
+
+struct ebpf_shm_reader;
+
+/* Connects to the socket lightfoot was started with (--shm) and maps the
+  ring. Returns NULL and sets errno on failure, EBUSY if another reader is
+  attached. */
+struct ebpf_shm_reader* ebpf_shm_open(const char* socket_path);
+
+/* Returns the oldest unread record or NULL if there is none. The record
+  points into the ring and stays valid until it is released. */
+const struct ebpf_shm_record* ebpf_shm_peek(struct ebpf_shm_reader* reader);
+
+/* Hands the space of the record returned by the last peek back to lightfoot.
+ */
+void ebpf_shm_release(struct ebpf_shm_reader* reader);
+
+uint64_t ebpf_shm_dropped(const struct ebpf_shm_reader* reader);
+
+/* Unmaps the ring and detaches from lightfoot. Unread records are kept for
+  the next reader. */
+void ebpf_shm_close(struct ebpf_shm_reader* reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
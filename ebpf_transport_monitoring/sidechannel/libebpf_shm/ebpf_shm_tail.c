@@ -0,0 +1,109 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Example reader of the lightfoot --shm ring. Prints every record, or with -c
+// only the number of records read per second.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ebpf_shm.h"
+
+static void print_record(const struct ebpf_shm_record* record) {
+  if (record->type == EBPF_SHM_METRIC &&
+      record->data_len >= sizeof(struct ebpf_shm_metric)) {
+    struct ebpf_shm_metric metric;
+    memcpy(&metric, ebpf_shm_record_data(record), sizeof(metric));
+    printf("metric %.*s uuid %.*s time %" PRIu64 " value %" PRId64 " %.*s\n",
+           record->name_len, ebpf_shm_record_name(record), record->uuid_len,
+           ebpf_shm_record_uuid(record), metric.time_ns, metric.value,
+           (int)strnlen(metric.unit, sizeof(metric.unit)), metric.unit);
+  } else if (record->type == EBPF_SHM_HISTOGRAM &&
+             record->data_len >= sizeof(struct ebpf_shm_histogram)) {
+    struct ebpf_shm_histogram hist;
+    memcpy(&hist, ebpf_shm_record_data(record), sizeof(hist));
+    printf("histogram %.*s uuid %.*s time %" PRIu64 " count %" PRIu64
+           " sum %" PRIu64 " %.*s\n",
+           record->name_len, ebpf_shm_record_name(record), record->uuid_len,
+           ebpf_shm_record_uuid(record), hist.time_ns, hist.count, hist.sum,
+           (int)strnlen(hist.unit, sizeof(hist.unit)), hist.unit);
+  } else if (record->type == EBPF_SHM_LOG &&
+             record->data_len >= sizeof(struct ebpf_shm_log)) {
+    struct ebpf_shm_log log;
+    memcpy(&log, ebpf_shm_record_data(record), sizeof(log));
+    printf("log %.*s uuid %.*s time %" PRIu64 " conn_id %" PRIu64
+           " event_bytes %" PRIu64 "\n",
+           record->name_len, ebpf_shm_record_name(record), record->uuid_len,
+           ebpf_shm_record_uuid(record), log.time_ns, log.conn_id,
+           (uint64_t)(record->data_len - sizeof(log)));
+  }
+}
+
+int main(int argc, char** argv) {
+  struct ebpf_shm_reader* reader;
+  const struct ebpf_shm_record* record;
+  const char* socket_path = NULL;
+  int count_only = 0;
+  uint64_t records = 0;
+  time_t last = time(NULL);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      count_only = 1;
+    } else {
+      socket_path = argv[i];
+    }
+  }
+  if (socket_path == NULL) {
+    fprintf(stderr, "Usage: ./ebpf_shm_tail <socket path> [-c]\n");
+    return -1;
+  }
+
+  reader = ebpf_shm_open(socket_path);
+  if (reader == NULL) {
+    fprintf(stderr, "Could not attach to %s: %s\n", socket_path,
+            strerror(errno));
+    return -1;
+  }
+  for (;;) {
+    errno = 0;
+    record = ebpf_shm_peek(reader);
+    if (record == NULL) {
+      if (errno == EPROTO) {
+        fprintf(stderr, "Corrupt record in ring\n");
+        break;
+      }
+      usleep(1000);
+    } else {
+      if (!count_only) {
+        print_record(record);
+      }
+      ebpf_shm_release(reader);
+      records++;
+    }
+    if (count_only && time(NULL) != last) {
+      last = time(NULL);
+      printf("%" PRIu64 " records/s, %" PRIu64 " dropped\n", records,
+             ebpf_shm_dropped(reader));
+      fflush(stdout);
+      records = 0;
+    }
+  }
+  ebpf_shm_close(reader);
+  return -1;
+}
@@ -0,0 +1,74 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _SOURCES_BPF_SOURCES_CONTROL_H_
+#define _SOURCES_BPF_SOURCES_CONTROL_H_
+
+#include "bpf/bpf_helpers.h"
+#include "defines.h"
+#include "events.h"
+
+/* Written by lightfoot at start and whenever the operator changes it, see
+  ec_control_t. Shared by all BPF objects through maps.h. */
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(key_size, sizeof(__u32));
+  __uint(value_size, sizeof(ec_control_t));
+  __uint(max_entries, 1);
+} ec_control SEC(".maps");
+
+static __always_inline ec_control_t *ec_get_control(void) {
+  __u32 zero = 0;
+  return bpf_map_lookup_elem(&ec_control, &zero);
+}
+
+/* Whether an event of category and type should be sent. Called before the
+  event is filled so dropped events cost a map lookup only. */
+static __always_inline bool ec_event_enabled(__u32 category, __u32 type) {
+  ec_control_t *control = ec_get_control();
+  if (control == NULL || category >= EC_CAT_MAX ||
+      type >= EC_CONTROL_TYPES) {
+    return true;
+  }
+  if (control->disabled[category] & (1U << type)) {
+    return false;
+  }
+  __u32 every = control->sample_every[category][type];
+  return every <= 1 || bpf_get_prandom_u32() % every == 0;
+}
+
+/* cgroup v2 ids, i.e. inode numbers of the cgroup directories, whose
+  processes are traced on top of the PID filters. Filled from --cgroup, see
+  loader/source/cgroup_filter.h. */
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(key_size, sizeof(__u64));
+  __uint(value_size, sizeof(__u8));
+  __uint(max_entries, MAX_CGROUP_TRACED);
+} cgroup_filter SEC(".maps");
+
+static __always_inline bool ec_cgroup_traced(void) {
+  __u64 id = bpf_get_current_cgroup_id();
+  return bpf_map_lookup_elem(&cgroup_filter, &id) != NULL;
+}
+
+static __always_inline __u64 ec_tcp_sample_ns(__u64 default_ns) {
+  ec_control_t *control = ec_get_control();
+  if (control == NULL || control->tcp_sample_ns == 0) {
+    return default_ns;
+  }
+  return control->tcp_sample_ns;
+}
+
+#endif  // _SOURCES_BPF_SOURCES_CONTROL_H_
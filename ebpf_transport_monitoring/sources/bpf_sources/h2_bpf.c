@@ -66,7 +66,7 @@ struct {
 static __always_inline uint32_t get_curr_pid() {
   uint32_t ppid = (bpf_get_current_pid_tgid() >> 32);
   uint8_t* trace_pid = bpf_map_lookup_elem(&h2_grpc_pid_filter, &ppid);
-  if (unlikely(trace_pid == NULL)) {
+  if (unlikely(trace_pid == NULL && !ec_cgroup_traced())) {
     return 0;
   }
   return ppid;
@@ -83,6 +83,7 @@ static __always_inline ec_ebpf_events_t * get_event(uint32_t pid){
     return event;
   }
   event->mdata.event_category = EC_CAT_HTTP2;
+  event->mdata.version = EC_EVENT_VERSION;
   event->mdata.pid = pid;
   event->mdata.timestamp = bpf_ktime_get_ns();
   return event;
@@ -187,12 +188,21 @@ static __always_inline int send_h2_start(void * ctx,
   uint64_t timestamp = event->mdata.timestamp;
   bpf_map_update_elem(&h2_connection,&conn_id,
                       &timestamp, BPF_ANY);
+  // Updates of per CPU maps only reset the current CPU, delete first so the
+  // counts of a previous connection at this address are dropped everywhere.
+  bpf_map_delete_elem(&h2_stream_count, &conn_id);
   bpf_map_update_elem(&h2_stream_count,&conn_id,
-                      &format, BPF_ANY);
+                      &format, BPF_NOEXIST);
+  bpf_map_delete_elem(&h2_reset_stream_count, &conn_id);
   bpf_map_update_elem(&h2_reset_stream_count,&conn_id,
-                      &format, BPF_ANY);
-  bpf_perf_event_output(ctx, &h2_grpc_events, BPF_F_CURRENT_CPU, event,
-                        sizeof(ec_ebpf_event_metadata_t) + 0);
+                      &format, BPF_NOEXIST);
+  // hist_record creates these on the first stream of the connection.
+  bpf_map_delete_elem(&h2_client_stream_latency, &conn_id);
+  bpf_map_delete_elem(&h2_server_stream_latency, &conn_id);
+  if (ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_START)) {
+    bpf_perf_event_output(ctx, &h2_grpc_events, BPF_F_CURRENT_CPU, event,
+                          sizeof(ec_ebpf_event_metadata_t) + 0);
+  }
 
   void * framer_ptr = 0;
   if (client) {
@@ -230,6 +240,9 @@ static __always_inline int send_h2_go_away (void * ctx,
 	                                   config_type_t * configuration,
                                      ec_ebpf_events_t * event,
                                      void * frame_ptr){             
+  if (!ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_GO_AWAY)) {
+    return 0;
+  }
   ec_h2_go_away_t * data = (ec_h2_go_away_t*)event->event_info;
   REQUIRE_MEM_VAR(configuration->offset.goawayframe_stream,data->last_stream_id);
   READ_MEMBER(frame_ptr, configuration->offset.goawayframe_stream,
@@ -252,6 +265,9 @@ static __always_inline int send_h2_settings (void * ctx,
 		                                  config_type_t * configuration,
                                       ec_ebpf_events_t * event,
                                       void * frame_ptr){                               
+  if (!ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_SETTINGS)) {
+    return 0;
+  }
   struct go_slice slice;
   char * settings = (char *)event->event_info;
   REQUIRE_MEM_VAR(configuration->offset.settingsframe_data,slice);
@@ -268,6 +284,7 @@ static __always_inline int send_h2_settings (void * ctx,
   if (likely(length_minus_1 < EC_MAX_EVENT_DATA_SIZE)) {
     bpf_probe_read(settings,(uint32_t) length, slice.ptr);
     event->mdata.event_type = EC_H2_EVENT_SETTINGS;
+    event->mdata.length = length;
     uint64_t data_length = length + sizeof(ec_ebpf_event_metadata_t);
     if (unlikely(data_length > sizeof(ec_ebpf_events_t))){
       data_length = sizeof(ec_ebpf_events_t);
@@ -353,7 +370,7 @@ static __always_inline int collect_data(__u8 client, struct pt_regs* ctx) {
       if (unlikely(success < 0)){
         return -1;
       }
-      send_h2_reset(ctx, event, stream_id, error);
+      send_h2_reset(ctx, event, stream_id, error, client);
       break;
     }
     case H2_SETTINGS:
@@ -380,7 +397,7 @@ static __always_inline int collect_data(__u8 client, struct pt_regs* ctx) {
   READ_MEMBER(frame_ptr,configuration->offset.frameheader_flags,&flag);
 
   if ((flag & H2_END_STREAM) != 0){
-    send_h2_end(ctx, event, stream_id);
+    send_h2_end(ctx, event, stream_id, client);
   }
 
   return 0;
@@ -455,7 +472,7 @@ static __always_inline int collect_header_data(__u8 client, struct pt_regs* ctx)
   REQUIRE_MEM_VAR(configuration->offset.frameheader_flags,flag);
   READ_MEMBER(frame_ptr,configuration->offset.frameheader_flags,&flag);
   if ((flag & H2_END_STREAM) != 0){
-    send_h2_end(ctx, event, stream_id);
+    send_h2_end(ctx, event, stream_id, client);
   }
   return 0;
 }
@@ -604,7 +621,10 @@ int probe_close(struct pt_regs* ctx){
     return 0;
   }
   bpf_map_delete_elem(&h2_connection, &conn_ptr);
-  
+  if (!ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_CLOSE)) {
+    return 0;
+  }
+
   event->mdata.length = 0;
   event->mdata.event_type = EC_H2_EVENT_CLOSE;
   bpf_perf_event_output(ctx, &h2_grpc_events, BPF_F_CURRENT_CPU, event,
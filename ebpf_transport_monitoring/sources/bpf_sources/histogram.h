@@ -0,0 +1,71 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _SOURCES_BPF_SOURCES_HISTOGRAM_H_
+#define _SOURCES_BPF_SOURCES_HISTOGRAM_H_
+
+#include "events.h"
+
+/* Index of the highest set bit, without loops for older verifiers. */
+static __always_inline __u32 log2_u64(__u64 v) {
+  __u32 r = 0;
+  __u32 shift;
+  shift = (v > 0xFFFFFFFF) << 5; v >>= shift; r |= shift;
+  shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+  shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+  shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+  shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+  r |= (v >> 1);
+  return r;
+}
+
+/* Histograms are shared by the CPUs, e.g. tcp_sendmsg runs before the socket
+  is locked and Go readers and writers of a connection run on different
+  threads, so the counters are added atomically. timestamp and last are
+  plain stores, any recent value will do. */
+static __always_inline void hist_add(metric_hist_format_t *hist,
+                                     __u64 timestamp, __u64 value) {
+  __u32 slot = value ? log2_u64(value) + 1 : 0;
+  if (slot >= METRIC_HIST_BUCKETS) {
+    slot = METRIC_HIST_BUCKETS - 1;
+  }
+  hist->timestamp = timestamp;
+  __sync_fetch_and_add(&hist->data.count, 1);
+  __sync_fetch_and_add(&hist->data.sum, value);
+  hist->data.last = value;
+  __sync_fetch_and_add(&hist->data.buckets[slot & (METRIC_HIST_BUCKETS - 1)],
+                       1);
+}
+
+// hist_add is also built into the C++ tests, which have no BPF helpers.
+#ifndef __cplusplus
+#include "bpf/bpf_helpers.h"
+
+/* Adds value to the histogram of key in map, creating it if needed. */
+static __always_inline void hist_record(void *map, const void *key,
+                                        __u64 timestamp, __u64 value) {
+  metric_hist_format_t *hist = bpf_map_lookup_elem(map, key);
+  if (hist == NULL) {
+    metric_hist_format_t empty = {};
+    bpf_map_update_elem(map, key, &empty, BPF_NOEXIST);
+    hist = bpf_map_lookup_elem(map, key);
+    if (hist == NULL) {
+      return;
+    }
+  }
+  hist_add(hist, timestamp, value);
+}
+#endif  // __cplusplus
+
+#endif  // _SOURCES_BPF_SOURCES_HISTOGRAM_H_
@@ -0,0 +1,50 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cost of recording a sample with hist_add, from one thread and from several
+// threads sharing a histogram as the probes of one connection do.
+
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+#include "events.h"
+#include "sources/bpf_sources/histogram.h"
+
+namespace {
+
+metric_hist_format_t shared_hist;
+
+void BM_HistAdd(benchmark::State& state) {
+  metric_hist_format_t hist = {};
+  uint64_t value = 1;
+  for (auto _ : state) {
+    hist_add(&hist, value, value);
+    value = value * 3 + 1;
+    benchmark::DoNotOptimize(hist);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HistAdd);
+
+void BM_HistAddShared(benchmark::State& state) {
+  uint64_t value = state.thread_index() + 1;
+  for (auto _ : state) {
+    hist_add(&shared_hist, value, value);
+    value = value * 3 + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HistAddShared)->Threads(1)->Threads(4);
+
+}  // namespace
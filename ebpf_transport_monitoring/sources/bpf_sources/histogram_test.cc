@@ -0,0 +1,83 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sources/bpf_sources/histogram.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "events.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(HistogramTest, Log2) {
+  EXPECT_EQ(log2_u64(1), 0);
+  EXPECT_EQ(log2_u64(2), 1);
+  EXPECT_EQ(log2_u64(3), 1);
+  EXPECT_EQ(log2_u64(4), 2);
+  EXPECT_EQ(log2_u64(1023), 9);
+  EXPECT_EQ(log2_u64(1024), 10);
+  EXPECT_EQ(log2_u64(UINT64_C(1) << 40), 40);
+  EXPECT_EQ(log2_u64(UINT64_MAX), 63);
+}
+
+TEST(HistogramTest, Buckets) {
+  metric_hist_format_t hist = {};
+  // Bucket i holds [2^(i-1), 2^i), bucket 0 holds 0.
+  hist_add(&hist, 1, 0);
+  hist_add(&hist, 2, 1);
+  hist_add(&hist, 3, 2);
+  hist_add(&hist, 4, 3);
+  hist_add(&hist, 5, 1000);
+  EXPECT_EQ(hist.timestamp, 5);
+  EXPECT_EQ(hist.data.count, 5);
+  EXPECT_EQ(hist.data.sum, 1006);
+  EXPECT_EQ(hist.data.last, 1000);
+  EXPECT_EQ(hist.data.buckets[0], 1);
+  EXPECT_EQ(hist.data.buckets[1], 1);
+  EXPECT_EQ(hist.data.buckets[2], 2);
+  EXPECT_EQ(hist.data.buckets[10], 1);
+}
+
+TEST(HistogramTest, LargeValuesGoToLastBucket) {
+  metric_hist_format_t hist = {};
+  hist_add(&hist, 1, UINT64_C(1) << 40);
+  hist_add(&hist, 1, UINT64_MAX);
+  EXPECT_EQ(hist.data.count, 2);
+  EXPECT_EQ(hist.data.buckets[METRIC_HIST_BUCKETS - 1], 2);
+}
+
+TEST(HistogramTest, ConcurrentAdds) {
+  metric_hist_format_t hist = {};
+  constexpr int kThreads = 4;
+  constexpr int kSamples = 100000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.emplace_back([&hist]() {
+      for (int j = 0; j < kSamples; j++) {
+        hist_add(&hist, j, 5);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(hist.data.count, kThreads * kSamples);
+  EXPECT_EQ(hist.data.sum, 5ULL * kThreads * kSamples);
+  EXPECT_EQ(hist.data.buckets[3], kThreads * kSamples);
+}
+
+}  // namespace
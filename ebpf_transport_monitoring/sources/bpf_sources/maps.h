@@ -14,6 +14,7 @@ userspace. For definition of different events please refer to events.h */
 #include "bpf/bpf_tracing.h"
 #include "events.h"
 #include "defines.h"
+#include "control.h"
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
@@ -30,8 +31,10 @@ struct {
     __uint(max_entries, MAX_H2_CONN_TRACED);
 } h2_connection SEC(".maps");
 
+/* The counters below are per CPU so the probes of different CPUs do not
+write to the same cache lines, lightfoot sums them when reading. */
 struct {
-	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
 	__uint(key_size, sizeof(__u64));
 	__uint(value_size, sizeof(metric_format_t));
   	__uint(max_entries, MAX_H2_CONN_TRACED);
@@ -47,7 +50,7 @@ struct {
 
 /* Map keeps count of absolute number of streams per connection */
 struct {
-	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
 	__uint(key_size, sizeof(__u64));
 	__uint(value_size, sizeof(metric_format_t));
   	__uint(max_entries, MAX_H2_CONN_TRACED);
@@ -55,12 +58,30 @@ struct {
 
 /* Map keeps count of streams resets per connection */
 struct {
-	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
 	__uint(key_size, sizeof(__u64));
 	__uint(value_size, sizeof(metric_format_t));
  	__uint(max_entries, MAX_H2_CONN_TRACED);
 } h2_reset_stream_count SEC(".maps");
 
+/* Log2 histograms of stream durations in us per connection, from the first
+HEADERS frame to END_STREAM or RST_STREAM. Streams of connections lightfoot
+sees from the client side go to h2_client_stream_latency, the others to
+h2_server_stream_latency. */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_hist_format_t));
+ 	__uint(max_entries, MAX_H2_CONN_TRACED);
+} h2_client_stream_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_hist_format_t));
+ 	__uint(max_entries, MAX_H2_CONN_TRACED);
+} h2_server_stream_latency SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
 	__uint(key_size, sizeof(__u32));
@@ -15,6 +15,7 @@
 #include "defines.h"
 #include "events.h"
 #include "h2_symaddrs.h"
+#include "histogram.h"
 #include "sym_helpers.h"
 #include "sym_addrs.h"
 #include "maps.h"
@@ -41,10 +42,8 @@ static __always_inline int send_h2_headers(void * ctx,
 
 static __always_inline int send_h2_end(void * ctx,
                                 ec_ebpf_events_t * event,
-                                uint32_t stream_id){
-  // There is a potential race condition here. So maybe spinlocks is the answer
-  // But spinlocks are availiable only from 5.1. We will accept a small difference 
-  // in count for now.
+                                uint32_t stream_id,
+                                bool client){
   uint64_t stream_hash = stream_id;
   stream_hash = (stream_hash << 48) | 
         (event->mdata.connection_id & 0xffffffffffff);
@@ -53,16 +52,31 @@ static __always_inline int send_h2_end(void * ctx,
   if (hash == NULL) {
     return 0;
   }
+  uint64_t start = *hash;
 
-  bpf_map_delete_elem(&h2_stream_id, &stream_hash);
+  // Only the probe that removes the stream counts it.
+  if (bpf_map_delete_elem(&h2_stream_id, &stream_hash) != 0) {
+    return 0;
+  }
   uint64_t conn_id = event->mdata.connection_id;
+  uint64_t timestamp = event->mdata.timestamp;
+  if (timestamp > start) {
+    // Separate calls so each one refers to a single map.
+    if (client) {
+      hist_record(&h2_client_stream_latency, &conn_id, timestamp,
+                  (timestamp - start) / 1000);
+    } else {
+      hist_record(&h2_server_stream_latency, &conn_id, timestamp,
+                  (timestamp - start) / 1000);
+    }
+  }
   metric_format_t * value = (metric_format_t *)bpf_map_lookup_elem(&h2_stream_count, &conn_id);
   if (unlikely(value == NULL)) {
     return 0;
   }
+  // Per CPU value, no other CPU writes to it.
   value->timestamp = event->mdata.timestamp;
-
-  __sync_add_and_fetch(&value->data, 1);
+  value->data += 1;
 
   return 0;
 }
@@ -85,7 +99,8 @@ static __always_inline void send_h2_ping(void * ctx,
 static __always_inline int send_h2_reset(void * ctx,
                                   ec_ebpf_events_t * event,
                                   uint32_t stream_id,
-                                  uint32_t error){             
+                                  uint32_t error,
+                                  bool client){             
 
   uint64_t conn_id = event->mdata.connection_id;
   metric_format_t * value = (metric_format_t *)bpf_map_lookup_elem(&h2_reset_stream_count, &conn_id);
@@ -95,7 +110,7 @@ static __always_inline int send_h2_reset(void * ctx,
   value->timestamp = event->mdata.timestamp;
   value->data+=1; 
 
-  send_h2_end(ctx, event, stream_id);
+  send_h2_end(ctx, event, stream_id, client);
   return 0;
 }
 
@@ -155,11 +170,14 @@ static __always_inline int parse_h2_frame(void * ctx,
       if (unlikely(success < 0)){
         return success;
       } 
-      send_h2_reset(ctx, event, stream_id, error);
+      send_h2_reset(ctx, event, stream_id, error, client);
       break;
     }
     //Settings_frame
     case H2_SETTINGS: {
+      if (!ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_SETTINGS)) {
+        return 0;
+      }
       char * settings = (char *)event->event_info;
 
       event->mdata.length = frame_length;
@@ -191,6 +209,9 @@ static __always_inline int parse_h2_frame(void * ctx,
 
     //GO_AWAY
     case H2_GOAWAY: {
+      if (!ec_event_enabled(EC_CAT_HTTP2, EC_H2_EVENT_GO_AWAY)) {
+        return 0;
+      }
       ec_h2_go_away_t * data = (ec_h2_go_away_t*)event->event_info;
       if(unlikely(bpf_probe_read(&data->last_stream_id,4,&buf_ptr[curr_loc]))){
         return 0;
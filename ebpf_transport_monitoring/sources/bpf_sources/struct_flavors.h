@@ -12,4 +12,33 @@ struct sock___old {
   u16 sk_gso_max_segs;
 };
 
+// Drop reasons added after the kernel vmlinux.h was generated from. Their
+// values differ between kernels, CO-RE resolves them on the running one.
+enum skb_drop_reason___new {
+  SKB_DROP_REASON_NETFILTER_DROP,
+  SKB_DROP_REASON_IP_CSUM,
+  SKB_DROP_REASON_SKB_CSUM,
+  SKB_DROP_REASON_BPF_CGROUP_EGRESS,
+  SKB_DROP_REASON_TC_EGRESS,
+  SKB_DROP_REASON_TC_INGRESS,
+  SKB_DROP_REASON_XDP,
+  SKB_DROP_REASON_SOCKET_RCVBUFF,
+  SKB_DROP_REASON_SOCKET_BACKLOG,
+  SKB_DROP_REASON_PROTO_MEM,
+  SKB_DROP_REASON_NOMEM,
+  SKB_DROP_REASON_QDISC_DROP,
+  SKB_DROP_REASON_CPU_BACKLOG,
+  SKB_DROP_REASON_FULL_RING,
+  SKB_DROP_REASON_TCP_OFO_QUEUE_PRUNE,
+  SKB_DROP_REASON_TCP_ZEROWINDOW,
+  SKB_DROP_REASON_TCP_OLD_DATA,
+  SKB_DROP_REASON_TCP_OVERWINDOW,
+  SKB_DROP_REASON_TCP_OFOMERGE,
+  SKB_DROP_REASON_TCP_OFO_DROP,
+  SKB_DROP_REASON_TCP_RFC7323_PAWS,
+  SKB_DROP_REASON_TCP_INVALID_SEQUENCE,
+  SKB_DROP_REASON_TCP_OLD_ACK,
+  SKB_DROP_REASON_TCP_TOO_OLD_ACK,
+};
+
 #endif
@@ -20,6 +20,7 @@
 #include "bpf/bpf_endian.h"
 #include "defines.h"
 #include "correlator_types.h"
+#include "histogram.h"
 #include "maps.h"
 #include "events.h"
 
@@ -36,6 +37,9 @@ extern u32 LINUX_KERNEL_VERSION __kconfig;
 //1 second
 #define SAMPLE_TIME   2000000000
 
+//1 second
+#define DROP_EVENT_TIME   1000000000
+
 /* tcp_pid_filter is a map of pids that the probe is supposed to trace */ 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -51,11 +55,15 @@ The timestamp value will be used in case of sampling congestion values.
 
 Raw tracepoints don't get the context of the program hence the PID value must
 be saved in kProbe.
+
+start is when the connection was first seen, it tells connections reusing the
+same struct sock apart.
 */
 
 struct tcp_conn_t {
   uint64_t timestamp;
   uint64_t pid;
+  uint64_t start;
 };
 
 struct {
@@ -84,12 +92,13 @@ struct {
 } tcp_retransmits SEC(".maps");
 
 /* tcp_rtt is a map of connections. 
-Round trip latency corresponding to tcp connections.
+Log2 histogram of the smoothed round trip time in usec of tcp connections,
+updated on every tcp_probe.
 */ 
 struct {
 	__uint(type, BPF_MAP_TYPE_LRU_HASH);
 	__uint(key_size, sizeof(__u64));
-	__uint(value_size, sizeof(metric_format_t));
+	__uint(value_size, sizeof(metric_hist_format_t));
   	__uint(max_entries, MAX_TCP_CONN_TRACED);
 } tcp_rtt SEC(".maps");
 
@@ -133,6 +142,76 @@ struct {
   	__uint(max_entries, MAX_TCP_CONN_TRACED);
 } tcp_rcv_cwnd SEC(".maps");
 
+/* tcp_packet_drops is a map of connections. 
+Packets dropped by the kernel corresponding to tcp connections.
+*/ 
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_format_t));
+  	__uint(max_entries, MAX_TCP_CONN_TRACED);
+} tcp_packet_drops SEC(".maps");
+
+/* tcp_drops_<cause> are maps of connections.
+Packets dropped by the kernel corresponding to tcp connections, for the drop
+reasons of one cause: bad checksums, filters (netfilter, tc, bpf, xdp),
+memory or queue limits and sequence or window checks of tcp. Drops with
+other reasons are only in tcp_packet_drops. Reasons are only known with the
+CO-RE objects on Linux 5.17 or later.
+*/
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_format_t));
+  	__uint(max_entries, MAX_TCP_CONN_TRACED);
+} tcp_drops_checksum SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_format_t));
+  	__uint(max_entries, MAX_TCP_CONN_TRACED);
+} tcp_drops_filter SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_format_t));
+  	__uint(max_entries, MAX_TCP_CONN_TRACED);
+} tcp_drops_memory SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(__u64));
+	__uint(value_size, sizeof(metric_format_t));
+  	__uint(max_entries, MAX_TCP_CONN_TRACED);
+} tcp_drops_sequence SEC(".maps");
+
+/* tcp_drop_reasons counts the drops of connections per drop reason.
+last_event is when the last EC_TCP_EVENT_PACKET_DROP of the connection and
+reason was sent, at most one is sent per DROP_EVENT_TIME. Entries whose start
+is not the one of the connection in tcp_connection were left by an earlier
+connection on the same struct sock.
+*/
+struct tcp_drop_key_t {
+  uint64_t sk;
+  uint32_t reason;
+  uint32_t pad;
+};
+
+struct tcp_drop_t {
+  uint64_t count;
+  uint64_t last_event;
+  uint64_t start;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(key_size, sizeof(struct tcp_drop_key_t));
+	__uint(value_size, sizeof(struct tcp_drop_t));
+  	__uint(max_entries, MAX_TCP_DROP_REASONS);
+} tcp_drop_reasons SEC(".maps");
+
 /* Because of limited stack space in eBPF we usually store variables on heap
 using maps. The BPF_MAP_TYPE_PERCPU_ARRAY avoids contention and need for locks
 since the code will always run inline to the process thread.*/
@@ -145,7 +224,7 @@ struct {
 static __always_inline uint32_t get_curr_pid() {
   uint32_t ppid = (bpf_get_current_pid_tgid() >> 32);
   uint8_t* trace_pid = bpf_map_lookup_elem(&tcp_pid_filter, &ppid);
-  if (trace_pid == NULL) {
+  if (trace_pid == NULL && !ec_cgroup_traced()) {
     return 0;
   }
   return ppid;
@@ -159,6 +238,7 @@ static __always_inline ec_ebpf_events_t * get_event(uint32_t pid){
   }
   event->mdata.sent_recv = 0;
   event->mdata.event_category = EC_CAT_TCP;
+  event->mdata.version = EC_EVENT_VERSION;
   event->mdata.pid = pid;
   event->mdata.timestamp = bpf_ktime_get_ns();
   return event;
@@ -170,9 +250,19 @@ static __always_inline void send_tcp_start(void * ctx,
   metric_format_t format = {.data =0, .timestamp = event->mdata.timestamp};
   bpf_map_update_elem(&tcp_retransmits,&sk,
                       &format, BPF_ANY);
+  bpf_map_update_elem(&tcp_packet_drops,&sk,
+                      &format, BPF_ANY);
+  bpf_map_delete_elem(&tcp_drops_checksum, &sk);
+  bpf_map_delete_elem(&tcp_drops_filter, &sk);
+  bpf_map_delete_elem(&tcp_drops_memory, &sk);
+  bpf_map_delete_elem(&tcp_drops_sequence, &sk);
   const struct inet_sock *inet = inet_sk(sk);
-  struct tcp_conn_t conn_info = {.timestamp = 0, .pid = event->mdata.pid};
+  struct tcp_conn_t conn_info = {.timestamp = 0, .pid = event->mdata.pid,
+                                 .start = event->mdata.timestamp};
   bpf_map_update_elem(&tcp_connection, &sk, &conn_info, BPF_NOEXIST);
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_START)) {
+    return;
+  }
   event->mdata.event_type = EC_TCP_EVENT_START;
   ec_tcp_start_t * start = (ec_tcp_start_t*)event->event_info;
   KERN_READ(&start->family,sizeof(uint16_t),&sk->__sk_common.skc_family);
@@ -214,6 +304,9 @@ int sock_state(struct bpf_raw_tracepoint_args *ctx)
   if ((uint32_t) ctx->args[2] == TCP_CLOSE){
     bpf_map_delete_elem(&tcp_connection, &sk);
   }
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_STATE_CHANGE)) {
+    return 0;
+  }
   #ifndef CORE
   #if (LINUX_VERSION_CODE < KERNEL_VERSION(5,6,0))
     uint8_t proto;
@@ -252,21 +345,25 @@ int sock_state(struct bpf_raw_tracepoint_args *ctx)
   return 0;
 }
 
-#define READ_TCP_METRIC_TO_MAP(map, metric)   \
-  KERN_READ(&metric_value, sizeof(uint32_t), metric); \
+#define WRITE_TCP_METRIC_TO_MAP(map, val)   \
   format = bpf_map_lookup_elem(map,&sk); \
   if (format == NULL){ \
-    metric_format_t data = {.timestamp = timestamp, .data = metric_value}; \
+    metric_format_t data = {.timestamp = timestamp, .data = val}; \
     bpf_map_update_elem(map, &sk, &data, BPF_ANY); \
   } else { \
     format->timestamp = timestamp; \
-    format->data = metric_value; \
+    format->data = val; \
   }
 
+#define READ_TCP_METRIC_TO_MAP(map, metric)   \
+  KERN_READ(&metric_value, sizeof(uint32_t), metric); \
+  WRITE_TCP_METRIC_TO_MAP(map, metric_value)
+
 static __always_inline int handle_tcp(void * ctx, uint32_t pid, const struct sock * const sk) {
   struct tcp_conn_t * value = bpf_map_lookup_elem(&tcp_connection, &sk);
   uint64_t timestamp = bpf_ktime_get_ns();
-  if (value != NULL && ((timestamp - value->timestamp) < SAMPLE_TIME)) {
+  if (value != NULL &&
+      ((timestamp - value->timestamp) < ec_tcp_sample_ns(SAMPLE_TIME))) {
     return 0;
   }
 
@@ -286,7 +383,6 @@ static __always_inline int handle_tcp(void * ctx, uint32_t pid, const struct soc
   uint32_t metric_value;
   metric_format_t * format;
 
-  READ_TCP_METRIC_TO_MAP(&tcp_rtt,&tcpi->srtt_us);
   READ_TCP_METRIC_TO_MAP(&tcp_snd_cwnd,&tcpi->snd_cwnd);
   READ_TCP_METRIC_TO_MAP(&tcp_rcv_cwnd,&tcpi->rcv_wnd);
   READ_TCP_METRIC_TO_MAP(&tcp_rcv_bytes,&tcpi->bytes_received);
@@ -307,9 +403,38 @@ int tcp_congestion(struct bpf_raw_tracepoint_args *ctx)
   if (value == NULL){
     return 0;
   }
+  // srtt_us holds 8 times the smoothed rtt, 0 until the first RTT sample.
+  uint32_t srtt;
+  KERN_READ(&srtt, sizeof(uint32_t), &(tcp_sk(sk)->srtt_us));
+  if (srtt != 0) {
+    hist_record(&tcp_rtt, &sk, bpf_ktime_get_ns(), srtt >> 3);
+  }
   return handle_tcp(ctx, value->pid, sk);
 }
 
+#ifdef FENTRY
+/*
+Built as tcp_bpf_fentry.o. fexit is called through a BPF trampoline which is
+much cheaper than the breakpoint of a kprobe, and it sees the return value so
+sockets whose first send failed are not tracked.
+*/
+SEC("fexit/tcp_sendmsg")
+int BPF_PROG(probe_tcp_sendmsg, struct sock *sk, struct msghdr *msg,
+             size_t size, int ret) {
+  if (ret < 0){
+    return 0;
+  }
+  uint32_t pid = get_curr_pid();
+  if (pid == 0){
+    return 0;
+  }
+
+  if (bpf_map_lookup_elem(&tcp_connection, &sk) == NULL){
+    return handle_tcp(ctx, pid, sk);
+  }
+  return 0;
+}
+#else
 //int tcp_sendmsg(struct sock *sk, struct msghdr *msg, size_t size)
 SEC("kprobe/tcp_sendmsg")
 int probe_tcp_sendmsg(struct pt_regs* ctx) {
@@ -324,6 +449,101 @@ int probe_tcp_sendmsg(struct pt_regs* ctx) {
   }
   return 0;
 }
+#endif
+
+#ifdef FENTRY
+/*
+Snapshot of the traced connections for --tcp_collection=iter, used instead
+of tcp_congestion. Lightfoot runs the iterator once per poll interval so
+nothing is paid per packet, at the cost of reading the metrics only at that
+granularity. Every TCP socket of the host is visited, only the ones in
+tcp_connection are read.
+*/
+SEC("iter/tcp")
+int tcp_snapshot(struct bpf_iter__tcp *ctx)
+{
+  struct sock_common *skc = ctx->sk_common;
+  if (skc == NULL){
+    return 0;
+  }
+  const struct sock * sk = (const struct sock *)skc;
+  if (bpf_map_lookup_elem(&tcp_connection, &sk) == NULL){
+    return 0;
+  }
+  struct tcp_sock *tcpi = bpf_skc_to_tcp_sock(skc);
+  if (tcpi == NULL){
+    return 0;
+  }
+
+  uint64_t timestamp = bpf_ktime_get_ns();
+  uint32_t metric_value;
+  metric_format_t * format;
+
+  // srtt_us holds 8 times the smoothed rtt, 0 until the first RTT sample.
+  KERN_READ(&metric_value, sizeof(uint32_t), &tcpi->srtt_us);
+  if (metric_value != 0) {
+    hist_record(&tcp_rtt, &sk, timestamp, metric_value >> 3);
+  }
+  READ_TCP_METRIC_TO_MAP(&tcp_snd_cwnd,&tcpi->snd_cwnd);
+  READ_TCP_METRIC_TO_MAP(&tcp_rcv_cwnd,&tcpi->rcv_wnd);
+  READ_TCP_METRIC_TO_MAP(&tcp_rcv_bytes,&tcpi->bytes_received);
+  READ_TCP_METRIC_TO_MAP(&tcp_snd_bytes,&tcpi->bytes_acked);
+  READ_TCP_METRIC_TO_MAP(&tcp_retransmits,&tcpi->total_retrans);
+  return 0;
+}
+#endif
+
+#ifdef FENTRY
+/*
+sock_ops program for --tcp_collection=sock_ops, attached to the cgroups of
+the traced processes so the kernel only calls it for their sockets. The RTT
+and retransmit callbacks are enabled per connection once it is established,
+there is no global hook left on the packet path. As with the other probes a
+connection is traced once probe_tcp_sendmsg has seen it.
+
+Connections established before the program was attached never get the
+callbacks. State changes, and with them the removal of closed connections,
+are left to sock_state which sees every connection.
+*/
+SEC("sockops")
+int tcp_sockops(struct bpf_sock_ops *skops)
+{
+  uint32_t op = skops->op;
+  if (op == BPF_SOCK_OPS_ACTIVE_ESTABLISHED_CB ||
+      op == BPF_SOCK_OPS_PASSIVE_ESTABLISHED_CB) {
+    bpf_sock_ops_cb_flags_set(skops, BPF_SOCK_OPS_RTT_CB_FLAG |
+                                     BPF_SOCK_OPS_RETRANS_CB_FLAG);
+    return 1;
+  }
+  if (op != BPF_SOCK_OPS_RTT_CB && op != BPF_SOCK_OPS_RETRANS_CB) {
+    return 1;
+  }
+  struct bpf_sock *bsk = skops->sk;
+  if (bsk == NULL){
+    return 1;
+  }
+  // Same key as the other probes, the struct sock of the connection.
+  const struct sock * sk = (const struct sock *)bsk;
+  const struct tcp_conn_t * value = bpf_map_lookup_elem(&tcp_connection, &sk);
+  if (value == NULL){
+    return 1;
+  }
+
+  uint64_t timestamp = bpf_ktime_get_ns();
+  metric_format_t * format;
+  if (op == BPF_SOCK_OPS_RTT_CB) {
+    if (skops->srtt_us != 0) {
+      hist_record(&tcp_rtt, &sk, timestamp, skops->srtt_us >> 3);
+    }
+    WRITE_TCP_METRIC_TO_MAP(&tcp_snd_cwnd, skops->snd_cwnd);
+    WRITE_TCP_METRIC_TO_MAP(&tcp_rcv_bytes, skops->bytes_received);
+    WRITE_TCP_METRIC_TO_MAP(&tcp_snd_bytes, skops->bytes_acked);
+    return 1;
+  }
+  WRITE_TCP_METRIC_TO_MAP(&tcp_retransmits, skops->total_retrans);
+  return 1;
+}
+#endif
 
 /*
 Retransmission event
@@ -361,6 +581,147 @@ int tcp_retransmit(struct bpf_raw_tracepoint_args *ctx)
   return 0;
 }
 
+static __always_inline void count_drop(void * map, const struct sock * sk,
+                                       uint64_t timestamp){
+  metric_format_t * drops = bpf_map_lookup_elem(map, &sk);
+  if (drops == NULL){
+    metric_format_t format = {.timestamp = timestamp, .data = 1};
+    bpf_map_update_elem(map, &sk, &format, BPF_ANY);
+  } else {
+    drops->timestamp = timestamp;
+    __sync_fetch_and_add(&drops->data, 1);
+  }
+}
+
+#ifdef CORE
+#define DROP_REASON_IS(reason, type, name) \
+  (bpf_core_enum_value_exists(type, name) && \
+   (reason) == bpf_core_enum_value(type, name))
+
+#define NEW_DROP_REASON_IS(reason, name) \
+  DROP_REASON_IS(reason, enum skb_drop_reason___new, name)
+
+/* Counts the drop in the tcp_drops_<cause> map of its reason. */
+static __always_inline void count_drop_cause(const struct sock * sk,
+                                             uint32_t reason,
+                                             uint64_t timestamp){
+  if (DROP_REASON_IS(reason, enum skb_drop_reason,
+                     SKB_DROP_REASON_TCP_CSUM) ||
+      NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_IP_CSUM) ||
+      NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_SKB_CSUM)) {
+    count_drop(&tcp_drops_checksum, sk, timestamp);
+  } else if (DROP_REASON_IS(reason, enum skb_drop_reason,
+                            SKB_DROP_REASON_SOCKET_FILTER) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_NETFILTER_DROP) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_BPF_CGROUP_EGRESS) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TC_EGRESS) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TC_INGRESS) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_XDP)) {
+    count_drop(&tcp_drops_filter, sk, timestamp);
+  } else if (NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_SOCKET_RCVBUFF) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_SOCKET_BACKLOG) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_PROTO_MEM) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_NOMEM) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_QDISC_DROP) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_CPU_BACKLOG) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_FULL_RING) ||
+             NEW_DROP_REASON_IS(reason,
+                                SKB_DROP_REASON_TCP_OFO_QUEUE_PRUNE)) {
+    count_drop(&tcp_drops_memory, sk, timestamp);
+  } else if (NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_ZEROWINDOW) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_OLD_DATA) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_OVERWINDOW) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_OFOMERGE) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_OFO_DROP) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_RFC7323_PAWS) ||
+             NEW_DROP_REASON_IS(reason,
+                                SKB_DROP_REASON_TCP_INVALID_SEQUENCE) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_OLD_ACK) ||
+             NEW_DROP_REASON_IS(reason, SKB_DROP_REASON_TCP_TOO_OLD_ACK)) {
+    count_drop(&tcp_drops_sequence, sk, timestamp);
+  }
+}
+#endif
+
+/*
+Packet drops
+
+TP_PROTO(struct sk_buff *skb, void *location),
+5.17 onwards
+TP_PROTO(struct sk_buff *skb, void *location, enum skb_drop_reason reason),
+
+This fires for every dropped packet of the host, only packets still owned by
+a traced connection are counted. Packets dropped on receive before they are
+charged to the socket, e.g. on a full backlog, have no socket yet and are not
+seen. Events are rate limited per connection and reason, tcp_packet_drops has
+the exact count.
+*/
+SEC("raw_tracepoint/kfree_skb")
+int tcp_packet_drop(struct bpf_raw_tracepoint_args *ctx)
+{
+  const struct sk_buff * skb = (const struct sk_buff *)ctx->args[0];
+  const struct sock * sk = NULL;
+  KERN_READ(&sk, sizeof(sk), &skb->sk);
+  if (sk == NULL){
+    return 0;
+  }
+  struct tcp_conn_t * value = bpf_map_lookup_elem(&tcp_connection, &sk);
+  if (value == NULL){
+    return 0;
+  }
+
+  uint32_t reason = 0;
+  #ifdef CORE
+  // The reason argument came with enum skb_drop_reason, older kernels reject
+  // programs reading past the arguments of the tracepoint.
+  if (bpf_core_type_exists(enum skb_drop_reason)) {
+    reason = (uint32_t) ctx->args[2];
+  }
+  #endif
+
+  uint64_t timestamp = bpf_ktime_get_ns();
+  count_drop(&tcp_packet_drops, sk, timestamp);
+  #ifdef CORE
+  if (reason != 0) {
+    count_drop_cause(sk, reason, timestamp);
+  }
+  #endif
+
+  struct tcp_drop_key_t key = {.sk = (uint64_t) sk, .reason = reason};
+  uint32_t count = 1;
+  struct tcp_drop_t * drop = bpf_map_lookup_elem(&tcp_drop_reasons, &key);
+  if (drop == NULL || drop->start != value->start){
+    struct tcp_drop_t first = {.count = 1, .last_event = timestamp,
+                               .start = value->start};
+    bpf_map_update_elem(&tcp_drop_reasons, &key, &first, BPF_ANY);
+  } else {
+    // The result of the add is not used, fetching it needs -mcpu=v3.
+    __sync_fetch_and_add(&drop->count, 1);
+    count = drop->count;
+    if ((timestamp - drop->last_event) < DROP_EVENT_TIME) {
+      return 0;
+    }
+    drop->last_event = timestamp;
+  }
+
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_PACKET_DROP)) {
+    return 0;
+  }
+  ec_ebpf_events_t * event = get_event(value->pid);
+  if (unlikely(event == NULL)){
+    return -1;
+  }
+  event->mdata.connection_id = (uint64_t) sk;
+  event->mdata.event_type = EC_TCP_EVENT_PACKET_DROP;
+  ec_tcp_drop_t * ev = (ec_tcp_drop_t*)event->event_info;
+  ev->reason = reason;
+  ev->count = count;
+  event->mdata.length = sizeof(ec_tcp_drop_t);
+  bpf_perf_event_output(ctx, &tcp_events, BPF_F_CURRENT_CPU, event,
+                        sizeof(ec_ebpf_event_metadata_t) + event->mdata.length);
+  return 0;
+}
+
 static __always_inline int tcp_reset_event(struct bpf_raw_tracepoint_args *ctx,
                                     int send_recv){
   const struct sock * sk = (const struct sock *)ctx->args[0];
@@ -369,6 +730,9 @@ static __always_inline int tcp_reset_event(struct bpf_raw_tracepoint_args *ctx,
   if (value == NULL){
     return 0;
   }
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_RESET)) {
+    return 0;
+  }
   ec_ebpf_events_t * event = get_event(value->pid);
   if (unlikely(event == NULL)){
     return -1;
@@ -21,6 +21,8 @@
 #include "correlator_types.h"
 #include "defines.h"
 #include "events.h"
+#include "control.h"
+#include "histogram.h"
 
 #ifdef CORE
 extern u32 LINUX_KERNEL_VERSION __kconfig;
@@ -41,7 +43,7 @@ static __always_inline uint32_t get_curr_pid(void* map) {
   uint64_t id = bpf_get_current_pid_tgid();
   uint32_t ppid = (id >> 32);
   uint8_t* trace_pid = bpf_map_lookup_elem(map, &ppid);
-  if (trace_pid == NULL) {
+  if (trace_pid == NULL && !ec_cgroup_traced()) {
     return 0;
   }
   return ppid;
@@ -96,12 +98,13 @@ struct {
 } event_heap SEC(".maps");
 
 /* tcp_rtt is a map of connections. 
-Retransmits corresponding to tcp connections.
+Log2 histogram of the smoothed round trip time in usec of tcp connections,
+updated on every tcp_sendmsg.
 */ 
 struct {
 	__uint(type, BPF_MAP_TYPE_LRU_HASH);
 	__uint(key_size, sizeof(__u64));
-	__uint(value_size, sizeof(metric_format_t));
+	__uint(value_size, sizeof(metric_hist_format_t));
   __uint(max_entries, MAX_TCP_CONN_TRACED);
 } tcp_rtt SEC(".maps");
 
@@ -153,6 +156,7 @@ static __always_inline ec_ebpf_events_t * get_event(uint32_t pid){
   }
   event->mdata.sent_recv = 0;
   event->mdata.event_category = EC_CAT_TCP;
+  event->mdata.version = EC_EVENT_VERSION;
   event->mdata.pid = pid;
   event->mdata.timestamp = bpf_ktime_get_ns();
   return event;
@@ -164,6 +168,9 @@ static __always_inline void send_tcp_start(void * ctx,
   uint64_t kZero = 0;
   const struct inet_sock *inet = inet_sk(sk);
   bpf_map_update_elem(&tcp_connection, &sk, &kZero, BPF_NOEXIST);
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_START)) {
+    return;
+  }
   event->mdata.event_type = EC_TCP_EVENT_START;
   ec_tcp_start_t * start = (ec_tcp_start_t*)event->event_info;
   KERN_READ(&start->family,sizeof(uint16_t),&sk->__sk_common.skc_family);
@@ -201,8 +208,17 @@ static __always_inline void send_tcp_start(void * ctx,
 static __always_inline int handle_tcp(void * ctx, uint32_t pid, const struct sock * const sk) {
   uint64_t * value = bpf_map_lookup_elem(&tcp_connection, &sk);
   uint64_t timestamp = bpf_ktime_get_ns();
-  if (value != NULL && ((timestamp - *value) < SAMPLE_TIME)) {
-    return 0;
+  struct tcp_sock *tcpi = tcp_sk(sk);
+  uint32_t metric_value;
+  if (value != NULL) {
+    // srtt_us holds 8 times the smoothed rtt, 0 until the first RTT sample.
+    KERN_READ(&metric_value, sizeof(uint32_t), &tcpi->srtt_us);
+    if (metric_value != 0) {
+      hist_record(&tcp_rtt, &sk, timestamp, metric_value >> 3);
+    }
+    if ((timestamp - *value) < ec_tcp_sample_ns(SAMPLE_TIME)) {
+      return 0;
+    }
   }
 
   ec_ebpf_events_t * event = get_event(pid);
@@ -217,13 +233,8 @@ static __always_inline int handle_tcp(void * ctx, uint32_t pid, const struct soc
     *value = timestamp;
   }
 
-  struct tcp_sock *tcpi = tcp_sk(sk);
-
-
-  uint32_t metric_value;
   metric_format_t * format;
 
-  READ_TCP_METRIC_TO_MAP(&tcp_rtt,&tcpi->srtt_us);
   READ_TCP_METRIC_TO_MAP(&tcp_snd_cwnd,&tcpi->snd_cwnd);
   READ_TCP_METRIC_TO_MAP(&tcp_rcv_cwnd,&tcpi->rcv_wnd);
   READ_TCP_METRIC_TO_MAP(&tcp_rcv_bytes,&tcpi->bytes_received);
@@ -267,7 +278,9 @@ int probe_tcp_set_state(struct pt_regs *ctx)
   if (pid == 0){
     return 0;
   }
-
+  if (!ec_event_enabled(EC_CAT_TCP, EC_TCP_EVENT_STATE_CHANGE)) {
+    return 0;
+  }
 
   ec_ebpf_events_t * event = get_event(pid);
   if (unlikely(event == NULL)){
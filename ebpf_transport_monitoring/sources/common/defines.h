@@ -38,10 +38,15 @@
  changing this value. */
 #define MAX_PID_TRACED 16
 
+/* Maximum cgroups traced with --cgroup, counting the descendants of each
+  cgroup given. Processes in them are traced in addition to the PIDs. */
+#define MAX_CGROUP_TRACED 256
+
 /*
-Maximum connections traced. The value is an arbitrary limit.
-This value can be made configurable via command line later.
-bpf_map__set_max_entries()
+Maximum connections traced. This is the compiled default, lightfoot resizes
+the maps sized with MAX_CONN_TRACED, MAX_H2_STREAMS, MAX_TCP_DROP_REASONS and
+MAX_PID_TRACED at load time (loader/source/map_capacity.h, --max_connections). The values must
+stay distinct for that.
 */
 #define MAX_CONN_TRACED 128
 
@@ -57,6 +62,12 @@ bpf_map__set_max_entries()
 
 #define MAX_H2_STREAMS MAX_H2_CONN_TRACED* MAX_AVG_CONCURRENT_STREAMS
 
+/* Drop reasons seen per connection on average, drops of a connection usually
+  come from a few causes. */
+#define MAX_AVG_DROP_REASONS 4
+
+#define MAX_TCP_DROP_REASONS MAX_TCP_CONN_TRACED* MAX_AVG_DROP_REASONS
+
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
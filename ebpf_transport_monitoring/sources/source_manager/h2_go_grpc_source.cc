@@ -44,7 +44,7 @@ H2GoGrpcSource::H2GoGrpcSource()
     : DataSource::DataSource(
           {},
           {new DataCtx("h2_grpc_events", LogDesc{}, absl::Seconds(2), false, true),
-           new DataCtx("h2_grpc_correlation", LogDesc{}, absl::Seconds(2),
+           new DataCtx("h2_grpc_correlation", LogDesc{true}, absl::Seconds(2),
                        true, false)},
           {
               {new DataCtx("h2_stream_count",
@@ -59,6 +59,20 @@ H2GoGrpcSource::H2GoGrpcSource()
                                       MetricKind::kCumulative,
                                       {MetricUnitType::kNone}},
                            absl::Seconds(60), false, true)},
+              {new DataCtx("h2_client_stream_latency",
+                           MetricDesc{MetricType::kUint64,
+                                      MetricType::kLog2Histogram,
+                                      MetricKind::kDistribution,
+                                      {MetricUnitType::kTime,
+                                       {.time = MetricTimeType::kusec}}},
+                           absl::Seconds(60), false, true)},
+              {new DataCtx("h2_server_stream_latency",
+                           MetricDesc{MetricType::kUint64,
+                                      MetricType::kLog2Histogram,
+                                      MetricKind::kDistribution,
+                                      {MetricUnitType::kTime,
+                                       {.time = MetricTimeType::kusec}}},
+                           absl::Seconds(60), false, true)},
               {new DataCtx("h2_ping_counter",
                            MetricDesc{MetricType::kUint64,
                                       MetricType::kUint64,
@@ -45,6 +45,20 @@ MapSource::MapSource() {
                               MetricKind::kCumulative,
                               {MetricUnitType::kNone}},
                     absl::Seconds(60), false, true)},
+      {new DataCtx("h2_client_stream_latency",
+                    MetricDesc{MetricType::kUint64,
+                              MetricType::kLog2Histogram,
+                              MetricKind::kDistribution,
+                              {MetricUnitType::kTime,
+                               {.time = MetricTimeType::kusec}}},
+                    absl::Seconds(60), false, true)},
+      {new DataCtx("h2_server_stream_latency",
+                    MetricDesc{MetricType::kUint64,
+                              MetricType::kLog2Histogram,
+                              MetricKind::kDistribution,
+                              {MetricUnitType::kTime,
+                               {.time = MetricTimeType::kusec}}},
+                    absl::Seconds(60), false, true)},
       {new DataCtx("h2_ping_counter",
                     MetricDesc{MetricType::kUint64,
                               MetricType::kUint64,
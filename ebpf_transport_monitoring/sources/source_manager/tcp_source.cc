@@ -17,12 +17,19 @@
 #include <bpf/libbpf.h>
 #include <linux/bpf.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "loader/exporter/self_metrics.h"
 #include "loader/source/data_source.h"
+#include "loader/source/probes.h"
 #include "loader/source/source_helper.h"
 
 namespace prober {
@@ -48,9 +55,39 @@ TcpSource::TcpSource() {
                              {MetricUnitType::kNone}},
                   absl::Seconds(60), false, false),
       new DataCtx("tcp_rtt",
-                  MetricDesc{MetricType::kUint64, MetricType::kUint32,
+                  MetricDesc{MetricType::kUint64, MetricType::kLog2Histogram,
                              MetricKind::kDistribution, usec},
                   absl::Seconds(10), false, false),
+      new DataCtx("tcp_packet_drops",
+                  MetricDesc{MetricType::kUint64,
+                             MetricType::kUint32,
+                             MetricKind::kCumulative,
+                             {MetricUnitType::kNone}},
+                  absl::Seconds(60), false, false),
+      new DataCtx("tcp_drops_checksum",
+                  MetricDesc{MetricType::kUint64,
+                             MetricType::kUint32,
+                             MetricKind::kCumulative,
+                             {MetricUnitType::kNone}},
+                  absl::Seconds(60), false, false),
+      new DataCtx("tcp_drops_filter",
+                  MetricDesc{MetricType::kUint64,
+                             MetricType::kUint32,
+                             MetricKind::kCumulative,
+                             {MetricUnitType::kNone}},
+                  absl::Seconds(60), false, false),
+      new DataCtx("tcp_drops_memory",
+                  MetricDesc{MetricType::kUint64,
+                             MetricType::kUint32,
+                             MetricKind::kCumulative,
+                             {MetricUnitType::kNone}},
+                  absl::Seconds(60), false, false),
+      new DataCtx("tcp_drops_sequence",
+                  MetricDesc{MetricType::kUint64,
+                             MetricType::kUint32,
+                             MetricKind::kCumulative,
+                             {MetricUnitType::kNone}},
+                  absl::Seconds(60), false, false),
       new DataCtx("tcp_snd_bytes",
                   MetricDesc{MetricType::kUint64, MetricType::kUint32,
                              MetricKind::kCumulative, bytes},
@@ -77,11 +114,29 @@ TcpSource::TcpSource() {
                   MetricDesc{MetricType::kUint64, MetricType::kInternal,
                              MetricKind::kNone, bytes},
                   absl::Seconds(60), true, false),
+      new DataCtx("tcp_drop_reasons",
+                  MetricDesc{MetricType::kInternal, MetricType::kInternal,
+                             MetricKind::kNone, {MetricUnitType::kNone}},
+                  absl::Seconds(60), true, false),
   };
 
   pid_filter_map_ = "tcp_pid_filter";
 
-  if (SourceHelper::TestProgType(BPF_PROG_TYPE_RAW_TRACEPOINT)) {
+  if (SourceHelper::FentrySupported()) {
+    std::cout << "Loading raw_tracepoint with fexit" << std::endl;
+    probes_ = {
+        new RawTPProbe("sock_state", "sock", "inet_sock_set_state"),
+        new RawTPProbe("tcp_congestion", "tcp", "tcp_probe"),
+        new RawTPProbe("tcp_retransmit", "tcp", "tcp_retransmit_skb"),
+        new RawTPProbe("tcp_send_reset", "tcp", "tcp_send_reset"),
+        new RawTPProbe("tcp_receive_reset", "tcp", "tcp_receive_reset"),
+        new RawTPProbe("tcp_packet_drop", "skb", "kfree_skb"),
+        new TraceProbe("probe_tcp_sendmsg"),
+    };
+
+    file_name_ = "./tcp_bpf_fentry.o";
+    file_name_core_ = "./tcp_bpf_fentry.o";
+  } else if (SourceHelper::TestProgType(BPF_PROG_TYPE_RAW_TRACEPOINT)) {
     std::cout << "Loading raw_tracepoint" << std::endl;
     probes_ = {
         new RawTPProbe("sock_state", "sock", "inet_sock_set_state"),
@@ -91,6 +146,7 @@ TcpSource::TcpSource() {
         new RawTPProbe("tcp_retransmit", "tcp", "tcp_retransmit_skb"),
         new RawTPProbe("tcp_send_reset", "tcp", "tcp_send_reset"),
         new RawTPProbe("tcp_receive_reset", "tcp", "tcp_receive_reset"),
+        new RawTPProbe("tcp_packet_drop", "skb", "kfree_skb"),
         new KProbe("probe_tcp_sendmsg", "tcp_sendmsg", false),
     };
 
@@ -101,11 +157,121 @@ TcpSource::TcpSource() {
         new KProbe("probe_tcp_sendmsg", "tcp_sendmsg", false),
         new KProbe("probe_tcp_set_state", "tcp_set_state", false),
     };
+    // The kprobe objects do not trace kfree_skb, so there are no drop maps.
+    auto drops = std::remove_if(
+        metric_sources_.begin(), metric_sources_.end(), [](DataCtx* ctx) {
+          if (ctx->name_ != "tcp_packet_drops" &&
+              !absl::StartsWith(ctx->name_, "tcp_drop")) {
+            return false;
+          }
+          delete ctx;
+          return true;
+        });
+    metric_sources_.erase(drops, metric_sources_.end());
 
     file_name_ = "./tcp_bpf_kprobe.o";
     file_name_core_ = "./tcp_bpf_kprobe_core.o";
   }
 }
 
+absl::Status TcpSource::UseIterator() {
+  if (!SourceHelper::TcpIterSupported()) {
+    return absl::UnimplementedError(
+        "BPF TCP iterators need Linux 5.9 and /sys/kernel/btf/vmlinux");
+  }
+  for (auto probe : probes_) {
+    delete probe;
+  }
+  std::cout << "Loading tcp iterator" << std::endl;
+  snapshot_ = new IterProbe("tcp_snapshot");
+  probes_ = {
+      new RawTPProbe("sock_state", "sock", "inet_sock_set_state"),
+      new RawTPProbe("tcp_retransmit", "tcp", "tcp_retransmit_skb"),
+      new RawTPProbe("tcp_send_reset", "tcp", "tcp_send_reset"),
+      new RawTPProbe("tcp_receive_reset", "tcp", "tcp_receive_reset"),
+      new RawTPProbe("tcp_packet_drop", "skb", "kfree_skb"),
+      new TraceProbe("probe_tcp_sendmsg"),
+      snapshot_,
+  };
+
+  file_name_ = "./tcp_bpf_fentry.o";
+  file_name_core_ = "./tcp_bpf_fentry.o";
+  return absl::OkStatus();
+}
+
+absl::Status TcpSource::UseSockOps(const std::vector<std::string>& cgroups) {
+  if (!SourceHelper::FentrySupported() ||
+      !SourceHelper::TestProgType(BPF_PROG_TYPE_SOCK_OPS)) {
+    return absl::UnimplementedError(
+        "sock_ops collection needs BPF trampolines and "
+        "/sys/kernel/btf/vmlinux");
+  }
+  if (cgroups.empty()) {
+    return absl::InvalidArgumentError("No cgroup to attach sock_ops to");
+  }
+  for (auto probe : probes_) {
+    delete probe;
+  }
+  std::cout << "Loading sock_ops" << std::endl;
+  sock_ops_ = true;
+  // sock_ops has no receive window, it would only be read on the first send.
+  for (auto it = metric_sources_.begin(); it != metric_sources_.end(); ++it) {
+    if ((*it)->name_ == "tcp_rcv_cwnd") {
+      delete *it;
+      metric_sources_.erase(it);
+      break;
+    }
+  }
+  probes_ = {
+      new RawTPProbe("sock_state", "sock", "inet_sock_set_state"),
+      new RawTPProbe("tcp_send_reset", "tcp", "tcp_send_reset"),
+      new RawTPProbe("tcp_receive_reset", "tcp", "tcp_receive_reset"),
+      new RawTPProbe("tcp_packet_drop", "skb", "kfree_skb"),
+      new TraceProbe("probe_tcp_sendmsg"),
+  };
+  for (const auto& cgroup : cgroups) {
+    probes_.push_back(new CgroupProbe("tcp_sockops", cgroup));
+  }
+
+  file_name_ = "./tcp_bpf_fentry.o";
+  file_name_core_ = "./tcp_bpf_fentry.o";
+  return absl::OkStatus();
+}
+
+absl::Status TcpSource::LoadObj() {
+  // Iterators and sock_ops need a newer kernel than the rest of
+  // tcp_bpf_fentry.o, only load the programs when they are used.
+  auto prog = bpf_object__find_program_by_name(obj_, "tcp_snapshot");
+  if (prog != nullptr && snapshot_ == nullptr) {
+    bpf_program__set_autoload(prog, false);
+  }
+  prog = bpf_object__find_program_by_name(obj_, "tcp_sockops");
+  if (prog != nullptr && !sock_ops_) {
+    bpf_program__set_autoload(prog, false);
+  }
+  return DataSource::LoadObj();
+}
+
+absl::Status TcpSource::Snapshot() {
+  if (snapshot_ == nullptr) {
+    return absl::FailedPreconditionError("TCP iterator not used");
+  }
+  absl::Time start = absl::Now();
+  absl::Status status = snapshot_->Run();
+  SelfMetrics::GetInstance().RecordLatency("tcp_snapshot",
+                                           absl::Now() - start);
+  return status;
+}
+
+absl::Duration TcpSource::SnapshotInterval() const {
+  absl::Duration interval = absl::InfiniteDuration();
+  for (auto ctx : metric_sources_) {
+    if (!ctx->internal_ && ctx->poll_ < interval) {
+      interval = ctx->poll_;
+    }
+  }
+  return interval;
+}
+
 TcpSource::~TcpSource() { DataSource::Cleanup(); }
 }  // namespace prober
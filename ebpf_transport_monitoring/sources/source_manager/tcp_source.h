@@ -16,8 +16,12 @@
 #define _SOURCES_TCP_SOURCE_H_
 
 #include <string>
+#include <vector>
 
+#include "absl/status/status.h"
+#include "absl/time/time.h"
 #include "loader/source/data_source.h"
+#include "loader/source/probes.h"
 
 namespace prober {
 
@@ -25,7 +29,27 @@ class TcpSource : public DataSource {
  public:
   TcpSource();
   ~TcpSource() override;
+  absl::Status LoadObj() override;
   std::string ToString() const override { return "TcpSource"; };
+
+  /* Reads the metrics of all traced connections with the tcp_snapshot
+    iterator every Snapshot call instead of hooking tcp_probe, which fires
+    for every packet. Must be called before Init. */
+  absl::Status UseIterator();
+  absl::Status Snapshot();
+  // Shortest poll interval of the metrics read by Snapshot.
+  absl::Duration SnapshotInterval() const;
+
+  /* Reads RTT and retransmits from the tcp_sockops program attached to
+    cgroups instead of the tcp_probe and tcp_retransmit_skb tracepoints. The
+    kernel only calls it for sockets of processes in those cgroups, and only
+    for connections established after it was attached. tcp_rcv_cwnd is not
+    exported in this mode. Must be called before Init. */
+  absl::Status UseSockOps(const std::vector<std::string>& cgroups);
+
+ private:
+  IterProbe* snapshot_ = nullptr;
+  bool sock_ops_ = false;
 };
 
 }  // namespace prober